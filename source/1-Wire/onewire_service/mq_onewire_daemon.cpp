@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2017-2019
-// Version: 09122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -19,6 +19,7 @@
 #include <thread>                   // sleep_for
 #include <limits>                   // for limit
 #include <algorithm>                // to write some common algos faster
+#include <map>                      // devices (ordered for reload diff)
 
 #include "Platforms/Sleep.hpp"
 #if defined pigpio_FOUND
@@ -34,34 +35,75 @@
 using namespace MQ_System;
 using namespace libconfig;
 
+namespace {
+
+constexpr uint_least8_t kConvertTemperature = 0x44;  // DS18B20 command
+constexpr std::chrono::milliseconds kConversionTime(750);  // DS18B20 12bit conversion (the longest one)
+constexpr std::chrono::milliseconds kBusBusyDelay(100);  // retry of conversion start while other device converts
+
+// two's complement of 1/16 °C; bits below configured resolution are undefined; false - data error
+bool ds18b20_temperature(const MaximInterfaceDevices::DS18B20::Scratchpad& scratchpad, int& temperature) noexcept {
+    const unsigned data = (static_cast<unsigned>(scratchpad[1]) << 8) | scratchpad[0];
+    const unsigned sign_mask = 0xF800;
+    if ((data & sign_mask) != sign_mask && (data & sign_mask) != 0)
+        return false;
+    unsigned precision_mask = 0x7;
+    switch (scratchpad[4]) {
+        case MaximInterfaceDevices::DS18B20::tenBitResolution: precision_mask = 0x3; break;
+        case MaximInterfaceDevices::DS18B20::elevenBitResolution: precision_mask = 0x1; break;
+        case MaximInterfaceDevices::DS18B20::twelveBitResolution: precision_mask = 0x0; break;
+        default: break;
+    }
+    temperature = ((data & sign_mask) ? -0x800 : 0) + static_cast<int>(data & ~(sign_mask | precision_mask));
+    return true;
+}
+
+}  // namespace
+
 class OneWire_Service : public Daemon {
  public:
     OneWire_Service();
     virtual ~OneWire_Service() noexcept;
     void main();
     //virtual void CallBack(const std::string& topic, const std::string& message) override;
+    virtual void OnConfigChanged() override;
  private:
+    struct DeviceConfig {
+        std::string dev_id;
+        int interval;
+        bool operator==(const DeviceConfig& other) const noexcept { return dev_id == other.dev_id && interval == other.interval; }
+    };
+
     void ProcessRomDevice(MaximInterfaceCore::SearchRomState& searchState);
-    void load_daemon_configuration();
+    std::map<std::string, DeviceConfig> load_daemon_configuration(int& driver_address);
+    bool search_devices();
 
     class OWDevice {
      public:
-        OWDevice(const std::string& name, const std::string& id, int interval) : _found(false), _name(name), _interval(interval) {
+        OWDevice(const std::string& name, const std::string& id, int interval) : _found(false), _name(name), _interval(interval), _timer(TimerWheel::kInvalidTimer),
+                _step_timer(EventLoop::kInvalidTimer) {
              auto rom_id = MaximInterfaceCore::fromHexString(MaximInterfaceCore::span<const char>(id.c_str(), id.size()));
              if (rom_id) // rom_id is optional (it may or may not contain vector) this way we check if it has value
                 _rom_id = std::move(*rom_id);
         }
-        decltype(std::chrono::steady_clock::now()) _last_refresh;
         bool _found;
         // MaximInterfaceCore::RomId _rom_id;
         std::vector<uint_least8_t> _rom_id;
         std::string _name;
         int _interval;
+        TimerWheel::TimerId _timer;
+        EventLoop::TimerId _step_timer;  // pending step of current read
     };
+    void ReadDS18B20(OWDevice& device);
+    void ConvertDS18B20(OWDevice& device);
     void ReadAndProcessDS18B20(OWDevice& device);
+    void release_bus(OWDevice& device) noexcept;
+    bool schedule_device(OWDevice& device);
 
-    std::vector<OWDevice> _devices;
+    std::map<std::string, OWDevice> _devices;  // name : device; timer callbacks hold reference to the map node
+    std::map<std::string, DeviceConfig> _device_config;  // configuration _devices were made of
     int _ow_driver_address;
+    OWDevice* _converting;  // device keeping the bus (strong pullup) till its conversion is done
     std::string _sensor_name;
     struct json_tokener* const _tokener;
 #if defined pigpio_FOUND
@@ -82,16 +124,16 @@ OneWire_Service::~OneWire_Service() noexcept {
         json_tokener_free(_tokener);
 }
 
-OneWire_Service::OneWire_Service(): Daemon("mq_onewire_daemon", "/var/run/mq_onewire_daemon.pid"), _tokener(json_tokener_new()) {}
+OneWire_Service::OneWire_Service(): Daemon("mq_onewire_daemon", "/var/run/mq_onewire_daemon.pid"), _converting(nullptr), _tokener(json_tokener_new()) {}
 
-void OneWire_Service::load_daemon_configuration() {
-    static const char* config_file = "/etc/mq_system/mq_onewire_daemon.conf";
+std::map<std::string, OneWire_Service::DeviceConfig> OneWire_Service::load_daemon_configuration(int& driver_address) {
+    const std::string config_file = MQ_System::ConfigPath("mq_onewire_daemon.conf");
     static constexpr int kDefaultDriverAddress = 0x18;
 
     Config cfg;
     _logger->trace("Load conf");
     try {
-        cfg.readFile(config_file);
+        cfg.readFile(config_file.c_str());
     } catch(const FileIOException &fioex) {
         _logger->error("I/O error while reading configuration file");
         throw std::runtime_error("");
@@ -99,11 +141,12 @@ void OneWire_Service::load_daemon_configuration() {
         _logger->error("Parse error at {}:{} - {}", pex.getFile(), pex.getLine(), pex.getError());
         throw std::runtime_error("");
     }
+    std::map<std::string, DeviceConfig> devices;
     try {
         if (!cfg.exists("driver_address"))
-            _ow_driver_address = kDefaultDriverAddress;
+            driver_address = kDefaultDriverAddress;
         else
-            cfg.lookupValue("driver_address", _ow_driver_address);
+            cfg.lookupValue("driver_address", driver_address);
 
         const Setting& sensors = cfg.lookup("sensors");
         for (int i = 0; i < sensors.getLength(); i++) {
@@ -113,7 +156,7 @@ void OneWire_Service::load_daemon_configuration() {
             int sensor_interval = 60;
             if (sensor.exists("interval"))
                 sensor_interval = sensor.lookup("interval");
-            _devices.emplace_back(sensor_name, device_id, sensor_interval);
+            devices.emplace(sensor_name, DeviceConfig{device_id, sensor_interval});
         }
         if  (cfg.exists("log_level")) {
             int level;
@@ -126,10 +169,11 @@ void OneWire_Service::load_daemon_configuration() {
     } catch (const SettingTypeException &nfex) {
         _logger->error("Seting type error at: {}", nfex.getPath());
     }
+    return devices;
 }
 
 void OneWire_Service::ProcessRomDevice(MaximInterfaceCore::SearchRomState& searchState) {
-    auto iterator = std::find_if(_devices.begin(), _devices.end(), [searchState](const OWDevice& dev){ return std::equal(&searchState.romId[0], &searchState.romId[7], dev._rom_id.cbegin());});
+    auto iterator = std::find_if(_devices.begin(), _devices.end(), [searchState](const decltype(_devices)::value_type& dev){ return std::equal(&searchState.romId[0], &searchState.romId[7], dev.second._rom_id.cbegin());});
     if (iterator == _devices.end()) {
         _logger->info("Found additional device that is not rquested by config file - such device can't be reported - ID {}", MaximInterfaceCore::toHexString(searchState.romId));
         return;
@@ -142,27 +186,99 @@ void OneWire_Service::ProcessRomDevice(MaximInterfaceCore::SearchRomState& searc
         default:
             _logger->warn("Founf unsupported device type: {}; device will be removed from report list!", family_code);
             _devices.erase(iterator);
-            break;
+            return;
+    }
+    iterator->second._found = true;
+}
+
+// marks devices present on the bus (_found)
+bool OneWire_Service::search_devices() {
+    MaximInterfaceCore::SearchRomState searchState;
+    do {
+        const auto result_search_rom = MaximInterfaceCore::searchRom(*_master.get(), searchState);
+        if (!result_search_rom) {
+            _logger->error("Device error {}", result_search_rom.error().message());
+            return false;
+        }
+        if (MaximInterfaceCore::valid(searchState.romId)) {
+            ProcessRomDevice(searchState);
+        }
+    } while (!searchState.lastDevice);
+    _logger->trace("Rom Search Finshed");
+    return true;
+}
+
+bool OneWire_Service::schedule_device(OWDevice& device) {
+    // TODO move this logic to proxy function
+    auto family_code = device._rom_id.front();
+    switch (family_code) {
+        case 0x28:
+            device._timer = Loop().Wheel().AddPeriodic(std::chrono::seconds(device._interval), [this, &device] {
+                ReadDS18B20(device);
+            });
+            return true;
+        default:
+            _logger->critical("Unexpected device family! {}", family_code);  // this should never happen
+            return false;
+    }
+}
+
+// read is split to loop timer steps - conversion start, its result kConversionTime later; the loop is not blocked
+void OneWire_Service::ReadDS18B20(OWDevice& device) {
+    if (device._step_timer != EventLoop::kInvalidTimer) {
+        _logger->warn("DS18B20 {} previous read not finished yet - skipping this one", device._name);
+        return;
     }
-    iterator->_found = true;
+    ConvertDS18B20(device);
+}
+
+// parasite powered devices are fed by strong pullup during conversion - any other bus communication would end it so
+// devices convert one by one
+void OneWire_Service::ConvertDS18B20(OWDevice& device) {
+    device._step_timer = EventLoop::kInvalidTimer;
+    if (_converting != nullptr) {
+        device._step_timer = Loop().AddTimer(kBusBusyDelay, std::chrono::nanoseconds(0), [this, &device] { ConvertDS18B20(device); });
+        return;
+    }
+    _logger->debug("Convert DS18B20 {}", device._name);
+    const MaximInterfaceCore::SelectMatchRom rom(device._rom_id);
+    auto result_convert = rom(*_master.get());
+    if (result_convert)
+        result_convert = _master->writeByteSetLevel(kConvertTemperature, MaximInterfaceCore::OneWireMaster::StrongLevel);
+    if (!result_convert) {
+        _logger->error("DS18B20 device convert error {}", result_convert.error().message());
+        return;
+    }
+    _converting = &device;
+    device._step_timer = Loop().AddTimer(kConversionTime, std::chrono::nanoseconds(0), [this, &device] { ReadAndProcessDS18B20(device); });
+}
+
+void OneWire_Service::release_bus(OWDevice& device) noexcept {
+    if (_converting != &device)
+        return;
+    _converting = nullptr;
+    const auto result_level = _master->setLevel(MaximInterfaceCore::OneWireMaster::NormalLevel);
+    if (!result_level)
+        _logger->error("DS18B20 device strong pullup release error {}", result_level.error().message());
 }
 
 void OneWire_Service::ReadAndProcessDS18B20(OWDevice& device) {
-    _logger->debug("Init DS18B20");
-    MaximInterfaceCore::SelectMatchRom rom(device._rom_id);
-    MaximInterfaceDevices::DS18B20 dev(*_sleep.get(), *_master.get() , rom);
-    const auto result_init_dev = dev.initialize();
-    if (!result_init_dev) {
-        _logger->error("DS18B20 device init error {}", result_init_dev.error().message());
+    device._step_timer = EventLoop::kInvalidTimer;
+    release_bus(device);
+    _logger->debug("Read temp DS18B20 {}", device._name);
+    const MaximInterfaceCore::SelectMatchRom rom(device._rom_id);
+    const MaximInterfaceDevices::DS18B20 dev(*_sleep.get(), *_master.get(), rom);
+    const auto result_read = dev.readScratchpad();
+    if (!result_read) {
+        _logger->error("DS18B20 device error {}", result_read.error().message());
         return;
     }
-    _logger->debug("Read temp DS18B20");
-    const auto result_read_temp = MaximInterfaceDevices::readTemperature(dev);
-    if (!result_read_temp) {
-        _logger->error("DS18B20 device error {}", result_read_temp.error().message());
+    int raw_temperature;
+    if (!ds18b20_temperature(result_read.value(), raw_temperature)) {
+        _logger->error("DS18B20 device error {}", make_error_code(MaximInterfaceDevices::DS18B20::DataError).message());
         return;
     }
-    const double temperature = result_read_temp.value() / 16.0;
+    const double temperature = raw_temperature / 16.0;
     auto temp = json_object_new_array();
     json_object_array_add(temp, json_object_new_double(temperature));
     json_object_array_add(temp, json_object_new_string("°C"));
@@ -174,7 +290,9 @@ void OneWire_Service::ReadAndProcessDS18B20(OWDevice& device) {
 }
 
 void OneWire_Service::main() {
-    load_daemon_configuration();
+    _device_config = load_daemon_configuration(_ow_driver_address);
+    for (const auto& device : _device_config)
+        _devices.emplace(std::piecewise_construct, std::forward_as_tuple(device.first), std::forward_as_tuple(device.first, device.second.dev_id, device.second.interval));
     _logger->debug("Entered main");
 #if defined pigpio_FOUND
     _i2c.reset(new MaximInterfaceCore::piI2CMaster());
@@ -192,61 +310,69 @@ void OneWire_Service::main() {
         return;
     }
     _logger->trace("Device init OK");
-    MaximInterfaceCore::SearchRomState searchState;
-    do {
-        const auto result_search_rom = MaximInterfaceCore::searchRom(*_master.get(), searchState);
-        if (!result_search_rom) {
-            _logger->error("Device error {}", result_search_rom.error().message());
-            break;
-        }
-        if (MaximInterfaceCore::valid(searchState.romId)) {
-            ProcessRomDevice(searchState);
-        }
-    } while (!searchState.lastDevice);
-    _logger->trace("Rom Search Finshed");
-    for (auto iterator = _devices.begin(); iterator != _devices.end(); ++iterator)
-        if (!iterator->_found) {
-            _logger->warn("Device {} not found on I2C - removing it from list", MaximInterfaceCore::toHexString(iterator->_rom_id));
-            iterator = _devices.erase(iterator);
-        }
+    search_devices();
+    for (auto device = _devices.begin(); device != _devices.end(); ) {
+        if (!device->second._found) {
+            _logger->warn("Device {} not found on I2C - removing it from list", MaximInterfaceCore::toHexString(device->second._rom_id));
+            device = _devices.erase(device);
+        } else
+            ++device;
+    }
     if (!_devices.size()) {
         _logger->warn("No device in devices list - terminating daemon - no reason to run");
         return;
     }
     _sleep.reset(new MaximInterface::Sleep());
 
-    while(true) {
-        auto now = std::chrono::steady_clock::now();
-        for (auto&& device : _devices) {
-            auto diff = now - device._last_refresh;
-            const double seconds_since_last_refresh = diff.count() / 1000000000.0;
-            _logger->debug("Last refresh {} s", seconds_since_last_refresh);
-            if (seconds_since_last_refresh > device._interval) {
-                // TODO move this logic to proxy function
-                auto family_code = device._rom_id.front();
-                switch (family_code) {
-                    case 0x28: {
-                        device._last_refresh = now;
-                        ReadAndProcessDS18B20(device);  // this takes some time ~ 1s
-                        now = std::chrono::steady_clock::now();  // so we need to refresh now status, because it may be 1 sec ahead
-                        break;
-                    }
-                    default: 
-                        _logger->critical("Unexpected device family! {}", family_code);  // this should never happen
-                        return;
-                }
-            }
-        }
-        double next_refresh = std::numeric_limits<double>::max();
-        for (const auto& device : _devices) {
-            const double seconds_since_last_refresh = (now - device._last_refresh).count() / 1000000000.0;
-            if (next_refresh > (device._interval - seconds_since_last_refresh))
-                next_refresh = device._interval - seconds_since_last_refresh;
-        }
-        if (next_refresh > 0.5) {
-            _logger->debug("Refresh time {} s", next_refresh);
-            std::this_thread::sleep_for(std::chrono::duration<float>(next_refresh));
+    for (auto&& device : _devices)
+        if (!schedule_device(device.second))
+            return;
+    Run();
+}
+
+void OneWire_Service::OnConfigChanged() {
+    int driver_address;
+    auto device_config = load_daemon_configuration(driver_address);
+    if (driver_address != _ow_driver_address)
+        _logger->warn("Driver address change requires daemon restart - keeping {}", _ow_driver_address);
+    const auto diff = MakeConfigDiff(_device_config, device_config);
+    auto remove_device = [this](const std::string& name) {
+        const auto device = _devices.find(name);
+        if (device == _devices.end())
+            return;  // device was not found on the bus
+        Loop().Wheel().Cancel(device->second._timer);
+        Loop().CancelTimer(device->second._step_timer);
+        release_bus(device->second);
+        _devices.erase(device);
+    };
+    std::vector<std::string> new_devices;
+    for (const auto& name : diff.removed) {
+        remove_device(name);
+        _logger->info("Configuration reload - device {} removed", name);
+    }
+    for (const auto& device : diff.changed) {  // device id may change so it's removed and added again
+        remove_device(device.first);
+        _devices.emplace(std::piecewise_construct, std::forward_as_tuple(device.first), std::forward_as_tuple(device.first, device.second.dev_id, device.second.interval));
+        new_devices.push_back(device.first);
+    }
+    for (const auto& device : diff.added) {
+        _devices.emplace(std::piecewise_construct, std::forward_as_tuple(device.first), std::forward_as_tuple(device.first, device.second.dev_id, device.second.interval));
+        new_devices.push_back(device.first);
+    }
+    _device_config = std::move(device_config);
+    if (new_devices.empty())
+        return;
+    search_devices();  // only new devices are not marked found yet
+    for (const auto& name : new_devices) {
+        const auto device = _devices.find(name);
+        if (device == _devices.end())
+            continue;  // unsupported device type (removed by search)
+        if (!device->second._found || !schedule_device(device->second)) {
+            _logger->warn("Device {} not found on I2C - removing it from list", MaximInterfaceCore::toHexString(device->second._rom_id));
+            _devices.erase(device);
+            continue;
         }
+        _logger->info("Configuration reload - device {} scheduled", name);
     }
 }
 
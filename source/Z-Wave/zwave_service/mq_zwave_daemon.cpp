@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2017-2019
-// Version: 01042019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -26,6 +26,8 @@
 #include <atomic>
 #include <limits>
 #include <list>
+#include <map>
+#include <mutex>
 #include <unordered_map>
 #include <chrono>           // for interval measurement
 #include <algorithm>
@@ -64,21 +66,32 @@ class Zwave_Service : public Daemon {
     void main();
     void on_notification(Notification const *pNotification);
     virtual void CallBack(const std::string& topic, const std::string& message) override;
+    virtual void OnConfigChanged() override;
     virtual ~Zwave_Service() noexcept;
  private:
+    struct ValueConfig {
+        bool read;
+        bool write;
+        uint32_t refresh_limit;
+        uint32_t refresh;
+        bool operator==(const ValueConfig& other) const noexcept {
+            return read == other.read && write == other.write && refresh_limit == other.refresh_limit && refresh == other.refresh;
+        }
+    };
+    typedef std::map<uint64_t, ValueConfig> SensorConfig;  // value id : value configuration
+
     struct json_object* ozw_value_to_json_object(const ValueID &value) const;
-    void load_daemon_configuration(std::string& zw_driver_path, std::string& zw_config_path, std::string& zw_network_data_path);
-    void peprare_data_structures();
-    void main_loop();
+    std::map<std::string, SensorConfig> load_daemon_configuration(std::string& zw_driver_path, std::string& zw_config_path, std::string& zw_network_data_path);
+    void on_startup_timer();
+    void on_reload_timer();
 
     OpenZWave::Manager * _manager;
-    std::chrono::time_point<std::chrono::steady_clock> _last_refresh;  // we use this value to measure 24hour cycle to call heal network and write config
     std::atomic<uint32_t> _home_id;
     std::atomic<bool> _initialized;
     std::string _zw_driver_path;
     struct ValueData {
         ValueData(uint64_t rv, const std::string& sn, bool r, bool w, uint32_t r_limit, uint32_t ref) :
-             sensor_name(sn), read(r), write(w), raw_val(rv), refresh_limit(r_limit), refresh(ref) {}
+             sensor_name(sn), read(r), write(w), raw_val(rv), refresh_limit(r_limit), refresh(ref), refresh_timer(TimerWheel::kInvalidTimer) {}
         const std::string sensor_name;
         std::chrono::time_point<std::chrono::steady_clock> last_refresh;
         std::string label;
@@ -95,24 +108,41 @@ class Zwave_Service : public Daemon {
         // for specified value. This value controlls how often this may happen (in seconds!). Ofc once the device reports value by it's own it is counted as value report (refresh). 
         // Also take care about the refresh value. If you refresh it too often it might deplete sensor battery, and overload the Z-Wave network.
         const uint32_t refresh;
+        TimerWheel::TimerId refresh_timer;
     };
+    void schedule_refresh(ValueData& value, std::chrono::milliseconds delay);
+    void refresh_value(ValueData& value);
 
     struct SensorData {
         SensorData(const std::string &n): name(n) {}
         const std::string name;
         std::list<ValueData> values;
     };
+    void add_sensor(std::list<SensorData>& sensors, const std::string& name, const SensorConfig& config) const;
+    void remove_sensor(const std::string& name);
+    void peprare_data_structures(std::list<SensorData>& sensors);
+    bool check_pending_nodes(std::list<SensorData>& sensors);
+    void finish_data_structures(std::list<SensorData>& sensors);
+    void start_refresh(std::list<SensorData>& sensors);
 
     std::list <SensorData> _sensors;  // real data storage for values related to sensors
+    std::list <SensorData> _staged_sensors;  // sensors added by configuration reload that wait for node info (moved to _sensors once ready)
+    std::map<std::string, SensorConfig> _sensor_config;  // configuration _sensors (and _staged_sensors) were made of
+    std::mutex _sensor_mutex;  // guards _sensor_id_map (and values it points to) against OpenZWave notification thread
     std::unordered_map <uint64_t, decltype(_sensors.begin()->values.begin())> _sensor_id_map;  // for effective search using value_id (Z-Wave events)
     std::unordered_map <std::string, decltype(_sensors.begin())> _sensor_name_map;  // for effective search using name (broker events)
     struct json_tokener* _tokener;
+    std::list<std::pair<unsigned char, std::chrono::steady_clock::time_point>> _pending_nodes;  // nodes we wait for node info during startup
+    EventLoop::TimerId _startup_timer;
+    EventLoop::TimerId _reload_timer;
+    int _home_id_wait;  // seconds we wait for home id
+    bool _home_id_received;
 };
 
-Zwave_Service::Zwave_Service(): Daemon("mq_zwave_daemon", "/var/run/mq_zwave_daemon.pid"), _home_id(std::numeric_limits<uint32_t>::max()), _initialized(false), _tokener(json_tokener_new()), _manager(nullptr) {}
+Zwave_Service::Zwave_Service(): Daemon("mq_zwave_daemon", "/var/run/mq_zwave_daemon.pid"), _home_id(std::numeric_limits<uint32_t>::max()), _initialized(false), _tokener(json_tokener_new()), _manager(nullptr), _startup_timer(EventLoop::kInvalidTimer), _reload_timer(EventLoop::kInvalidTimer), _home_id_wait(0), _home_id_received(false) {}
 
-void Zwave_Service::load_daemon_configuration(std::string& zw_driver_path, std::string& zw_config_path, std::string& zw_network_data_path) {
-    static const char* kConfig_file = "/etc/mq_system/mq_zwave_daemon.conf";
+std::map<std::string, Zwave_Service::SensorConfig> Zwave_Service::load_daemon_configuration(std::string& zw_driver_path, std::string& zw_config_path, std::string& zw_network_data_path) {
+    const std::string kConfig_file = MQ_System::ConfigPath("mq_zwave_daemon.conf");
     static const char* kDefaultDriverPath = "/dev/ttyACM0";
     static const char* kDefaultConfigPath = "/usr/config/";
     static const char* kDefaultLogFile = "/var/log/mq_system/zwave.log";
@@ -121,7 +151,7 @@ void Zwave_Service::load_daemon_configuration(std::string& zw_driver_path, std::
     //spdlog::set_pattern("[%x %H:%M:%S.%e][%n][%t][%l] %v");
 
     try {
-        cfg.readFile(kConfig_file);
+        cfg.readFile(kConfig_file.c_str());
     } catch(const FileIOException& fioex) {
         _logger->error("I/O error while reading system configuration file: {}", kConfig_file);
         throw std::runtime_error("");
@@ -129,12 +159,8 @@ void Zwave_Service::load_daemon_configuration(std::string& zw_driver_path, std::
         _logger->error("Parse error at {} : {} - {}", pex.getFile(), pex.getLine(), pex.getError());
         throw std::runtime_error("");
     }
+    std::map<std::string, SensorConfig> sensor_config;
     try {
-        if (cfg.exists("log_level")) {
-            int level;
-            cfg.lookupValue("log_level", level);
-            _logger->set_level(static_cast<spdlog::level::level_enum>(level));
-        }
         if (!cfg.exists("driver_path"))
             zw_driver_path = kDefaultDriverPath;
         else
@@ -150,7 +176,7 @@ void Zwave_Service::load_daemon_configuration(std::string& zw_driver_path, std::
         Setting& sensors = cfg.lookup("sensors");
         for (const auto& sensor : sensors) {
             const std::string sensor_name = sensor.lookup("name");
-            decltype(_sensors)::value_type inner(sensor_name);
+            SensorConfig inner;
             for (const auto& value : sensor.lookup("values")) {
                 const unsigned long long value_id = value.lookup("value_id");
                 bool value_read = false;
@@ -167,9 +193,14 @@ void Zwave_Service::load_daemon_configuration(std::string& zw_driver_path, std::
                     value.lookupValue("refresh", value_refresh);
                 if (value_refresh && value_refresh < value_refresh_limit)
                     value_refresh = value_refresh_limit;
-                inner.values.emplace_back(value_id, inner.name, value_read, value_write, value_refresh_limit, value_refresh);
+                inner.emplace(value_id, ValueConfig{value_read, value_write, value_refresh_limit, value_refresh});
             }
-            _sensors.emplace_back(inner);
+            sensor_config.emplace(sensor_name, inner);
+        }
+        if (cfg.exists("log_level")) {  // applied once whole configuration is parsed (reload keeps running configuration on error)
+            int level;
+            cfg.lookupValue("log_level", level);
+            _logger->set_level(static_cast<spdlog::level::level_enum>(level));
         }
     } catch(const SettingNotFoundException& nfex) {
         _logger->error("Required setting not found in system configuration file");
@@ -178,6 +209,35 @@ void Zwave_Service::load_daemon_configuration(std::string& zw_driver_path, std::
         _logger->error("Seting type error (at system configuaration) at: {}", nfex.getPath());
         throw std::runtime_error("");
     }
+    return sensor_config;
+}
+
+void Zwave_Service::add_sensor(std::list<SensorData>& sensors, const std::string& name, const SensorConfig& config) const {
+    sensors.emplace_back(name);
+    auto& sensor = sensors.back();
+    for (const auto& value : config)
+        sensor.values.emplace_back(value.first, sensor.name, value.second.read, value.second.write, value.second.refresh_limit, value.second.refresh);
+}
+
+void Zwave_Service::remove_sensor(const std::string& name) {
+    _staged_sensors.remove_if([&name](const SensorData& sensor) { return sensor.name == name; });
+    const auto sensor = std::find_if(_sensors.begin(), _sensors.end(), [&name](const SensorData& sensor) { return sensor.name == name; });
+    if (sensor == _sensors.end())
+        return;  // sensor nodes were removed during startup
+    std::unique_lock<std::mutex> sensor_lock(_sensor_mutex);
+    for (auto&& value : sensor->values) {
+        Loop().Wheel().Cancel(value.refresh_timer);
+        const auto id_entry = _sensor_id_map.find(value.val.GetId());
+        if (id_entry != _sensor_id_map.end() && &*id_entry->second == &value)
+            _sensor_id_map.erase(id_entry);
+    }
+    const std::string write_name = std::string("set/") + name;
+    const auto name_entry = _sensor_name_map.find(write_name);
+    if (name_entry != _sensor_name_map.end() && name_entry->second == sensor) {
+        Unsubscribe(write_name);
+        _sensor_name_map.erase(name_entry);
+    }
+    _sensors.erase(sensor);
 }
 
 void Zwave_Service::CallBack(const std::string& topic, const std::string& message){
@@ -261,58 +321,63 @@ static void OnNotification(Notification const *pNotification, void *context) {
     reinterpret_cast<Zwave_Service*>(context)->on_notification(pNotification);
 }
 
-void Zwave_Service::peprare_data_structures() {
+void Zwave_Service::peprare_data_structures(std::list<SensorData>& sensors) {
     _logger->trace("Setup value id's");
     auto requested_time = std::chrono::steady_clock::now();
-    std::list<std::pair<unsigned char, decltype(requested_time)>> status_map;
-    // init value IDs of sensor_values and prepare initialization map (status_map)
-    for (auto&& sensor : _sensors)
+    // init value IDs of sensor_values and prepare initialization map (_pending_nodes)
+    for (auto&& sensor : sensors)
         for (auto&& sensor_value : sensor.values) {
             sensor_value.val = ValueID(_home_id, (uint64) sensor_value.raw_val);
-            status_map.emplace_back(sensor_value.val.GetNodeId(), requested_time);
+            _pending_nodes.emplace_back(sensor_value.val.GetNodeId(), requested_time);
         }
     _logger->trace("Wait until all sensors are ready");
-    while (!status_map.empty()) { // this may take up to 10 minutes (in case of uninitialized Z-Wave network)!
-        auto now = std::chrono::steady_clock::now();
-        for (auto status_map_iterator = status_map.cbegin(); status_map_iterator != status_map.cend(); ) {
-            auto seconds_since_last_check = (now - status_map_iterator->second).count() / 1000000000.0;
-            _logger->debug("Node status {} {}", status_map_iterator->first, seconds_since_last_check);
-            if (_manager->IsNodeInfoReceived(_home_id, status_map_iterator->first)) {
-                status_map_iterator = status_map.erase(status_map_iterator);
-                _logger->debug("Node info recieved after {} seconds", seconds_since_last_check);
-            } else {
-                if (seconds_since_last_check >= 600.0) {  // we wait max 10 mins
-                    if (_manager->IsNodeFailed(_home_id, status_map_iterator->first))
-                        _logger->warn("Node {} is failed removing it (it wont't work - fix it (in mangement program?) and restart daemon)!", status_map_iterator->first);
-                    else if (!_manager->IsNodeAwake(_home_id, status_map_iterator->first))
-                        _logger->warn("Node {} is sleeping removing it (it wont't work - pls wake it manually and restart daemon)!", status_map_iterator->first);
-                    else
-                        _logger->error("Node {} info not received yet after {} second (unexpected behavior) node is not sleeping and not failed (probably non-existant valueid)", status_map_iterator->first, seconds_since_last_check);
-                    // cleanup values for nodes without Nodeinfo
-                    for (auto sensor_iterator = _sensors.begin(); sensor_iterator != _sensors.end(); ) {
-                        //std::remove_if(sensor_iterator->values.begin(), sensor_iterator->values.end(),
-                        //        [status_map_iterator](const ValueData& element){ return element.val.GetNodeId() == status_map_iterator->first; });    // this one shows the intent but requires assignment operator that is not declared for ValueData...
-                        for (auto value_iterator = sensor_iterator->values.begin(); value_iterator != sensor_iterator->values.end(); ) {
-                            if (value_iterator->val.GetNodeId() == status_map_iterator->first)
-                                value_iterator = sensor_iterator->values.erase(value_iterator);
-                            else
-                                ++value_iterator;
-                        }
-                        if (sensor_iterator->values.empty())
-                            sensor_iterator = _sensors.erase(sensor_iterator);
+}
+
+bool Zwave_Service::check_pending_nodes(std::list<SensorData>& sensors) {
+    // this may take up to 10 minutes (in case of uninitialized Z-Wave network)!
+    auto now = std::chrono::steady_clock::now();
+    for (auto status_map_iterator = _pending_nodes.cbegin(); status_map_iterator != _pending_nodes.cend(); ) {
+        auto seconds_since_last_check = (now - status_map_iterator->second).count() / 1000000000.0;
+        _logger->debug("Node status {} {}", status_map_iterator->first, seconds_since_last_check);
+        if (_manager->IsNodeInfoReceived(_home_id, status_map_iterator->first)) {
+            status_map_iterator = _pending_nodes.erase(status_map_iterator);
+            _logger->debug("Node info recieved after {} seconds", seconds_since_last_check);
+        } else {
+            if (seconds_since_last_check >= 600.0) {  // we wait max 10 mins
+                if (_manager->IsNodeFailed(_home_id, status_map_iterator->first))
+                    _logger->warn("Node {} is failed removing it (it wont't work - fix it (in mangement program?) and restart daemon)!", status_map_iterator->first);
+                else if (!_manager->IsNodeAwake(_home_id, status_map_iterator->first))
+                    _logger->warn("Node {} is sleeping removing it (it wont't work - pls wake it manually and restart daemon)!", status_map_iterator->first);
+                else
+                    _logger->error("Node {} info not received yet after {} second (unexpected behavior) node is not sleeping and not failed (probably non-existant valueid)", status_map_iterator->first, seconds_since_last_check);
+                // cleanup values for nodes without Nodeinfo
+                for (auto sensor_iterator = sensors.begin(); sensor_iterator != sensors.end(); ) {
+                    //std::remove_if(sensor_iterator->values.begin(), sensor_iterator->values.end(),
+                    //        [status_map_iterator](const ValueData& element){ return element.val.GetNodeId() == status_map_iterator->first; });    // this one shows the intent but requires assignment operator that is not declared for ValueData...
+                    for (auto value_iterator = sensor_iterator->values.begin(); value_iterator != sensor_iterator->values.end(); ) {
+                        if (value_iterator->val.GetNodeId() == status_map_iterator->first)
+                            value_iterator = sensor_iterator->values.erase(value_iterator);
                         else
-                            ++sensor_iterator;
+                            ++value_iterator;
                     }
-                    status_map_iterator = status_map.erase(status_map_iterator);
-                } else
-                    ++status_map_iterator;
-            }
+                    if (sensor_iterator->values.empty())
+                        sensor_iterator = sensors.erase(sensor_iterator);
+                    else
+                        ++sensor_iterator;
+                }
+                status_map_iterator = _pending_nodes.erase(status_map_iterator);
+            } else
+                ++status_map_iterator;
         }
-        if (!status_map.empty())
-            std::this_thread::sleep_for(std::chrono::seconds(1));
     }
+    return _pending_nodes.empty();
+}
+
+// iterators stored in the maps stay valid once @sensors are spliced to _sensors; OpenZWave is queried without _sensor_mutex
+// (notification thread holds OpenZWave locks while it waits for it)
+void Zwave_Service::finish_data_structures(std::list<SensorData>& sensors) {
     _logger->trace("ZW Network ready"); // now the Z-Wave is ready to provide node information (sensor value information) so we parse it.
-    for (auto sensor_iterator = _sensors.begin(); sensor_iterator != _sensors.end(); ++sensor_iterator) 
+    for (auto sensor_iterator = sensors.begin(); sensor_iterator != sensors.end(); ++sensor_iterator) 
         for (auto value_iterator = sensor_iterator->values.begin(); value_iterator != sensor_iterator->values.end(); ++value_iterator) {
             try {
                 value_iterator->label = _manager->GetValueLabel(value_iterator->val);  // this may all throw OZWEXCEPTION_INVALID_VALUEID
@@ -324,8 +389,10 @@ void Zwave_Service::peprare_data_structures() {
                     value_iterator->read = false;
                 }
                 // this map is used for sensor reading facility
-                if (value_iterator->read)
+                if (value_iterator->read) {
+                    std::unique_lock<std::mutex> sensor_lock(_sensor_mutex);
                     _sensor_id_map.emplace(value_iterator->val.GetId(), value_iterator);
+                }
                 if (!value_writeable && value_iterator->write) {
                     _logger->warn ("Sensor {} value {} is marked read only - setting write to false", sensor_iterator->name, value_iterator->val.GetId());
                     value_iterator->write = false;
@@ -343,48 +410,121 @@ void Zwave_Service::peprare_data_structures() {
         }
 }
 
-void Zwave_Service::main_loop() {
-    while ( true ) {
-        float next_refresh = 600.0f;
-        auto now = std::chrono::steady_clock::now();
-        for (const auto& sensor : _sensors)
-            for (auto&& sensor_value : sensor.values) {
-                if (!sensor_value.refresh)
-                    continue;
-                if (_manager->IsNodeFailed(_home_id, sensor_value.val.GetNodeId()))	 // ignore failed nodes
-                    continue;
-                auto sec_since_last_refresh = static_cast<double>((now - sensor_value.last_refresh).count()) / 1000000000.0;
-                if (sec_since_last_refresh > sensor_value.refresh) {
-                    _manager->RefreshValue(sensor_value.val);
-                    sec_since_last_refresh = 0.0;
-                    _logger->debug("Normal Refresh value on node {} since last refresh {}", sensor_value.val.GetNodeId(), sec_since_last_refresh);
-                }
-                if (sec_since_last_refresh > sensor_value.refresh) {
-                    next_refresh = 2.1f;
-                    _logger->debug("Node {} Req Refresh 0 {}; Ref {}; Since Last {} ", sensor_value.val.GetNodeId(), next_refresh, sensor_value.refresh, sec_since_last_refresh);
-                } else if ((sensor_value.refresh - sec_since_last_refresh) < next_refresh) {
-                    next_refresh = sensor_value.refresh - sec_since_last_refresh;
-                    _logger->debug("Node {} Req Refresh 1 {}; Ref {}; Since Last {} ", sensor_value.val.GetNodeId(), next_refresh, sensor_value.refresh, sec_since_last_refresh);
-                } else {
-                    _logger->debug("Node {} Refresh Next {}; Ref {}; Since Last {} ", sensor_value.val.GetNodeId(), (sensor_value.refresh - sec_since_last_refresh), sensor_value.refresh, sec_since_last_refresh);
-                }
+void Zwave_Service::schedule_refresh(ValueData& value, std::chrono::milliseconds delay) {
+    static constexpr std::chrono::milliseconds kMinRefreshDelay(2100);  // do not flood Z-Wave network
+    value.refresh_timer = Loop().Wheel().Add(std::max(delay, kMinRefreshDelay), std::chrono::milliseconds(0), [this, &value] { refresh_value(value); });
+}
+
+void Zwave_Service::start_refresh(std::list<SensorData>& sensors) {
+    for (auto&& sensor : sensors)
+        for (auto&& sensor_value : sensor.values)
+            if (sensor_value.refresh)
+                schedule_refresh(sensor_value, std::chrono::seconds(sensor_value.refresh));
+}
+
+void Zwave_Service::refresh_value(ValueData& value) {
+    const std::chrono::milliseconds refresh_interval = std::chrono::seconds(value.refresh);
+    const auto since_last_refresh = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - value.last_refresh);
+    if (since_last_refresh < refresh_interval) {  // device reported value by itself in the meantime
+        _logger->debug("Node {} Refresh Next {} s", value.val.GetNodeId(), std::chrono::duration<float>(refresh_interval - since_last_refresh).count());
+        schedule_refresh(value, refresh_interval - since_last_refresh);
+        return;
+    }
+    if (!_manager->IsNodeFailed(_home_id, value.val.GetNodeId())) {  // ignore failed nodes
+        _manager->RefreshValue(value.val);
+        _logger->debug("Normal Refresh value on node {}", value.val.GetNodeId());
+    }
+    schedule_refresh(value, refresh_interval);
+}
+
+void Zwave_Service::on_startup_timer() {
+    if (!_home_id_received) {
+        if (_home_id == std::numeric_limits<uint32_t>::max()) {
+            if (++_home_id_wait < 20) {
+                _logger->trace("Wait for home_id");
+                return;
             }
-        if (_last_refresh - now > std::chrono::hours(24)) {
-            _last_refresh = now;
-            _manager->HealNetwork(_home_id , true);
+            _logger->critical("Home ID not received - Z-Wave driver not ready");
+            Loop().CancelTimer(_startup_timer);
+            Loop().Stop();
+            return;
         }
-        if (next_refresh < 2.1f)
-            next_refresh = 2.1f;
-        _logger->debug("Final Refresh {}", next_refresh);
-        std::this_thread::sleep_for(std::chrono::duration<float>(next_refresh));
+        _logger->trace("Got Home ID!");
+        _home_id_received = true;
+        _logger->debug("Prep Data structures");
+        peprare_data_structures(_sensors);
     }
+    if (!check_pending_nodes(_sensors))
+        return;
+    Loop().CancelTimer(_startup_timer);
+    try {
+        finish_data_structures(_sensors);
+    } catch (OZWException& oze) {
+        _logger->error("OpenZWave exception {}", oze.GetMsg());
+        Loop().Stop();
+        return;
+    }
+    _initialized = true;
+    _logger->debug("Schedule refresh");
+    start_refresh(_sensors);
+    Loop().AddTimer(std::chrono::hours(24), std::chrono::hours(24), [this] {  // 24hour cycle to call heal network
+        _manager->HealNetwork(_home_id, true);
+    });
+}
+
+// same as startup but only for sensors added (changed) by reload - values of running sensors keep working meanwhile
+void Zwave_Service::on_reload_timer() {
+    if (!check_pending_nodes(_staged_sensors))  // nodes already known by the network pass at once
+        return;
+    Loop().CancelTimer(_reload_timer);
+    _reload_timer = EventLoop::kInvalidTimer;
+    try {
+        finish_data_structures(_staged_sensors);
+    } catch (OZWException& oze) {
+        _logger->error("OpenZWave exception {}", oze.GetMsg());
+    }
+    start_refresh(_staged_sensors);
+    _logger->info("Configuration reload - {} sensors ready", _staged_sensors.size());
+    std::unique_lock<std::mutex> sensor_lock(_sensor_mutex);
+    _sensors.splice(_sensors.end(), _staged_sensors);
+}
+
+void Zwave_Service::OnConfigChanged() {
+    std::string zw_driver_path, zw_config_path, zw_network_data_path;
+    auto sensor_config = load_daemon_configuration(zw_driver_path, zw_config_path, zw_network_data_path);
+    if (zw_driver_path != _zw_driver_path)
+        _logger->warn("Z-Wave driver change requires daemon restart - keeping {}", _zw_driver_path);
+    if (!_initialized) {
+        _logger->warn("Z-Wave network is not initialized yet - sensor configuration reload ignored");
+        return;
+    }
+    const auto diff = MakeConfigDiff(_sensor_config, sensor_config);
+    std::list<SensorData> new_sensors;
+    for (const auto& name : diff.removed) {
+        remove_sensor(name);
+        _logger->info("Configuration reload - sensor {} removed", name);
+    }
+    for (const auto& sensor : diff.changed) {  // values are re-created; their nodes are known so they're ready at next reload tick
+        remove_sensor(sensor.first);
+        add_sensor(new_sensors, sensor.first, sensor.second);
+    }
+    for (const auto& sensor : diff.added)
+        add_sensor(new_sensors, sensor.first, sensor.second);
+    _sensor_config = std::move(sensor_config);
+    if (new_sensors.empty())
+        return;
+    peprare_data_structures(new_sensors);
+    _staged_sensors.splice(_staged_sensors.end(), new_sensors);
+    if (_reload_timer == EventLoop::kInvalidTimer)
+        _reload_timer = Loop().AddTimer(std::chrono::seconds(1), std::chrono::seconds(1), [this] { on_reload_timer(); });
 }
 
 void Zwave_Service::main() {
     std::string zw_config_path, zw_network_data_path;
-    load_daemon_configuration(_zw_driver_path, zw_config_path, zw_network_data_path);
+    _sensor_config = load_daemon_configuration(_zw_driver_path, zw_config_path, zw_network_data_path);
+    for (const auto& sensor : _sensor_config)
+        add_sensor(_sensors, sensor.first, sensor.second);
     _logger->info("Entered main");
-    _last_refresh = std::chrono::steady_clock::now();
     try {
         auto zw_log = new ZWLog(_logger);  // setup custom logging interface - to see the messages also in MQ_System logging interface
         zw_log->SetLoggingState(LogLevel_Alert, LogLevel_Alert, LogLevel_Alert);
@@ -402,21 +542,12 @@ void Zwave_Service::main() {
         if (!_manager->AddDriver(_zw_driver_path))
             _logger->warn("Driver add error.. driver already exists {}", _zw_driver_path);
         _logger->trace("ZWave initialization");
-        for (int counter = 0; _home_id == std::numeric_limits<uint32_t>::max() && counter < 20; ++counter) {
-            _logger->trace("Wait for home_id");
-            std::this_thread::sleep_for(std::chrono::seconds(1));
-        }
-        _logger->trace("Got Home ID!");
-        if (_home_id != std::numeric_limits<uint32_t>::max()) {
-            _logger->debug("Prep Data structures");
-            peprare_data_structures();
-            _initialized = true;
-            _logger->debug("Main loop");
-            main_loop();
-        }
     } catch (OZWException& oze) {
         _logger->error("OpenZWave exception {}", oze.GetMsg());
+        return;
     }
+    _startup_timer = Loop().AddTimer(std::chrono::seconds(1), std::chrono::seconds(1), [this] { on_startup_timer(); });  // wait for home id & node info
+    Run();
 }
 
 void Zwave_Service::on_notification(Notification const *pNotification) {
@@ -434,7 +565,8 @@ void Zwave_Service::on_notification(Notification const *pNotification) {
                     _logger->trace ("Value event - system not initialized break");
                     break;
                 }
-                const auto value = pNotification->GetValueID();                
+                const auto value = pNotification->GetValueID();
+                std::unique_lock<std::mutex> sensor_lock(_sensor_mutex);  // configuration reload may alter the map
                 const auto sensor_search_result = _sensor_id_map.find(value.GetId());
                 if (sensor_search_result == _sensor_id_map.end())
                     break;
@@ -0,0 +1,69 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// DHT decode benchmark - feeds DhtDecoder frames of simulated edge source (DhtEdgeSimulator) instead of a sensor: clean
+// frames, timing jitter and frames whose response edges were lost while the line switched to input. Reports decode time
+// and share of frames decoded to the value that was sent.
+//
+// usage: dht_decode_bench [frames] [jitter ns]
+
+#include "dht_decoder.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+
+struct Scenario {
+    const char* name;
+    uint32_t jitter_ns;
+    bool drop_response;
+};
+
+void run(const Scenario& scenario, unsigned frames) {
+    DhtEdgeSimulator simulator(12345);
+    std::vector<DhtEdge> edges;
+    edges.reserve(DhtDecoder::kFrameEdges);
+    unsigned decoded = 0;
+    BenchClock::duration decode_time(0);
+    for (unsigned frame = 0; frame < frames; ++frame) {
+        const float humidity = static_cast<float>(frame % 1000) / 10.f;
+        const float temperature = static_cast<float>(static_cast<int>(frame % 900) - 400) / 10.f;
+        simulator.Frame(humidity, temperature, 1000000000ULL + frame * 2000000000ULL, scenario.jitter_ns, scenario.drop_response, edges);
+        float decoded_humidity = 0.f, decoded_temperature = 0.f;
+        unsigned bits = 0;
+        const auto start = BenchClock::now();
+        const DhtResult result = DhtDecoder::Decode(edges, decoded_humidity, decoded_temperature, bits);
+        decode_time += BenchClock::now() - start;
+        if (result == DhtResult::kOk && std::fabs(decoded_humidity - humidity) < 0.05f && std::fabs(decoded_temperature - temperature) < 0.05f)
+            ++decoded;
+    }
+    std::printf("%-28s %8u frames  %6.1f ns/frame  %6.2f %% decoded\n", scenario.name, frames,
+        std::chrono::duration<double, std::nano>(decode_time).count() / frames, 100.0 * decoded / frames);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const unsigned frames = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 100000;
+    const uint32_t jitter = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 10000;
+    const Scenario scenarios[] = {
+        {"clean", 0, false},
+        {"jitter", jitter, false},
+        {"lost response edges", 0, true},
+        {"jitter + lost response", jitter, true},
+    };
+    for (const auto& scenario : scenarios)
+        run(scenario, frames ? frames : 1);
+    return 0;
+}
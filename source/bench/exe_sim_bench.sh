@@ -0,0 +1,73 @@
+#!/bin/sh
+# Copyright: (c) Jaromir Veber 2026
+# Version: 18102026
+# License: MPL-2.0
+# *******************************************************************************
+#  This Source Code Form is subject to the terms of the Mozilla Public
+#  License, v. 2.0. If a copy of the MPL was not distributed with this
+#  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+# *******************************************************************************
+# Simulation benchmark - runs thermostat scripts in mq_exe_daemon simulation mode (virtual time) on synthetic capture and
+# reports how many script-days per second it sustains. Needs no broker - configuration and db are temporary.
+#
+# usage: exe_sim_bench.sh [-n scripts] [-d days] [-i interval] [-b bin dir] [-k]
+
+set -e
+
+scripts=100
+days=7
+interval=60
+bin_dir=$(dirname "$0")
+keep=0
+
+while getopts "n:d:i:b:k" option; do
+    case $option in
+        n) scripts=$OPTARG ;;
+        d) days=$OPTARG ;;
+        i) interval=$OPTARG ;;
+        b) bin_dir=$OPTARG ;;
+        k) keep=1 ;;
+        *) sed -n '13p' "$0"; exit 2 ;;
+    esac
+done
+
+find_binary() {
+    for candidate in "$bin_dir/$1" "$bin_dir/../exe_service/$1" "$bin_dir/../bench/$1"; do
+        if [ -x "$candidate" ]; then
+            echo "$candidate"
+            return
+        fi
+    done
+    command -v "$1" || { echo "$1 not found (use -b)" >&2; exit 1; }
+}
+
+bench=$(find_binary mq_replay_bench)
+exe_daemon=$(find_binary mq_exe_daemon)
+
+work=$(mktemp -d /tmp/mq_exe_sim_bench.XXXXXX)
+cleanup() {
+    if [ $keep -eq 0 ]; then
+        rm -rf "$work"
+    else
+        echo "work directory kept: $work"
+    fi
+}
+trap cleanup EXIT INT TERM
+
+cat > "$work/system.conf" <<CONF
+log_file = "$work/mq_system.log";
+log_mqtt = false;
+log_level = 3;
+metrics_interval = 0;
+metrics_socket_dir = "";
+CONF
+cat > "$work/mq_exe_daemon.conf" <<CONF
+uri = "$work/mq_exe_system.db";
+log_level = 3;
+CONF
+"$bench" generate "$work/synthetic.capture" "$scripts" $((days * 86400)) "$interval"
+"$bench" exe-db "$work/mq_exe_system.db" "$scripts"
+
+MQ_SYSTEM_CONFIG_DIR=$work "$exe_daemon" --simulate "$work/mq_exe_system.db" --capture "$work/synthetic.capture" --days "$days" \
+    --output "$work/simulation.log"
+echo "$(wc -l < "$work/simulation.log") messages published (see simulation.log with -k)"
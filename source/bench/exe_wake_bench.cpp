@@ -0,0 +1,317 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Wake benchmark of exe daemon value events - one thread delivers status messages (as the loop thread does) while script workers
+// keep re-registering waits of many scripts. It compares global mutex + multimap keyed by "topic:value" strings exe used before
+// with ValueTable (interned ids, per-value lock). Wake latency is measured apart: message is timestamped before delivery, workers
+// blocked on ready queue (as exe workers on _ready_cv) take woken scripts and register their next wait; the next message goes
+// once all woken scripts were taken, so the latency holds no queue backlog.
+//
+// usage: exe_wake_bench [sensors] [scripts] [messages] [workers]
+
+#include "value_table.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+
+constexpr unsigned kValuesPerSensor = 4;
+constexpr unsigned kValuesPerWait = 3;
+const char* const kValueNames[kValuesPerSensor] = {"temp", "hum", "press", "alarm"};
+
+struct Waiter {
+    std::atomic<uint64_t> events;
+    bool queued;  // wake latency - in ready queue already (woken by other value of the message)
+};
+
+struct Config {
+    unsigned sensors;
+    unsigned scripts;
+    unsigned messages;
+    unsigned workers;
+};
+
+struct Result {
+    double deliver_ns;  // per delivered value
+    double register_ns;  // per clear + wait of one script
+    uint64_t wakes;
+};
+
+struct Latency {  // us
+    double p50;
+    double p99;
+    double p999;
+    uint64_t wakes;
+};
+
+std::string topic_name(unsigned sensor) {
+    return "status/sensor" + std::to_string(sensor);
+}
+
+uint32_t next_random(uint32_t& state) {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+}
+
+double elapsed_ns(BenchClock::time_point since) {
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - since).count();
+}
+
+// the way exe used to do it
+class MultimapEvents {
+ public:
+    explicit MultimapEvents(const Config&) {}
+    void Deliver(const std::string& topic, const char* value_name, std::vector<Waiter*>* woken = nullptr) {
+        const auto key = topic + ":" + value_name;
+        std::unique_lock<std::mutex> lock(_mutex);
+        const auto range = _waiters.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second) {
+                it->second->events.fetch_add(1, std::memory_order_acq_rel);
+                if (woken != nullptr)
+                    woken->push_back(it->second);
+                it->second = nullptr;
+            }
+    }
+    void Wait(Waiter* waiter, std::vector<std::string>& keys, uint32_t& random, const Config& config) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (const auto& key : keys) {
+            const auto range = _waiters.equal_range(key);
+            for (auto it = range.first; it != range.second; )
+                if (it->second == nullptr || it->second == waiter)
+                    it = _waiters.erase(it);
+                else
+                    ++it;
+        }
+        lock.unlock();
+        for (auto&& key : keys)
+            key = topic_name(next_random(random) % config.sensors) + ":" + kValueNames[next_random(random) % kValuesPerSensor];
+        lock.lock();
+        for (const auto& key : keys)
+            _waiters.emplace(key, waiter);
+    }
+    typedef std::string Key;
+
+ private:
+    std::mutex _mutex;
+    std::unordered_multimap<std::string, Waiter*> _waiters;
+};
+
+class TableEvents {
+ public:
+    explicit TableEvents(const Config& config) {
+        for (unsigned sensor = 0; sensor < config.sensors; ++sensor)
+            for (const auto value_name : kValueNames)
+                _table.Intern(topic_name(sensor) + ":" + value_name);
+    }
+    void Deliver(const std::string& topic, const char* value_name, std::vector<Waiter*>* woken = nullptr) {
+        const auto id = _table.Find(topic, value_name);
+        if (id == ValueTable<Waiter>::kInvalidValue)
+            return;
+        auto& slot = _table[id];
+        std::unique_lock<std::mutex> lock(slot.mutex);
+        for (auto waiter : slot.waiters) {
+            waiter->events.fetch_add(1, std::memory_order_acq_rel);
+            if (woken != nullptr)
+                woken->push_back(waiter);
+        }
+        slot.waiters.clear();
+    }
+    void Wait(Waiter* waiter, std::vector<ValueTable<Waiter>::ValueId>& keys, uint32_t& random, const Config& config) {
+        for (const auto id : keys) {
+            auto& slot = _table[id];
+            std::unique_lock<std::mutex> lock(slot.mutex);
+            slot.waiters.erase(std::remove(slot.waiters.begin(), slot.waiters.end(), waiter), slot.waiters.end());
+        }
+        for (auto&& id : keys)
+            id = next_random(random) % (config.sensors * kValuesPerSensor);
+        for (const auto id : keys) {
+            auto& slot = _table[id];
+            std::unique_lock<std::mutex> lock(slot.mutex);
+            slot.waiters.push_back(waiter);
+        }
+    }
+    typedef ValueTable<Waiter>::ValueId Key;
+
+ private:
+    ValueTable<Waiter> _table;
+};
+
+template <typename Events>
+Result run(const Config& config) {
+    Events events(config);
+    std::vector<Waiter> waiters(config.scripts);
+    std::vector<std::vector<typename Events::Key>> keys(config.scripts, std::vector<typename Events::Key>(kValuesPerWait));
+    for (auto&& waiter : waiters)
+        waiter.events.store(0, std::memory_order_relaxed);
+    uint32_t random = 1;
+    for (unsigned i = 0; i < config.scripts; ++i)  // every script waits from the start
+        events.Wait(&waiters[i], keys[i], random, config);
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> registrations(0);
+    std::atomic<uint64_t> register_ns(0);
+    std::vector<std::thread> workers;
+    for (unsigned worker = 0; worker < config.workers; ++worker)
+        workers.emplace_back([&, worker] {
+            uint32_t worker_random = worker + 7;
+            uint64_t count = 0;
+            const auto start = BenchClock::now();
+            while (!stop.load(std::memory_order_relaxed))
+                for (unsigned i = worker; i < config.scripts && !stop.load(std::memory_order_relaxed); i += config.workers) {
+                    events.Wait(&waiters[i], keys[i], worker_random, config);  // script resumed and waits again
+                    ++count;
+                }
+            registrations.fetch_add(count);
+            register_ns.fetch_add(static_cast<uint64_t>(elapsed_ns(start)));
+        });
+
+    std::vector<std::string> topics;
+    for (unsigned sensor = 0; sensor < config.sensors; ++sensor)
+        topics.push_back(topic_name(sensor));
+    const auto start = BenchClock::now();
+    for (unsigned message = 0; message < config.messages; ++message)
+        for (const auto value_name : kValueNames)
+            events.Deliver(topics[message % config.sensors], value_name);
+    Result result;
+    result.deliver_ns = elapsed_ns(start) / (static_cast<double>(config.messages) * kValuesPerSensor);
+    stop = true;
+    for (auto&& worker : workers)
+        worker.join();
+    result.register_ns = registrations ? static_cast<double>(register_ns) / registrations : 0.0;
+    result.wakes = 0;
+    for (const auto& waiter : waiters)
+        result.wakes += waiter.events.load(std::memory_order_relaxed);
+    return result;
+}
+
+template <typename Events>
+Latency wake_latency(const Config& config, unsigned messages) {
+    Events events(config);
+    std::vector<Waiter> waiters(config.scripts);
+    std::vector<std::vector<typename Events::Key>> keys(config.scripts, std::vector<typename Events::Key>(kValuesPerWait));
+    uint32_t random = 1;
+    for (unsigned i = 0; i < config.scripts; ++i) {
+        waiters[i].events.store(0, std::memory_order_relaxed);
+        waiters[i].queued = false;
+        events.Wait(&waiters[i], keys[i], random, config);
+    }
+
+    std::mutex ready_mutex;
+    std::condition_variable ready_cv;
+    std::deque<Waiter*> ready;
+    BenchClock::time_point delivered;  // of the message that woke scripts in ready
+    bool stop = false;
+    std::atomic<size_t> pending(0);  // woken scripts not registered again yet
+    std::vector<std::vector<uint64_t>> latencies(config.workers);
+    std::vector<std::thread> workers;
+    for (unsigned worker = 0; worker < config.workers; ++worker)
+        workers.emplace_back([&, worker] {
+            uint32_t worker_random = worker + 7;
+            std::unique_lock<std::mutex> lock(ready_mutex);
+            while (true) {
+                ready_cv.wait(lock, [&] { return stop || !ready.empty(); });
+                if (ready.empty())
+                    break;
+                Waiter* waiter = ready.front();
+                ready.pop_front();
+                const auto since = delivered;
+                lock.unlock();
+                latencies[worker].push_back(static_cast<uint64_t>(elapsed_ns(since)));
+                waiter->queued = false;
+                events.Wait(waiter, keys[waiter - waiters.data()], worker_random, config);
+                pending.fetch_sub(1, std::memory_order_release);
+                lock.lock();
+            }
+        });
+
+    std::vector<std::string> topics;
+    for (unsigned sensor = 0; sensor < config.sensors; ++sensor)
+        topics.push_back(topic_name(sensor));
+    std::vector<Waiter*> woken;
+    for (unsigned message = 0; message < messages; ++message) {
+        woken.clear();
+        const auto now = BenchClock::now();
+        for (const auto value_name : kValueNames)
+            events.Deliver(topics[message % config.sensors], value_name, &woken);
+        std::unique_lock<std::mutex> lock(ready_mutex);
+        delivered = now;
+        for (auto waiter : woken)
+            if (!waiter->queued) {
+                waiter->queued = true;
+                ready.push_back(waiter);
+                pending.fetch_add(1, std::memory_order_relaxed);
+                ready_cv.notify_one();
+            }
+        lock.unlock();
+        while (pending.load(std::memory_order_acquire))
+            std::this_thread::yield();
+    }
+    {
+        std::unique_lock<std::mutex> lock(ready_mutex);
+        stop = true;
+    }
+    ready_cv.notify_all();
+    for (auto&& worker : workers)
+        worker.join();
+
+    std::vector<uint64_t> all;
+    for (const auto& worker_latencies : latencies)
+        all.insert(all.end(), worker_latencies.begin(), worker_latencies.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double fraction) {
+        return all.empty() ? 0.0 : all[std::min(all.size() - 1, static_cast<size_t>(fraction * all.size()))] / 1000.0;
+    };
+    return Latency{percentile(0.5), percentile(0.99), percentile(0.999), all.size()};
+}
+
+void print(const char* name, const Result& result) {
+    std::printf("%-24s %12.1f %12.1f %12llu\n", name, result.deliver_ns, result.register_ns, static_cast<unsigned long long>(result.wakes));
+}
+
+void print(const char* name, const Latency& latency) {
+    std::printf("%-24s %12.1f %12.1f %12.1f %12llu\n", name, latency.p50, latency.p99, latency.p999, static_cast<unsigned long long>(latency.wakes));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Config config;
+    config.sensors = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    config.scripts = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+    config.messages = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000000;
+    config.workers = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 4;
+    if (!config.sensors || !config.scripts || !config.workers) {
+        std::fprintf(stderr, "usage: exe_wake_bench [sensors] [scripts] [messages] [workers]\n");
+        return 1;
+    }
+    std::printf("%u sensors x %u values, %u scripts waiting on %u values, %u messages, %u workers\n", config.sensors, kValuesPerSensor,
+        config.scripts, kValuesPerWait, config.messages, config.workers);
+    std::printf("%-24s %12s %12s %12s\n", "events", "deliver ns", "wait ns", "wakes");
+    print("global multimap (before)", run<MultimapEvents>(config));
+    print("value table", run<TableEvents>(config));
+    const unsigned latency_messages = std::min(config.messages, 20000u);
+    std::printf("\nwake latency (deliver -> worker), %u messages\n", latency_messages);
+    std::printf("%-24s %12s %12s %12s %12s\n", "events", "p50 us", "p99 us", "p99.9 us", "wakes");
+    print("global multimap (before)", wake_latency<MultimapEvents>(config, latency_messages));
+    print("value table", wake_latency<TableEvents>(config, latency_messages));
+    return 0;
+}
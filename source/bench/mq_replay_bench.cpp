@@ -0,0 +1,477 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// End-to-end benchmark of the pipeline (broker -> mq_db_daemon / mq_exe_daemon) driven by recorded or synthetic MQTT traffic.
+// replay_bench.sh sets up temporary broker, configuration and databases and runs the daemons; this tool does the measuring.
+//
+// usage: mq_replay_bench record <capture> [host] [port]               record all the traffic till SIGINT
+//        mq_replay_bench generate <capture> <sensors> <seconds> [interval]  synthetic capture of N sensors
+//        mq_replay_bench db-config <capture> <output> <db file>        mq_db_daemon configuration storing every value of capture
+//        mq_replay_bench exe-db <db file> [thermostats]                mq_exe_daemon database with latency probe echo script
+//                                                                      (and thermostat scripts of first sensors - simulation bench)
+//        mq_replay_bench replay <capture> <speed|max> [--host h] [--port p] [--probe-ms ms] [--pid name=pid]... [--db file] [--metrics socket]
+//
+// capture format: "<offset us> <topic> <payload bytes>\n<payload>\n" per message
+// latency: probe messages (status/bench/probe) are echoed by exe daemon script to status/bench/echo
+// db throughput: mq_db_values_stored_total of db daemon metrics endpoint (--metrics) - replay waits till it stops growing
+
+#include <mosquitto.h>
+#include <sqlite3.h>
+#include <json-c/json_tokener.h>
+#include <json-c/linkhash.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>  // std::greater
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+
+const char* kProbeTopic = "status/bench/probe";
+const char* kEchoTopic = "status/bench/echo";
+const char* kEchoScript =
+    "local probe = register_value(\"bench/probe:seq\")\n"
+    "while true do\n"
+    "    wait_or(probe)\n"
+    "    report_value(\"bench/echo:seq\", request_value(probe))\n"
+    "end\n";
+// typical automation - day / night setpoint, reacts to the sensor and re-checks every hour (%1$u - sensor of generated capture)
+const char* kThermostatScript =
+    "local temperature = register_value(\"bench/sensor%1$u:Temperature\")\n"
+    "local heating = false\n"
+    "while true do\n"
+    "    wait_or(temperature, \"EVERY HOURMINUTE 0\")\n"
+    "    local value = request_value(temperature)\n"
+    "    local hour = tonumber(os.date(\"%%H\"))\n"
+    "    local setpoint = (hour >= 6 and hour < 22) and 21.0 or 18.0\n"
+    "    if value ~= nil and (value < setpoint - 0.3 or value > setpoint + 0.3) and (value < setpoint) ~= heating then\n"
+    "        heating = value < setpoint\n"
+    "        write_value(\"bench/heater%1$u:relay1\", heating)\n"
+    "    end\n"
+    "end\n";
+
+struct Message {
+    uint64_t offset;  // us since capture start
+    std::string topic;
+    std::string payload;
+};
+
+bool read_message(std::istream& input, Message& message) {
+    size_t size = 0;
+    if (!(input >> message.offset >> message.topic >> size))
+        return false;
+    input.get();  // '\n'
+    message.payload.resize(size);
+    input.read(&message.payload[0], size);
+    input.get();
+    return static_cast<bool>(input);
+}
+
+void write_message(std::ostream& output, uint64_t offset, const std::string& topic, const std::string& payload) {
+    output << offset << ' ' << topic << ' ' << payload.size() << '\n' << payload << '\n';
+}
+
+std::vector<Message> load_capture(const char* file_name) {
+    std::ifstream input(file_name, std::ios::binary);
+    if (!input) {
+        std::fprintf(stderr, "unable to open capture %s\n", file_name);
+        std::exit(1);
+    }
+    std::vector<Message> messages;
+    Message message;
+    while (read_message(input, message))
+        messages.push_back(message);
+    return messages;
+}
+
+struct mosquitto* connect_broker(const std::string& host, int port, void* context) {
+    mosquitto_lib_init();
+    struct mosquitto* mosq = mosquitto_new(NULL, true, context);
+    if (mosq == nullptr || mosquitto_connect(mosq, host.c_str(), port, 60) != MOSQ_ERR_SUCCESS) {
+        std::fprintf(stderr, "unable to connect to %s:%d\n", host.c_str(), port);
+        std::exit(1);
+    }
+    return mosq;
+}
+
+// ********** record **********
+std::atomic<bool> g_stop(false);
+
+struct Recorder {
+    std::ofstream output;
+    BenchClock::time_point start;
+    uint64_t messages;
+};
+
+int record(int argc, char* argv[]) {
+    if (argc < 3)
+        return 2;
+    Recorder recorder{std::ofstream(argv[2], std::ios::binary), BenchClock::now(), 0};
+    struct mosquitto* mosq = connect_broker(argc > 3 ? argv[3] : "127.0.0.1", argc > 4 ? std::atoi(argv[4]) : 1883, &recorder);
+    mosquitto_message_callback_set(mosq, [](struct mosquitto*, void* context, const struct mosquitto_message* message) {
+        auto recorder = reinterpret_cast<Recorder*>(context);
+        const auto offset = std::chrono::duration_cast<std::chrono::microseconds>(BenchClock::now() - recorder->start).count();
+        write_message(recorder->output, offset, message->topic, std::string(reinterpret_cast<const char*>(message->payload), message->payloadlen));
+        ++recorder->messages;
+    });
+    mosquitto_subscribe(mosq, NULL, "#", 0);
+    signal(SIGINT, [](int) { g_stop = true; });
+    while (!g_stop)
+        mosquitto_loop(mosq, 100, 1);
+    std::printf("recorded %llu messages\n", static_cast<unsigned long long>(recorder.messages));
+    mosquitto_destroy(mosq);
+    mosquitto_lib_cleanup();
+    return 0;
+}
+
+// ********** generate **********
+int generate(int argc, char* argv[]) {
+    if (argc < 5)
+        return 2;
+    const unsigned sensors = std::strtoul(argv[3], nullptr, 10);
+    const uint64_t duration = std::strtoull(argv[4], nullptr, 10) * 1000000;
+    const uint64_t interval = (argc > 5 ? std::strtoull(argv[5], nullptr, 10) : 60) * 1000000;
+    std::mt19937 random(42);  // fixed seed - capture is repeatable
+    std::normal_distribution<double> step(0.0, 0.05);
+    std::vector<std::pair<uint64_t, unsigned>> schedule;  // next publish time : sensor
+    std::vector<std::pair<double, double>> values(sensors);
+    for (unsigned i = 0; i < sensors; ++i) {
+        double phase = i * 0.6180339887498949;  // spread sensors over the interval the way real ones are
+        phase -= static_cast<unsigned>(phase);
+        schedule.emplace_back(static_cast<uint64_t>(phase * interval), i);
+        values[i] = std::make_pair(20.0 + i % 10, 40.0 + i % 30);
+    }
+    std::ofstream output(argv[2], std::ios::binary);
+    uint64_t messages = 0;
+    std::make_heap(schedule.begin(), schedule.end(), std::greater<std::pair<uint64_t, unsigned>>());
+    while (!schedule.empty() && schedule.front().first < duration) {
+        std::pop_heap(schedule.begin(), schedule.end(), std::greater<std::pair<uint64_t, unsigned>>());
+        auto& next = schedule.back();
+        auto& value = values[next.second];
+        value.first += step(random);
+        value.second = std::min(100.0, std::max(0.0, value.second + step(random) * 4));
+        char payload[128];
+        std::snprintf(payload, sizeof(payload), "{\"Temperature\":[%.2f,\"°C\"],\"RH\":[%.1f,\"%%\"]}", value.first, value.second);
+        write_message(output, next.first, "status/bench/sensor" + std::to_string(next.second), payload);
+        ++messages;
+        next.first += interval;
+        std::push_heap(schedule.begin(), schedule.end(), std::greater<std::pair<uint64_t, unsigned>>());
+    }
+    std::printf("generated %llu messages of %u sensors\n", static_cast<unsigned long long>(messages), sensors);
+    return 0;
+}
+
+// ********** db-config **********
+int db_config(int argc, char* argv[]) {
+    if (argc < 5)
+        return 2;
+    std::map<std::string, std::set<std::string>> sensors;
+    struct json_tokener* tokener = json_tokener_new();
+    for (const auto& message : load_capture(argv[2])) {
+        if (message.topic.compare(0, 7, "status/"))
+            continue;
+        struct json_object* root = json_tokener_parse_ex(tokener, message.payload.c_str(), message.payload.size());
+        json_tokener_reset(tokener);
+        if (json_object_get_type(root) == json_type_object) {
+            json_object_object_foreach(root, value_name, value) {
+                (void)value;
+                sensors[message.topic.substr(7)].insert(value_name);
+            }
+        }
+        json_object_put(root);
+    }
+    json_tokener_free(tokener);
+    std::ofstream output(argv[3]);
+    output << "uri = \"" << argv[4] << "\";\nlog_level = 3;\ndb = (\n";
+    for (auto sensor = sensors.cbegin(); sensor != sensors.cend(); ++sensor) {
+        output << "    { name : \"" << sensor->first << "\"; values : (";
+        for (auto value = sensor->second.cbegin(); value != sensor->second.cend(); ++value)
+            output << (value == sensor->second.cbegin() ? "" : ",") << " { name : \"" << *value << "\"; precision : 0.0; }";
+        output << " ); }" << (std::next(sensor) == sensors.cend() ? "\n" : ",\n");
+    }
+    output << ");\n";
+    std::printf("%zu sensors configured\n", sensors.size());
+    return 0;
+}
+
+// ********** exe-db **********
+int exe_db(int argc, char* argv[]) {
+    if (argc < 3)
+        return 2;
+    sqlite3* db = nullptr;
+    sqlite3_stmt* insert = nullptr;
+    if (sqlite3_open(argv[2], &db) != SQLITE_OK
+        || sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS script (name TEXT PRIMARY KEY, script TEXT)", NULL, NULL, NULL) != SQLITE_OK
+        || sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO script VALUES ('bench_echo', ?)", -1, &insert, NULL) != SQLITE_OK) {
+        std::fprintf(stderr, "unable to prepare exe database %s: %s\n", argv[2], sqlite3_errmsg(db));
+        return 1;
+    }
+    sqlite3_bind_text(insert, 1, kEchoScript, -1, SQLITE_STATIC);
+    int result = sqlite3_step(insert);
+    sqlite3_finalize(insert);
+    const unsigned thermostats = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 0;
+    if (result == SQLITE_DONE && thermostats
+        && sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO script VALUES (?, ?)", -1, &insert, NULL) == SQLITE_OK) {
+        for (unsigned i = 0; i < thermostats && result == SQLITE_DONE; ++i) {
+            char script[1024];
+            std::snprintf(script, sizeof(script), kThermostatScript, i);
+            const std::string name = "bench_thermostat" + std::to_string(i);
+            sqlite3_bind_text(insert, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(insert, 2, script, -1, SQLITE_TRANSIENT);
+            result = sqlite3_step(insert);
+            sqlite3_reset(insert);
+        }
+        sqlite3_finalize(insert);
+    }
+    sqlite3_close(db);
+    return result == SQLITE_DONE ? 0 : 1;
+}
+
+// ********** replay **********
+struct Probes {
+    std::mutex mutex;
+    std::map<uint64_t, BenchClock::time_point> sent;
+    std::vector<double> latencies;  // us
+};
+
+struct ProcessStats {
+    std::string name;
+    int pid;
+    double cpu_seconds;
+};
+
+double process_cpu_seconds(int pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string field;
+    std::getline(stat, field, ')');  // skip pid (comm)
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && stat >> field; ++i) {
+        if (i == 14)
+            utime = std::strtoull(field.c_str(), nullptr, 10);
+        else if (i == 15)
+            stime = std::strtoull(field.c_str(), nullptr, 10);
+    }
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+std::string process_memory(int pid, const char* key) {
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (!line.compare(0, std::strlen(key), key))
+            return line.substr(line.find_first_not_of(" \t", std::strlen(key)));
+    return "?";
+}
+
+int64_t file_size(const std::string& file_name) {
+    struct stat file_stat;
+    int64_t size = 0;
+    if (!stat(file_name.c_str(), &file_stat))
+        size += file_stat.st_size;
+    if (!stat((file_name + "-wal").c_str(), &file_stat))
+        size += file_stat.st_size;
+    return size;
+}
+
+// -1 when endpoint is not available
+int64_t read_metric(const std::string& socket_path, const std::string& name) {
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address))) {
+        close(fd);
+        return -1;
+    }
+    shutdown(fd, SHUT_WR);
+    std::string text;
+    char buffer[4096];
+    for (ssize_t size; (size = read(fd, buffer, sizeof(buffer))) > 0; )
+        text.append(buffer, size);
+    close(fd);
+    const auto position = text.find("\n" + name + " ");
+    return position == std::string::npos ? 0 : std::strtoll(text.c_str() + position + name.size() + 2, nullptr, 10);
+}
+
+double percentile(const std::vector<double>& sorted, double percent) {
+    if (sorted.empty())
+        return NAN;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(percent / 100.0 * sorted.size()))];
+}
+
+int replay(int argc, char* argv[]) {
+    if (argc < 4)
+        return 2;
+    const auto messages = load_capture(argv[2]);
+    const double speed = std::strcmp(argv[3], "max") ? std::strtod(argv[3], nullptr) : 0.0;  // 0 means as fast as possible
+    std::string host = "127.0.0.1", db_file, metrics_socket;
+    int port = 1883;
+    unsigned probe_ms = 100;
+    std::vector<ProcessStats> processes;
+    for (int i = 4; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--host") {
+            host = argv[i + 1];
+        } else if (option == "--port") {
+            port = std::atoi(argv[i + 1]);
+        } else if (option == "--probe-ms") {
+            probe_ms = std::strtoul(argv[i + 1], nullptr, 10);
+        } else if (option == "--db") {
+            db_file = argv[i + 1];
+        } else if (option == "--metrics") {
+            metrics_socket = argv[i + 1];
+        } else if (option == "--pid") {
+            const std::string value = argv[i + 1];
+            const auto separator = value.find('=');
+            processes.push_back(ProcessStats{value.substr(0, separator), std::atoi(value.c_str() + separator + 1), 0.0});
+        } else {
+            std::fprintf(stderr, "unknown option %s\n", option.c_str());
+            return 2;
+        }
+    }
+    if (messages.empty()) {
+        std::fprintf(stderr, "empty capture\n");
+        return 1;
+    }
+
+    Probes probes;
+    struct mosquitto* mosq = connect_broker(host, port, &probes);
+    mosquitto_message_callback_set(mosq, [](struct mosquitto*, void* context, const struct mosquitto_message* message) {
+        const auto now = BenchClock::now();
+        auto probes = reinterpret_cast<Probes*>(context);
+        const std::string payload(reinterpret_cast<const char*>(message->payload), message->payloadlen);
+        const auto position = payload.find("\"seq\":");
+        if (position == std::string::npos)
+            return;
+        const auto sequence = static_cast<uint64_t>(std::strtod(payload.c_str() + position + 6, nullptr));
+        std::unique_lock<std::mutex> lock(probes->mutex);
+        const auto sent = probes->sent.find(sequence);
+        if (sent == probes->sent.end())
+            return;
+        probes->latencies.push_back(std::chrono::duration<double, std::micro>(now - sent->second).count());
+        probes->sent.erase(probes->sent.begin(), std::next(sent));  // older probes were overwritten before the script read them
+    });
+    mosquitto_subscribe(mosq, NULL, kEchoTopic, 0);
+    mosquitto_loop_start(mosq);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));  // subscription is active
+
+    for (auto&& process : processes)
+        process.cpu_seconds = process_cpu_seconds(process.pid);
+    const int64_t stored_before = metrics_socket.empty() ? -1 : read_metric(metrics_socket, "mq_db_values_stored_total");
+    const int64_t db_size_before = db_file.empty() ? 0 : file_size(db_file);
+
+    const auto start = BenchClock::now();
+    auto next_probe = start;
+    uint64_t probe_sequence = 0;
+    uint64_t publish_errors = 0;
+    for (const auto& message : messages) {
+        const auto due = start + std::chrono::microseconds(speed > 0 ? static_cast<uint64_t>(message.offset / speed) : 0);
+        while (true) {
+            const auto now = BenchClock::now();
+            if (probe_ms && now >= next_probe) {
+                const std::string payload = "{\"seq\":" + std::to_string(++probe_sequence) + "}";
+                {
+                    std::unique_lock<std::mutex> lock(probes.mutex);
+                    probes.sent.emplace(probe_sequence, BenchClock::now());
+                }
+                mosquitto_publish(mosq, NULL, kProbeTopic, payload.size(), payload.c_str(), 2, false);
+                next_probe += std::chrono::milliseconds(probe_ms);
+            }
+            if (now >= due)
+                break;
+            std::this_thread::sleep_until(std::min(due, probe_ms ? next_probe : due));
+        }
+        if (mosquitto_publish(mosq, NULL, message.topic.c_str(), message.payload.size(), message.payload.data(), 2, false) != MOSQ_ERR_SUCCESS)
+            ++publish_errors;
+    }
+    const auto replay_end = BenchClock::now();
+
+    // db daemon drain - wait till the stored value count stops growing (2s)
+    auto processed_end = replay_end;
+    int64_t stored = stored_before;
+    if (stored_before >= 0) {
+        for (auto last_change = BenchClock::now(); BenchClock::now() - last_change < std::chrono::seconds(2); ) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            const int64_t current = read_metric(metrics_socket, "mq_db_values_stored_total");
+            if (current != stored) {
+                stored = current;
+                processed_end = last_change = BenchClock::now();
+            }
+        }
+    } else {
+        std::this_thread::sleep_for(std::chrono::seconds(2));  // late probe echoes
+    }
+    mosquitto_disconnect(mosq);
+    mosquitto_loop_stop(mosq, false);
+    mosquitto_destroy(mosq);
+    mosquitto_lib_cleanup();
+
+    const double replay_seconds = std::chrono::duration<double>(replay_end - start).count();
+    const double processed_seconds = std::chrono::duration<double>(processed_end - start).count();
+    std::printf("speed %s: %zu messages in %.3f s - %.0f msg/s published (%llu errors)\n", argv[3], messages.size(), replay_seconds,
+        messages.size() / replay_seconds, static_cast<unsigned long long>(publish_errors));
+    if (stored_before >= 0) {
+        const int64_t stored_values = stored - stored_before;
+        std::printf("db: %lld values stored in %.3f s - %.0f values/s sustained", static_cast<long long>(stored_values), processed_seconds,
+            stored_values / processed_seconds);
+        if (!db_file.empty() && stored_values > 0)
+            std::printf(", %.1f db bytes per value", static_cast<double>(file_size(db_file) - db_size_before) / stored_values);
+        std::printf("\n");
+    }
+    std::sort(probes.latencies.begin(), probes.latencies.end());
+    std::printf("end-to-end latency (%zu of %llu probes echoed) us: p50 %.0f p90 %.0f p99 %.0f max %.0f\n", probes.latencies.size(),
+        static_cast<unsigned long long>(probe_sequence), percentile(probes.latencies, 50), percentile(probes.latencies, 90),
+        percentile(probes.latencies, 99), probes.latencies.empty() ? NAN : probes.latencies.back());
+    for (const auto& process : processes) {
+        const double cpu = process_cpu_seconds(process.pid) - process.cpu_seconds;
+        std::printf("%s: cpu %.3f s (%.1f%%) rss %s peak %s\n", process.name.c_str(), cpu, 100.0 * cpu / processed_seconds,
+            process_memory(process.pid, "VmRSS:").c_str(), process_memory(process.pid, "VmHWM:").c_str());
+    }
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const std::string command = argc > 1 ? argv[1] : "";
+    int result = 2;
+    if (command == "record")
+        result = record(argc, argv);
+    else if (command == "generate")
+        result = generate(argc, argv);
+    else if (command == "db-config")
+        result = db_config(argc, argv);
+    else if (command == "exe-db")
+        result = exe_db(argc, argv);
+    else if (command == "replay")
+        result = replay(argc, argv);
+    if (result == 2)
+        std::fprintf(stderr, "usage: %s record|generate|db-config|exe-db|replay ... (see source header)\n", argv[0]);
+    return result;
+}
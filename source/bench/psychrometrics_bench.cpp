@@ -0,0 +1,82 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Psychrometrics benchmark - batch functions of mq_lib against scalar libm (std::exp / std::log) formulas over a grid of
+// (T, RH) pairs. Reports time per pair and largest difference of the results.
+//
+// usage: psychrometrics_bench [rounds]
+
+#include "psychrometrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+namespace P = MQ_System::Psychrometrics;
+
+double dew_point(double temperature, double humidity) {
+    const double gamma = std::log(std::max(humidity, 0.01) / 100.0) + 17.62 * temperature / (243.12 + temperature);
+    return 243.12 * gamma / (17.62 - gamma);
+}
+
+double vapor_pressure(double temperature, double humidity) {
+    return std::max(humidity, 0.01) / 100.0 * 6.112 * std::exp(17.62 * temperature / (243.12 + temperature));
+}
+
+double enthalpy(double temperature, double humidity) {
+    const double vapor = vapor_pressure(temperature, humidity);
+    return 1.006 * temperature + 0.62198 * vapor / (1013.25 - vapor) * (2501.0 + 1.86 * temperature);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const unsigned rounds = argc > 1 ? std::max(1ul, std::strtoul(argv[1], nullptr, 10)) : 200;
+    std::vector<float> temperature, humidity;
+    for (int t = -400; t <= 600; t += 5)
+        for (int h = 0; h <= 1000; h += 10) {
+            temperature.push_back(t / 10.f);
+            humidity.push_back(h / 10.f);
+        }
+    const size_t count = temperature.size();
+    std::vector<float> dew(count), absolute(count), humidex(count), heat(count), reference(4 * count);
+    float* const outputs[4] = {dew.data(), absolute.data(), humidex.data(), heat.data()};
+    const unsigned all = P::kDewPoint | P::kAbsoluteHumidity | P::kHumidex | P::kEnthalpy;
+
+    auto start = BenchClock::now();
+    for (unsigned round = 0; round < rounds; ++round)
+        P::Compute(all, temperature.data(), humidity.data(), count, outputs);
+    const double batch = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count() / (double(rounds) * count);
+
+    start = BenchClock::now();
+    for (unsigned round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < count; ++i) {
+            const double vapor = vapor_pressure(temperature[i], humidity[i]);
+            reference[4 * i] = static_cast<float>(dew_point(temperature[i], humidity[i]));
+            reference[4 * i + 1] = static_cast<float>(216.68 * vapor / (273.15 + temperature[i]));
+            reference[4 * i + 2] = static_cast<float>(temperature[i] + 5.0 / 9.0 * (vapor - 10.0));
+            reference[4 * i + 3] = static_cast<float>(enthalpy(temperature[i], humidity[i]));
+        }
+    }
+    const double scalar = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count() / (double(rounds) * count);
+
+    double difference[4] = {};
+    for (size_t i = 0; i < count; ++i)
+        for (unsigned q = 0; q < 4; ++q)
+            difference[q] = std::max(difference[q], std::fabs(double(outputs[q][i]) - reference[4 * i + q]));
+    std::printf("%zu pairs x %u rounds (dew point, absolute humidity, humidex, enthalpy)\n", count, rounds);
+    std::printf("batch  %6.2f ns/pair\nscalar %6.2f ns/pair (libm)\n", batch, scalar);
+    std::printf("max difference: %.5f °C  %.5f g/m³  %.5f  %.5f kJ/kg\n", difference[0], difference[1], difference[2], difference[3]);
+    return 0;
+}
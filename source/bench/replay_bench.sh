@@ -0,0 +1,117 @@
+#!/bin/sh
+# Copyright: (c) Jaromir Veber 2026
+# Version: 18102026
+# License: MPL-2.0
+# *******************************************************************************
+#  This Source Code Form is subject to the terms of the Mozilla Public
+#  License, v. 2.0. If a copy of the MPL was not distributed with this
+#  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+# *******************************************************************************
+# End-to-end replay benchmark - runs local mosquitto, mq_db_daemon and mq_exe_daemon on temporary configuration and databases
+# (MQ_SYSTEM_CONFIG_DIR) and replays capture against them at every requested speed.
+# Daemons have to stay in foreground - use systemd build (OpenRC build forks).
+#
+# usage: replay_bench.sh [-c capture] [-n sensors] [-t seconds] [-i interval] [-s "1 10 max"] [-b bin dir] [-p port] [-k]
+#        without -c synthetic capture of n sensors (default 1000) publishing every interval (60s) for t seconds (600) is used
+
+set -e
+
+capture=""
+sensors=1000
+seconds=600
+interval=60
+speeds="1 10 max"
+bin_dir=$(dirname "$0")
+port=18883
+keep=0
+
+while getopts "c:n:t:i:s:b:p:k" option; do
+    case $option in
+        c) capture=$OPTARG ;;
+        n) sensors=$OPTARG ;;
+        t) seconds=$OPTARG ;;
+        i) interval=$OPTARG ;;
+        s) speeds=$OPTARG ;;
+        b) bin_dir=$OPTARG ;;
+        p) port=$OPTARG ;;
+        k) keep=1 ;;
+        *) sed -n '14,15p' "$0"; exit 2 ;;
+    esac
+done
+
+find_binary() {
+    for candidate in "$bin_dir/$1" "$bin_dir/../db_sqlite/$1" "$bin_dir/../exe_service/$1" "$bin_dir/../bench/$1"; do
+        if [ -x "$candidate" ]; then
+            echo "$candidate"
+            return
+        fi
+    done
+    command -v "$1" || { echo "$1 not found (use -b)" >&2; exit 1; }
+}
+
+bench=$(find_binary mq_replay_bench)
+db_daemon=$(find_binary mq_db_daemon)
+exe_daemon=$(find_binary mq_exe_daemon)
+mosquitto=$(command -v mosquitto || echo /usr/sbin/mosquitto)
+
+work=$(mktemp -d /tmp/mq_replay_bench.XXXXXX)
+pids=""
+cleanup() {
+    for pid in $pids; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    if [ $keep -eq 0 ]; then
+        rm -rf "$work"
+    else
+        echo "work directory kept: $work"
+    fi
+}
+trap cleanup EXIT INT TERM
+
+if [ -z "$capture" ]; then
+    capture=$work/synthetic.capture
+    "$bench" generate "$capture" "$sensors" "$seconds" "$interval"
+fi
+
+cat > "$work/system.conf" <<EOF
+mqtt_connection: { host = "127.0.0.1"; port = $port; };
+log_file = "$work/mq_system.log";
+log_mqtt = false;
+log_level = 3;
+metrics_interval = 0;
+metrics_socket_dir = "$work";
+EOF
+cat > "$work/mq_exe_daemon.conf" <<EOF
+uri = "$work/mq_exe_system.db";
+log_level = 3;
+EOF
+"$bench" db-config "$capture" "$work/mq_db_daemon.conf" "$work/mq_system.db"
+"$bench" exe-db "$work/mq_exe_system.db"
+
+"$mosquitto" -p "$port" > "$work/mosquitto.log" 2>&1 &
+pids="$!"
+sleep 1
+MQ_SYSTEM_CONFIG_DIR=$work "$db_daemon" &
+db_pid=$!
+pids="$pids $db_pid"
+MQ_SYSTEM_CONFIG_DIR=$work "$exe_daemon" &
+exe_pid=$!
+pids="$pids $exe_pid"
+
+waited=0
+until [ -S "$work/mq_db_daemon.prom" ] && [ -S "$work/mq_exe_daemon.prom" ]; do
+    sleep 1
+    waited=$((waited + 1))
+    if [ $waited -gt 30 ]; then
+        echo "daemons did not start - see $work/mq_system.log" >&2
+        keep=1
+        exit 1
+    fi
+done
+sleep 3  # exe daemon starts scripts
+
+for speed in $speeds; do
+    "$bench" replay "$capture" "$speed" --port "$port" --pid "mq_db_daemon=$db_pid" --pid "mq_exe_daemon=$exe_pid" \
+        --db "$work/mq_system.db" --metrics "$work/mq_db_daemon.prom"
+done
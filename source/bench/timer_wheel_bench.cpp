@@ -0,0 +1,144 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Scaling benchmark of TimerWheel - simulates polling schedules of many sensors (default 10000) for one hour of virtual time.
+// It compares the wheel with "scan all sensors on every wake" approach daemons used before and shows effect of phase spreading.
+//
+// usage: timer_wheel_bench [sensors] [simulated seconds]
+
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+using MQ_System::TimerWheel;
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;  // real time used for measurement
+TimerWheel::Clock::time_point g_virtual_now;   // virtual time used by the wheel
+
+TimerWheel::Clock::time_point virtual_now() {
+    return g_virtual_now;
+}
+
+const int kIntervals[] = {10, 30, 60, 60, 60, 120, 300};  // seconds - typical sensor intervals (60s is the default one)
+
+double elapsed_ns(BenchClock::time_point since) {
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - since).count();
+}
+
+struct Result {
+    double add_ns;
+    double run_ns;
+    double cancel_ns;
+    uint64_t fired;
+    uint64_t wakeups;
+    uint64_t max_fired_per_second;
+};
+
+Result run_wheel(unsigned sensors, unsigned seconds, bool spread) {
+    Result result = {};
+    g_virtual_now = TimerWheel::Clock::time_point(std::chrono::hours(1));
+    TimerWheel wheel(std::chrono::milliseconds(10), g_virtual_now, &virtual_now);
+    std::vector<TimerWheel::TimerId> ids(sensors);
+    std::vector<uint32_t> fired_per_second(seconds + 1, 0);
+    const auto start_time = g_virtual_now;
+    uint64_t fired = 0;
+    auto callback = [&fired, &fired_per_second, start_time] {
+        ++fired;
+        ++fired_per_second[std::chrono::duration_cast<std::chrono::seconds>(g_virtual_now - start_time).count()];
+    };
+
+    auto timer = BenchClock::now();
+    for (unsigned i = 0; i < sensors; ++i) {
+        const std::chrono::milliseconds interval = std::chrono::seconds(kIntervals[i % (sizeof(kIntervals) / sizeof(kIntervals[0]))]);
+        ids[i] = spread ? wheel.AddPeriodic(interval, callback) : wheel.Add(interval, interval, callback);
+    }
+    result.add_ns = elapsed_ns(timer) / sensors;
+
+    // drive the wheel the same way EventLoop does - sleep till next expiry, then advance
+    const auto end_time = start_time + std::chrono::seconds(seconds);
+    timer = BenchClock::now();
+    while (true) {
+        const auto next = wheel.NextExpiry();
+        if (next >= end_time)
+            break;
+        g_virtual_now = next;
+        wheel.Advance(g_virtual_now);
+        ++result.wakeups;
+    }
+    result.run_ns = elapsed_ns(timer);
+    result.fired = fired;
+    result.max_fired_per_second = *std::max_element(fired_per_second.begin(), fired_per_second.end());
+
+    timer = BenchClock::now();
+    for (const auto id : ids)
+        wheel.Cancel(id);
+    result.cancel_ns = elapsed_ns(timer) / sensors;
+    return result;
+}
+
+// the way daemons used to poll - every wake scans all the sensors for expired ones and for the next deadline
+Result run_scan(unsigned sensors, unsigned seconds, bool spread) {
+    Result result = {};
+    struct Sensor {
+        double interval;
+        double last_refresh;
+    };
+    std::vector<Sensor> devices(sensors);
+    for (unsigned i = 0; i < sensors; ++i) {
+        const double interval = kIntervals[i % (sizeof(kIntervals) / sizeof(kIntervals[0]))];
+        double phase = spread ? i * 0.6180339887498949 : 0.0;  // same spreading as the wheel does
+        phase -= static_cast<unsigned>(phase);
+        devices[i] = Sensor{interval, phase * interval};  // first refresh at interval + phase
+    }
+    std::vector<uint32_t> fired_per_second(seconds + 1, 0);
+    double now = 0.0;
+    auto timer = BenchClock::now();
+    while (now < seconds) {
+        double next_refresh = std::numeric_limits<double>::max();
+        for (auto&& device : devices) {
+            if (now - device.last_refresh >= device.interval - 1e-9) {
+                device.last_refresh = now;
+                ++result.fired;
+                ++fired_per_second[static_cast<size_t>(now)];
+            }
+            next_refresh = std::min(next_refresh, device.interval - (now - device.last_refresh));
+        }
+        now += next_refresh;
+        ++result.wakeups;
+    }
+    result.run_ns = elapsed_ns(timer);
+    result.max_fired_per_second = *std::max_element(fired_per_second.begin(), fired_per_second.end());
+    return result;
+}
+
+void print(const char* name, const Result& result) {
+    std::printf("%-22s %10.1f %12.1f %10.1f %10llu %10llu %12.1f %10llu\n", name, result.add_ns, result.run_ns / 1e6, result.cancel_ns,
+        static_cast<unsigned long long>(result.fired), static_cast<unsigned long long>(result.wakeups),
+        result.fired ? result.run_ns / result.fired : 0.0, static_cast<unsigned long long>(result.max_fired_per_second));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const unsigned sensors = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    const unsigned seconds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 3600;
+    std::printf("%u sensors, %u simulated seconds\n", sensors, seconds);
+    std::printf("%-22s %10s %12s %10s %10s %10s %12s %10s\n", "schedule", "add ns", "run ms", "cancel ns", "fired", "wakeups", "ns/fire", "max/s");
+    print("scan all (before)", run_scan(sensors, seconds, false));
+    print("scan all phase spread", run_scan(sensors, seconds, true));
+    print("wheel aligned", run_wheel(sensors, seconds, false));
+    print("wheel phase spread", run_wheel(sensors, seconds, true));
+    return 0;
+}
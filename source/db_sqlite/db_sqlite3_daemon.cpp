@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2017-2019
-// Version: 29032019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -16,6 +16,7 @@
 #include <stdexcept>      // for excpetion
 #include <array>          // for constant C++11 iterable arrays
 #include <unordered_map>  // for fast search and storage of statements
+#include <map>            // ordered configuration (for reload diff)
 #include <vector>
 #include <chrono>
 #include <limits>
@@ -32,6 +33,7 @@ public:
     virtual ~SQLite_DB_Service() noexcept;
     void main();
     virtual void CallBack(const std::string& topic, const std::string& message) override;
+    virtual void OnConfigChanged() override;
  private:
     static const std::array<std::string, 7> kTableDefinitions;
     static const std::array<std::string, 9> kStatementDefinitions;
@@ -42,6 +44,14 @@ public:
         std::chrono::time_point<std::chrono::steady_clock> time_mark;
     };
 
+    struct ValueConfig {
+        uint64_t interval;
+        bool averaging;
+        double precision;
+        bool operator==(const ValueConfig& other) const noexcept { return interval == other.interval && averaging == other.averaging && precision == other.precision; }
+    };
+    typedef std::map<std::string, ValueConfig> SensorConfig;  // value name : value configuration
+
     struct Value_data {
         Value_data(uint64_t i, bool a, double pre): averaging(a), interval(i), precision(pre), last_val(std::numeric_limits<decltype(last_val)>::quiet_NaN()) {}
         const bool averaging;
@@ -60,6 +70,7 @@ public:
     };
 
     std::unordered_map<std::string, SensorData> _sensors;
+    std::map<std::string, SensorConfig> _sensor_config;  // configuration _sensors were made of (topic : values)
     std::vector<sqlite3_stmt *> _statements;
     std::unordered_map<std::string, sqlite3_int64> _known_sensors;
     std::unordered_map<std::string, sqlite3_int64> _known_names;
@@ -68,15 +79,16 @@ public:
     sqlite3* _pDb;
     struct json_tokener* const _tokener;
     
-    void load_daemon_configuration();
+    std::map<std::string, SensorConfig> load_daemon_configuration(std::string& db_uri);
     void check_and_init_database();
+    SensorData make_sensor_data(const std::string& topic, const SensorConfig& config, SensorData* previous = nullptr);
+    void load_last_value(const std::string& topic, const std::string& value_name, Value_data& value);
 
     std::unordered_map<std::string, sqlite3_int64>::const_iterator get_name_id(std::unordered_map<std::string, sqlite3_int64>&,const std::string&, sqlite3_stmt *, sqlite3_stmt *, sqlite3_int64 = std::numeric_limits<sqlite3_int64>::max());
 };
 
 SQLite_DB_Service::~SQLite_DB_Service() noexcept {
-    Unsubscribe("#");  //unsubscribe all - makes it safe because we destroy lot of objects that might by used by concurent thread.
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    Unsubscribe("#");  //unsubscribe all - event loop is already stopped so no callback may use the objects we destroy now.
     for (auto&& statement : _statements) {
         sqlite3_finalize(statement);
     }
@@ -145,12 +157,12 @@ uint64_t gcd( uint64_t x, uint64_t y ) {
        return x;
 }
 
-void SQLite_DB_Service::load_daemon_configuration() {
-    static const char* config_file = "/etc/mq_system/mq_db_daemon.conf";
+std::map<std::string, SQLite_DB_Service::SensorConfig> SQLite_DB_Service::load_daemon_configuration(std::string& db_uri) {
+    const std::string config_file = MQ_System::ConfigPath("mq_db_daemon.conf");
     static const char* default_db_uri = "/var/db/mq_system.db";
     Config cfg;
     try {
-        cfg.readFile(config_file);
+        cfg.readFile(config_file.c_str());
     } catch(const FileIOException &fioex) {
         _logger->error("I/O error while reading system configuration file: {}", config_file);
         throw std::runtime_error("");
@@ -158,17 +170,13 @@ void SQLite_DB_Service::load_daemon_configuration() {
         _logger->error("Parse error at {} : {} - {}", pex.getFile(), pex.getLine(), pex.getError());
         throw std::runtime_error("");
     }
+    std::map<std::string, SensorConfig> sensors;
     try {
         const auto& root = cfg.getRoot();
         if (root.exists("uri"))
-            root.lookupValue("uri", _db_uri);
+            root.lookupValue("uri", db_uri);
         else
-            _db_uri = default_db_uri;
-        if  (cfg.exists("log_level")) {
-            int level;
-            cfg.lookupValue("log_level", level);
-            _logger->set_level(static_cast<spdlog::level::level_enum>(level));		
-        }
+            db_uri = default_db_uri;
         const auto& db_elements = root.lookup("db");
         for (auto db_element = db_elements.begin(); db_element != db_elements.end(); ++db_element) {
             const std::string sensor_name = db_element->lookup("name");
@@ -176,7 +184,7 @@ void SQLite_DB_Service::load_daemon_configuration() {
                 _logger->warn("Configuration: Sensor: {} is missing value definitions - ignoring it!", sensor_name);
                 continue;
             }
-            decltype(_sensors)::mapped_type inner;
+            SensorConfig inner;
             const auto& db_values = db_element->lookup("values");
             for (const auto& db_value : db_values) {
                 // value name
@@ -210,26 +218,20 @@ void SQLite_DB_Service::load_daemon_configuration() {
                     return 0;
                 }();
                 const double precision = db_value.exists("precision") ? db_value.lookup("precision") : 0.0;
-                // if there is a single value with averaging we need to read all messages to get the average
-                if (value_averaging)
-                    inner.interval = 0;
-                // well this may seem to be a bit complicated but if there is no averaging on values of sensor - we use GCD for interval
-                if (inner.interval != 0) {
-                    if (inner.interval == std::numeric_limits<decltype(inner.interval)>::max())
-                        inner.interval = value_interval;
-                    else {
-                        inner.interval = gcd(value_interval, inner.interval);
-                    }
-                }
                 _logger->debug("Sensor {} Value {}, averaging {}, interval {}, precision {}",sensor_name, value_name, value_averaging, value_interval, precision);
-                inner.values.emplace(std::piecewise_construct, std::forward_as_tuple(value_name), std::forward_as_tuple(value_interval, value_averaging, precision));
+                inner.emplace(value_name, ValueConfig{value_interval, value_averaging, precision});
             }
-            if (inner.values.size()) {
-                _sensors.emplace(std::string("status/") + sensor_name, inner);
+            if (inner.size()) {
+                sensors.emplace(std::string("status/") + sensor_name, inner);
             } else {
                 _logger->warn("Sensor {} contain no values in configuration - ignoring the record", sensor_name);
             }
         }
+        if  (cfg.exists("log_level")) {  // applied once whole configuration is parsed (reload keeps running configuration on error)
+            int level;
+            cfg.lookupValue("log_level", level);
+            _logger->set_level(static_cast<spdlog::level::level_enum>(level));
+        }
     } catch(const SettingNotFoundException &nfex) {
         _logger->error("Required setting not found in system configuration file");
         throw std::runtime_error("");
@@ -237,6 +239,57 @@ void SQLite_DB_Service::load_daemon_configuration() {
         _logger->error("Seting type error (at system configuaration) at: {}", nfex.getPath());
         throw std::runtime_error("");
     }
+    return sensors;
+}
+
+// hot state (last values, averaging events) of values that exist in @previous is moved to the new sensor data
+SQLite_DB_Service::SensorData SQLite_DB_Service::make_sensor_data(const std::string& topic, const SensorConfig& config, SensorData* previous) {
+    SensorData sensor;
+    if (previous)
+        sensor.last_update = previous->last_update;
+    for (const auto& value : config) {
+        // if there is a single value with averaging (or without interval) we need to read all messages of the sensor
+        if (value.second.averaging || !value.second.interval)
+            sensor.interval = 0;
+        // well this may seem to be a bit complicated but if there is no averaging on values of sensor - we use GCD for interval
+        if (sensor.interval != 0) {
+            if (sensor.interval == std::numeric_limits<decltype(sensor.interval)>::max())
+                sensor.interval = value.second.interval;
+            else
+                sensor.interval = gcd(value.second.interval, sensor.interval);
+        }
+        auto& value_data = sensor.values.emplace(std::piecewise_construct, std::forward_as_tuple(value.first), std::forward_as_tuple(value.second.interval, value.second.averaging, value.second.precision)).first->second;
+        if (previous) {
+            const auto previous_value = previous->values.find(value.first);
+            if (previous_value != previous->values.end()) {
+                value_data.last_val = previous_value->second.last_val;
+                value_data.last_update = previous_value->second.last_update;
+                value_data.ValEvents = std::move(previous_value->second.ValEvents);
+            }
+        }
+        if (std::isnan(value_data.last_val) && value_data.precision != 0.0)
+            load_last_value(topic, value.first, value_data);  // needed for precision change check (slow - so it's done only once per value)
+    }
+    return sensor;
+}
+
+void SQLite_DB_Service::load_last_value(const std::string& topic, const std::string& value_name, Value_data& value) {
+    const auto last_val_stmt = _statements[SELECT_value_valreal_index];
+    if (SQLITE_OK != sqlite3_bind_text(last_val_stmt, 1, topic.c_str(), topic.size(), SQLITE_STATIC))
+        _logger->error("Sqlite error {}", 700);
+    if (SQLITE_OK != sqlite3_bind_text(last_val_stmt, 2, value_name.c_str(), value_name.size(), SQLITE_STATIC))
+        _logger->error("Sqlite error {}", 701);
+    auto sqresult = sqlite3_step(last_val_stmt);
+    if (sqresult == SQLITE_DONE) {
+        // value stays NAN
+    } else if (sqresult == SQLITE_ROW) {
+        value.last_val = sqlite3_column_double(last_val_stmt, 0);
+    } else {
+        // value stays NAN
+        _logger->error("Sqlite error {} unexpected result {} : {}", 703, sqresult, sqlite3_errmsg(_pDb));
+    }
+    if (SQLITE_OK != sqlite3_reset(last_val_stmt))
+        _logger->error("Sqlite error {}", 705);
 }
 
 void SQLite_DB_Service::check_and_init_database() {
@@ -253,39 +306,14 @@ void SQLite_DB_Service::check_and_init_database() {
         }
         _statements.push_back(temp_stmt);
     }
-    // load last values (if exist for precision change check)
-    const auto last_val_stmt = _statements[SELECT_value_valreal_index];
-    for (auto&& sensor : _sensors) {
-        for (auto && value : sensor.second.values) {
-            if (value.second.precision != 0.0) {
-                if (SQLITE_OK != sqlite3_bind_text(last_val_stmt, 1, sensor.first.c_str(), sensor.first.size(), SQLITE_STATIC))
-                    _logger->error("Sqlite error {}", 700);
-                if (SQLITE_OK != sqlite3_bind_text(last_val_stmt, 2, value.first.c_str(), value.first.size(), SQLITE_STATIC))
-                    _logger->error("Sqlite error {}", 701);
-                auto sqresult = sqlite3_step(last_val_stmt);
-                if (sqresult == SQLITE_DONE) {
-                    // value stays NAN
-                } else if (sqresult == SQLITE_ROW) {
-                    value.second.last_val = sqlite3_column_double(last_val_stmt, 0);
-                } else {
-                    // value stays NAN
-                    _logger->error("Sqlite error {} unexpected result {} : {}", 703, sqresult, sqlite3_errmsg(_pDb));
-                }
-                if (SQLITE_OK != sqlite3_reset(last_val_stmt))
-                    _logger->error("Sqlite error {}", 705);
-            }
-        }
-    }
-    if (SQLITE_OK != sqlite3_finalize(last_val_stmt)) {
-        _logger->error("Unable to finalize statement: {}", sqlite3_errmsg(_pDb));
-    } else {
-        _statements[SELECT_value_valreal_index] = nullptr;
-    }
+    // last value statement is kept prepared - sensors added by configuration reload need it too
+    for (const auto& sensor : _sensor_config)
+        _sensors.emplace(sensor.first, make_sensor_data(sensor.first, sensor.second));
 }
 
 void SQLite_DB_Service::main() {
     _logger->trace("Daemon Start");
-    load_daemon_configuration();
+    _sensor_config = load_daemon_configuration(_db_uri);
     _logger->trace("Config done");
     if (!sqlite3_threadsafe()) {
         if (sqlite3_config(SQLITE_CONFIG_SERIALIZED)) {
@@ -307,8 +335,8 @@ void SQLite_DB_Service::main() {
     _logger->trace("Sqlite initialized");
     for (const auto& sensor : _sensors)
         Subscribe(sensor.first);
-    _logger->trace("Subscribed - Sleeping");
-    SleepForever();
+    _logger->trace("Subscribed - Running");
+    Run();
 }
 
 std::unordered_map<std::string, sqlite3_int64>::const_iterator SQLite_DB_Service::get_name_id(std::unordered_map<std::string, sqlite3_int64>& map, const std::string& message_value_name, sqlite3_stmt* insert, sqlite3_stmt* request, sqlite3_int64 unit_id) {
@@ -349,6 +377,9 @@ std::unordered_map<std::string, sqlite3_int64>::const_iterator SQLite_DB_Service
 
 void SQLite_DB_Service::CallBack(const std::string& topic, const std::string& message) {
     _logger->trace("SQLite_DB_Service::CallBack - start");
+    static Counter& values_stored = Metrics::Instance().GetCounter("mq_db_values_stored_total", "Values inserted to database");
+    static Counter& values_filtered = Metrics::Instance().GetCounter("mq_db_values_filtered_total", "Values not stored because of precision filter");
+    static Histogram& insert_time = Metrics::Instance().GetHistogram("mq_db_insert_seconds", "Time of value insert statement");
     const auto now = std::chrono::steady_clock::now();
     const std::string& message_sensor_name = topic;
     const auto& sensor_search_result = _sensors.find(message_sensor_name);
@@ -443,6 +474,7 @@ void SQLite_DB_Service::CallBack(const std::string& topic, const std::string& me
                     _logger->debug("Precision sensor {} name {} last_event_value {} value: {} precision {}", message_sensor_name, message_value_name, current_value_data.last_val, value, current_value_data.precision);
                     if (!std::isnan(current_value_data.last_val) && fabs(current_value_data.last_val - value) < current_value_data.precision) {
                         statement_value_bound = false;
+                        values_filtered.Increment();
                         _logger->debug("Precision break");
                         break;
                     }
@@ -469,8 +501,12 @@ void SQLite_DB_Service::CallBack(const std::string& topic, const std::string& me
                     _logger->error("Sqlite error {}", 21);
                 if (SQLITE_OK != sqlite3_bind_int64(stmt, 2, name_name_database_id))
                     _logger->error("Sqlite error {}", 23);
+                const auto step_start = std::chrono::steady_clock::now();
                 if (SQLITE_DONE != sqlite3_step(stmt))
                     _logger->error("Sqlite error on position {} : {} ", 24, sqlite3_errmsg(_pDb));
+                else
+                    values_stored.Increment();
+                insert_time.Record(std::chrono::steady_clock::now() - step_start);
                 sqlite3_clear_bindings(stmt);   // this one may not be necessary
                 current_value_data.last_update = now;
                 mapped_sensor_data.last_update = now;
@@ -483,6 +519,33 @@ void SQLite_DB_Service::CallBack(const std::string& topic, const std::string& me
     _logger->trace("SQLite_DB_Service::CallBack - end");
 }
 
+// runs in event loop thread so CallBack never sees half applied configuration
+void SQLite_DB_Service::OnConfigChanged() {
+    std::string db_uri;
+    auto sensor_config = load_daemon_configuration(db_uri);
+    if (db_uri != _db_uri)
+        _logger->warn("Database uri change requires daemon restart - keeping {}", _db_uri);
+    const auto diff = MakeConfigDiff(_sensor_config, sensor_config);
+    for (const auto& topic : diff.removed) {
+        Unsubscribe(topic);
+        _sensors.erase(topic);
+        _logger->info("Configuration reload - sensor {} removed", topic);
+    }
+    for (const auto& sensor : diff.changed) {
+        auto current = _sensors.find(sensor.first);
+        auto updated = make_sensor_data(sensor.first, sensor.second, &current->second);
+        _sensors.erase(current);
+        _sensors.emplace(sensor.first, std::move(updated));
+        _logger->info("Configuration reload - sensor {} changed", sensor.first);
+    }
+    for (const auto& sensor : diff.added) {
+        _sensors.emplace(sensor.first, make_sensor_data(sensor.first, sensor.second));
+        Subscribe(sensor.first);
+        _logger->info("Configuration reload - sensor {} added", sensor.first);
+    }
+    _sensor_config = std::move(sensor_config);
+}
+
 int main() {
     try {
         SQLite_DB_Service d;
@@ -0,0 +1,110 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// DHT22 frame decoder driven by edge timestamps (kernel GPIO line events) and simulated edge source to exercise it.
+// After start pulse the sensor answers:
+//   response  - 80us low, 80us high
+//   each bit  - 50us low, then high 26-28us (0) or 70us (1)
+//   end       - 50us low, then the line is released (high)
+// Bit value is the length of its high pulse, so decoding takes the last 40 complete high pulses (rising to falling edge) -
+// response edges lost while the line switched to input do not matter. Edge times come from the kernel so they are exact
+// even if the daemon is not scheduled for a while.
+
+#include <cstdint>
+#include <vector>
+
+struct DhtEdge {
+    uint64_t time_ns;
+    bool rising;
+};
+
+enum class DhtResult { kOk, kNoResponse, kMissingBits, kChecksum };
+
+class DhtDecoder {
+ public:
+    enum : unsigned { kBits = 40, kFrameEdges = 2 + 2 * kBits + 2 };  // response, bits, end
+
+    // humidity and temperature are set on kOk; @bits - complete high pulses seen (diagnostics)
+    static DhtResult Decode(const std::vector<DhtEdge>& edges, float& humidity, float& temperature, unsigned& bits) {
+        if (edges.empty()) {
+            bits = 0;
+            return DhtResult::kNoResponse;
+        }
+        uint32_t widths[kBits];  // high pulses (ns) - last kBits are kept in ring
+        unsigned count = 0;
+        uint64_t rise = 0;
+        bool high = false;
+        for (const auto& edge : edges) {
+            if (edge.rising) {
+                rise = edge.time_ns;
+                high = true;
+            } else if (high) {
+                widths[count++ % kBits] = static_cast<uint32_t>(edge.time_ns - rise);
+                high = false;
+            }
+        }
+        bits = count;
+        if (count < kBits)
+            return DhtResult::kMissingBits;
+        uint8_t data[5] = {};
+        for (unsigned i = 0; i < kBits; ++i) {
+            const uint32_t width = widths[(count + i) % kBits];  // oldest of the last kBits first
+            data[i / 8] = static_cast<uint8_t>((data[i / 8] << 1) | (width > kOneThreshold ? 1 : 0));
+        }
+        if (data[4] != ((data[0] + data[1] + data[2] + data[3]) & 0xFF))
+            return DhtResult::kChecksum;
+        humidity = ((static_cast<uint16_t>(data[0]) << 8) | data[1]) / 10.f;
+        temperature = (((static_cast<uint16_t>(data[2] & 0x7F)) << 8) | data[3]) / 10.f;
+        if (data[2] & 0x80)
+            temperature = -temperature;
+        return DhtResult::kOk;
+    }
+
+ private:
+    enum : uint32_t { kOneThreshold = 48000 };  // ns - 0 is ~27us, 1 is ~70us high
+};
+
+// generates edges of a frame as the sensor would send them (for benchmarks and decoder checks without hardware);
+// times are jittered and the response edges may be dropped (slow switch of the line to input)
+class DhtEdgeSimulator {
+ public:
+    explicit DhtEdgeSimulator(uint32_t seed) : _state(seed) {}
+
+    void Frame(float humidity, float temperature, uint64_t start_ns, uint32_t jitter_ns, bool drop_response, std::vector<DhtEdge>& edges) {
+        const uint16_t raw_humidity = static_cast<uint16_t>(humidity * 10.f + 0.5f);
+        const uint16_t raw_temperature = static_cast<uint16_t>((temperature < 0 ? -temperature : temperature) * 10.f + 0.5f) | (temperature < 0 ? 0x8000 : 0);
+        uint8_t data[5] = {static_cast<uint8_t>(raw_humidity >> 8), static_cast<uint8_t>(raw_humidity), static_cast<uint8_t>(raw_temperature >> 8), static_cast<uint8_t>(raw_temperature), 0};
+        data[4] = static_cast<uint8_t>(data[0] + data[1] + data[2] + data[3]);
+        uint64_t time = start_ns + 30000;  // sensor answers 20-40us after release
+        edges.clear();
+        auto edge = [&](bool rising, uint32_t length_ns) {
+            if (!drop_response || time > start_ns + kSwitchTime)
+                edges.push_back(DhtEdge{time, rising});
+            time += length_ns + (jitter_ns ? next() % jitter_ns : 0);
+        };
+        edge(false, 80000);
+        edge(true, 80000);
+        for (unsigned i = 0; i < DhtDecoder::kBits; ++i) {
+            edge(false, 50000);
+            edge(true, (data[i / 8] >> (7 - i % 8)) & 1 ? 70000 : 27000);
+        }
+        edge(false, 50000);
+        edge(true, 0);
+    }
+
+ private:
+    enum : uint64_t { kSwitchTime = 160000 };  // ns - edges before are lost with drop_response
+
+    uint32_t next() noexcept {
+        _state = _state * 1664525u + 1013904223u;
+        return _state >> 8;
+    }
+
+    uint32_t _state;
+};
@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2017-2021
-// Version: 21122020
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -9,6 +9,8 @@
 // Code to handle DHT sensor (DHT22 for now)
 // This code is not based on origial adafruit (or another) code.
 #include "mq_lib.h"
+#include "dht_decoder.h"
+#include "psychrometrics.h"
 
 #if defined pigpio_FOUND
     #include <pigpiod_if2.h>            // GPIO connector
@@ -21,10 +23,12 @@
 #include <json-c/json_object.h>     // JSON format for communication
 #include <libconfig.h++>            // loading configuration data
 
-#include <cmath>                    // dew point equation
+#include <algorithm>                // std::min
+#include <cmath>                    // std::fabs
 #include <limits>                   // techically could be switched to <limits> but well
 #include <chrono>                   // for elapsed time measurement
 #include <vector>                   // for storing sensor information
+#include <map>                      // sensor configuration (ordered for reload diff)
 #include <stdexcept>                // exceptions
 #include <thread>                   // sleep_for
 #include <memory>                   // smart pointers
@@ -32,33 +36,107 @@
 using namespace MQ_System;
 using namespace libconfig;
 
+typedef struct my_data {
+   uint8_t bit_counter;
+   uint32_t time;
+   uint64_t bits;
+} MyData;
+
 class DHT_Service : public Daemon {
  public:
     DHT_Service();
     ~DHT_Service() noexcept;
     void main();
+    virtual void OnConfigChanged() override;
  private:
     struct MyConfig {
-        MyConfig(std::string n, int p, int i):
-            pin(p), interval(i), name(n) {}
+        MyConfig(std::string n, int p, int i, unsigned d):
+            pin(p), interval(i), derived(d), name(n) {}
+        bool operator==(const MyConfig& other) const noexcept { return pin == other.pin && interval == other.interval && derived == other.derived; }
         int pin;
         int interval;
+        unsigned derived;  // Psychrometrics::Quantity mask - published with the measure
         std::string name;
-        std::chrono::time_point<std::chrono::steady_clock> last_refresh;
     };
 
-    void load_daemon_configuration();
-    void read_sensors();
-    void read_sensor(MyConfig &c) noexcept;
-    int  read_sensor_data(int id, float& humidity, float& temperature) noexcept;
+    enum : unsigned { kSamples = 3 };  // samples of unstable sensor - median of them is published
+
+    // read statistics of a sensor - kept over reads, they decide how the next read is done: stable sensor publishes its first
+    // sample, unstable one takes median of kSamples, failing one gets less attempts and skips intervals (backoff)
+    struct Health {
+        Health() : failure_rate(0.0), failed_reads(0), skip(0), has_last(false), last_humidity(0.f), last_temperature(0.f), failure_gauge(nullptr) {}
+        double failure_rate;  // moving average of failed attempts (no answer, missing bits, checksum, out of range)
+        unsigned failed_reads;  // consecutive reads without any sample
+        unsigned skip;  // intervals left to skip
+        bool has_last;
+        float last_humidity;  // last published
+        float last_temperature;
+        Gauge* failure_gauge;  // failure_rate per mille (mq_dht_failure_permille_<sensor>)
+    };
+
+    // read of one sensor - samples are taken by asynchronous steps on the loop (start pulse, capture, decode) so sensors on
+    // other pins are read at the same time and a failing sensor retries on its own backoff timer without delaying the others
+    struct Reading {
+        Reading(const std::string& t, int p, unsigned d, Health& h) : topic(t), pin(p), derived(d), health(h), sample(0), attempts(0), max_attempts(0), samples(0), timer(EventLoop::kInvalidTimer), on_line(false) {
+#ifdef pigpio_FOUND
+            data = MyData();
+            callback_id = -1;
+#endif
+        }
+        const std::string topic;
+        const int pin;  // configuration may change while reading
+        const unsigned derived;
+        Health& health;
+        unsigned sample;  // current sample
+        unsigned attempts;  // failed attempts of current sample
+        unsigned max_attempts;
+        unsigned samples;  // good samples - values follow
+        float humidity[kSamples];
+        float temperature[kSamples];
+        EventLoop::TimerId timer;  // next step (stale id of fired step is ignored by CancelTimer)
+        bool on_line;  // pulse sent, capture not decoded yet
+#ifdef pigpio_FOUND
+        MyData data;  // filled by pigpio callback while capturing
+        int callback_id;
+#endif
+    };
+    typedef void (DHT_Service::*Step)(Reading& reading);
+
+    std::map<std::string, MyConfig> load_daemon_configuration();
+    void schedule_sensor(MyConfig& sensor);
+    void open_gpio();
+    void read_sensor(MyConfig &c);
+    void next_step(Reading& reading, std::chrono::nanoseconds delay, Step step);
+    void start_sample(Reading& reading);
+    void capture_sample(Reading& reading);
+    void decode_sample(Reading& reading);
+    void sample_failed(Reading& reading);
+    void finish_sample(Reading& reading, bool last);
+    void finish_read(Reading& reading);
+    void abort_read(const std::string& topic) noexcept;
+    void publish_measure(const std::string& topic, unsigned derived, float humidity, float temperature);
+    // GPIO backend - start pulse, release of the line to the sensor answer, decoding of the captured answer
+    bool pulse_line(Reading& reading) noexcept;
+    bool release_line(Reading& reading) noexcept;
+    DhtResult read_capture(Reading& reading, float& humidity, float& temperature) noexcept;
+    void free_line(Reading& reading) noexcept;
 #ifdef pigpio_FOUND
     void check_result(int result);
+#elif !defined GPIO_V2_GET_LINE_IOCTL
+    DhtResult read_sensor_data(int id, float& humidity, float& temperature) noexcept;
 #endif
-    std::vector<MyConfig> _pin_config;
+    std::map<std::string, MyConfig> _pin_config;  // topic : sensor; timer callbacks hold reference to the map node
+    std::map<std::string, TimerWheel::TimerId> _timers;  // topic : sensor read timer
+    std::map<std::string, Reading> _readings;  // topic : read in progress; step timers hold reference to the map node
+    std::map<std::string, Health> _health;  // topic : statistics; readings hold reference to the map node
 #ifdef pigpio_FOUND
     int _pigpio_handle;
 #else
     std::unique_ptr<gpiocxx> _chip;
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    std::vector<gpiocxx::line_event> _events;  // capture buffers (reused)
+    std::vector<DhtEdge> _edges;
+#endif
 #endif
 };
 
@@ -70,12 +148,12 @@ DHT_Service::DHT_Service(): Daemon("mq_dht_daemon", "/var/run/mq_dht_daemon.pid"
 {}
 
 
-void DHT_Service::load_daemon_configuration() {
-    static const char* config_file = "/etc/mq_system/mq_dht_daemon.conf";
+std::map<std::string, DHT_Service::MyConfig> DHT_Service::load_daemon_configuration() {
+    const std::string config_file = MQ_System::ConfigPath("mq_dht_daemon.conf");
     Config cfg;
     try
     {
-        cfg.readFile(config_file);
+        cfg.readFile(config_file.c_str());
     }
     catch(const FileIOException &fioex)
     {
@@ -87,6 +165,7 @@ void DHT_Service::load_daemon_configuration() {
         _logger->error("Parse error at {} : {} - {}", pex.getFile(), pex.getLine(), pex.getError());
         throw std::runtime_error("");
     }
+    std::map<std::string, MyConfig> pin_config;
     try {
         const auto& sensors = cfg.getRoot()["sensors"];
         for (auto sensor = sensors.begin(); sensor != sensors.end(); ++sensor) {
@@ -95,7 +174,22 @@ void DHT_Service::load_daemon_configuration() {
             int sensor_interval = 60;
             if (sensor->exists("interval"))
                 sensor_interval = sensor->lookup("interval");
-            _pin_config.emplace_back(std::string("status/") + sensor_name, sensor_pin, sensor_interval);
+            unsigned derived = Psychrometrics::kDewPoint;
+            if (sensor->exists("derived")) {
+                const auto& names = sensor->lookup("derived");
+                derived = 0;
+                for (int i = 0; i < names.getLength(); ++i) {
+                    const std::string name = names[i];
+                    const unsigned quantity = Psychrometrics::ParseQuantity(name);
+                    if (!quantity) {
+                        _logger->error("Unknown derived quantity {} of sensor {} (dew_point, absolute_humidity, humidex, enthalpy)", name, sensor_name);
+                        throw std::runtime_error("");
+                    }
+                    derived |= quantity;
+                }
+            }
+            const std::string topic = std::string("status/") + sensor_name;
+            pin_config.emplace(std::piecewise_construct, std::forward_as_tuple(topic), std::forward_as_tuple(topic, sensor_pin, sensor_interval, derived));
         }
         if  (cfg.exists("log_level")) {
             int level;
@@ -109,122 +203,311 @@ void DHT_Service::load_daemon_configuration() {
         _logger->error("Seting type error (at system configuaration) at: {}", nfex.getPath());
         throw std::runtime_error("");
     }
+    return pin_config;
+}
+
+void DHT_Service::schedule_sensor(MyConfig& sensor) {
+    _logger->trace("Schedule sensor {} every {} s", sensor.pin, sensor.interval);
+    _timers[sensor.name] = Loop().Wheel().AddPeriodic(std::chrono::seconds(sensor.interval), [this, &sensor] { read_sensor(sensor); });  // sensors are spread over the interval
 }
 
 void DHT_Service::main()
 {
-    load_daemon_configuration();
-    read_sensors();  // Main Cycle
+    _pin_config = load_daemon_configuration();
+    open_gpio();
+    for (auto&& sensor : _pin_config)
+        schedule_sensor(sensor.second);
+    Run();  // Main Cycle
 }
 
-typedef struct my_data {
-   uint8_t bit_counter;
-   uint32_t time;
-   uint64_t bits;
-} MyData;
+void DHT_Service::OnConfigChanged() {
+    auto pin_config = load_daemon_configuration();
+    const auto diff = MakeConfigDiff(_pin_config, pin_config);
+    for (const auto& topic : diff.removed) {
+        Loop().Wheel().Cancel(_timers[topic]);
+        abort_read(topic);
+        _health.erase(topic);
+        _timers.erase(topic);
+        _pin_config.erase(topic);
+        _logger->info("Configuration reload - sensor {} removed", topic);
+    }
+    for (const auto& sensor : diff.changed) {
+        auto& current = _pin_config.at(sensor.first);
+        const bool interval_changed = current.interval != sensor.second.interval;
+        if (current.pin != sensor.second.pin && !_readings.count(sensor.first))
+            _health.erase(sensor.first);  // statistics of the old pin (kept while it is being read)
+        current = sensor.second;  // map node stays the same so the timer reads new pin from now on (read in progress keeps old one)
+        if (interval_changed) {
+            Loop().Wheel().Cancel(_timers[sensor.first]);
+            schedule_sensor(current);
+        }
+        _logger->info("Configuration reload - sensor {} changed", sensor.first);
+    }
+    for (const auto& sensor : diff.added) {
+        schedule_sensor(_pin_config.emplace(sensor).first->second);
+        _logger->info("Configuration reload - sensor {} added", sensor.first);
+    }
+}
 
-void DHT_Service::read_sensors()
+void DHT_Service::open_gpio()
 {
-    while (true) {
 #ifdef pigpio_FOUND
-        if (_pigpio_handle < 0)
-            _pigpio_handle = pigpio_start(NULL, NULL);	// technically we also could support GPIO read from another RPI but well not yet needed TODO?
-
-        if (_pigpio_handle < 0) {
-            _logger->error("Failed to connect to GPIO daemon (pigpiod): Error - {}", pigpio_error(_pigpio_handle));
-            throw std::runtime_error("");
-        }
+    //Close connection to Pigpio? NO!!! Pigpio is not that stabe and is failing to recoonect it ater few thousand attempts; keep connection alive all the time.
+    _pigpio_handle = pigpio_start(NULL, NULL);	// technically we also could support GPIO read from another RPI but well not yet needed TODO?
+    if (_pigpio_handle < 0) {
+        _logger->error("Failed to connect to GPIO daemon (pigpiod): Error - {}", pigpio_error(_pigpio_handle));
+        throw std::runtime_error("");
+    }
 #else
-        if (!_chip)
-            _chip.reset(new gpiocxx("/dev/gpiochip0", _logger));  // C++11 does not offer "std::make_unique<gpiocxx>("/dev/gpiochip0", _logger);" ...
-        _logger->debug("Chip initialized");
+    _chip.reset(new gpiocxx("/dev/gpiochip0", _logger));  // C++11 does not offer "std::make_unique<gpiocxx>("/dev/gpiochip0", _logger);" ...
+    _logger->debug("Chip initialized");
 #endif
-        int biggest_interval = 1;   // this may be prepared in load_daemon_configuration
-        int interval = std::numeric_limits<decltype(interval)>::max();
-        for (auto&& x : _pin_config) {
-            _logger->trace("read_sensors():Cycle {}", x.pin);
-            auto now = std::chrono::steady_clock::now();
-            std::chrono::duration<float> diff = now - x.last_refresh;
-            biggest_interval = biggest_interval < x.interval ? x.interval : biggest_interval;
-            int next_wake = 0;
-            if (diff.count() >= x.interval) {
-                read_sensor(x);
-                x.last_refresh = now;
-                next_wake = x.interval;
-            } else {
-                next_wake = x.interval - diff.count();
-            }
-            if (next_wake < interval)
-                interval = next_wake;
-            _logger->debug("diff {} Interval {} Next wake {}", diff.count(), interval, next_wake);
-        }
-        _logger->debug("Interval {}, biggest interval {}", interval, biggest_interval);
-        if (interval > 0 && interval <= biggest_interval) { // interval may be negative! I that case we're not waiting at all
-            //Close connection to Pigpio? NO!!! Pigpio is not that stabe and is failing to recoonect it ater few thousand attempts; keep connection alive all the time.
-            _logger->trace("Waiting {} seconds", interval);
-            std::this_thread::sleep_for(std::chrono::seconds(interval));
-            _logger->trace("Awake!");
-        }
+}
+
+namespace {
+
+constexpr unsigned kMaxAttempts = 5;  // failed attempts of a sample - sensor failing that long would fail the others as well
+constexpr unsigned kFailingAttempts = 2;  // attempts of a sample while the sensor fails (last read got no sample)
+constexpr unsigned kMaxSkippedIntervals = 15;  // failing sensor skips 1, 3, 7... intervals up to this
+constexpr double kFailureWeight = 0.05;  // weight of an attempt in failure rate (~last 20 attempts)
+constexpr float kStableTemperature = 0.3f;  // first sample this close to last published one is published right away
+constexpr float kStableHumidity = 1.5f;
+constexpr float kSpikeTemperature = 2.0f;  // sample this far from the median is a spike (median leaves it out)
+constexpr float kSpikeHumidity = 5.0f;
+constexpr std::chrono::microseconds kStartPulse(1500);  // DHT22 start signal is 1ms typical, 20ms max - loop timer latency has ~18ms margin
+constexpr std::chrono::milliseconds kFrameTime(10);  // sensor answer (~5ms) is over by then
+constexpr std::chrono::seconds kSampleDelay(1);  // between samples of a sensor
+constexpr std::chrono::seconds kRetryDelay(1);  // doubles with every failed attempt up to kMaxRetryDelay
+constexpr std::chrono::seconds kMaxRetryDelay(8);
+constexpr std::chrono::milliseconds kPinBusyDelay(50);  // other sensor configured on the same pin is being read
+
+Counter& attempt_counter() {
+    static Counter& counter = Metrics::Instance().GetCounter("mq_dht_attempts_total", "DHT read attempts (start pulses)");
+    return counter;
+}
+
+Counter& failure_counter(DhtResult result) {
+    static Counter& no_response = Metrics::Instance().GetCounter("mq_dht_no_response_total", "DHT attempts without answer (no edges)");
+    static Counter& missing_bits = Metrics::Instance().GetCounter("mq_dht_missing_bits_total", "DHT attempts with incomplete frame");
+    static Counter& checksum = Metrics::Instance().GetCounter("mq_dht_checksum_errors_total", "DHT frames with checksum mismatch");
+    switch (result) {
+        case DhtResult::kNoResponse: return no_response;
+        case DhtResult::kMissingBits: return missing_bits;
+        default: return checksum;
     }
-    _logger->trace("Exit read_sensors");
 }
 
-void DHT_Service::read_sensor(MyConfig &c)  noexcept {
-    float humidity_[3], temperature_[3];
-    bool got_measure[3] = {false, false, false};
-    _logger->debug("Read sensor {}", c.pin);
-    // prepare GPIO
-#ifdef pigpio_FOUND
-    set_pull_up_down(_pigpio_handle, c.pin, PI_PUD_OFF);
-    set_pull_up_down(_pigpio_handle, c.pin, PI_PUD_DOWN);
-    set_noise_filter(_pigpio_handle, c.pin, 0, 0);
-#else
-#endif
-    // we actually do 3 measures and calculate the average
-    for (int j = 0; j < 3; j++) {
-        for (int i = 0; i < 40; i++) {
-            if (0 != read_sensor_data(c.pin, humidity_[j], temperature_[j])) {
-                _logger->trace("Error reading sensor {}", c.pin);
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-                continue;
-            }
+Counter& out_of_range_counter() {
+    static Counter& counter = Metrics::Instance().GetCounter("mq_dht_out_of_range_total", "DHT samples out of plausible range");
+    return counter;
+}
 
-            if (humidity_[j] > 100.f ||  humidity_[j] < 0.f) {
-                _logger->info("Humidity out of bounds: {}", humidity_[j]);
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-                continue;
-            }
+Counter& spike_counter() {
+    static Counter& counter = Metrics::Instance().GetCounter("mq_dht_spikes_total", "DHT sample values left out by median as spikes");
+    return counter;
+}
 
-            if (temperature_[j] > 55.f || temperature_[j] < -30.f) {
-                _logger->info("Temperature out of bounds: {}", temperature_[j]);
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-                continue;
-            }
+Counter& stable_counter() {
+    static Counter& counter = Metrics::Instance().GetCounter("mq_dht_stable_reads_total", "DHT reads published from first sample (stable sensor)");
+    return counter;
+}
 
-            // all is ok finally
-            got_measure[j] = true;
-            break;
+Counter& failed_read_counter() {
+    static Counter& counter = Metrics::Instance().GetCounter("mq_dht_failed_reads_total", "DHT reads without any sample");
+    return counter;
+}
+
+Counter& skipped_counter() {
+    static Counter& counter = Metrics::Instance().GetCounter("mq_dht_skipped_intervals_total", "DHT read intervals skipped by failing sensor backoff");
+    return counter;
+}
+
+std::string failure_metric(const std::string& topic) {
+    std::string name = "mq_dht_failure_permille_" + topic.substr(topic.find('/') + 1);  // status/<sensor>
+    for (auto&& character : name)
+        if (!((character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z') || (character >= '0' && character <= '9')))
+            character = '_';
+    return name;
+}
+
+float median(float* values, unsigned count) {
+    std::sort(values, values + count);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2.f;
+}
+
+void record_attempt(double& failure_rate, Gauge& gauge, bool failed) {
+    failure_rate = failure_rate * (1.0 - kFailureWeight) + (failed ? kFailureWeight : 0.0);
+    gauge.Set(std::llround(failure_rate * 1000.0));
+}
+
+}  // namespace
+
+void DHT_Service::read_sensor(MyConfig &c) {
+    if (_readings.count(c.name)) {
+        _logger->debug("Sensor {} is still being read - interval skipped", c.name);
+        return;
+    }
+    auto& health = _health[c.name];
+    if (health.skip) {
+        --health.skip;
+        skipped_counter().Increment();
+        _logger->debug("Sensor {} is failing - interval skipped", c.name);
+        return;
+    }
+    if (health.failure_gauge == nullptr)
+        health.failure_gauge = &Metrics::Instance().GetGauge(failure_metric(c.name), "DHT sensor failed attempts (moving average, per mille)");
+    _logger->debug("Read sensor {}", c.pin);
+    auto& reading = _readings.emplace(std::piecewise_construct, std::forward_as_tuple(c.name), std::forward_as_tuple(c.name, c.pin, c.derived, health)).first->second;
+    reading.max_attempts = health.failed_reads ? kFailingAttempts : kMaxAttempts;
+    start_sample(reading);
+}
+
+void DHT_Service::next_step(Reading& reading, std::chrono::nanoseconds delay, Step step) {
+    reading.timer = Loop().AddTimer(delay, std::chrono::nanoseconds(0), [this, &reading, step] { (this->*step)(reading); });
+}
+
+void DHT_Service::start_sample(Reading& reading) {
+    for (const auto& other : _readings) {
+        if (&other.second != &reading && other.second.pin == reading.pin && other.second.on_line) {
+            next_step(reading, kPinBusyDelay, &DHT_Service::start_sample);
+            return;
         }
-        std::this_thread::sleep_for(std::chrono::seconds(1)); // wait 1 sec be4 next measure
     }
-    
-    if (!got_measure[0] && !got_measure[1] && !got_measure[2]) {
-        _logger->warn("Unable to read sensor: {} at all", c.pin);
+    attempt_counter().Increment();
+    reading.on_line = true;
+    if (!pulse_line(reading)) {
+        sample_failed(reading);
         return;
     }
+    next_step(reading, kStartPulse, &DHT_Service::capture_sample);
+}
 
-    // calculate the average
-    double divisor = (got_measure[0] ? 1.0 : 0.0) + (got_measure[1] ? 1.0 : 0.0) + (got_measure[2] ? 1.0 : 0.0);
-    double humidity = ((got_measure[0] ? humidity_[0] : 0.0) + (got_measure[1] ? humidity_[1] : 0.0) + (got_measure[2] ? humidity_[2] : 0.0)) / divisor;
-    double temperature = ((got_measure[0] ? temperature_[0] : 0.0) + (got_measure[1] ? temperature_[1] : 0.0) + (got_measure[2] ? temperature_[2] : 0.0)) / divisor;
-    // Dew point equation " Arden Buck equation"
-    // https://en.wikipedia.org/wiki/Dew_point
-    // using close approximation with error around 1%
-    double dew_point_LN = std::log((humidity / 100.0) * std::exp((17.62 - (temperature / 243.5))*(temperature / 243.12)));
-    double dew_point = (243.12 * dew_point_LN) / (17.62 - dew_point_LN);
+void DHT_Service::capture_sample(Reading& reading) {
+    if (!release_line(reading)) {
+        sample_failed(reading);
+        return;
+    }
+    next_step(reading, kFrameTime, &DHT_Service::decode_sample);
+}
+
+void DHT_Service::decode_sample(Reading& reading) {
+    float humidity = 0.f, temperature = 0.f;
+    const DhtResult result = read_capture(reading, humidity, temperature);
+    free_line(reading);
+    reading.on_line = false;
+    if (result != DhtResult::kOk) {
+        failure_counter(result).Increment();
+        _logger->trace("Error reading sensor {}", reading.pin);
+        sample_failed(reading);
+        return;
+    }
+    if (humidity > 100.f ||  humidity < 0.f) {
+        out_of_range_counter().Increment();
+        _logger->info("Humidity out of bounds: {}", humidity);
+        sample_failed(reading);
+        return;
+    }
+    if (temperature > 55.f || temperature < -30.f) {
+        out_of_range_counter().Increment();
+        _logger->info("Temperature out of bounds: {}", temperature);
+        sample_failed(reading);
+        return;
+    }
+    // all is ok finally
+    Health& health = reading.health;
+    record_attempt(health.failure_rate, *health.failure_gauge, false);
+    reading.humidity[reading.samples] = humidity;
+    reading.temperature[reading.samples] = temperature;
+    ++reading.samples;
+    const bool stable = reading.samples == 1 && health.has_last && std::fabs(temperature - health.last_temperature) <= kStableTemperature
+        && std::fabs(humidity - health.last_humidity) <= kStableHumidity;
+    if (stable)
+        stable_counter().Increment();
+    finish_sample(reading, stable);
+}
+
+void DHT_Service::sample_failed(Reading& reading) {
+    if (reading.on_line) {
+        free_line(reading);
+        reading.on_line = false;
+    }
+    record_attempt(reading.health.failure_rate, *reading.health.failure_gauge, true);
+    if (++reading.attempts < reading.max_attempts) {
+        const auto delay = std::min<std::chrono::seconds>(kRetryDelay * (1 << (reading.attempts - 1)), kMaxRetryDelay);
+        next_step(reading, delay, &DHT_Service::start_sample);
+        return;
+    }
+    finish_sample(reading, true);  // next samples would most likely fail the same way
+}
+
+void DHT_Service::finish_sample(Reading& reading, bool last) {
+    reading.attempts = 0;
+    if (!last && ++reading.sample < kSamples) {
+        next_step(reading, kSampleDelay, &DHT_Service::start_sample);  // wait 1 sec be4 next measure
+        return;
+    }
+    finish_read(reading);
+}
+
+// publishes median of the samples - one spike among three samples does not get through
+void DHT_Service::finish_read(Reading& reading) {
+    Health& health = reading.health;
+    if (!reading.samples) {
+        failed_read_counter().Increment();
+        ++health.failed_reads;
+        health.skip = std::min((1u << std::min(health.failed_reads - 1, 4u)) - 1, kMaxSkippedIntervals);
+        if (health.skip)
+            _logger->warn("Unable to read sensor: {} at all - skipping next {} intervals", reading.pin, health.skip);
+        else
+            _logger->warn("Unable to read sensor: {} at all", reading.pin);
+    } else {
+        if (health.failed_reads)
+            _logger->info("Sensor {} recovered after {} failed reads", reading.topic, health.failed_reads);
+        health.failed_reads = 0;
+        const float humidity = median(reading.humidity, reading.samples);
+        const float temperature = median(reading.temperature, reading.samples);
+        for (unsigned i = 0; i < reading.samples; ++i) {
+            if (std::fabs(reading.humidity[i] - humidity) > kSpikeHumidity || std::fabs(reading.temperature[i] - temperature) > kSpikeTemperature) {
+                spike_counter().Increment();
+                _logger->debug("Sensor {} spike left out: {} *C {} %", reading.pin, reading.temperature[i], reading.humidity[i]);
+            }
+        }
+        health.has_last = true;
+        health.last_humidity = humidity;
+        health.last_temperature = temperature;
+        publish_measure(reading.topic, reading.derived, humidity, temperature);
+    }
+    _readings.erase(_readings.find(reading.topic));  // reading is gone
+}
+
+void DHT_Service::abort_read(const std::string& topic) noexcept {
+    const auto reading = _readings.find(topic);
+    if (reading == _readings.end())
+        return;
+    Loop().CancelTimer(reading->second.timer);
+    if (reading->second.on_line)
+        free_line(reading->second);
+    _readings.erase(reading);
+}
+
+void DHT_Service::publish_measure(const std::string& topic, unsigned derived, float humidity, float temperature) {
+    // quantities derived from the measure - configured per sensor (dew point by default)
+    static const struct {
+        Psychrometrics::Quantity quantity;
+        const char* name;
+        const char* unit;
+    } kDerived[] = {
+        {Psychrometrics::kDewPoint, "Dew-point", "°C"},
+        {Psychrometrics::kAbsoluteHumidity, "Absolute-humidity", "g/m³"},
+        {Psychrometrics::kHumidex, "Humidex", ""},
+        {Psychrometrics::kEnthalpy, "Enthalpy", "kJ/kg"},
+    };
+    float values[4] = {};
+    float* const outputs[4] = {&values[0], &values[1], &values[2], &values[3]};
+    Psychrometrics::Compute(derived, &temperature, &humidity, 1, outputs);
     // parse result into JSON string
-    // format (JSON): array [ dict {id_string : double }, dict {id_string : double } ]
-    // example [ { "temperature" : 21.3} , { "humidity" : 53 } ] */
+    // format (JSON): dict {id_string : array [ double, unit_string ] }
+    // example { "Temperature" : [ 21.3, "°C" ], "RH" : [ 53, "%" ] }
 
     struct json_object* j = json_object_new_object();
     //temperature
@@ -241,19 +524,19 @@ void DHT_Service::read_sensor(MyConfig &c)  noexcept {
         json_object_array_add(arr, json_object_new_string("%"));
         json_object_object_add(j, "RH", arr);
     }
-    //dew_point
-    {
+    for (size_t i = 0; i < sizeof(kDerived) / sizeof(kDerived[0]); ++i) {
+        if (!(derived & kDerived[i].quantity))
+            continue;
         struct json_object* arr = json_object_new_array();
-        json_object_array_add(arr, json_object_new_double(dew_point));
-        json_object_array_add(arr, json_object_new_string("°C"));
-        json_object_object_add(j, "Dew-point", arr);
+        json_object_array_add(arr, json_object_new_double(values[i]));
+        json_object_array_add(arr, json_object_new_string(kDerived[i].unit));
+        json_object_object_add(j, kDerived[i].name, arr);
     }
 
     //format JSON string
     std::string json_string = json_object_to_json_string(j);
-    Publish(c.name, json_string);  // send JSON message with our measures to MQTT broker
+    Publish(topic, json_string);  // send JSON message with our measures to MQTT broker
     json_object_put(j); //free the object - is this enough? TODO check memory consumption after few days running (basically it seems to be safe).
-    _logger->trace("Exit read_sensor");
 }
 
 
@@ -274,32 +557,41 @@ static void callback_rise_func(int pi __attribute__((unused)), unsigned user_gpi
     }
 }
 
-MyData T {};
+bool DHT_Service::pulse_line(Reading& reading) noexcept {
+    set_pull_up_down(_pigpio_handle, reading.pin, PI_PUD_OFF);
+    set_pull_up_down(_pigpio_handle, reading.pin, PI_PUD_DOWN);
+    set_noise_filter(_pigpio_handle, reading.pin, 0, 0);
+    // data of the read live in reading (map node) - callback may trigger in unpredictable time so it must not be on stack
+    reading.data.time = get_current_tick(_pigpio_handle);
+    reading.data.bit_counter = 0;
+    reading.data.bits = 0;
+    check_result(set_mode(_pigpio_handle, reading.pin, PI_OUTPUT));    // first of all send DHT pulse
+    check_result(gpio_write(_pigpio_handle, reading.pin, 0));          // write 0
+    reading.callback_id = callback_ex(_pigpio_handle, reading.pin, EITHER_EDGE, callback_rise_func, &reading.data);
+    return reading.callback_id >= 0;
+}
 
-int DHT_Service::read_sensor_data(int id, float& humidity, float& temperature)  noexcept {
-    // T moved to global context, because making it in function context might cause some stack memory access problems as we proveide it to interruption handler that may trigger itself in unpredictable time, even after we exit the function.
-    T.time = get_current_tick(_pigpio_handle);
-    T.bit_counter = 0;
-    T.bits = 0;
-    decltype(std::chrono::steady_clock::now()) begin;
+bool DHT_Service::release_line(Reading& reading) noexcept {
+    check_result(gpio_write(_pigpio_handle, reading.pin, 1));          // write 1
+    check_result(set_mode(_pigpio_handle, reading.pin, PI_INPUT));     // set it to read mode (let DHT communicate)
+    return true;
+}
 
-    check_result(set_mode(_pigpio_handle, id, PI_OUTPUT));    // first of all send DHT pulse
-    check_result(gpio_write(_pigpio_handle, id, 0));          // write 0
-    begin = std::chrono::steady_clock::now();
-    int callback_id = callback_ex(_pigpio_handle, id, EITHER_EDGE, callback_rise_func, &T);
-    time_sleep(0.018);                                        // wait at least 1ms (we wait ~18ms)
-    check_result(gpio_write(_pigpio_handle, id, 1));          // write 1
-    check_result(set_mode(_pigpio_handle, id, PI_INPUT));     // set it to read mode (let DHT communicate)
-    for (uint64_t time_dif = 0; time_dif < 8000; ) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10)); // let it communicate some time it may actually get woke up sooner so we control time if it's at least ~8ms
-        auto now = std::chrono::steady_clock::now();
-        time_dif = (now - begin).count();
+void DHT_Service::free_line(Reading& reading) noexcept {
+    if (reading.callback_id >= 0) {
+        callback_cancel(reading.callback_id);
+        reading.callback_id = -1;
     }
-    callback_cancel(callback_id);
+}
 
+DhtResult DHT_Service::read_capture(Reading& reading, float& humidity, float& temperature) noexcept {
+    free_line(reading);  // no more edges
+    MyData& T = reading.data;
+    if (!T.bit_counter)
+        return DhtResult::kNoResponse;
     if (T.bit_counter < 40) {
         _logger->trace("Error - not enough bits providied by sensor!");
-        return -2;
+        return DhtResult::kMissingBits;
     }
 
     // now process bits sensor provided us; well bit work could be much more... simple but this is enough I guess...
@@ -317,13 +609,13 @@ int DHT_Service::read_sensor_data(int id, float& humidity, float& temperature)
 
     if (data[4] != ((data[0] + data[1] + data[2] + data[3]) & 0xFF)) {
         _logger->trace("Data CRC failed");
-        return -1;
+        return DhtResult::kChecksum;
     } else {
         humidity = (((uint16_t) data[0]) << 8 | data[1]) / 10.f;
         temperature = ((((uint16_t)(data[2] & 0x7F)) << 8) | data[3]) / 10.f;
         if (data[2] & 0x80) temperature = -temperature;
         _logger->debug("Humidity = {}% | Temperature = {} *C", humidity, temperature );
-        return 0;
+        return DhtResult::kOk;
     }
 }
 
@@ -352,14 +644,93 @@ DHT_Service::~DHT_Service() noexcept {
         _pigpio_handle = -1;
     }
 }
-#else /* gpioxx */
+#elif defined GPIO_V2_GET_LINE_IOCTL /* gpioxx - line events */
 
-int DHT_Service::read_sensor_data(int id, float& humidity, float& temperature) noexcept {
+// Line is released to input with edge events right after the start pulse - kernel timestamps edges in the interrupt and buffers
+// them, so the daemon is idle through the frame and reads all of it at once (exact even under load, no busy polling).
+bool DHT_Service::pulse_line(Reading& reading) noexcept {
+    try {
+        _chip->drive(reading.pin, false);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    return true;
+}
+
+bool DHT_Service::release_line(Reading& reading) noexcept {
+    try {
+        _chip->watch_edges(reading.pin, gpiocxx::event_clock::HARDWARE);  // releases the line - pull-up ends the start pulse
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    return true;
+}
+
+void DHT_Service::free_line(Reading& reading) noexcept {
+    try {
+        _chip->reset(reading.pin);   // free resources including kernel ones... (pull-up keeps the line high)
+    } catch (const std::runtime_error&) {
+    }
+}
+
+DhtResult DHT_Service::read_capture(Reading& reading, float& humidity, float& temperature) noexcept {
+    _events.clear();
+    _edges.clear();
+    try {
+        const struct timespec no_wait = {0, 0};  // frame is over - kernel has buffered its edges
+        _chip->read_edges(reading.pin, _events, &no_wait);
+    } catch (const std::runtime_error&) {
+        return DhtResult::kNoResponse;
+    }
+    for (const auto& event : _events)
+        _edges.push_back(DhtEdge{event.timestamp_ns, event.rising});
+    unsigned bits = 0;
+    const DhtResult result = DhtDecoder::Decode(_edges, humidity, temperature, bits);
+    switch (result) {
+        case DhtResult::kOk:
+            _logger->debug("Humidity = {}% | Temperature = {} *C", humidity, temperature);
+            break;
+        case DhtResult::kNoResponse:
+            _logger->debug("No pulse from DHT detected");
+            break;
+        case DhtResult::kMissingBits:
+            _logger->debug("Got less than 40 bits from sensor! {} ({} edges)", bits, _edges.size());
+            break;
+        default:
+            _logger->debug("Data CRC failed");
+            break;
+    }
+    return result;
+}
+
+DHT_Service::~DHT_Service() noexcept {
+    _logger->debug("~DHT_Service()");
+}
+#else /* gpioxx - polling (kernel headers without GPIO v2 uAPI) */
+
+// polling reader sends the pulse itself and samples the line in busy loop - whole read is done by read_capture
+
+bool DHT_Service::pulse_line(Reading&) noexcept {
+    return true;
+}
+
+bool DHT_Service::release_line(Reading&) noexcept {
+    return true;
+}
+
+void DHT_Service::free_line(Reading&) noexcept {
+}
+
+DhtResult DHT_Service::read_capture(Reading& reading, float& humidity, float& temperature) noexcept {
+    return read_sensor_data(reading.pin, humidity, temperature);
+}
+
+DhtResult DHT_Service::read_sensor_data(int id, float& humidity, float& temperature) noexcept {
     std::vector<std::pair<decltype(std::chrono::steady_clock::now()), decltype(_chip->get_value(id))>> pairs;
     static constexpr decltype(std::chrono::steady_clock::now().time_since_epoch().count()) kMaxTime = 200 + 40 * 130 + 500; // start (200ms) + 40 (ms) * 1-bit (130ms) + reserve (500ms)
 
     _chip->set_value(id, 0);
-    std::this_thread::sleep_for(std::chrono::milliseconds(18));
+    std::this_thread::sleep_for(kStartPulse);
     const auto begin = std::chrono::steady_clock::now();
     pairs.reserve(1500);
     pairs.emplace_back(begin, true);
@@ -411,7 +782,7 @@ int DHT_Service::read_sensor_data(int id, float& humidity, float& temperature) n
     if (!edges.size()) {
         _logger->debug("No pulse from DHT detected");  // this may happen if system is under heavy load... if your system is under heavy load all the time this daemon may not work at all 
                                                        // so you might need to set higher priority (nice) or if your kernel support real-time sheduling you might set it's rt priority temporary...
-        return -1;
+        return DhtResult::kNoResponse;
     }
     auto last_edge_time = *edges.begin();
     for (auto&& edge : edges) {
@@ -435,7 +806,7 @@ int DHT_Service::read_sensor_data(int id, float& humidity, float& temperature) n
     }
     if (bit_counter < 40) {
         _logger->debug("Got less than 40 bits from sensor! {}", bit_counter);
-        return -1;
+        return DhtResult::kMissingBits;
     }
     _logger->debug("Got {} bits", bit_counter);
     // now process bits sensor provided us; well bit work could be much more... simple but this is enough I guess...
@@ -453,13 +824,13 @@ int DHT_Service::read_sensor_data(int id, float& humidity, float& temperature) n
 
     if (data[4] != ((data[0] + data[1] + data[2] + data[3]) & 0xFF)) {
         _logger->debug("Data CRC failed");
-        return -1;
+        return DhtResult::kChecksum;
     } else {
         humidity = (((uint16_t) data[0]) << 8 | data[1]) / 10.f;
         temperature = ((((uint16_t)(data[2] & 0x7F)) << 8) | data[3]) / 10.f;
         if (data[2] & 0x80) temperature = -temperature;
         _logger->debug("Humidity = {}% | Temperature = {} *C", humidity, temperature );
-        return 0;
+        return DhtResult::kOk;
     }
 }
 
@@ -470,7 +841,7 @@ DHT_Service::~DHT_Service() noexcept {
 
 int main() {
     try {
-        DHT_Service d;  //explicit destruction on signal is possible but it does not delete pointer now...!
+        DHT_Service d;
         d.main();
     } catch (const std::runtime_error& error) {
         return -1;
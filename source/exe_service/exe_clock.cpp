@@ -0,0 +1,45 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+
+#include "exe_clock.h"
+
+std::atomic<bool> ExeClock::_virtual(false);
+std::atomic<int64_t> ExeClock::_virtual_now(0);
+int64_t ExeClock::_virtual_start = 0;
+std::chrono::steady_clock::time_point ExeClock::_steady_start;
+
+std::chrono::system_clock::time_point ExeClock::Now() noexcept {
+    if (!IsVirtual())
+        return std::chrono::system_clock::now();
+    return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::nanoseconds(_virtual_now.load(std::memory_order_acquire))));
+}
+
+std::chrono::steady_clock::time_point ExeClock::SteadyNow() noexcept {
+    if (!IsVirtual())
+        return std::chrono::steady_clock::now();
+    return _steady_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::nanoseconds(_virtual_now.load(std::memory_order_acquire) - _virtual_start));
+}
+
+void ExeClock::SetVirtual(std::chrono::system_clock::time_point now) noexcept {
+    const int64_t since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    if (!IsVirtual()) {
+        _virtual_start = since_epoch;
+        _steady_start = std::chrono::steady_clock::now();
+        _virtual_now.store(since_epoch, std::memory_order_release);
+        _virtual.store(true, std::memory_order_release);
+        return;
+    }
+    _virtual_now.store(since_epoch, std::memory_order_release);
+}
+
+time_t mq_exe_time() {
+    return std::chrono::system_clock::to_time_t(ExeClock::Now());
+}
@@ -0,0 +1,32 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// ExeClock is the time scripts see - time waits, os.time/os.date, request_stats windows and rule timers. It is the system
+// clock unless simulation (mq_exe_daemon --simulate) switched it to virtual time; virtual time moves only by SetVirtual.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+class ExeClock {
+ public:
+    static std::chrono::system_clock::time_point Now() noexcept;
+    static std::chrono::steady_clock::time_point SteadyNow() noexcept;  // steady time - follows virtual time in simulation
+    static void SetVirtual(std::chrono::system_clock::time_point now) noexcept;  // first call switches to virtual time for good
+    static bool IsVirtual() noexcept { return _virtual.load(std::memory_order_acquire); }
+
+ private:
+    static std::atomic<bool> _virtual;
+    static std::atomic<int64_t> _virtual_now;  // ns since epoch
+    static int64_t _virtual_start;  // ns since epoch of first SetVirtual
+    static std::chrono::steady_clock::time_point _steady_start;  // steady time of first SetVirtual
+};
+
+time_t mq_exe_time();  // ExeClock::Now() for mq_loslib (os.time, os.date)
@@ -0,0 +1,162 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Simulation mode (mq_exe_daemon --simulate) - scripts and rules of a db run on virtual time (ExeClock) in the calling thread.
+// Time jumps to the next event (capture message, time wait, rule timer) so a week of automation runs in seconds, and as
+// nothing runs concurrently every run gives the same output - each published message with its virtual time. Scripts are not
+// preempted in simulation; only CPU limit kills depend on the host (measured CPU time) - they are reported at the end.
+
+#include "mq_exe_daemon.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t kMaxLoopback = 10000;  // status messages scripts publish in reaction to one event (script echo loop guard)
+
+struct CaptureMessage {
+    uint64_t offset;  // us since capture start
+    std::string topic;
+    std::string payload;
+};
+
+// mq_replay_bench capture - "<offset us> <topic> <payload bytes>\n<payload>\n" per message (record or generate it there)
+bool read_capture_message(std::istream& input, CaptureMessage& message) {
+    size_t size = 0;
+    if (!(input >> message.offset >> message.topic >> size))
+        return false;
+    input.get();  // '\n'
+    message.payload.resize(size);
+    input.read(&message.payload[0], size);
+    input.get();
+    return static_cast<bool>(input);
+}
+
+std::string format_time(std::chrono::system_clock::time_point time) {
+    const time_t seconds = std::chrono::system_clock::to_time_t(time);
+    struct tm tm;
+    ::localtime_r(&seconds, &tm);
+    char text[32];
+    const size_t length = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+    const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+    snprintf(text + length, sizeof(text) - length, ".%03d", static_cast<int>(milliseconds));
+    return text;
+}
+
+}  // namespace
+
+void Exe_Service::publish(const std::string& topic, const std::string& message) {
+    if (!_simulation) {
+        Publish(topic, message);
+        return;
+    }
+    std::fprintf(_simulation->output, "%s %s %s\n", format_time(ExeClock::Now()).c_str(), topic.c_str(), message.c_str());
+    ++_simulation->published;
+    if (!topic.compare(0, 7, "status/"))
+        _simulation->loopback.emplace_back(topic, message);
+}
+
+// loop that has stopped (daemon terminates during reload) refuses the post - callback runs inline then, the loop thread
+// waits for the reload in ~Exe_Service so nothing runs concurrently
+void Exe_Service::in_loop(MQ_System::EventLoop::Callback callback) {
+    if (_simulation || !Loop().Post(callback))
+        callback();
+}
+
+void Exe_Service::run_ready_scripts() {
+    std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+    while (!_ready_scripts.empty()) {
+        Script* script = _ready_scripts.front();
+        _ready_scripts.pop_front();
+        ++_simulation->resumes;
+        run_script(script, scheduler_lock);
+    }
+}
+
+int Exe_Service::simulate(const std::string& db_uri, const std::string& capture, std::chrono::system_clock::time_point start, std::chrono::seconds duration, std::FILE* output) {
+    _logger->info("Simulation of {} from {}", db_uri, format_time(start));
+    std::string configured_db;  // limits and state sharing are taken from configuration, scripts from the simulated db
+    load_daemon_configuration(configured_db, _lua_shared_states, _lua_pool_allocator, _globals_flush_interval, _script_limits);
+    _db_uri = db_uri;
+    open_database();
+    load_globals();  // scripts see stored globals - their changes are not written back
+    std::vector<CaptureMessage> messages;
+    if (!capture.empty()) {
+        std::ifstream input(capture, std::ios::binary);
+        if (!input) {
+            _logger->error("Simulation: unable to open capture {}", capture);
+            throw std::runtime_error("");
+        }
+        CaptureMessage message;
+        while (read_capture_message(input, message))
+            messages.push_back(message);
+        std::stable_sort(messages.begin(), messages.end(), [](const CaptureMessage& first, const CaptureMessage& second) { return first.offset < second.offset; });
+    }
+    const auto end = duration.count() > 0 ? start + duration : start + std::chrono::microseconds(messages.empty() ? 0 : messages.back().offset);
+
+    ExeClock::SetVirtual(start);
+    _simulation.reset(new Simulation{output, std::unique_ptr<MQ_System::TimerWheel>(new MQ_System::TimerWheel(std::chrono::milliseconds(10),
+        ExeClock::SteadyNow(), &ExeClock::SteadyNow)), {}, 0, 0, 0});
+    const auto wall_start = std::chrono::steady_clock::now();
+    create_shared_states();
+    start_all();
+    const size_t script_count = _scripts.size();
+    run_ready_scripts();
+    auto deliver = [this](const std::string& topic, const std::string& payload) {
+        if (!topic.compare(0, 7, "status/"))
+            parse_status_message(topic, payload);  // app topics (reload) are not simulated
+    };
+    size_t next_message = 0;
+    while (true) {
+        auto now = end;
+        if (next_message < messages.size())
+            now = std::min(now, start + std::chrono::microseconds(messages[next_message].offset));
+        {
+            std::unique_lock<std::mutex> time_lock(_time_mutex);
+            if (!_time_wait_map.empty())
+                now = std::min(now, _time_wait_map.begin()->first);
+        }
+        const auto timer = _simulation->wheel->NextExpiry();
+        if (timer != MQ_System::TimerWheel::Clock::time_point::max())
+            now = std::min(now, ExeClock::Now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(timer - ExeClock::SteadyNow()));
+        now = std::max(now, ExeClock::Now());  // time does not go back (waits already due fire now)
+        ExeClock::SetVirtual(now);
+        _simulation->wheel->Advance(ExeClock::SteadyNow());
+        fire_time_waits();
+        for (; next_message < messages.size() && start + std::chrono::microseconds(messages[next_message].offset) <= now; ++next_message)
+            deliver(messages[next_message].topic, messages[next_message].payload);
+        run_ready_scripts();
+        for (size_t looped = 0; !_simulation->loopback.empty(); ++looped) {
+            if (looped == kMaxLoopback) {
+                _logger->warn("Simulation: scripts keep reporting status at {} - dropping {} messages", format_time(now), _simulation->loopback.size());
+                _simulation->loopback.clear();
+                break;
+            }
+            const auto message = std::move(_simulation->loopback.front());
+            _simulation->loopback.pop_front();
+            deliver(message.first, message.second);
+            run_ready_scripts();
+        }
+        if (now >= end)
+            break;
+    }
+    std::fflush(output);
+
+    const double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    const double days = std::chrono::duration<double>(end - start).count() / 86400.0;
+    std::fprintf(stderr, "simulated %.2f days of %zu scripts in %.3f s - %.0f script-days/s (%zu messages, %llu resumes, %llu published)\n",
+        days, script_count, wall_seconds, wall_seconds > 0.0 ? days * script_count / wall_seconds : 0.0, messages.size(),
+        static_cast<unsigned long long>(_simulation->resumes), static_cast<unsigned long long>(_simulation->published));
+    if (_simulation->cpu_kills)
+        std::fprintf(stderr, "%llu scripts killed by CPU limit - output is not deterministic (depends on host CPU time)\n",
+            static_cast<unsigned long long>(_simulation->cpu_kills));
+    _logger->info("Simulation finished - {:.2f} days of {} scripts in {:.3f} s", days, script_count, wall_seconds);
+    return 0;
+}
@@ -0,0 +1,119 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+
+#include "lua_allocator.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "metrics.h"
+
+constexpr size_t LuaAllocator::kGranularity;
+constexpr size_t LuaAllocator::kMaxPooled;
+constexpr size_t LuaAllocator::kClasses;
+constexpr size_t LuaAllocator::kChunkSize;
+constexpr int64_t LuaAllocator::kReportThreshold;
+
+namespace {
+
+MQ_System::Gauge& lua_memory() {
+    static MQ_System::Gauge& gauge = MQ_System::Metrics::Instance().GetGauge("mq_lua_memory_bytes", "Memory used by Lua states");
+    return gauge;
+}
+
+}  // namespace
+
+LuaAllocator::LuaAllocator(bool pooled, size_t limit) noexcept : _pooled(pooled), _free(), _chunk_position(nullptr), _chunk_left(0), _allocated(0), _unreported(0), _limit(limit) {}
+
+LuaAllocator::~LuaAllocator() noexcept {
+    lua_memory().Add(-(static_cast<int64_t>(Allocated()) - _unreported));  // remove reported part
+    for (auto chunk : _chunks)
+        std::free(chunk);
+}
+
+void LuaAllocator::account(int64_t bytes) noexcept {
+    _allocated.store(Allocated() + bytes, std::memory_order_relaxed);
+    _unreported += bytes;
+    if (_unreported >= kReportThreshold || _unreported <= -kReportThreshold) {
+        lua_memory().Add(_unreported);
+        _unreported = 0;
+    }
+}
+
+void* LuaAllocator::allocate(size_t size) noexcept {
+    if (!_pooled || size > kMaxPooled)
+        return std::malloc(size);
+    const auto index = size_class(size);
+    if (_free[index] != nullptr) {
+        FreeBlock* block = _free[index];
+        _free[index] = block->next;
+        return block;
+    }
+    const size_t block_size = (index + 1) * kGranularity;
+    if (_chunk_left < block_size) {  // rest of the chunk is left unused (less than 256 B)
+        void* chunk = std::malloc(kChunkSize);
+        if (chunk == nullptr)
+            return nullptr;
+        try {
+            _chunks.push_back(chunk);
+        } catch (...) {
+            std::free(chunk);
+            return nullptr;
+        }
+        _chunk_position = static_cast<char*>(chunk);
+        _chunk_left = kChunkSize;
+    }
+    void* block = _chunk_position;
+    _chunk_position += block_size;
+    _chunk_left -= block_size;
+    return block;
+}
+
+void LuaAllocator::release(void* block, size_t size) noexcept {
+    if (!_pooled || size > kMaxPooled) {
+        std::free(block);
+        return;
+    }
+    const auto index = size_class(size);
+    FreeBlock* free_block = static_cast<FreeBlock*>(block);
+    free_block->next = _free[index];
+    _free[index] = free_block;
+}
+
+void* LuaAllocator::reallocate(void* block, size_t old_size, size_t new_size) noexcept {
+    if (!_pooled || (old_size > kMaxPooled && new_size > kMaxPooled))
+        return std::realloc(block, new_size);
+    if (old_size <= kMaxPooled && new_size <= kMaxPooled && size_class(old_size) == size_class(new_size))
+        return block;
+    void* new_block = allocate(new_size);
+    if (new_block == nullptr)
+        return nullptr;  // Lua keeps the old block
+    std::memcpy(new_block, block, old_size < new_size ? old_size : new_size);
+    release(block, old_size);
+    return new_block;
+}
+
+// Lua passes real old size for existing blocks; for new blocks old_size is object type
+void* LuaAllocator::Allocate(void* allocator, void* block, size_t old_size, size_t new_size) noexcept {
+    LuaAllocator& self = *static_cast<LuaAllocator*>(allocator);
+    if (new_size == 0) {
+        if (block != nullptr) {
+            self.release(block, old_size);
+            self.account(-static_cast<int64_t>(old_size));
+        }
+        return nullptr;
+    }
+    const size_t current_size = block == nullptr ? 0 : old_size;
+    if (self._limit && new_size > current_size && self.Allocated() + (new_size - current_size) > self._limit)
+        return nullptr;  // Lua collects garbage and retries once, then raises memory error
+    void* result = block == nullptr ? self.allocate(new_size) : self.reallocate(block, old_size, new_size);
+    if (result != nullptr)
+        self.account(static_cast<int64_t>(new_size) - static_cast<int64_t>(current_size));
+    return result;
+}
@@ -0,0 +1,56 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// LuaAllocator is lua_Alloc of one Lua state with memory accounting (mq_lua_memory_bytes). Pooled variant serves small blocks
+// (most of Lua objects - strings, tables, closures) from per-state free lists carved from 64 KiB chunks, so it does not touch
+// malloc on hot paths; chunks are returned once the state is closed. State is single threaded so the allocator is as well.
+// Optional limit makes allocations fail once the state would use more - Lua raises memory error in the allocating script.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class LuaAllocator {
+ public:
+    LuaAllocator(bool pooled, size_t limit) noexcept;  // limit 0 - unlimited
+    ~LuaAllocator() noexcept;  // delete after lua_close
+    LuaAllocator(const LuaAllocator&) = delete;
+    LuaAllocator& operator=(const LuaAllocator&) = delete;
+
+    static void* Allocate(void* allocator, void* block, size_t old_size, size_t new_size) noexcept;  // lua_Alloc (ud is allocator)
+    size_t Allocated() const noexcept { return _allocated.load(std::memory_order_relaxed); }  // bytes Lua uses (without pool overhead)
+    void SetLimit(size_t limit) noexcept { _limit = limit; }  // call with the state locked
+
+ private:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxPooled = 256;
+    static constexpr size_t kClasses = kMaxPooled / kGranularity;
+    static constexpr size_t kChunkSize = 64 * 1024;
+    static constexpr int64_t kReportThreshold = 4 * 1024;  // gauge is updated in batches (it's shared by all states)
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    static size_t size_class(size_t size) noexcept { return (size - 1) / kGranularity; }
+
+    void* allocate(size_t size) noexcept;
+    void release(void* block, size_t size) noexcept;
+    void* reallocate(void* block, size_t old_size, size_t new_size) noexcept;
+    void account(int64_t bytes) noexcept;
+
+    const bool _pooled;
+    FreeBlock* _free[kClasses];
+    std::vector<void*> _chunks;
+    char* _chunk_position;
+    size_t _chunk_left;
+    std::atomic<size_t> _allocated;  // read by reporting thread
+    int64_t _unreported;
+    size_t _limit;
+};
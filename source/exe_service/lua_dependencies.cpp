@@ -0,0 +1,106 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Lua internals are used here - Lua is built from extern/lua-5.4.4 together with the daemon so the bytecode format matches.
+
+#include "lua_dependencies.h"
+
+#include <cstring>
+
+#include "lopcodes.h"
+#include "lstate.h"  // lobject.h & gco2ts
+
+namespace {
+
+bool string_constant(const Proto* proto, int index, std::string& value) {
+    if (index < 0 || index >= proto->sizek || !ttisstring(&proto->k[index]))
+        return false;
+    const TString* string = tsvalue(&proto->k[index]);
+    value.assign(getstr(string), tsslen(string));
+    return true;
+}
+
+bool environment_upvalue(const Proto* proto, int index) {
+    return index < proto->sizeupvalues && proto->upvalues[index].name != nullptr && !strcmp(getstr(proto->upvalues[index].name), "_ENV");
+}
+
+bool has_string_constant(const Proto* proto, const char* value) {
+    std::string constant;
+    for (int index = 0; index < proto->sizek; ++index)
+        if (string_constant(proto, index, constant) && constant == value)
+            return true;
+    return false;
+}
+
+std::string location(const Proto* proto) {
+    return proto->linedefined ? "function at line " + std::to_string(proto->linedefined) : std::string("main chunk");
+}
+
+// global access is GETTABUP _ENV "name"; functions with more than 255 constants access globals by GETUPVAL + GETFIELD/GETTABLE
+// instead - function name constant of a function without recognised call is rejected so such access is never missed
+// literal call is: GETTABUP Rf _ENV "function"; LOADK Rf+1 "p1"; ... LOADK Rf+n "pn"; CALL/TAILCALL Rf n+1
+bool scan_function(const Proto* proto, const char* function, std::vector<std::string>& parameters, std::string& error) {
+    bool called = false;
+    for (int pc = 0; pc < proto->sizecode; ++pc) {
+        const Instruction instruction = proto->code[pc];
+        std::string key;
+        if (GET_OPCODE(instruction) != OP_GETTABUP || !environment_upvalue(proto, GETARG_B(instruction)) ||
+                !string_constant(proto, GETARG_C(instruction), key) || key != function)
+            continue;
+        const int function_register = GETARG_A(instruction);
+        int next_register = function_register + 1;
+        std::vector<std::string> call_parameters;
+        int call = pc + 1;
+        for (; call < proto->sizecode; ++call) {
+            const Instruction load = proto->code[call];
+            const auto opcode = GET_OPCODE(load);
+            if ((opcode != OP_LOADK && opcode != OP_LOADKX) || GETARG_A(load) != next_register)
+                break;
+            int constant = GETARG_Bx(load);
+            if (opcode == OP_LOADKX) {
+                if (++call >= proto->sizecode)
+                    break;
+                constant = GETARG_Ax(proto->code[call]);
+            }
+            std::string parameter;
+            if (!string_constant(proto, constant, parameter))
+                break;
+            call_parameters.emplace_back(std::move(parameter));
+            ++next_register;
+        }
+        const Instruction call_instruction = call < proto->sizecode ? proto->code[call] : 0;
+        if (call >= proto->sizecode || (GET_OPCODE(call_instruction) != OP_CALL && GET_OPCODE(call_instruction) != OP_TAILCALL) ||
+                GETARG_A(call_instruction) != function_register || GETARG_B(call_instruction) != next_register - function_register) {
+            error = std::string(function) + " in " + location(proto) + " is not called with string literal parameters only";
+            return false;
+        }
+        parameters.insert(parameters.end(), call_parameters.begin(), call_parameters.end());
+        called = true;
+        pc = call;
+    }
+    if (!called && has_string_constant(proto, function)) {
+        error = std::string(function) + " in " + location(proto) + " is not called as global function with string literal parameters"
+            " (function with more than 255 constants?)";
+        return false;
+    }
+    for (int i = 0; i < proto->sizep; ++i)
+        if (!scan_function(proto->p[i], function, parameters, error))
+            return false;
+    return true;
+}
+
+}  // namespace
+
+bool lua_call_parameters(lua_State* state, const char* function, std::vector<std::string>& parameters, std::string& error) {
+    if (lua_type(state, -1) != LUA_TFUNCTION || lua_iscfunction(state, -1)) {
+        error = "not a Lua function";
+        return false;
+    }
+    const LClosure* closure = static_cast<const LClosure*>(lua_topointer(state, -1));  // GC object pointer of Lua closure
+    return scan_function(closure->p, function, parameters, error);
+}
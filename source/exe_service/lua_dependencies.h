@@ -0,0 +1,20 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Static dependency extraction of exe scripts - finds global function calls with string literal parameters in bytecode of
+// compiled chunk (and all its nested functions). Lua parser already dropped comments and strings so only real calls are seen.
+
+#include <string>
+#include <vector>
+
+#include "lua.h"
+
+// @function calls of the Lua function on top of @state stack; their literal parameters are appended to @parameters.
+// Returns false (with @error) if the function is used any other way (non-literal parameters, aliasing) - result would not be exact.
+bool lua_call_parameters(lua_State* state, const char* function, std::vector<std::string>& parameters, std::string& error);
@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2018-2019
-// Version: 13122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -9,12 +9,18 @@
 // File containing LUA bindings to exe module
 // to make it all working well lua should be built using C++ Othrewise there's risk of leaking some resources in the case of bugged scripts (we need support for exceptions).
 
-#include <regex>
+#include <algorithm>  // std::remove
+#include <cstdlib>  // strtod
+#include <cstring>  // memcmp
 #include <chrono>
 #include <ctime>
+#include <map>
 #include <stdexcept>
 
 #include "mq_exe_daemon.h"
+#include "lua_allocator.h"
+#include "lua_dependencies.h"
+#include "lua_serializer.h"
 
 // here defined functions
 int lua_debug_function(lua_State *l);
@@ -22,12 +28,22 @@ int lua_warn_function(lua_State *l);
 int lua_register_sensor(lua_State *l);
 int lua_wait_and(lua_State * l);
 int lua_wait_or(lua_State * l);
+int lua_wait_until(lua_State * l);
+int lua_wait_change(lua_State * l);
 int lua_req_value(lua_State * l);
+int lua_req_stats(lua_State * l);
 int lua_write_value(lua_State * l);
 int lua_report_value(lua_State * l);
+int lua_write_values(lua_State * l);
+int lua_report_values(lua_State * l);
 int lua_set_global(lua_State *l);
 int lua_get_global(lua_State *l);
-int lua_string_destructor(lua_State * l);
+void lua_instruction_hook(lua_State *l, lua_Debug *ar);
+
+// binding call counters (lua thread hot path - relaxed atomics only)
+MQ_System::Counter& lua_calls(const char* name) {
+    return MQ_System::Metrics::Instance().GetCounter(std::string("mq_lua_") + name + "_total", std::string("Lua ") + name + " calls");
+}
 
 // part of lua os-lib (mq_loslib.c)
 int os_difftime (lua_State *L);
@@ -35,18 +51,313 @@ int os_time (lua_State *L);
 int os_date (lua_State *L);
 int os_clock (lua_State *L);
 
-void Exe_Service::thread_start(lua_State *lua_state, const std::string& script_name) {
-    _logger->trace("Script {} started", script_name);
-    auto status = lua_pcall(lua_state, 0, LUA_MULTRET, 0);
-    if (status != LUA_OK)
-        _logger->info("Script {} terminated with error {}", script_name, lua_tostring(lua_state, -1));
+namespace {
+
+const char* const kValueMetatable = "mq_value";  // register_value userdata - value table id
+const char* const kEnvironmentMetatable = "mq_environment";  // shared state - metatable of script _ENV tables
+constexpr int kHookInstructions = 10000;  // instruction hook period (~100us of Lua code)
+constexpr std::chrono::milliseconds kPreemptSlice(10);  // script running longer yields so others are not delayed
+const char* const kCpuLimitKill = "CPU limit exceeded without wait";
+constexpr size_t kMaxStatsWindows = 4;  // request_stats spans kept per value
+constexpr std::chrono::seconds kMinStatsSpan(60);
+constexpr std::chrono::hours kMaxStatsSpan(24 * 31);
+
+MQ_System::Gauge& running_scripts() {
+    static MQ_System::Gauge& gauge = MQ_System::Metrics::Instance().GetGauge("mq_lua_running_scripts", "Lua scripts running");
+    return gauge;
+}
+
+MQ_System::Gauge& waiting_scripts() {
+    static MQ_System::Gauge& gauge = MQ_System::Metrics::Instance().GetGauge("mq_lua_waiting_scripts", "Lua scripts blocked in wait_and/wait_or");
+    return gauge;
+}
+
+// per-script (per-state) metrics - one metric per name as the registry has no labels
+std::string script_metric(const char* prefix, const std::string& name) {
+    std::string metric = prefix + name;
+    for (auto&& character : metric)
+        if (!((character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z') || (character >= '0' && character <= '9')))
+            character = '_';
+    return metric;
+}
+
+size_t state_memory(lua_State* state) noexcept {
+    void* allocator = nullptr;
+    lua_getallocf(state, &allocator);
+    return static_cast<const LuaAllocator*>(allocator)->Allocated();
+}
+
+std::chrono::nanoseconds thread_cpu_time() noexcept {
+    struct timespec time = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
+
+void push_packed_value(lua_State* l, uint64_t value) {
+    if (PackedValue::IsNil(value))
+        lua_pushnil(l);
+    else if (PackedValue::IsBoolean(value))
+        lua_pushboolean(l, static_cast<int>(PackedValue::ToBoolean(value)));
     else
-        _logger->info("Script {} sccessfully ended", script_name);
-    lua_close(lua_state);
+        lua_pushnumber(l, PackedValue::ToNumber(value));
+}
+
+}  // namespace
+
+void Exe_Service::start_workers() {
+    std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+    _terminate_workers = false;
+    _running_scripts = 0;
+    for (unsigned i = 0; i < kScriptWorkers; ++i)
+        _workers.emplace_back([this] { worker_loop(); });
+}
+
+void Exe_Service::stop_workers() {
+    {
+        std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+        _terminate_workers = true;
+    }
+    _ready_cv.notify_all();
+    for (auto&& worker : _workers)
+        worker.join();
+    _workers.clear();
+}
+
+void Exe_Service::hold_workers() {
+    std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+    _hold_workers = true;
+    _preempt_scripts = true;  // long running scripts would delay reload
+    _idle_cv.wait(scheduler_lock, [this] { return _running_scripts == 0; });
+}
+
+void Exe_Service::release_workers() {
+    {
+        std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+        _hold_workers = false;
+        _preempt_scripts = false;
+    }
+    _ready_cv.notify_all();
+}
+
+void Exe_Service::worker_loop() {
+    std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+    while (true) {
+        _ready_cv.wait(scheduler_lock, [this] { return _terminate_workers || (!_hold_workers && !_ready_scripts.empty()); });
+        if (_terminate_workers)
+            return;
+        Script* script = _ready_scripts.front();
+        _ready_scripts.pop_front();
+        run_script(script, scheduler_lock);
+    }
+}
+
+void Exe_Service::run_script(Script* script, std::unique_lock<std::mutex>& scheduler_lock) {
+    if (_terminate_lua_threads)
+        return;
+    script->running = true;
+    ++_running_scripts;
+    scheduler_lock.unlock();
+    const bool waiting = resume_script(*script);
+    scheduler_lock.lock();
+    script->running = false;
+    if (waiting && script->ready && !_terminate_lua_threads) {  // event fired before the script yielded
+        _ready_scripts.push_back(script);
+        _ready_cv.notify_one();
+    }
+    if (!--_running_scripts)
+        _idle_cv.notify_all();
+}
+
+// runs script till it waits, is preempted or ends; ended script state is closed at once
+bool Exe_Service::resume_script(Script& script) {
+    static MQ_System::Counter& script_errors = MQ_System::Metrics::Instance().GetCounter("mq_lua_script_errors_total", "Lua scripts terminated with error");
+    static MQ_System::Counter& scripts_killed = MQ_System::Metrics::Instance().GetCounter("mq_lua_scripts_killed_total", "Lua scripts killed for exceeding CPU or memory limit");
+    static MQ_System::Counter& preemptions = MQ_System::Metrics::Instance().GetCounter("mq_lua_preemptions_total", "Lua script resumes cut by preemption");
+    static MQ_System::Histogram& wait_time = MQ_System::Metrics::Instance().GetHistogram("mq_lua_wait_seconds", "Time Lua scripts spend in wait_and/wait_or");
+    static MQ_System::Histogram& resume_cpu = MQ_System::Metrics::Instance().GetHistogram("mq_lua_resume_cpu_seconds", "CPU time of one Lua script resume");
+    if (script.preempted)
+        script.preempted = false;
+    else if (script.wait_required) {
+        waiting_scripts().Add(-1);
+        wait_time.Record(std::chrono::steady_clock::now() - script.wait_start);
+        clear_waits(script);  // event sources do not see the script from now on
+        std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+        script.wait_required = 0;
+    } else
+        _logger->trace("Script {} started", script.name);
+    int results = 0;
+    std::unique_lock<std::mutex> shared_lock;
+    if (script.shared != nullptr)
+        shared_lock = std::unique_lock<std::mutex>(script.shared->mutex);
+    script.resume_cpu = thread_cpu_time();
+    script.resume_start = std::chrono::steady_clock::now();
+    const auto status = lua_resume(script.coroutine, nullptr, 0, &results);
+    const auto cpu = thread_cpu_time() - script.resume_cpu;
+    resume_cpu.Record(cpu);
+    const auto reported = std::chrono::duration_cast<std::chrono::microseconds>(script.cpu_time);
+    script.cpu_time += cpu;
+    script.cpu_counter->Increment(std::chrono::duration_cast<std::chrono::microseconds>(script.cpu_time - reported).count());  // no rounding loss over resumes
+    script.memory_gauge->Set(state_memory(script.state));
+    script.cpu_since_wait += cpu;
+    if (script.killed != nullptr) {  // hook yielded (pcall can't catch that) or raised error
+        if (script.wait_required) {  // error was caught and the script waits - event sources must not see closed script
+            clear_waits(script);
+            std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+            script.wait_required = 0;
+        }
+        if (!_terminate_lua_threads) {
+            scripts_killed.Increment();
+            _logger->warn("Script {} killed - {} (CPU {} ms since last wait)", script.name, script.killed,
+                std::chrono::duration_cast<std::chrono::milliseconds>(script.cpu_since_wait).count());
+            if (_simulation && script.killed == kCpuLimitKill)
+                ++_simulation->cpu_kills;
+        }
+    } else if (status == LUA_YIELD) {
+        lua_pop(script.coroutine, results);
+        if (script.preempted) {
+            preemptions.Increment();
+            return true;  // still ready - worker queues it behind others
+        }
+        if (script.wait_required) {
+            script.cpu_since_wait = std::chrono::nanoseconds(0);
+            waiting_scripts().Add(1);
+            return true;
+        }
+        _logger->warn("Script {} yielded outside of wait_and/wait_or - terminating it", script.name);
+    } else if (status == LUA_ERRMEM && _script_limits.memory) {
+        scripts_killed.Increment();
+        _logger->warn("Script {} killed - memory limit {} KiB exceeded", script.name, _script_limits.memory / 1024);
+    } else if (status != LUA_OK) {
+        script_errors.Increment();
+        _logger->info("Script {} terminated with error {}", script.name, lua_tostring(script.coroutine, -1));
+    } else
+        _logger->info("Script {} sccessfully ended", script.name);
+    _logger->debug("Script {} used {} ms of CPU", script.name, std::chrono::duration_cast<std::chrono::milliseconds>(script.cpu_time).count());
+    if (shared_lock.owns_lock())
+        shared_lock.unlock();
+    close_script(script);
+    return false;
+}
+
+void Exe_Service::close_script(Script& script) noexcept {
+    if (script.state == nullptr)
+        return;
+    if (script.wait_required)
+        waiting_scripts().Add(-1);
+    running_scripts().Add(-1);
+    release_sensors(script.values);
+    if (script.shared != nullptr) {  // coroutine and its _ENV are collected by shared state GC
+        std::unique_lock<std::mutex> shared_lock(script.shared->mutex);
+        lua_resetthread(script.coroutine);
+        luaL_unref(script.state, LUA_REGISTRYINDEX, script.reference);
+        --script.shared->scripts;
+        set_memory_limit(script.state, _script_limits.memory * (script.shared->scripts + 1));
+        script.memory_gauge->Set(state_memory(script.state));
+    } else {
+        close_lua_state(script.state);
+        script.memory_gauge->Set(0);
+    }
+    script.state = nullptr;
+    script.coroutine = nullptr;
+}
+
+// called with the event source (value slot, time map) locked; scheduler lock is taken only by the event completing the wait
+void Exe_Service::wake_script(Script* script) {
+    if (script->wait_events.fetch_add(1, std::memory_order_acq_rel) + 1 != script->wait_required)
+        return;
+    std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+    if (script->ready)
+        return;
+    script->ready = true;
+    if (!script->running) {
+        _ready_scripts.push_back(script);
+        _ready_cv.notify_one();
+    }
+}
+
+void Exe_Service::clear_waits(Script& script) {
+    if (!script.wait_ids.empty()) {
+        Values& values = *_value_table.load(std::memory_order_acquire);
+        for (const auto id : script.wait_ids) {
+            auto& slot = values[id];
+            std::unique_lock<std::mutex> slot_lock(slot.mutex);
+            slot.waiters.erase(std::remove(slot.waiters.begin(), slot.waiters.end(), &script), slot.waiters.end());
+            slot.conditions.erase(std::remove_if(slot.conditions.begin(), slot.conditions.end(),
+                [&script](const std::pair<Script*, ValueCondition>& condition) { return condition.first == &script; }), slot.conditions.end());
+        }
+        script.wait_ids.clear();
+    }
+    if (!script.wait_times.empty()) {
+        std::unique_lock<std::mutex> time_map_lock(_time_mutex);
+        for (const auto& time_point : script.wait_times) {
+            const auto range = _time_wait_map.equal_range(time_point);
+            for (auto it = range.first; it != range.second; ) {
+                if (it->second == nullptr || it->second == &script)
+                    it = _time_wait_map.erase(it);
+                else
+                    ++it;
+            }
+        }
+        script.wait_times.clear();
+    }
+}
+
+int string_writer(lua_State*, const void* data, size_t size, void* output) {
+    static_cast<std::string*>(output)->append(static_cast<const char*>(data), size);
+    return 0;
 }
 
-void Exe_Service::execute_lua_script(const std::string& script_name, const std::string& script_content) {
+// compiles script source to bytecode (with debug info so errors still report lines) and extracts its register_value dependencies
+bool Exe_Service::compile_script(CompiledScript& script) {
     auto lua_state = luaL_newstate();
+    bool compiled = false;
+    std::vector<std::string> parameters;
+    std::string error;
+    switch (luaL_loadbufferx(lua_state, script.source.c_str(), script.source.length(), script.name.c_str(), "t")) {
+        case LUA_OK:
+            if (!lua_call_parameters(lua_state, "register_value", parameters, error)) {
+                _logger->warn("Script {} - {} - not adding it (values are resolved before script starts)", script.name, error);
+                break;
+            }
+            script.values.clear();
+            for (const auto& parameter : parameters) {
+                if (!valid_value_name(parameter.data(), parameter.size())) {
+                    _logger->warn("Script {} - register_value parameter {} does not match sensor:value format - not adding it", script.name, parameter);
+                    script.values.clear();
+                    break;
+                }
+                const auto value_name = "status/" + parameter;
+                if (std::find(script.values.cbegin(), script.values.cend(), value_name) == script.values.cend())
+                    script.values.push_back(value_name);
+            }
+            if (script.values.size() == 0 && !parameters.empty())
+                break;
+            script.bytecode.clear();
+            compiled = !lua_dump(lua_state, string_writer, &script.bytecode, 0) && !script.bytecode.empty();
+            if (!compiled)
+                _logger->warn("Unable to dump LUA script {} bytecode", script.name);
+            break;
+        case LUA_ERRSYNTAX:
+            _logger->warn("Syntax error while loading LUA script {} : {}", script.name, lua_tostring(lua_state, -1));
+            break;
+        case LUA_ERRMEM:
+            _logger->warn("Memory allocation error while loading LUA script {} : {}", script.name, lua_tostring(lua_state, -1));
+            break;
+        default:
+            _logger->warn("Unexpected error while loading LUA script {} : {}", script.name, lua_tostring(lua_state, -1));
+            break;
+    }
+    lua_close(lua_state);
+    return compiled;
+}
+
+lua_State* Exe_Service::new_lua_state() {
+    auto allocator = new LuaAllocator(_lua_pool_allocator, _script_limits.memory);
+    auto lua_state = lua_newstate(LuaAllocator::Allocate, allocator);
+    if (lua_state == nullptr) {
+        delete allocator;
+        return nullptr;
+    }
     lua_pushlightuserdata(lua_state, this);
     lua_setglobal(lua_state, "___exe_object___");   // this one is used to pass the object to library functions
     static const luaL_Reg mq_procedures[] {
@@ -55,9 +366,14 @@ void Exe_Service::execute_lua_script(const std::string& script_name, const std::
         { "register_value", lua_register_sensor },
         { "wait_and", lua_wait_and },
         { "wait_or", lua_wait_or },
+        { "wait_until", lua_wait_until },
+        { "wait_change", lua_wait_change },
         { "request_value", lua_req_value },
+        { "request_stats", lua_req_stats },
         { "write_value", lua_write_value },
         { "report_value", lua_report_value },
+        { "write_values", lua_write_values },
+        { "report_values", lua_report_values },
         { "set_global", lua_set_global},
         { "get_global", lua_get_global},
         { "clock", os_clock },
@@ -67,17 +383,129 @@ void Exe_Service::execute_lua_script(const std::string& script_name, const std::
     };
     for (auto const& procedure : mq_procedures)     // register all functions - use rather setfuncs?
         lua_register(lua_state, procedure.name, procedure.func);
-    static const luaL_Reg sStrRegs[] {
-        { "__gc", lua_string_destructor },
-        {NULL, NULL}
-    };
-    luaL_newmetatable(lua_state, "std_string");
-    luaL_setfuncs(lua_state, sStrRegs, 0);
-    auto lua_load_result = luaL_loadbuffer(lua_state, script_content.c_str(), script_content.length(), script_name.c_str());
+    luaL_newmetatable(lua_state, kValueMetatable);
+    lua_pop(lua_state, 1);
+    return lua_state;
+}
+
+void Exe_Service::close_lua_state(lua_State* state) noexcept {
+    void* allocator = nullptr;
+    lua_getallocf(state, &allocator);
+    lua_close(state);
+    delete static_cast<LuaAllocator*>(allocator);
+}
+
+// shared state gets limit of all its scripts (and one more for its libraries)
+void Exe_Service::set_memory_limit(lua_State* state, size_t limit) noexcept {
+    void* allocator = nullptr;
+    lua_getallocf(state, &allocator);
+    static_cast<LuaAllocator*>(allocator)->SetLimit(limit);
+}
+
+size_t Exe_Service::lua_memory() const noexcept {
+    size_t memory = 0;
+    for (const auto& shared : _shared_states)
+        memory += state_memory(shared->state);
+    for (const auto& script : _scripts)
+        if (script.state != nullptr && script.shared == nullptr)
+            memory += state_memory(script.state);
+    return memory;
+}
+
+void Exe_Service::create_shared_states() {
+    for (unsigned i = 0; i < _lua_shared_states; ++i) {
+        std::unique_ptr<SharedState> shared(new SharedState());
+        shared->state = new_lua_state();
+        if (shared->state == nullptr) {
+            _logger->error("Unable to create shared Lua state");
+            throw std::runtime_error("");
+        }
+        shared->scripts = 0;
+        shared->memory_gauge = &MQ_System::Metrics::Instance().GetGauge(script_metric("mq_lua_shared_state_memory_bytes_", std::to_string(_shared_states.size())),
+            "Lua memory of shared state (all its scripts)");
+        lua_pushglobaltable(shared->state);  // metatable of script environments - globals are read through it
+        lua_createtable(shared->state, 0, 2);
+        lua_pushvalue(shared->state, -2);
+        lua_setfield(shared->state, -2, "__index");
+        lua_pushboolean(shared->state, 0);
+        lua_setfield(shared->state, -2, "__metatable");
+        lua_setfield(shared->state, LUA_REGISTRYINDEX, kEnvironmentMetatable);
+        lua_pop(shared->state, 1);
+        _shared_states.emplace_back(std::move(shared));
+    }
+    if (_lua_shared_states)
+        _logger->info("Scripts share {} Lua states", _lua_shared_states);
+}
+
+bool Exe_Service::execute_lua_script(const CompiledScript& compiled) {
+    const std::string& script_name = compiled.name;
+    SharedState* shared = nullptr;
+    for (auto&& candidate : _shared_states)  // least loaded one
+        if (shared == nullptr || candidate->scripts < shared->scripts)
+            shared = candidate.get();
+    std::unique_lock<std::mutex> shared_lock;
+    lua_State* lua_state = nullptr;
+    if (shared != nullptr) {
+        shared_lock = std::unique_lock<std::mutex>(shared->mutex);
+        lua_state = shared->state;
+    } else {
+        lua_state = new_lua_state();
+        if (lua_state == nullptr) {
+            _logger->warn("Unable to create Lua state for script {}", script_name);
+            return false;
+        }
+    }
+    auto lua_load_result = luaL_loadbufferx(lua_state, compiled.bytecode.data(), compiled.bytecode.size(), script_name.c_str(), "b");
+    if (lua_load_result != LUA_OK) {  // cache written by different Lua build
+        _logger->debug("Cached bytecode of LUA script {} rejected : {}", script_name, lua_tostring(lua_state, -1));
+        lua_pop(lua_state, 1);
+        lua_load_result = luaL_loadbufferx(lua_state, compiled.source.c_str(), compiled.source.length(), script_name.c_str(), "t");
+    }
     switch (lua_load_result) {
         case LUA_OK:
-            _script_threads.emplace_back([this, lua_state, script_name]{thread_start(lua_state, script_name);});
-            return;
+        {
+            if (shared != nullptr) {  // script globals go to its own _ENV (main chunk's first upvalue)
+                lua_newtable(lua_state);
+                lua_getfield(lua_state, LUA_REGISTRYINDEX, kEnvironmentMetatable);
+                lua_setmetatable(lua_state, -2);
+                lua_setupvalue(lua_state, -2, 1);
+            }
+            _scripts.emplace_back();
+            Script& script = _scripts.back();
+            script.name = script_name;
+            script.hash = compiled.hash;
+            script.values = compiled.values;
+            script.state = lua_state;
+            script.shared = shared;
+            script.coroutine = lua_newthread(lua_state);
+            *static_cast<Script**>(lua_getextraspace(script.coroutine)) = &script;  // wait() finds its script there
+            lua_sethook(script.coroutine, lua_instruction_hook, LUA_MASKCOUNT, kHookInstructions);
+            lua_pushvalue(lua_state, -2);
+            lua_xmove(lua_state, script.coroutine, 1);  // script main function
+            if (shared != nullptr) {
+                script.reference = luaL_ref(lua_state, LUA_REGISTRYINDEX);
+                lua_pop(lua_state, 1);
+                ++shared->scripts;
+                set_memory_limit(lua_state, _script_limits.memory * (shared->scripts + 1));
+            }
+            script.wait_required = 0;
+            script.wait_events = 0;
+            script.wait_value = PackedValue::kNil;
+            script.running = false;
+            script.ready = true;
+            script.cpu_time = std::chrono::nanoseconds(0);
+            script.cpu_since_wait = std::chrono::nanoseconds(0);
+            script.preempted = false;
+            script.killed = nullptr;
+            script.cpu_counter = &MQ_System::Metrics::Instance().GetCounter(script_metric("mq_lua_script_cpu_microseconds_", script_name), "CPU time of Lua script");
+            script.memory_gauge = shared != nullptr ? shared->memory_gauge :
+                &MQ_System::Metrics::Instance().GetGauge(script_metric("mq_lua_script_memory_bytes_", script_name), "Lua memory of script");
+            running_scripts().Add(1);
+            std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+            _ready_scripts.push_back(&script);
+            _ready_cv.notify_one();
+            return true;
+        }
         case LUA_ERRSYNTAX: 
             _logger->warn("Syntax error while loading LUA script {} : {}", script_name, lua_tostring(lua_state, -1));
             break;
@@ -88,7 +516,11 @@ void Exe_Service::execute_lua_script(const std::string& script_name, const std::
             _logger->warn("Unexpected error while loading LUA script {} : {}", script_name, lua_tostring(lua_state, -1));
             break;
     }
-    lua_close(lua_state);
+    if (shared != nullptr)
+        lua_pop(lua_state, 1);
+    else
+        close_lua_state(lua_state);
+    return false;
 }
 
 // ************** Lua library ********************************//
@@ -100,6 +532,34 @@ Exe_Service* get_exe_object(lua_State *l) {
     return exe_object;
 }
 
+void lua_instruction_hook(lua_State *l, lua_Debug *) {
+    get_exe_object(l)->script_hook(l);
+}
+
+// hook can yield only if no C function (without continuation) is on the coroutine stack - otherwise the script continues
+// and is preempted at a later hook; kill falls back to error there (pcall may catch it - the next hook kills again)
+void Exe_Service::script_hook(lua_State * l) {
+    Script& script = **static_cast<Script**>(lua_getextraspace(l));
+    if (_terminate_lua_threads)
+        script.killed = "daemon is stopping";
+    else if (_script_limits.cpu.count() && script.cpu_since_wait + (thread_cpu_time() - script.resume_cpu) > _script_limits.cpu)  // time descheduled does not count
+        script.killed = kCpuLimitKill;
+    if (script.killed != nullptr) {
+        if (lua_isyieldable(l)) {
+            lua_yield(l, 0);
+            return;
+        }
+        luaL_error(l, "script killed - %s", script.killed);
+    }
+    if (_simulation)
+        return;  // wall time slices would make order of script resumes differ run to run (nothing runs concurrently anyway)
+    const auto slice = std::chrono::steady_clock::now() - script.resume_start;
+    if ((slice > kPreemptSlice || _preempt_scripts.load(std::memory_order_relaxed)) && lua_isyieldable(l)) {
+        script.preempted = true;
+        lua_yield(l, 0);
+    }
+}
+
 int lua_debug_function(lua_State *l) {
     return get_exe_object(l)->print(l, false);
 }
@@ -130,34 +590,23 @@ int lua_register_sensor(lua_State *l) {
     return get_exe_object(l)->register_sensor(l);
 }
 
-int lua_string_destructor(lua_State * l)
-{
-    if (lua_isuserdata(l, 1)) {
-        std::string* str = reinterpret_cast<std::string*>(lua_touserdata(l,1));
-        str->std::string::~string();  // lua object is consturcted by pacemant constructor so we need to call only destructor!
-    } else {
-        luaL_error(l, "string destructor type error");
-    }
-    return 0;
-}
-
-
+// value reference is id in value table - all values were interned from script scan before the script started
 int Exe_Service::register_sensor(lua_State *l) {
-    static const std::regex txt_regex("(\\w|\\/)+\\:\\w+");
+    const Values& values = *_value_table.load(std::memory_order_acquire);
     int values_on_stack = 0;
     const int argc = lua_gettop(l);
     _logger->trace("[LUA] register_sensor enter arguments {}", argc);
     for (int i = 1; i <= argc; ++i) {
         if (lua_isstring(l, i)) {
             const std::string sensor_value_text{lua_tostring(l, i)};
-            if (std::regex_match(sensor_value_text, txt_regex)) {
-                void* user_data_p = lua_newuserdata(l, sizeof(std::string));
-                new(user_data_p) std::string{ std::move(std::string("status/") + sensor_value_text) };
-                luaL_setmetatable(l, "std_string");  // add destructor for GC
+            const auto id = values.Find(std::string("status/") + sensor_value_text);
+            if (id != Values::kInvalidValue) {
+                *static_cast<Values::ValueId*>(lua_newuserdata(l, sizeof(Values::ValueId))) = id;
+                luaL_setmetatable(l, kValueMetatable);
                 ++values_on_stack;
                 _logger->debug("[LUA] sensor registered {}", sensor_value_text);
             } else
-                luaL_error(l, "register_sensor: sensor name not in expected format %s", sensor_value_text);
+                luaL_error(l, "register_sensor: unknown sensor value %s (parameters have to be string literals in sensor:value format)", sensor_value_text.c_str());
         } else
             luaL_error (l, "register_sensor: unexpected input type %d (expecting string)", lua_type(l, i));
     }
@@ -165,337 +614,315 @@ int Exe_Service::register_sensor(lua_State *l) {
 }
 
 int lua_wait_and(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("wait");
+    calls.Increment();
     return get_exe_object(l)->wait(l, false);
 }
 
 int lua_wait_or(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("wait");
+    calls.Increment();
     return get_exe_object(l)->wait(l, true);
 }
 
-std::string trim(const std::string& str) {
-    const size_t first = str.find_first_not_of(' ');
-    if (std::string::npos == first)
-        return str;
-    return str.substr(first, str.find_last_not_of(' ') - first + 1);
+// scripts wait on the same time strings in loops - they are compiled once (dynamically built strings beyond the limit are not cached)
+std::chrono::system_clock::time_point Exe_Service::next_time(Script& script, const char* text, size_t length) {
+    static constexpr size_t kMaxCachedSchedules = 16;
+    for (auto&& cached : script.schedules)
+        if (cached.first.size() == length && !memcmp(cached.first.data(), text, length))
+            return cached.second.Next(ExeClock::Now());
+    auto schedule = TimeSchedule::Parse(text, length);
+    const auto next = schedule.Next(ExeClock::Now());
+    if (script.schedules.size() < kMaxCachedSchedules)
+        script.schedules.emplace_back(std::string(text, length), schedule);
+    return next;
 }
 
-int month_days(const int in_year, int month) {
-    switch (month) {
-        case 1: {  // resolve february problem
-            const int year = in_year + 1900;
-            if (( year % 4 == 0 && year % 100 != 0) || (year % 400 == 0))
-                return 29;
-            else
-                return 28;
+// registers script events and yields - worker resumes the script once they fire (see wake_script)
+int Exe_Service::wait(lua_State * l, bool _or) {
+    _logger->trace("[LUA] wait enter");
+    Script* script = *static_cast<Script**>(lua_getextraspace(l));
+    std::vector<Values::ValueId> value_list;
+    std::vector<std::chrono::system_clock::time_point> time_list;
+    const int argc = lua_gettop(l);
+    for (int i = 1; i <= argc; ++i) {
+        const auto value_id = static_cast<Values::ValueId*>(luaL_testudata(l, i, kValueMetatable));
+        if (value_id != nullptr)
+            value_list.push_back(*value_id);
+        else if (lua_isstring(l, i)) {
+            try {
+                size_t length = 0;
+                const char* time_string = lua_tolstring(l, i, &length);
+                time_list.emplace_back(next_time(*script, time_string, length));
+            } catch (const std::exception &e) {
+                luaL_error(l, "wait_and/or: - Error: %s", e.what());
+            }
+        } else
+            luaL_error(l, "wait_and/or: unexpected input type %d at %d", lua_type(l, i), i);
+    }
+    if (value_list.empty() && time_list.empty())
+        luaL_error (l, "wait_and/or: nothing to wait for!");
+    if (_terminate_lua_threads)
+        luaL_error (l, "Terminate thread internally requested");
+    if (script->killed != nullptr)
+        luaL_error(l, "script killed - %s", script->killed);  // pcall caught the kill - script must not wait anymore
+    {
+        std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+        script->wait_required = _or ? 1 : value_list.size() + time_list.size();
+        script->wait_events = 0;
+        script->ready = false;
+        script->wait_start = std::chrono::steady_clock::now();
+    }
+    script->wait_ids = std::move(value_list);
+    script->wait_times = std::move(time_list);
+    if (!script->wait_ids.empty()) {
+        Values& values = *_value_table.load(std::memory_order_acquire);
+        for (const auto id : script->wait_ids) {
+            auto& slot = values[id];
+            std::unique_lock<std::mutex> slot_lock(slot.mutex);
+            slot.waiters.push_back(script);
         }
-        case 0:
-        case 2:
-        case 4:
-        case 6:
-        case 7:
-        case 9:
-        case 11:
-            return 31;
-        default:
-            return 30;
     }
+    if (!script->wait_times.empty()) {
+        std::unique_lock<std::mutex> time_map_lock(_time_mutex);
+        for (const auto& time_point : script->wait_times)
+            _time_wait_map.emplace(time_point, script);
+        arm_time_timer();
+    }
+    _logger->trace("[LUA] wait - yield");
+    return lua_yield(l, 0);
 }
 
-long long string_value(const std::string& input_string, std::string& output_string) {
-    const auto string_value = trim(input_string);
-    size_t pos = 0;
-    const long long value = std::stoll(string_value, &pos);
-    output_string = std::move(trim(string_value.substr(pos)));
-    return value;
+int lua_wait_until(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("wait_until");
+    calls.Increment();
+    return get_exe_object(l)->wait_condition(l, false);
 }
 
-inline int mod (int a, int b, bool & underflow) {
-   int ret = a % b;
-   underflow = false;
-   if (ret < 0) {
-     ret += b;
-     underflow = true;
-   }
-   return ret;
+int lua_wait_change(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("wait_change");
+    calls.Increment();
+    return get_exe_object(l)->wait_condition(l, true);
 }
 
-void value_since_now(int value_requested, unsigned int modulo, int16_t current, int_fast8_t& result, bool& underflow) {
-    result = mod(value_requested - current, modulo, underflow);
+int lua_wait_condition_continue(lua_State * l, int, lua_KContext context) {
+    return get_exe_object(l)->wait_condition_result(l, static_cast<uint32_t>(context));
 }
 
-int_fast16_t parse_month(struct tm* tm, int_fast8_t req_monthday) {
-    int8_t additional_days = 0;
-    req_monthday = (req_monthday > 0) ? req_monthday : req_monthday + 1;  // days are [1-31] but negative numbers have differrent meaning
-    int_fast8_t current_day = tm->tm_mday;
-    int_fast8_t requested_day = (req_monthday > 0) ? req_monthday : month_days(tm->tm_year, tm->tm_mon) + req_monthday;
-    if (requested_day < 0 || requested_day > month_days(tm->tm_year, tm->tm_mon)) {  // current month does not have enough days
-        // we move one month forward - that one should definitely have enuff days because every second month have 31 days
-        additional_days = month_days(tm->tm_year, tm->tm_mon) - current_day + 1;
-        if (++tm->tm_mon > 11) {
-            tm->tm_mon = 0;
-            ++tm->tm_year;
-        }
-        if (requested_day < 0)
-            requested_day = month_days(tm->tm_year, tm->tm_mon) + req_monthday;
-        current_day = 1;
-    }
-    int_fast16_t days_since_now = requested_day - current_day;
-    if (days_since_now < 0)
-        days_since_now = days_since_now + month_days(tm->tm_year, tm->tm_mon);
-    days_since_now += additional_days;
-    return days_since_now;
-}
-
-// known bug is that in daylight saving time switch days it may not work well; because such days does not really have 24 hours. Thus we need to handle such days in a special way TODO.
-std::chrono::system_clock::time_point Exe_Service::parse_time_string(const std::string& time_string) {
-    static const std::regex regex_now("NOW [0-9]+ (second|minute|hour|day|week|month)");
-    static const std::regex regex_every("EVERY(( MONTHDAY -?[0-9]+)|( WEEKDAY [0-6]))?( DAYHOUR [0-9]+)?( HOURMINUTE [0-9]+)?( MINUTESECOND [0-9]+)?");
-
-    if (!std::regex_match(time_string, regex_now) && !std::regex_match(time_string, regex_every))
-        throw std::runtime_error("string does not match expected format!");
-    if (time_string.substr(0,3) == "NOW") {
-        const auto rel = trim(time_string.substr(3));
-        size_t numterm = 0;
-        const auto num = std::stoll(rel, &numterm);
-        if (!num)
-            throw std::runtime_error("NOW number of metric not defined or 0");
-        const auto metric = trim(rel.substr(numterm));
-        if (metric == "second") {
-             return std::chrono::system_clock::now() + std::chrono::seconds(num);
-        } else if (metric == "minute") {
-             return std::chrono::system_clock::now() + std::chrono::minutes(num);
-        } else if (metric == "hour") {
-             return std::chrono::system_clock::now() + std::chrono::hours(num);
-        } else if (metric == "day") {
-             return std::chrono::system_clock::now() + std::chrono::hours(24*num);
-        } else if (metric == "week") {
-             return std::chrono::system_clock::now() + std::chrono::hours(7*24*num);
-        } else if (metric == "month") {
-             return std::chrono::system_clock::now() + std::chrono::hours(30*24*num);
-        } else {
-             throw std::runtime_error(std::string("unexpected metric type: ") +  metric);
-        }
-    } else if (time_string.substr(0,5) == "EVERY") {
-        auto rel = trim(time_string.substr(5));
-        time_t tt;
-        ::time(&tt);
-        struct tm tm;
-        ::localtime_r(&tt, &tm);  // this one should be thread-safe so we use this one as we can guarantee theread safety without locks..
-        _logger->debug("Date now {}.{}.{} {}:{}:{}", tm.tm_mday, tm.tm_mon, 1900 + tm.tm_year, tm.tm_hour, tm.tm_min, tm.tm_sec);
-        long long req_monthday = 0, req_weekday = -1, req_dayhour = -1, req_hourminute = -1, req_minutesecond = -1;
-        if (rel.substr(0,8) == "MONTHDAY") {
-            const auto string_value = trim(rel.substr(8));
-            size_t pos = 0;
-            req_monthday = std::stoll(string_value, &pos);
-            rel = trim(string_value.substr(pos));  // update rel
-            if (!req_monthday || req_monthday > 31 || req_monthday < -31)
-                throw std::runtime_error(std::string("MONTHDAY must be in range [1...31] or [-1...-30] & it is:") + std::to_string(req_monthday));
-        } else if (rel.substr(0,7) == "WEEKDAY") {
-            _logger->debug("WEEKDAY");
-            req_weekday = string_value(rel.substr(7), rel);
-        }
-        if (rel.substr(0,7) == "DAYHOUR") {
-            req_dayhour = string_value(rel.substr(7), rel);
-        }
-        if (rel.substr(0,10) == "HOURMINUTE") {
-            req_hourminute = string_value(rel.substr(10), rel);
+// wait_until(value, operator, operand [, timeout]) - operator is <, <=, >, >=, == or ~=; returns at once if it holds already
+// wait_change(value [, delta] [, timeout]) - value differs from the current one (number by delta at least)
+// Condition is tested by the loop thread as values arrive so updates not satisfying it do not wake the script. Both return
+// true and the value satisfying the condition, or false and current value once timeout (time string as in wait_and) passes.
+int Exe_Service::wait_condition(lua_State * l, bool change) {
+    const char* const procedure = change ? "wait_change" : "wait_until";
+    _logger->trace("[LUA] {} enter", procedure);
+    Script* script = *static_cast<Script**>(lua_getextraspace(l));
+    const int argc = lua_gettop(l);
+    const auto value_id = static_cast<Values::ValueId*>(luaL_testudata(l, 1, kValueMetatable));
+    if (value_id == nullptr)
+        luaL_error(l, "%s: first argument has to be registered value", procedure);
+    ValueCondition condition = {ValueCondition::Kind::kChange, PackedValue::kNil, 0.0};
+    int timeout_index = 0;
+    if (change) {
+        int next = 2;
+        if (argc >= next && lua_type(l, next) == LUA_TNUMBER) {
+            condition.delta = lua_tonumber(l, next++);
+            if (!(condition.delta >= 0.0))
+                luaL_error(l, "wait_change: delta has to be non negative number");
         }
-        if (rel.substr(0,12) == "MINUTESECOND") {
-            req_minutesecond = string_value(rel.substr(12), rel);
+        if (argc >= next)
+            timeout_index = next++;
+        if (argc >= next)
+            luaL_error(l, "wait_change: wrong argument count! (1 to 3 expected got %d)", argc);
+    } else {
+        if (argc != 3 && argc != 4)
+            luaL_error(l, "wait_until: wrong argument count! (3 or 4 expected got %d)", argc);
+        const char* operation = lua_type(l, 2) == LUA_TSTRING ? lua_tostring(l, 2) : "";
+        static const std::pair<const char*, ValueCondition::Kind> operations[] = {
+            {"<", ValueCondition::Kind::kLess}, {"<=", ValueCondition::Kind::kLessEqual}, {">", ValueCondition::Kind::kGreater},
+            {">=", ValueCondition::Kind::kGreaterEqual}, {"==", ValueCondition::Kind::kEqual}, {"~=", ValueCondition::Kind::kNotEqual}
+        };
+        const auto found = std::find_if(std::begin(operations), std::end(operations),
+            [operation](const std::pair<const char*, ValueCondition::Kind>& candidate) { return !strcmp(candidate.first, operation); });
+        if (found == std::end(operations))
+            luaL_error(l, "wait_until: unknown operator \"%s\" (<, <=, >, >=, == or ~= expected)", operation);
+        condition.kind = found->second;
+        if (lua_type(l, 3) == LUA_TNUMBER)
+            condition.operand = PackedValue::Number(lua_tonumber(l, 3));
+        else if (lua_type(l, 3) == LUA_TBOOLEAN)
+            condition.operand = PackedValue::Boolean(lua_toboolean(l, 3));
+        else
+            luaL_error(l, "wait_until: unexpected operand type %d - bool & number are supported", lua_type(l, 3));
+        if (argc == 4)
+            timeout_index = 4;
+    }
+    std::chrono::system_clock::time_point timeout;
+    if (timeout_index) {
+        if (lua_type(l, timeout_index) != LUA_TSTRING)
+            luaL_error(l, "%s: timeout has to be time string", procedure);
+        try {
+            size_t length = 0;
+            const char* time_string = lua_tolstring(l, timeout_index, &length);
+            timeout = next_time(*script, time_string, length);
+        } catch (const std::exception &e) {
+            luaL_error(l, "%s: - Error: %s", procedure, e.what());
         }
-        _logger->debug("Requested month day {} week day {} - {}:{}:{}", req_monthday, req_weekday, req_dayhour, req_hourminute, req_minutesecond);
-        int_fast8_t result_minute_second = 0, result_hour_minute = 0, result_day_hour = 0;
-        int_fast16_t result_days = 0;
-        if (req_minutesecond == -1) {
-            if ((req_hourminute == -1) && (req_dayhour == -1) && (req_weekday == -1) && !req_monthday)
-                req_minutesecond = tm.tm_sec + 1;
-            else
-                req_minutesecond = 0;
+    }
+    if (_terminate_lua_threads)
+        luaL_error (l, "Terminate thread internally requested");
+    if (script->killed != nullptr)
+        luaL_error(l, "script killed - %s", script->killed);
+    auto& slot = (*_value_table.load(std::memory_order_acquire))[*value_id];
+    {  // value is tested under slot lock - update delivered meanwhile is either seen here or tests the registered condition
+        std::unique_lock<std::mutex> slot_lock(slot.mutex);
+        const uint64_t current = slot.value.load(std::memory_order_acquire);
+        if (change) {
+            condition.operand = current;
+        } else if (condition.Test(current)) {
+            lua_pushboolean(l, 1);
+            push_packed_value(l, current);
+            return 2;
         }
-        bool underflow = false;
-        value_since_now(req_minutesecond, 60, tm.tm_sec, result_minute_second, underflow);
-        _logger->debug("Current hourminute {} - underflow {}", tm.tm_min, underflow);
-        if (req_hourminute == -1) {
-            if ((req_dayhour == -1) && (req_weekday == -1) && !req_monthday)
-                req_hourminute = underflow ? tm.tm_min + 1 : tm.tm_min;
-            else
-                req_hourminute = underflow ? 59 : 0;
-        } else
-            if (underflow)
-                --req_hourminute;
-        value_since_now(req_hourminute, 60, tm.tm_min, result_hour_minute, underflow);
-        _logger->debug("Result hourminute {}, {}", result_hour_minute, underflow);
-        _logger->debug("Current dayhour {} - underflow {}", tm.tm_hour, underflow);
-        if (req_dayhour == -1) {
-            if ((req_weekday == -1) && !req_monthday)
-                req_dayhour = underflow ? tm.tm_hour + 1 : tm.tm_hour;
-            else
-                req_dayhour =  underflow ? 23 : 0;
-        } else
-             if (underflow)
-                --req_dayhour;
-        value_since_now(req_dayhour, 24, tm.tm_hour, result_day_hour, underflow);
-        _logger->debug("Result dayhour {}, {}", result_day_hour, underflow);
-        if (req_monthday != 0) {
-            if (underflow) req_monthday++;
-            result_days = parse_month(&tm, req_monthday);
-        } else if (req_weekday != -1) {
-            if (underflow) req_weekday++;
-            int8_t days = 0;
-            value_since_now(req_weekday, 7, tm.tm_wday, days, underflow);
-            result_days = days;
-        } else {
-            _logger->debug("Nor monthday nor weekday underflow {}", underflow);
-            //result_days = underflow ? 1 : 0;
+        {
+            std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+            script->wait_required = 1;
+            script->wait_events = 0;
+            script->ready = false;
+            script->wait_start = std::chrono::steady_clock::now();
         }
-        _logger->debug("waiting since now - days# {} time# {}:{}:{} ", result_days, result_day_hour, result_hour_minute, result_minute_second);
-        _logger->debug("Result wait day {} - {}:{}:{}",
-            result_days + ((tm.tm_hour + result_day_hour + ((tm.tm_min + result_hour_minute + ((tm.tm_sec + result_minute_second) / 60)) / 60)) / 24), 
-            (tm.tm_hour + result_day_hour + ((tm.tm_min + result_hour_minute + ((tm.tm_sec + result_minute_second) / 60)) / 60)) % 24, 
-            (tm.tm_min + result_hour_minute + ((tm.tm_sec + result_minute_second) / 60)) % 60, 
-            (tm.tm_sec + result_minute_second) % 60);
-
-        const auto now = std::chrono::system_clock::now();
-        const auto duration = now.time_since_epoch();
-        const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
-        const auto reminder = millis % 1000;  // fine tuning to reach ~ one second accuracy
-        return now + std::chrono::milliseconds(950 - reminder) + std::chrono::minutes(result_hour_minute) + std::chrono::seconds(result_minute_second) + std::chrono::hours(result_day_hour) + std::chrono::hours(24*result_days);
-    } else // this should never happen unless someone change the code
-        throw std::runtime_error("Unexpected program behavior - plese report it!");
+        script->wait_value.store(PackedValue::kNil, std::memory_order_relaxed);
+        script->wait_ids.assign(1, *value_id);
+        slot.conditions.emplace_back(script, condition);
+    }
+    if (timeout_index) {
+        script->wait_times.assign(1, timeout);
+        std::unique_lock<std::mutex> time_map_lock(_time_mutex);
+        _time_wait_map.emplace(timeout, script);
+        arm_time_timer();
+    }
+    _logger->trace("[LUA] {} - yield", procedure);
+    return lua_yieldk(l, 0, static_cast<lua_KContext>(*value_id), lua_wait_condition_continue);
 }
 
-int Exe_Service::wait(lua_State * l, bool _or) {
-    _logger->trace("[LUA] wait enter");
-    {
-        std::vector<std::string*> sensor_value_list;
-        std::vector<std::chrono::system_clock::time_point> time_list;
-        const int argc = lua_gettop(l);
-        for (int i = 1; i <= argc; ++i) {
-            if (lua_isuserdata(l, i))
-                sensor_value_list.emplace_back(reinterpret_cast<std::string*>(lua_touserdata(l,i)));
-            else if (lua_isstring(l, i)) {
-                try {
-                    time_list.emplace_back(parse_time_string(std::string(lua_tostring(l, i))));
-                } catch (const std::exception &e) {
-                    luaL_error(l, "wait_and/or: - Error: %s", e.what());
-                }
-            } else
-                luaL_error(l, "wait_and/or: unexpected input type %d at %d", lua_type(l, i), i);
-        }
-        if (sensor_value_list.empty() && time_list.empty())
-            luaL_error (l, "wait_and/or: nothing to wait for!");
-        {  // synchronization scope
-            struct SynchronizationObject sync_obj;  // sync_obj is temporary and controlled by this thread
-            if (!sensor_value_list.empty()) {
-                std::unique_lock<std::mutex> value_map_lock(_map_mutex);
-                for (const auto& sensor_value : sensor_value_list)
-                    _value_wait_map.emplace(*sensor_value, &sync_obj);
-            }
-            if (!time_list.empty()) {
-                std::unique_lock<std::mutex> time_map_lock(_time_mutex);
-                for (const auto& time_point : time_list)
-                    _time_wait_map.emplace(time_point, &sync_obj);
-            }
-            {
-                std::mutex mtx;
-                std::unique_lock<std::mutex> wait_lock(mtx);
-                _logger->trace("[LUA] wait - enter");
-                if (!_or) {  //wait and
-                    const size_t wait_and_val = sensor_value_list.size() + time_list.size();
-                    sync_obj.cond_var.wait(wait_lock, [&]() -> bool {
-                        return _terminate_lua_threads || sync_obj.num >= wait_and_val;
-                    });
-                } else  //wait or
-                    sync_obj.cond_var.wait(wait_lock, [&]() -> bool {
-                        return _terminate_lua_threads || sync_obj.num > 0;
-                    });
-                _logger->trace("[LUA] wait - wake");
-            }
-            if (!sensor_value_list.empty()) {
-                std::unique_lock<std::mutex> value_map_lock(_map_mutex);
-                for (const auto& sensor_value : sensor_value_list) {
-                    const auto range = _value_wait_map.equal_range(*sensor_value);
-                    for (auto it = range.first; it != range.second; ) {
-                        if (it->second == nullptr || it->second == &sync_obj)
-                            it = _value_wait_map.erase(it);
-                        else
-                            ++it;
-                    }
-                }
-            }
-            if (!time_list.empty()) {
-                std::unique_lock<std::mutex> time_map_lock(_time_mutex);
-                for (const auto& time_point : time_list) {
-                    const auto range = _time_wait_map.equal_range(time_point);
-                    for (auto it = range.first; it != range.second; ) {
-                        if (it->second == nullptr || it->second == &sync_obj)
-                            it = _time_wait_map.erase(it);
-                        else
-                            ++it;
-                    }
-                }
-            }
-        }
-    }
-    if (_terminate_lua_threads)
-        luaL_error (l, "Terminate thread internally requested");
-    _logger->trace("[LUA] wait exit");
-    return 0;
+int Exe_Service::wait_condition_result(lua_State * l, uint32_t id) {
+    const Script* script = *static_cast<Script**>(lua_getextraspace(l));
+    const uint64_t value = script->wait_value.load(std::memory_order_acquire);
+    lua_pushboolean(l, static_cast<int>(!PackedValue::IsNil(value)));
+    push_packed_value(l, PackedValue::IsNil(value) ? (*_value_table.load(std::memory_order_acquire))[id].value.load(std::memory_order_acquire) : value);
+    return 2;
 }
 
 int lua_req_value(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("request_value");
+    calls.Increment();
     return get_exe_object(l)->req_value(l);
 }
 
 int Exe_Service::req_value(lua_State * l) {
     const int argc = lua_gettop(l);
     _logger->trace("[LUA] req_value: enter arguments {}", argc);
-    std::vector<std::string*> sensor_value_list;
+    Values& values = *_value_table.load(std::memory_order_acquire);
+    for (int i = 1; i <= argc; ++i)
+        if (luaL_testudata(l, i, kValueMetatable) == nullptr)
+            luaL_error(l, "req_value: unexpected input type %d : %d", lua_type(l, i), i);
+    luaL_checkstack(l, argc, "req_value: too many values");
     for (int i = 1; i <= argc; ++i) {
-        if (lua_isuserdata(l, i)) {
-            sensor_value_list.push_back(reinterpret_cast<std::string*>(lua_touserdata(l,i)));
-        } else
-            luaL_error(l, "req_value: unexpected input type {} : {}", lua_type(l, i), i);
-    }
-    if (sensor_value_list.empty()) 
-        return 0;
-    {   // lock scope
-        std::unique_lock<std::mutex> value_map_lock(_value_mutex);
-        for (const auto& sensor_value : sensor_value_list) {
-            auto it = _last_val_double_map.find(*sensor_value);
-            if (it == _last_val_double_map.end()) {
-                auto b_it = _last_val_boolean_map.find(*sensor_value);
-                if (b_it == _last_val_boolean_map.end())
-                    lua_pushnil(l);
-                else
-                    lua_pushboolean(l, static_cast<int>(b_it->second));
-            } else {
-                lua_pushnumber(l, it->second);
+        push_packed_value(l, values[*static_cast<Values::ValueId*>(lua_touserdata(l, i))].value.load(std::memory_order_acquire));
+    }
+    return argc;
+}
+
+int lua_req_stats(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("request_stats");
+    calls.Increment();
+    return get_exe_object(l)->req_stats(l);
+}
+
+// request_stats(value, span) - value is register_value result or "path:value" some script registered, span "<n>s|m|h|d";
+// returns average, min, max and count of the value over last span (booleans count as 0 and 1; nil if nothing arrived).
+// Window of the span is created by its first request (seeded by current value) and then kept up to date as values arrive.
+int Exe_Service::req_stats(lua_State * l) {
+    const int argc = lua_gettop(l);
+    _logger->trace("[LUA] req_stats: enter arguments {}", argc);
+    if (argc != 2)
+        luaL_error(l, "request_stats: wrong argument count! (2 expected got %d)", argc);
+    Values& values = *_value_table.load(std::memory_order_acquire);
+    Values::ValueId id = Values::kInvalidValue;
+    const auto value_id = static_cast<Values::ValueId*>(luaL_testudata(l, 1, kValueMetatable));
+    if (value_id != nullptr)
+        id = *value_id;
+    else if (lua_type(l, 1) == LUA_TSTRING)
+        id = values.Find(std::string("status/") + lua_tostring(l, 1));
+    if (id == Values::kInvalidValue)
+        luaL_error(l, "request_stats: first argument has to be registered value");
+    size_t length = 0;
+    const char* span_text = lua_type(l, 2) == LUA_TSTRING ? lua_tolstring(l, 2, &length) : "";
+    char* end = nullptr;
+    const double count = std::strtod(span_text, &end);
+    const char* const units = "smhd";
+    static const long long unit_seconds[] = {1, 60, 3600, 86400};
+    const char* unit = end != span_text && end + 1 == span_text + length && *end ? std::strchr(units, *end) : nullptr;
+    if (unit == nullptr || !(count > 0.0))
+        luaL_error(l, "request_stats: wrong span \"%s\" (<number><s|m|h|d> expected)", span_text);
+    const std::chrono::milliseconds span(static_cast<long long>(count * unit_seconds[unit - units] * 1000.0));
+    if (span < kMinStatsSpan || span > kMaxStatsSpan)
+        luaL_error(l, "request_stats: span %s out of range (1m - 31d)", span_text);
+    RollingWindow::Stats stats;
+    {
+        auto& slot = values[id];
+        std::unique_lock<std::mutex> slot_lock(slot.mutex);
+        const auto now = ExeClock::SteadyNow();
+        auto window = std::find_if(slot.windows.begin(), slot.windows.end(), [span](const RollingWindow& candidate) { return candidate.Span() == span; });
+        if (window == slot.windows.end()) {
+            if (slot.windows.size() >= kMaxStatsWindows) {
+                slot_lock.unlock();
+                luaL_error(l, "request_stats: too many spans of one value (%d at most)", static_cast<int>(kMaxStatsWindows));
             }
+            slot.windows.emplace_back(span);
+            window = slot.windows.end() - 1;
+            const uint64_t value = slot.value.load(std::memory_order_acquire);
+            if (!PackedValue::IsNil(value))
+                window->Add(now, PackedValue::IsBoolean(value) ? (PackedValue::ToBoolean(value) ? 1.0 : 0.0) : PackedValue::ToNumber(value));
         }
+        stats = window->Get(now);
+    }
+    if (!stats.count) {
+        lua_pushnil(l);
+        lua_pushnil(l);
+        lua_pushnil(l);
+    } else {
+        lua_pushnumber(l, stats.sum / stats.count);
+        lua_pushnumber(l, stats.min);
+        lua_pushnumber(l, stats.max);
     }
-    return sensor_value_list.size();
+    lua_pushinteger(l, static_cast<lua_Integer>(stats.count));
+    return 4;
 }
 //
 int lua_write_value(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("write_value");
+    calls.Increment();
     return get_exe_object(l)->write_value(l, false);
 }
 
 int lua_report_value(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("report_value");
+    calls.Increment();
     return get_exe_object(l)->write_value(l, true);
 }
 
 int Exe_Service::write_value(lua_State * l, bool report) {
-    static const std::regex txt_regex("(\\w|\\/)+\\:\\w+");
     const int argc = lua_gettop(l);
     _logger->trace("[LUA] write_value enter arguments {}", argc);
     if (argc != 2)
         luaL_error(l, "write_value: wrong argument count! (2 expected got %d)", argc);
     if (!lua_isstring(l, 1))
         luaL_error(l, "write_value: wrong argument type of first argument - string expected!");
-    const std::string sensor_value_text { lua_tostring(l, 1) };
-    if (!std::regex_match(sensor_value_text, txt_regex))
+    size_t sensor_value_length = 0;
+    const char* sensor_value_string = lua_tolstring(l, 1, &sensor_value_length);
+    if (!valid_value_name(sensor_value_string, sensor_value_length))
         luaL_error(l, "write_value: wrong argument format of first argument - \"must be path/path/path:value\"!");
+    const std::string sensor_value_text { sensor_value_string, sensor_value_length };
     struct json_object* j_object = json_object_new_object();
     const auto sensor_value_separator_position = sensor_value_text.find(":");
     const auto sensor_name_short = sensor_value_text.substr(0, sensor_value_separator_position);
@@ -517,16 +944,73 @@ int Exe_Service::write_value(lua_State * l, bool report) {
     }();
     json_object_object_add(j_object, sensor_value.c_str(), j_value);
     const std::string json_string = json_object_to_json_string_ext(j_object, JSON_C_TO_STRING_PLAIN);
-    Publish(sensor_name, json_string);
+    publish(sensor_name, json_string);
     json_object_put(j_object);
     return 0;
 }
 
+int lua_write_values(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("write_values");
+    calls.Increment();
+    return get_exe_object(l)->write_values(l, false);
+}
+
+int lua_report_values(lua_State * l) {
+    static MQ_System::Counter& calls = lua_calls("report_values");
+    calls.Increment();
+    return get_exe_object(l)->write_values(l, true);
+}
+
+// write_values({["path:value"] = value, ...}) - values of one sensor go in one message, so the sensor daemon applies them
+// together (e.g. all UniPi relays in one I2C write). Whole table is checked first - on error nothing is written.
+int Exe_Service::write_values(lua_State * l, bool report) {
+    const char* const procedure = report ? "report_values" : "write_values";
+    const int argc = lua_gettop(l);
+    _logger->trace("[LUA] {} enter arguments {}", procedure, argc);
+    if (argc != 1)
+        luaL_error(l, "%s: wrong argument count! (1 expected got %d)", procedure, argc);
+    if (!lua_istable(l, 1))
+        luaL_error(l, "%s: wrong argument type - table {[\"path:value\"] = value} expected!", procedure);
+    for (lua_pushnil(l); lua_next(l, 1); lua_pop(l, 1)) {
+        size_t name_length = 0;
+        const char* name = lua_type(l, -2) == LUA_TSTRING ? lua_tolstring(l, -2, &name_length) : nullptr;  // no conversion - it would break lua_next
+        if (name == nullptr || !valid_value_name(name, name_length))
+            luaL_error(l, "%s: wrong key format - \"must be path/path/path:value\"!", procedure);
+        if (lua_type(l, -1) != LUA_TBOOLEAN && lua_type(l, -1) != LUA_TNUMBER)
+            luaL_error(l, "%s: wrong value type of %s %d - bool & number are supported", procedure, name, lua_type(l, -1));
+    }
+    std::map<std::string, struct json_object*> messages;  // sensor topic : message (ordered - deterministic publish order)
+    for (lua_pushnil(l); lua_next(l, 1); lua_pop(l, 1)) {
+        const std::string sensor_value_text = lua_tostring(l, -2);
+        const auto separator = sensor_value_text.find(':');
+        auto& j_object = messages[(report ? std::string("status/") : std::string("set/")) + sensor_value_text.substr(0, separator)];
+        if (j_object == nullptr)
+            j_object = json_object_new_object();
+        struct json_object* j_value = nullptr;
+        if (lua_type(l, -1) == LUA_TBOOLEAN)
+            j_value = json_object_new_boolean(lua_toboolean(l, -1));
+        else if (lua_isinteger(l, -1))
+            j_value = json_object_new_int64(lua_tointeger(l, -1));
+        else
+            j_value = json_object_new_double(lua_tonumber(l, -1));
+        json_object_object_add(j_object, sensor_value_text.substr(separator + 1).c_str(), j_value);
+    }
+    for (auto&& message : messages) {
+        publish(message.first, json_object_to_json_string_ext(message.second, JSON_C_TO_STRING_PLAIN));
+        json_object_put(message.second);
+    }
+    return 0;
+}
+
 int lua_set_global(lua_State *l) {
+    static MQ_System::Counter& calls = lua_calls("set_global");
+    calls.Increment();
     return get_exe_object(l)->set_global(l);
 }
 
 int lua_get_global(lua_State *l) {
+    static MQ_System::Counter& calls = lua_calls("get_global");
+    calls.Increment();
     return get_exe_object(l)->get_global(l);
 }
 
@@ -538,16 +1022,27 @@ int Exe_Service::set_global(lua_State * l) {
     if (!lua_isstring(l, 1))
         luaL_error(l, "set_global: wrong argument type of the first argument - string expected! (nothing written)");
     const std::string value_name_text = lua_tostring(l, 1);
-    auto val_type = lua_type(l, 2);
-    if (val_type != LUA_TBOOLEAN && val_type != LUA_TNUMBER && val_type != LUA_TNIL)
-        luaL_error(l, "set_global: unsupported value type %d", lua_type(l, 2));
-    {  // lock scope
-        std::unique_lock<std::mutex> global_lock(_global_mutex);
-        auto result = _global_map.find(value_name_text);
-        if (result != _global_map.end())
-            _global_map.erase(result);
-        if (val_type != LUA_TNIL)  // we only erase value on NIL
-            _global_map.emplace(value_name_text, val_type == LUA_TBOOLEAN ?  lua_toboolean(l,2) > 0 :  lua_tonumber(l, 2));
+    switch (lua_type(l, 2)) {
+        case LUA_TBOOLEAN:
+            _globals.Set(value_name_text, PackedValue::Boolean(lua_toboolean(l, 2)));
+            break;
+        case LUA_TNUMBER:
+            _globals.Set(value_name_text, PackedValue::Number(lua_tonumber(l, 2)));
+            break;
+        case LUA_TNIL:  // erases the value
+            _globals.Set(value_name_text, PackedValue::kNil);
+            break;
+        case LUA_TSTRING:
+        case LUA_TTABLE: {  // kept serialized - tables are stored (and returned) as copies
+            auto data = std::make_shared<std::string>();
+            std::string error;
+            if (!lua_serialize(l, 2, *data, error))
+                luaL_error(l, "set_global: unable to store %s - %s", value_name_text.c_str(), error.c_str());
+            _globals.Set(value_name_text, PackedValue::kData, std::move(data));
+            break;
+        }
+        default:
+            luaL_error(l, "set_global: unsupported value type %d", lua_type(l, 2));
     }
     return 0;
 }
@@ -559,18 +1054,13 @@ int Exe_Service::get_global(lua_State * l) {
         luaL_error(l, "get_global: wrong argument count! (there must be exactly one argument)");
     if (!lua_isstring(l, 1))
         luaL_error(l, "get_global: wrong argument type of the first argument - string expected! (nothing written)");
-    const std::string value_name_text = lua_tostring(l, 1);
-    {   // lock scope
-        std::unique_lock<std::mutex> global_lock(_global_mutex);
-        auto result = _global_map.find(value_name_text);
-        if (result == _global_map.end())
-            lua_pushnil (l);
-        else {
-            if (result->second.get_type() == LuaValue::LuaType::BOOLEAN)
-                lua_pushboolean(l, static_cast<int>(result->second.get_value_bool()));
-            else 
-                lua_pushnumber(l, result->second.get_value_number());
-        }
+    GlobalTable::Data data;
+    const auto value = _globals.Get(lua_tostring(l, 1), data);
+    if (value != PackedValue::kData)
+        push_packed_value(l, value);
+    else if (!lua_deserialize(l, data->data(), data->size())) {
+        _logger->warn("Global {} is malformed - nil returned", lua_tostring(l, 1));
+        lua_pushnil(l);
     }
     return 1;
 }
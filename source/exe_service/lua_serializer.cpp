@@ -0,0 +1,248 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+
+#include "lua_serializer.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "value_table.h"  // PackedValue
+
+namespace {
+
+template <typename Type>
+void append(std::string& data, Type value) {
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+bool serialize(lua_State* state, int index, std::string& data, std::string& error, int depth) {
+    switch (lua_type(state, index)) {
+        case LUA_TNIL:
+            data += 'z';
+            break;
+        case LUA_TBOOLEAN:
+            data += 'b';
+            data += static_cast<char>(lua_toboolean(state, index));
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(state, index)) {
+                data += 'i';
+                append<int64_t>(data, lua_tointeger(state, index));
+            } else {
+                data += 'n';
+                append<double>(data, lua_tonumber(state, index));
+            }
+            break;
+        case LUA_TSTRING: {
+            size_t length = 0;
+            const char* string = lua_tolstring(state, index, &length);
+            data += 's';
+            append<uint32_t>(data, length);
+            data.append(string, length);
+            break;
+        }
+        case LUA_TTABLE: {
+            if (depth >= kSerializedMaxDepth) {
+                error = "tables nested deeper than " + std::to_string(kSerializedMaxDepth) + " (or cyclic)";
+                return false;
+            }
+            if (!lua_checkstack(state, 3)) {
+                error = "stack overflow";
+                return false;
+            }
+            index = lua_absindex(state, index);
+            data += 't';
+            const size_t count_position = data.size();
+            append<uint32_t>(data, 0);
+            uint32_t count = 0;
+            lua_pushnil(state);
+            while (lua_next(state, index)) {
+                const int key_type = lua_type(state, -2);
+                if (key_type == LUA_TTABLE) {
+                    error = "table keys are not supported";
+                    lua_pop(state, 2);
+                    return false;
+                }
+                if (!serialize(state, -2, data, error, depth + 1) || !serialize(state, -1, data, error, depth + 1)) {
+                    lua_pop(state, 2);
+                    return false;
+                }
+                lua_pop(state, 1);
+                ++count;
+            }
+            std::memcpy(&data[count_position], &count, sizeof(count));
+            break;
+        }
+        default:
+            error = std::string(lua_typename(state, lua_type(state, index))) + " values are not supported";
+            return false;
+    }
+    if (data.size() > kSerializedMaxSize) {
+        error = "value larger than " + std::to_string(kSerializedMaxSize) + " B";
+        return false;
+    }
+    return true;
+}
+
+class Reader {
+ public:
+    Reader(const char* data, size_t length) : _position(data), _end(data + length) {}
+    bool AtEnd() const noexcept { return _position == _end; }
+
+    template <typename Type>
+    bool Read(Type& value) noexcept {
+        if (static_cast<size_t>(_end - _position) < sizeof(value))
+            return false;
+        std::memcpy(&value, _position, sizeof(value));
+        _position += sizeof(value);
+        return true;
+    }
+
+    bool Read(const char*& bytes, size_t length) noexcept {
+        if (static_cast<size_t>(_end - _position) < length)
+            return false;
+        bytes = _position;
+        _position += length;
+        return true;
+    }
+
+ private:
+    const char* _position;
+    const char* const _end;
+};
+
+bool deserialize(lua_State* state, Reader& reader, int depth) {
+    char tag;
+    if (!reader.Read(tag) || !lua_checkstack(state, 3))
+        return false;
+    switch (tag) {
+        case 'z':
+            lua_pushnil(state);
+            return true;
+        case 'b': {
+            char boolean;
+            if (!reader.Read(boolean))
+                return false;
+            lua_pushboolean(state, boolean);
+            return true;
+        }
+        case 'i': {
+            int64_t integer;
+            if (!reader.Read(integer))
+                return false;
+            lua_pushinteger(state, integer);
+            return true;
+        }
+        case 'n': {
+            double number;
+            if (!reader.Read(number))
+                return false;
+            lua_pushnumber(state, number);
+            return true;
+        }
+        case 's': {
+            uint32_t length;
+            const char* string;
+            if (!reader.Read(length) || !reader.Read(string, length))
+                return false;
+            lua_pushlstring(state, string, length);
+            return true;
+        }
+        case 't': {
+            uint32_t count;
+            if (depth >= kSerializedMaxDepth || !reader.Read(count))
+                return false;
+            lua_createtable(state, 0, 0);
+            for (uint32_t i = 0; i < count; ++i) {
+                if (!deserialize(state, reader, depth + 1)) {
+                    lua_pop(state, 1);
+                    return false;
+                }
+                const bool valid_key = !lua_isnil(state, -1) && !(lua_type(state, -1) == LUA_TNUMBER && lua_tonumber(state, -1) != lua_tonumber(state, -1));
+                if (!valid_key || !deserialize(state, reader, depth + 1)) {  // nil and NaN keys would raise error in lua_rawset
+                    lua_pop(state, 2);
+                    return false;
+                }
+                lua_rawset(state, -3);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+}  // namespace
+
+bool lua_serialize(lua_State* state, int index, std::string& data, std::string& error) {
+    const size_t size = data.size();
+    if (serialize(state, index, data, error, 0))
+        return true;
+    data.resize(size);
+    return false;
+}
+
+bool lua_deserialize(lua_State* state, const char* data, size_t length) {
+    Reader reader(data, length);
+    if (!deserialize(state, reader, 0))
+        return false;
+    if (reader.AtEnd())
+        return true;
+    lua_pop(state, 1);
+    return false;
+}
+
+std::string serialize_packed(uint64_t value) {
+    std::string data;
+    if (PackedValue::IsNil(value)) {
+        data += 'z';
+    } else if (PackedValue::IsBoolean(value)) {
+        data += 'b';
+        data += static_cast<char>(PackedValue::ToBoolean(value));
+    } else {
+        data += 'n';
+        append<double>(data, PackedValue::ToNumber(value));
+    }
+    return data;
+}
+
+bool deserialize_packed(const char* data, size_t length, uint64_t& value) noexcept {
+    Reader reader(data, length);
+    char tag;
+    if (!reader.Read(tag))
+        return false;
+    bool valid = false;
+    switch (tag) {
+        case 'z':
+            value = PackedValue::kNil;
+            valid = true;
+            break;
+        case 'b': {
+            char boolean;
+            valid = reader.Read(boolean);
+            value = PackedValue::Boolean(boolean);
+            break;
+        }
+        case 'n': {
+            double number;
+            valid = reader.Read(number);
+            value = PackedValue::Number(number);
+            break;
+        }
+        case 'i': {
+            int64_t integer;
+            valid = reader.Read(integer);
+            value = PackedValue::Number(static_cast<double>(integer));
+            break;
+        }
+        default:
+            break;
+    }
+    return valid && reader.AtEnd();
+}
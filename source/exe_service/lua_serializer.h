@@ -0,0 +1,34 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Binary form of Lua values kept outside of Lua states (script globals in memory and in db). Supported are nil, booleans,
+// numbers (integers stay integers), strings and tables of those - tables are copied (no references, no metatables).
+// Format is tag byte followed by payload in host byte order:
+//   'z' nil | 'b' byte | 'n' double | 'i' int64 | 's' uint32 length, bytes | 't' uint32 count, count x (key, value)
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "lua.h"
+
+constexpr size_t kSerializedMaxSize = 64 * 1024;  // "small" values only - globals are copied on every get/set
+constexpr int kSerializedMaxDepth = 16;  // nested tables (also stops reference cycles)
+
+// appends value at @index to @data; returns false (with @error) on unsupported content or when limits are exceeded
+bool lua_serialize(lua_State* state, int index, std::string& data, std::string& error);
+
+// pushes value serialized by lua_serialize; returns false (nothing pushed) if @data is malformed
+bool lua_deserialize(lua_State* state, const char* data, size_t length);
+
+// scalar PackedValue (nil, boolean, number) in the same format
+std::string serialize_packed(uint64_t value);
+
+// @data to PackedValue; returns false if @data does not hold a scalar (strings and tables stay serialized)
+bool deserialize_packed(const char* data, size_t length, uint64_t& value) noexcept;
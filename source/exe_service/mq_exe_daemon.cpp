@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2018-2019
-// Version: 13122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -8,40 +8,71 @@
 // *******************************************************************************
 #include <libconfig.h++>  // parse configuration file
 #include <json-c/linkhash.h>  // access JSON-C dictionary object (json_foreach_..)
+#include <sys/timerfd.h>  // time waits timer
+#include <unistd.h>  // close, read
 
+#include <algorithm>    // std::remove
 #include <stdexcept>    // for excpetion
-#include <regex>        // regex_match
+#include <cmath>        // rule values written as integers
 #include <ctime>
+#include <cerrno>
+#include <cstring>      // strerror
 
 #include "mq_exe_daemon.h"
+#include "lua_serializer.h"
 
 using namespace libconfig;
 
-void time_thread_start(Exe_Service *exe_service) {
-    exe_service->time_thread_loop();
-}
-
-const std::array<std::string, 1 > Exe_Service::kTableDefinitions = {
+const std::array<std::string, 4 > Exe_Service::kTableDefinitions = {
     "CREATE TABLE IF NOT EXISTS script (name TEXT PRIMARY KEY, script TEXT)",  // basic table for scripts
+    "CREATE TABLE IF NOT EXISTS script_cache (name TEXT PRIMARY KEY, hash INTEGER, bytecode BLOB, value_list TEXT)",  // maintained by daemon
+    "CREATE TABLE IF NOT EXISTS global (name TEXT PRIMARY KEY, value BLOB)",  // script globals (lua_serializer format)
+    "CREATE TABLE IF NOT EXISTS rule (name TEXT PRIMARY KEY, rule TEXT)",  // declarative rules (see rule_engine.h)
 };
 
-const std::array<std::string, 1 > Exe_Service::kStatementDefinitions = {
+const std::array<std::string, 8 > Exe_Service::kStatementDefinitions = {
     "SELECT * FROM script",
+    "SELECT hash, bytecode, value_list FROM script_cache WHERE name = ?1",
+    "INSERT OR REPLACE INTO script_cache (name, hash, bytecode, value_list) VALUES (?1, ?2, ?3, ?4)",
+    "DELETE FROM script_cache WHERE name NOT IN (SELECT name FROM script)",
+    "SELECT name, value FROM global",
+    "INSERT OR REPLACE INTO global (name, value) VALUES (?1, ?2)",
+    "DELETE FROM global WHERE name = ?1",
+    "SELECT name, rule FROM rule",
 };
 
+const uint64_t Exe_Service::flush_interval = 10;
+
+namespace {
+
+constexpr unsigned char kCacheFormat = 2;  // bump when cached content changes so old entries are not used (2 - bytecode scan)
+
+uint64_t source_hash(const std::string& source) noexcept {  // FNV-1a - stable across builds (it's stored in db)
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](unsigned char byte) {
+        hash ^= byte;
+        hash *= 1099511628211ULL;
+    };
+    mix(kCacheFormat);
+    for (const auto character : source)
+        mix(static_cast<unsigned char>(character));
+    return hash;
+}
+
+}  // namespace
+
 const std::string Exe_Service::kReloadTopic = "app/exe/reload";
 
-Exe_Service::Exe_Service() : Daemon("mq_exe_daemon", "/var/run/mq_exe_daemon.pid"), _tokener(json_tokener_new()), _terminate_time_thread(false) {}
+Exe_Service::Exe_Service(bool offline) : Daemon("mq_exe_daemon", "/var/run/mq_exe_daemon.pid", offline, offline), _lua_shared_states(0), _lua_pool_allocator(false), _globals_flush_interval(flush_interval), _script_limits{std::chrono::nanoseconds(0), 0}, _tokener(json_tokener_new()), _running_scripts(0), _hold_workers(false), _preempt_scripts(false), _terminate_workers(false), _terminate_lua_threads(false), _value_table(new Values()), _time_fd(-1) {}
 
-void Exe_Service::load_daemon_configuration() {
-    spdlog::set_pattern("[%x %H:%M:%S.%e][%n][%t][%l] %v");  // here just to add thread id logging
-    
-    static const char* kConfigFile = "/etc/mq_system/mq_exe_daemon.conf";
+void Exe_Service::load_daemon_configuration(std::string& db_uri, unsigned& shared_states, bool& pool_allocator, unsigned& globals_flush_interval, ScriptLimits& limits) {
+
+    const std::string kConfigFile = MQ_System::ConfigPath("mq_exe_daemon.conf");
     static const std::string kDefaultDbUri = "/var/db/mq_exe_system.db";
     Config cfg;
 
     try {
-        cfg.readFile(kConfigFile);
+        cfg.readFile(kConfigFile.c_str());
     } catch(const FileIOException &fioex) {
         _logger->error("I/O error while reading system configuration file: {}", kConfigFile);
         throw std::runtime_error("");
@@ -52,14 +83,31 @@ void Exe_Service::load_daemon_configuration() {
     try {
         const auto& root = cfg.getRoot();
         if (root.exists("uri"))
-            root.lookupValue("uri", _db_uri);
+            root.lookupValue("uri", db_uri);
         else
-            _db_uri = kDefaultDbUri;
+            db_uri = kDefaultDbUri;
         if  (cfg.exists("log_level")) {
             int level;
             cfg.lookupValue("log_level", level);
             _logger->set_level(static_cast<spdlog::level::level_enum>(level));		
         }
+        int lua_shared_states = 0;
+        root.lookupValue("lua_shared_states", lua_shared_states);
+        shared_states = lua_shared_states > 0 ? lua_shared_states : 0;
+        std::string lua_allocator = "system";
+        root.lookupValue("lua_allocator", lua_allocator);
+        if (lua_allocator != "system" && lua_allocator != "pool")
+            _logger->warn("Unknown lua_allocator {} - using system one", lua_allocator);
+        pool_allocator = lua_allocator == "pool";
+        int flush_seconds = flush_interval;
+        root.lookupValue("globals_flush_interval", flush_seconds);
+        globals_flush_interval = flush_seconds > 0 ? flush_seconds : 1;
+        int cpu_limit = 10;  // [s]
+        root.lookupValue("lua_cpu_limit", cpu_limit);
+        limits.cpu = std::chrono::seconds(cpu_limit > 0 ? cpu_limit : 0);
+        int memory_limit = 64 * 1024;  // [KiB]
+        root.lookupValue("lua_memory_limit", memory_limit);
+        limits.memory = memory_limit > 0 ? static_cast<size_t>(memory_limit) * 1024 : 0;
     } catch(const SettingNotFoundException &nfex) {
         _logger->error("Required setting not found in system configuration file");
         throw std::runtime_error("");
@@ -83,118 +131,336 @@ void Exe_Service::check_and_init_database() {
     }
 }
 
-// This scans @content for "register_value(" and than tries to find it's string parameters, match them with regex and store them into @sensor_list
-/**
- * Right now this scan works well; however it does not work with LUA comments. It is kind of complicated to implement it so right now we 
- * accept this feature (BUG?) as it is. It should not affect users too much - if it is at least documented. 
- * Another way might be completely fresh script setup with void functions exept register_value that whould get registered and that whould record parameters.
- */
-bool Exe_Service::scan_script(const std::string& content, std::unordered_set<std::string>& sensor_list) {
-    for (size_t regval_string_scan_position = 0; regval_string_scan_position != std::string::npos; ) {
-        const std::string regval_string { "register_value(" };
-        const auto find_regval_result = content.find(regval_string, regval_string_scan_position);
-        if (find_regval_result == std::string::npos)
-            break;
-        const auto regval_params_position = find_regval_result + regval_string.size();
-        const auto regval_end_result = content.find(')', regval_params_position);
-        if (regval_end_result == std::string::npos)
-            break;
-        for (size_t iter = regval_params_position;;) {
-            const size_t regval_param_start = content.find('"', iter);
-            if (regval_param_start == std::string::npos || regval_param_start > regval_end_result)
-                break;
-            const auto param_string_start = regval_param_start + 1;
-            const auto regval_param_end = content.find('"', param_string_start);
-            if (regval_param_end == std::string::npos || regval_param_end > regval_end_result)
-                break;
-            iter = regval_param_end + 1;
-            const auto extracted_parameter_string = content.substr(param_string_start, regval_param_end - param_string_start);
-            const std::regex sensor_regex("(\\w|\\/)+\\:\\w+");
-            if (!std::regex_match(extracted_parameter_string, sensor_regex)) {
-                _logger->warn("scan script - \"register_value\" function parameter does not match expected format!");
-                return false;
-            }
-            const auto sensor_value_separator_position = extracted_parameter_string.find(":");
-            const auto sensor_name = std::string("status/") + extracted_parameter_string.substr(0, sensor_value_separator_position);
-            _logger->debug("scan script - adding string \"{}\" to sensor list", sensor_name);
-            sensor_list.emplace(sensor_name);
+// all globals in one query - before any script starts so nothing is dirty yet
+void Exe_Service::load_globals() {
+    auto select_globals = _statements[4];
+    size_t count = 0;
+    while (sqlite3_step(select_globals) == SQLITE_ROW) {
+        const auto name = reinterpret_cast<const char*>(sqlite3_column_text(select_globals, 0));
+        const auto data = static_cast<const char*>(sqlite3_column_blob(select_globals, 1));
+        const size_t length = sqlite3_column_bytes(select_globals, 1);
+        if (name == nullptr || data == nullptr)
+            continue;
+        uint64_t value;
+        if (deserialize_packed(data, length, value))
+            _globals.Set(name, value, GlobalTable::Data(), false);
+        else
+            _globals.Set(name, PackedValue::kData, std::make_shared<const std::string>(data, length), false);
+        ++count;
+    }
+    sqlite3_reset(select_globals);
+    _logger->debug("{} globals loaded", count);
+}
+
+void Exe_Service::flush_globals() {
+    if (_statements.size() != kStatementDefinitions.size())
+        return;  // database was not opened
+    auto insert_global = _statements[5];
+    auto delete_global = _statements[6];
+    bool transaction = false;
+    const auto count = _globals.Flush([&](const std::string& name, uint64_t value, const GlobalTable::Data& data) {
+        if (!transaction)
+            transaction = sqlite3_exec(_pDb, "BEGIN", nullptr, nullptr, nullptr) == SQLITE_OK;
+        auto statement = delete_global;
+        sqlite3_bind_text(statement, 1, name.c_str(), name.size(), SQLITE_STATIC);
+        const std::string scalar = data ? std::string() : serialize_packed(value);
+        if (!PackedValue::IsNil(value)) {
+            statement = insert_global;
+            sqlite3_bind_text(statement, 1, name.c_str(), name.size(), SQLITE_STATIC);
+            const std::string& serialized = data ? *data : scalar;
+            sqlite3_bind_blob(statement, 2, serialized.data(), serialized.size(), SQLITE_STATIC);
         }
-        regval_string_scan_position = regval_end_result + 1;
+        if (sqlite3_step(statement) != SQLITE_DONE)
+            _logger->warn("Sqlite unable to store global {} : {}", name, sqlite3_errmsg(_pDb));
+        sqlite3_reset(statement);
+        sqlite3_clear_bindings(statement);
+    });
+    if (transaction && sqlite3_exec(_pDb, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK)
+        _logger->warn("Sqlite unable to commit globals : {}", sqlite3_errmsg(_pDb));
+    if (count)
+        _logger->debug("{} globals written", count);
+}
+
+bool Exe_Service::load_cached_script(CompiledScript& script) {
+    auto select_cache = _statements[1];
+    sqlite3_bind_text(select_cache, 1, script.name.c_str(), script.name.size(), SQLITE_STATIC);
+    bool found = false;
+    if (sqlite3_step(select_cache) == SQLITE_ROW && static_cast<uint64_t>(sqlite3_column_int64(select_cache, 0)) == script.hash) {
+        const auto bytecode = static_cast<const char*>(sqlite3_column_blob(select_cache, 1));
+        script.bytecode.assign(bytecode, sqlite3_column_bytes(select_cache, 1));
+        const auto value_list = reinterpret_cast<const char*>(sqlite3_column_text(select_cache, 2));
+        const std::string values { value_list ? value_list : "" };
+        script.values.clear();
+        for (size_t start = 0, end = 0; start < values.size(); start = end + 1) {  // value names do not contain spaces (see valid_value_name)
+            end = values.find(' ', start);
+            if (end == std::string::npos)
+                end = values.size();
+            if (end > start)
+                script.values.emplace_back(values.substr(start, end - start));
+        }
+        found = !script.bytecode.empty();
     }
+    sqlite3_reset(select_cache);
+    sqlite3_clear_bindings(select_cache);
+    return found;
+}
+
+void Exe_Service::store_cached_script(const CompiledScript& script) {
+    auto insert_cache = _statements[2];
+    std::string values;
+    for (const auto& value : script.values)
+        values += (values.empty() ? "" : " ") + value;
+    sqlite3_bind_text(insert_cache, 1, script.name.c_str(), script.name.size(), SQLITE_STATIC);
+    sqlite3_bind_int64(insert_cache, 2, static_cast<sqlite3_int64>(script.hash));
+    sqlite3_bind_blob(insert_cache, 3, script.bytecode.data(), script.bytecode.size(), SQLITE_STATIC);
+    sqlite3_bind_text(insert_cache, 4, values.c_str(), values.size(), SQLITE_STATIC);
+    if (sqlite3_step(insert_cache) != SQLITE_DONE)
+        _logger->warn("Sqlite unable to cache script {} : {}", script.name, sqlite3_errmsg(_pDb));
+    sqlite3_reset(insert_cache);
+    sqlite3_clear_bindings(insert_cache);
+}
+
+// bytecode and dependencies from cache if the source did not change; otherwise compile (and scan) and cache
+bool Exe_Service::prepare_script(CompiledScript& script) {
+    if (load_cached_script(script))
+        return true;
+    if (!compile_script(script))
+        return false;
+    store_cached_script(script);
+    _logger->debug("Script {} compiled", script.name);
     return true;
 }
 
+// status topics are subscribed while any active (started and not ended) script needs them
+void Exe_Service::acquire_sensors(const std::vector<std::string>& values) {
+    std::unique_lock<std::mutex> sensor_lock(_sensor_mutex);
+    for (const auto& value_name : values) {
+        const auto sensor = value_name.substr(0, value_name.rfind(':'));
+        if (!_sensor_users[sensor]++)
+            Subscribe(sensor);
+    }
+}
+
+void Exe_Service::release_sensors(const std::vector<std::string>& values) {
+    std::unique_lock<std::mutex> sensor_lock(_sensor_mutex);
+    for (const auto& value_name : values) {
+        const auto sensor = _sensor_users.find(value_name.substr(0, value_name.rfind(':')));
+        if (sensor == _sensor_users.end() || --sensor->second)
+            continue;
+        Unsubscribe(sensor->first);
+        _sensor_users.erase(sensor);
+    }
+}
+
+// value ids held by running scripts stay valid if keep_ids is set (table is extended and its content moved in the loop thread)
+void Exe_Service::update_value_table(const std::unordered_set<std::string>& value_list, bool keep_ids) {
+    Values* const old_values = _value_table.load(std::memory_order_acquire);
+    bool complete = true;
+    for (const auto& value_name : value_list)
+        complete = complete && old_values->Find(value_name) != Values::kInvalidValue;
+    if (complete && (keep_ids || value_list.size() == old_values->Size()))
+        return;  // current table serves all the values
+    Values* values = new Values();
+    if (keep_ids) {
+        for (Values::ValueId id = 0; id < old_values->Size(); ++id)
+            values->Intern((*old_values)[id].name);
+        for (const auto& value_name : value_list)
+            values->Intern(value_name);
+        std::promise<void> swapped;
+        in_loop([this, old_values, values, &swapped] {  // no message is delivered meanwhile - waiters can't be lost or doubled
+            for (Values::ValueId id = 0; id < old_values->Size(); ++id) {
+                auto& old_slot = (*old_values)[id];
+                auto& slot = (*values)[id];
+                std::unique_lock<std::mutex> slot_lock(old_slot.mutex);
+                slot.value.store(old_slot.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                slot.waiters.swap(old_slot.waiters);
+                slot.conditions.swap(old_slot.conditions);
+                slot.windows.swap(old_slot.windows);
+            }
+            _value_table.store(values, std::memory_order_release);
+            delete old_values;
+            swapped.set_value();
+        });
+        swapped.get_future().wait();
+        return;
+    }
+    for (const auto& value_name : value_list) {  // no script waits - fresh table, last values are kept
+        auto& slot = (*values)[values->Intern(value_name)];
+        const auto old_id = old_values->Find(value_name);
+        if (old_id != Values::kInvalidValue) {
+            auto& old_slot = (*old_values)[old_id];
+            std::unique_lock<std::mutex> slot_lock(old_slot.mutex);  // loop thread may still update old slot windows
+            slot.value.store(old_slot.value.load(std::memory_order_acquire), std::memory_order_relaxed);
+            slot.windows.swap(old_slot.windows);
+        }
+    }
+    _value_table.store(values, std::memory_order_release);
+    in_loop([old_values] { delete old_values; });  // status messages are parsed in the loop thread - it may still use old table
+}
+
+std::unique_ptr<RuleEngine> Exe_Service::load_rules() {
+    std::unique_ptr<RuleEngine> rules(new RuleEngine([this](const std::string& value_name, uint64_t value) { write_packed_value(value_name, value); }));
+    auto select_from_rule = _statements[7];
+    for (auto sqresult = sqlite3_step(select_from_rule); sqresult != SQLITE_DONE; sqresult = sqlite3_step(select_from_rule)) {
+        if (sqresult != SQLITE_ROW) {
+            _logger->error("Sqlite error unexpected result during rule loading {} : {}", sqresult, sqlite3_errmsg(_pDb));
+            break;
+        }
+        const std::string name = reinterpret_cast<const char*>(sqlite3_column_text(select_from_rule, 0));
+        const auto text = sqlite3_column_text(select_from_rule, 1);
+        std::string error;
+        if (!rules->Add(name, text ? reinterpret_cast<const char*>(text) : "", error))
+            _logger->warn("Rule {} not loaded - {}", name, error);
+    }
+    sqlite3_reset(select_from_rule);
+    return rules;
+}
+
+// new rules take over in the loop thread after value table swap (posted after it) - they start from current slot values
+void Exe_Service::start_rules(RuleEngine* rules) {
+    in_loop([this, rules] {
+        Values& values = *_value_table.load(std::memory_order_acquire);
+        std::vector<uint32_t> ids;
+        std::vector<uint64_t> current;
+        for (const auto& value_name : rules->Values()) {
+            ids.push_back(values.Find(value_name));
+            current.push_back(values[ids.back()].value.load(std::memory_order_acquire));
+        }
+        rules->Start(&values, ids, current, timer_wheel(), _rule_engine.get());
+        _rule_engine.reset(rules);  // previous rules are destroyed here - their timers are cancelled
+    });
+}
+
+// (re)load scripts - only new and changed scripts are (re)started, unchanged running scripts keep running with their state
 void Exe_Service::load_and_run_scripts() {
+    static MQ_System::Histogram& reload_time = MQ_System::Metrics::Instance().GetHistogram("mq_exe_reload_seconds", "Duration of script (re)load");
+    MQ_System::ScopedTimer reload_timer(reload_time);
     auto select_from_script = _statements[0];
-    std::vector<std::pair<std::string, std::string>> script_store;
-    std::unordered_set<std::string> sensor_list;
+    std::vector<CompiledScript> script_store;
+    std::unordered_map<std::string, uint64_t> running_hashes;  // _scripts list is changed only here (and in stop_all)
+    for (const auto& script : _scripts)
+        running_hashes.emplace(script.name, script.hash);
 
     for (auto sqresult = sqlite3_step(select_from_script); sqresult != SQLITE_DONE; sqresult = sqlite3_step(select_from_script)) {
         if (sqresult != SQLITE_ROW) {
             _logger->error("Sqlite error unexpected result during script loading {} : {}", sqresult, sqlite3_errmsg(_pDb));
             break;
         }
-        const std::string script_name { reinterpret_cast<const char*>(sqlite3_column_text(select_from_script, 0)) };
-        const std::string script_content { reinterpret_cast<const char*>(sqlite3_column_text(select_from_script, 1)) };
-        _logger->debug("Script {}  ; Content: {}", script_name, script_content);
-        if (scan_script(script_content, sensor_list))
-            script_store.emplace_back(std::move(script_name), std::move(script_content));
-        else
-            _logger->warn("Script {} - scan error - not adding it - please fix the content so it may pass static analysis", script_name);
+        CompiledScript script;
+        script.name = reinterpret_cast<const char*>(sqlite3_column_text(select_from_script, 0));
+        script.source = reinterpret_cast<const char*>(sqlite3_column_text(select_from_script, 1));
+        script.hash = source_hash(script.source);
+        _logger->debug("Script {}  ; Content: {}", script.name, script.source);
+        const auto running = running_hashes.find(script.name);
+        if ((running == running_hashes.cend() || running->second != script.hash) && !prepare_script(script))
+            continue;
+        script_store.emplace_back(std::move(script));
     }
     sqlite3_reset(select_from_script);
-    for (const auto& sensor : sensor_list)
-        Subscribe(sensor);
-    _terminate_lua_threads = false;
-    for (const auto& script : script_store)
-        execute_lua_script(script.first, script.second);
+    if (sqlite3_step(_statements[3]) != SQLITE_DONE)
+        _logger->warn("Sqlite unable to clean script cache : {}", sqlite3_errmsg(_pDb));
+    sqlite3_reset(_statements[3]);
+    auto rules = load_rules();
+    if (_terminate_lua_threads) {
+        _logger->info("Reload interrupted - daemon terminates");
+        return;
+    }
+
+    hold_workers();  // script states do not change from now on
+    std::unordered_map<std::string, Script*> running_scripts;  // nullptr once the script is kept
+    for (auto&& script : _scripts)
+        running_scripts.emplace(script.name, &script);
+    std::vector<const CompiledScript*> start_list;
+    std::unordered_set<std::string> value_list;
+    size_t kept = 0;
+    for (auto&& script : script_store) {
+        const auto running = running_scripts.find(script.name);
+        if (running != running_scripts.end() && running->second->hash == script.hash && running->second->state != nullptr) {
+            value_list.insert(running->second->values.cbegin(), running->second->values.cend());
+            running->second = nullptr;
+            ++kept;
+            continue;
+        }
+        if (script.bytecode.empty() && !prepare_script(script))  // unchanged script that already ended
+            continue;
+        value_list.insert(script.values.cbegin(), script.values.cend());
+        start_list.push_back(&script);
+        acquire_sensors(script.values);  // before stopped scripts release them - shared topics stay subscribed
+    }
+    value_list.insert(rules->Values().cbegin(), rules->Values().cend());
+    acquire_sensors(rules->Values());
+    release_sensors(_rule_values);
+    _rule_values = rules->Values();
+    size_t stopped = 0;
+    for (auto it = _scripts.begin(); it != _scripts.end(); ) {
+        if (running_scripts[it->name] == nullptr) {
+            ++it;
+            continue;
+        }
+        clear_waits(*it);  // event sources do not see the script from now on
+        {
+            std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+            _ready_scripts.erase(std::remove(_ready_scripts.begin(), _ready_scripts.end(), &*it), _ready_scripts.end());
+        }
+        if (it->state != nullptr)
+            ++stopped;
+        close_script(*it);
+        it = _scripts.erase(it);
+    }
+    update_value_table(value_list, kept != 0);
+    _logger->info("Rules loaded - {} rules, {} nodes, {} KiB", rules->Rules(), rules->Nodes(), rules->Memory() / 1024);
+    start_rules(rules.release());
+    for (const auto script : start_list)
+        if (!execute_lua_script(*script))
+            release_sensors(script->values);
+    _globals.Reclaim();  // no script runs - nobody reads replaced global indexes
+    const auto memory = lua_memory();
+    release_workers();
+    _logger->info("Scripts loaded - {} kept running, {} started, {} stopped", kept, start_list.size(), stopped);
+    const auto script_count = kept + start_list.size();
+    _logger->info("Lua memory {} KiB - {} B per script ({})", memory / 1024, script_count ? memory / script_count : 0,
+        _lua_shared_states ? std::to_string(_lua_shared_states) + " shared states" : std::string("state per script"));
 }
 
 void Exe_Service::start_all() {
     _logger->trace("start all");
-    load_and_run_scripts();  // load & start all the lua scripts (this takes some time ~2 secs)
+    load_and_run_scripts();  // load & start all the lua scripts
     Subscribe(kReloadTopic);  // subscribe to reaload event
 }
 
 void Exe_Service::stop_all() {
     _logger->trace("stop_all");
-    Unsubscribe("#");  // stop reacting to any MQTT message (I hope this works..)
-    _terminate_lua_threads = true;  // issue command to stop all the treads that will wake (in wait function) - they will end with LUA error "terminate requested"
-    _logger->trace("lock event map");
-    {  // scope for lock guard
-        std::unique_lock<std::mutex> value_wait_lock(_map_mutex);  // get lock to event map and wake all the waiting LUA scripts
-        for (auto && el : _value_wait_map)  // issue events LUA scripts wait for (wake them)
-            if (el.second != nullptr) {
-                ++el.second->num;
-                el.second->cond_var.notify_all();
-            }
-    } // release lock so the threads may access the map (they gonna clean it if possible)    
-    _logger->trace("lock time map");
+    _terminate_lua_threads = true;  // waiting scripts are not resumed anymore and running ones fail in next wait
+    _logger->debug("wait for running scripts");
     {  // scope for lock guard
-        std::unique_lock<std::mutex> time_lock(_time_mutex); // lock the time map and wake all the waiting LUA scripts
-        for (auto && el : _time_wait_map)  // issue events LUA scripts wait time (wake them)
-            if (el.second != nullptr) {
-                ++el.second->num;
-                el.second->cond_var.notify_all();
-            }
+        std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+        _idle_cv.wait(scheduler_lock, [this] { return _running_scripts == 0; });
+        _ready_scripts.clear();
     }
-    _logger->debug("join script threads");
-    for (auto && script : _script_threads)
-        script.join();
-    _script_threads.clear();
-    {  // scope for lock guard
-        std::unique_lock<std::mutex> value_wait_lock(_map_mutex);  // well mosquitto (main) thread may still try to access the map but since it should be already unsubscribed it is highly unprobable scenario, but to be sure...
-        _value_wait_map.clear();    // map should be already clear unless something bad happend but to be sure it's clear.. we may clear it now!
+    {  // loop thread may still deliver already received message so slots are cleared under their locks
+        Values& values = *_value_table.load(std::memory_order_acquire);
+        for (Values::ValueId id = 0; id < values.Size(); ++id) {
+            std::unique_lock<std::mutex> slot_lock(values[id].mutex);
+            values[id].waiters.clear();
+            values[id].conditions.clear();
+        }
     }
     {  // scope for lock guard
-        std::unique_lock<std::mutex> time_lock(_time_mutex);  // time thread is still running we're not terminating it so the lock here is necessary
-        _time_wait_map.clear();     // this map may be acessed by time thread so lock it be4 emergency cleanup (map should be already clear unless something bad happend but to be sure it's clear.. we may clear it now!)
+        std::unique_lock<std::mutex> time_lock(_time_mutex);  // time timer is handled in the loop thread so the lock here is necessary
+        _time_wait_map.clear();
+    }
+    {  // events fired before maps were cleared may have queued scripts again
+        std::unique_lock<std::mutex> scheduler_lock(_scheduler_mutex);
+        _ready_scripts.clear();
     }
+    for (auto&& script : _scripts)
+        close_script(script);  // suspended coroutine is collected with the state
+    _scripts.clear();
+    release_sensors(_rule_values);
+    _rule_values.clear();
 }
 
-void Exe_Service::main() {
-    _logger->trace("Daemon Start");
-    load_daemon_configuration();
+void Exe_Service::open_database() {
     if (!sqlite3_threadsafe()) {
         if(sqlite3_config(SQLITE_CONFIG_SERIALIZED)) {
             _logger->warn("Unable to set serialized mode for SQLite! It is necessary to recompile it SQLITE_THREADSAFE!");
@@ -208,11 +474,27 @@ void Exe_Service::main() {
     }
     sqlite3_extended_result_codes(_pDb, true);
     check_and_init_database();
-    _time_thread = std::move(std::thread(time_thread_start, this));
+}
+
+void Exe_Service::main() {
+    _logger->trace("Daemon Start");
+    spdlog::set_pattern("[%x %H:%M:%S.%e][%n][%t][%l] %v");  // here just to add thread id logging
+    load_daemon_configuration(_db_uri, _lua_shared_states, _lua_pool_allocator, _globals_flush_interval, _script_limits);
+    open_database();
+    load_globals();
+    Loop().AddTimer(std::chrono::seconds(_globals_flush_interval), std::chrono::seconds(_globals_flush_interval), [this] { flush_globals(); });
+    _time_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_time_fd < 0) {
+        _logger->error("Unable to create time wait timer: {}", strerror(errno));
+        throw std::runtime_error("");
+    }
+    Loop().AddFd(_time_fd, EPOLLIN, [this](uint32_t) { on_time_timer(); });
+    create_shared_states();
+    start_workers();
     _logger->trace("Exe system initialized");
     start_all();
     _logger->info("--- Threads started ---");
-    SleepForever();
+    Run();
 }
 
 void Exe_Service::CallBack(const std::string& topic, const std::string& message) {
@@ -226,6 +508,24 @@ void Exe_Service::CallBack(const std::string& topic, const std::string& message)
     return;
 }
 
+// scripts are not touched - they are reloaded by kReloadTopic message
+void Exe_Service::OnConfigChanged() {
+    std::string db_uri;
+    unsigned shared_states;
+    bool pool_allocator;
+    unsigned globals_flush_interval;
+    ScriptLimits limits;
+    load_daemon_configuration(db_uri, shared_states, pool_allocator, globals_flush_interval, limits);
+    if (db_uri != _db_uri)
+        _logger->warn("Database uri change requires daemon restart - keeping {}", _db_uri);
+    if (shared_states != _lua_shared_states || pool_allocator != _lua_pool_allocator)
+        _logger->warn("Lua state configuration change requires daemon restart");
+    if (globals_flush_interval != _globals_flush_interval)
+        _logger->warn("Globals flush interval change requires daemon restart");
+    if (limits.cpu != _script_limits.cpu || limits.memory != _script_limits.memory)
+        _logger->warn("Lua script limits change requires daemon restart");
+}
+
 void Exe_Service::parse_app_message(const std::string& topic) {
     if (topic != kReloadTopic)
         return;
@@ -240,14 +540,14 @@ void Exe_Service::parse_app_message(const std::string& topic) {
     // this is slow so we do it in separate thread because original thread would stop all the reporting to mosquitto
     reload_sctripts_future_ = std::async(std::launch::async, [this](void) {
         _logger->trace("----------- Runtime reload -----------");
-        stop_all();
-        start_all();
+        load_and_run_scripts();
         _logger->trace("----------- Reload completed -----------");
         return true;
     });
 }
 
 void Exe_Service::parse_status_message(const std::string& topic, const std::string& message) {
+    static MQ_System::Counter& condition_misses = MQ_System::Metrics::Instance().GetCounter("mq_lua_wait_condition_misses_total", "Value updates not satisfying wait_until/wait_change condition (no wake)");
     const std::string& message_topic = topic;
     struct json_object* message_json_root_object = json_tokener_parse_ex(_tokener, message.c_str(), message.size());
 
@@ -256,9 +556,12 @@ void Exe_Service::parse_status_message(const std::string& topic, const std::stri
         return;
     }
 
+    Values& values = *_value_table.load(std::memory_order_acquire);
     json_object_object_foreach(message_json_root_object, key_string, current_object) {
-        const auto value_name = std::string(key_string);
-        const auto sensor_value_name = message_topic + ":" + value_name;
+        const auto id = values.Find(message_topic, key_string);
+        if (id == Values::kInvalidValue)
+            continue;  // no script registered this value
+        auto& slot = values[id];
         //std::string units;  // we do not need units string at all
         if (json_object_get_type(current_object) == json_type_array) {
             //units = json_object_get_string(json_object_array_get_idx (current_object, 1));  //uints are second element in array
@@ -269,40 +572,84 @@ void Exe_Service::parse_status_message(const std::string& topic, const std::stri
             case json_type_double: 
                 {
                     double value = json_object_get_double(current_object);
-                    _logger->trace("Received sensor {} name {} value: {}", message_topic, value_name, value);
-                    std::unique_lock<std::mutex> value_lock(_value_mutex);
-                    _last_val_double_map[sensor_value_name] = value;
+                    _logger->trace("Received sensor {} name {} value: {}", message_topic, key_string, value);
+                    slot.value.store(PackedValue::Number(value), std::memory_order_release);
                 }
                 break;
             case json_type_boolean: 
                 {
-                    bool value = json_object_get_boolean(current_object);
-                    std::unique_lock<std::mutex> value_lock(_value_mutex);
-                    _last_val_boolean_map[sensor_value_name] = value;
+                    slot.value.store(PackedValue::Boolean(json_object_get_boolean(current_object)), std::memory_order_release);
                 }
                 break;
             default:
-                _logger->debug("Json unexpected type of object for value name: {} payload: {} ", value_name, message);
+                _logger->debug("Json unexpected type of object for value name: {} payload: {} ", key_string, message);
                 break;
         }
-        // notify threads about update AFTER values were already updated in value map!
-        std::unique_lock<std::mutex> value_wait_lock(_map_mutex);
-        auto range = _value_wait_map.equal_range(sensor_value_name);
-        for (auto it = range.first; it != range.second; ++it)
-            if (it->second) {
-                ++it->second->num;
-                it->second->cond_var.notify_all();
-                it->second = nullptr;
+        const uint64_t value = slot.value.load(std::memory_order_relaxed);
+        if (_rule_engine && _rule_engine->Serves(&values))  // rules bound to previous table wait for start_rules of the reload
+            _rule_engine->OnValue(id, value);
+        // notify scripts about update AFTER the value was updated (waiters are woken once)
+        std::unique_lock<std::mutex> slot_lock(slot.mutex);
+        for (auto script : slot.waiters)
+            wake_script(script);
+        slot.waiters.clear();  // keeps capacity - no allocation on next wait
+        if (!slot.windows.empty() && !PackedValue::IsNil(value)) {
+            const auto now = ExeClock::SteadyNow();
+            const double number = PackedValue::IsBoolean(value) ? (PackedValue::ToBoolean(value) ? 1.0 : 0.0) : PackedValue::ToNumber(value);
+            for (auto&& window : slot.windows)
+                window.Add(now, number);
+        }
+        for (auto it = slot.conditions.begin(); it != slot.conditions.end(); ) {
+            if (!it->second.Test(value)) {
+                condition_misses.Increment();
+                ++it;
+                continue;
             }
+            if (it->first->wait_events.load(std::memory_order_acquire) == 0)  // timeout did not fire first (it fires in this thread too)
+                it->first->wait_value.store(value, std::memory_order_release);
+            wake_script(it->first);
+            it = slot.conditions.erase(it);
+        }
     }
     json_object_put(message_json_root_object);  // free message object tree
 }
 
+void Exe_Service::write_packed_value(const std::string& value_name, uint64_t value) {
+    const auto separator = value_name.find(':');
+    struct json_object* j_object = json_object_new_object();
+    struct json_object* j_value = nullptr;
+    if (PackedValue::IsBoolean(value)) {
+        j_value = json_object_new_boolean(PackedValue::ToBoolean(value));
+    } else {
+        const double number = PackedValue::ToNumber(value);
+        if (number == std::trunc(number) && std::fabs(number) < 9007199254740992.0)  // integral values are written as integers (like Lua integers)
+            j_value = json_object_new_int64(static_cast<int64_t>(number));
+        else
+            j_value = json_object_new_double(number);
+    }
+    json_object_object_add(j_object, value_name.substr(separator + 1).c_str(), j_value);
+    publish("set/" + value_name.substr(0, separator), json_object_to_json_string_ext(j_object, JSON_C_TO_STRING_PLAIN));
+    json_object_put(j_object);
+}
+
 Exe_Service::~Exe_Service() noexcept {
     _logger->debug("~Exe_Service()");
-    _terminate_time_thread = true;
+    _terminate_lua_threads = true;  // reload in progress stops before it changes scripts (or finishes - loop work runs inline then)
+    if (reload_sctripts_future_.valid())
+        reload_sctripts_future_.wait();
     stop_all();
-    _time_thread.join();
+    stop_workers();
+    for (auto&& shared : _shared_states)
+        close_lua_state(shared->state);
+    _shared_states.clear();
+    if (_time_fd >= 0) {
+        Loop().RemoveFd(_time_fd);
+        close(_time_fd);
+    }
+    _rule_engine.reset();  // cancels its timers
+    delete _value_table.load();
+    if (!_simulation)
+        flush_globals();  // scripts are stopped - last changes (simulation does not change the db)
     json_tokener_free(_tokener);
     for (auto&& statement : _statements)
         sqlite3_finalize(statement);
@@ -317,9 +664,46 @@ Exe_Service::~Exe_Service() noexcept {
         _logger->critical("Sqlite exe not closed the way it should - it may be inconsistent!");
 }
 
-int main() {
+// mq_exe_daemon --simulate <db> [--capture <file>] [--start <unix time>] [--days <n>] [--output <file>]
+int simulation_main(int argc, char* argv[]) {
+    std::string db_uri, capture;
+    std::chrono::system_clock::time_point start = std::chrono::system_clock::from_time_t(1767225600);  // 2026-01-01 00:00 UTC - runs are repeatable
+    std::chrono::seconds duration(0);
+    std::FILE* output = stdout;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--simulate")
+            db_uri = argv[i + 1];
+        else if (option == "--capture")
+            capture = argv[i + 1];
+        else if (option == "--start")
+            start = std::chrono::system_clock::from_time_t(static_cast<time_t>(std::strtoll(argv[i + 1], nullptr, 10)));
+        else if (option == "--days")
+            duration = std::chrono::seconds(static_cast<long long>(std::strtod(argv[i + 1], nullptr) * 86400));
+        else if (option == "--output" && (output = std::fopen(argv[i + 1], "w")) == nullptr)
+            break;
+    }
+    if (db_uri.empty() || output == nullptr || argc % 2 == 0 || (capture.empty() && duration.count() <= 0)) {
+        std::fprintf(stderr, "usage: mq_exe_daemon --simulate <db> [--capture <file>] [--start <unix time>] [--days <n>] [--output <file>]\n"
+            "       capture or days is required\n");
+        return 2;
+    }
+    int result = -1;
+    try {
+        Exe_Service d(true);
+        result = d.simulate(db_uri, capture, start, duration, output);
+    } catch (const std::exception& error) {
+    }
+    if (output != stdout)
+        std::fclose(output);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    ::tzset();
+    if (argc > 1 && !strcmp(argv[1], "--simulate"))
+        return simulation_main(argc, argv);
     try {
-        ::tzset();
         Exe_Service d;
         d.main();
     } catch (const std::exception& error) {
@@ -328,22 +712,43 @@ int main() {
     return 0;
 }
 
-void Exe_Service::time_thread_loop() {
-    _logger->trace("Time thread start");
-    while ( !_terminate_time_thread ) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        std::unique_lock<std::mutex> time_lock(_time_mutex);
-        // _logger->trace("time_thread tick");
-        if (!_time_wait_map.empty()) {
-            const auto now = std::chrono::system_clock::now();
-            for (auto it = _time_wait_map.begin(); it != _time_wait_map.end() && it->first <= now; ++it)
-                if (it->second) {
-                    _logger->trace("time_map event!");
-                    ++it->second->num;
-                    it->second->cond_var.notify_all();
-                    it->second = nullptr;
-                }
-        }
+// wall clock timer armed for the earliest time wait; clock change (NTP step) cancels it (ECANCELED) and deadlines are re-evaluated
+void Exe_Service::arm_time_timer() {
+    if (_time_fd < 0)
+        return;  // simulation - its loop takes the earliest wait itself
+    const auto deadline = _time_wait_map.empty() ? std::chrono::system_clock::time_point() : _time_wait_map.begin()->first;
+    if (deadline == _time_armed)
+        return;
+    const auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = since_epoch / 1000000000LL;
+    spec.it_value.tv_nsec = since_epoch % 1000000000LL;
+    if (since_epoch <= 0 && !_time_wait_map.empty())
+        spec.it_value.tv_nsec = 1;  // zero would disarm the timer
+    if (timerfd_settime(_time_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL) < 0) {
+        _logger->error("Unable to arm time wait timer: {}", strerror(errno));
+        return;
     }
-    _logger->trace("time_thread_loop - terminate");
+    _time_armed = deadline;
+}
+
+void Exe_Service::on_time_timer() {
+    uint64_t expirations = 0;
+    if (read(_time_fd, &expirations, sizeof(expirations)) < 0 && errno == ECANCELED)
+        _logger->debug("System clock changed - re-evaluating time waits");
+    fire_time_waits();
+}
+
+void Exe_Service::fire_time_waits() {
+    static MQ_System::Histogram& lateness = MQ_System::Metrics::Instance().GetHistogram("mq_lua_time_wait_lateness_seconds", "Delay of Lua time waits after their deadline");
+    std::unique_lock<std::mutex> time_lock(_time_mutex);
+    const auto now = ExeClock::Now();
+    for (auto it = _time_wait_map.begin(); it != _time_wait_map.end() && it->first <= now; it = _time_wait_map.erase(it))
+        if (it->second) {
+            _logger->trace("time_map event!");
+            lateness.Record(now - it->first);
+            wake_script(it->second);
+        }
+    _time_armed = std::chrono::system_clock::time_point();  // timer is disarmed (one-shot) or cancelled
+    arm_time_timer();
 }
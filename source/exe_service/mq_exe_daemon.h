@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2018-2019
-// Version: 18062019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -14,7 +14,11 @@
 #include <json-c/json_tokener.h>  // JSON format translation (reading)
 
 #include <array>  // for constant C++11 iterable arrays
+#include <cstdio>
 #include <thread>
+#include <deque>
+#include <list>
+#include <map>
 #include <unordered_set>
 #include <unordered_map>
 #include <condition_variable>
@@ -22,93 +26,194 @@
 #include <mutex>
 #include <atomic>
 #include <future>       // future
+#include <memory>
 #include "mq_lib.h"  // MQ_System utility library
+#include "value_table.h"
+#include "rule_engine.h"
+#include "exe_clock.h"
+#include "time_schedule.h"
 
 class Exe_Service : public MQ_System::Daemon {
 public:
-    Exe_Service();
+    explicit Exe_Service(bool offline = false);  // offline - simulation only (no MQTT)
     virtual ~Exe_Service() noexcept;
     void main();
+    // runs scripts and rules of db_uri on virtual time from start, fed by capture (mq_replay_bench format) for duration
+    // (0 - till the capture ends); every published message is reported to output with its virtual time; returns exit code
+    int simulate(const std::string& db_uri, const std::string& capture, std::chrono::system_clock::time_point start, std::chrono::seconds duration, std::FILE* output);
     virtual void CallBack(const std::string& topic, const std::string& message) override;
+    virtual void OnConfigChanged() override;
     int register_sensor(lua_State *l);
     int req_value(lua_State *l);
+    int req_stats(lua_State *l);
     int wait(lua_State * l, bool);
+    int wait_condition(lua_State * l, bool change);  // wait_until / wait_change
+    int wait_condition_result(lua_State * l, uint32_t id);  // continuation of wait_condition
     int print(lua_State * l, bool);
     int write_value(lua_State * l, bool);
-    void time_thread_loop();
-    void thread_start(lua_State *lua_state, const std::string& script_name);
+    int write_values(lua_State * l, bool);  // table of values - one message per sensor
+    void worker_loop();
     int set_global(lua_State * l);
     int get_global(lua_State * l);
+    void script_hook(lua_State * l);  // instruction count hook - preemption and CPU limit
 
  private:
-    struct SynchronizationObject {
-        SynchronizationObject():num(0){}
-        std::condition_variable cond_var;
-        std::atomic<size_t> num;
+    // scripts may share Lua states (lua_shared_states) - every script has its own _ENV table, procedures are shared (read only)
+    // runaway script protection - cpu is CPU time a script may use without waiting (0 - unlimited), memory is Lua memory of
+    // one script (shared state gets it per script it runs) in bytes (0 - unlimited)
+    struct ScriptLimits {
+        std::chrono::nanoseconds cpu;
+        size_t memory;
     };
 
-    class LuaValue {
-    public:
-        enum class LuaType {
-            NUMBER,
-            BOOLEAN,
-        };
-
-        inline explicit LuaValue(bool b) : luatype_{ LuaType::BOOLEAN }, value_{ b } {}
-        inline explicit LuaValue(lua_Number n) : luatype_{ LuaType::NUMBER }, value_{ n } {}
-        
-        inline LuaType get_type() const noexcept { return luatype_; }
-        inline bool get_value_bool() const noexcept {assert(get_type() == LuaType::BOOLEAN); return value_.boolean; }
-        inline bool get_value_number() const noexcept {assert(get_type() == LuaType::NUMBER); return value_.number; }
-    private:
-        const LuaType luatype_;
-        const union U {
-            inline explicit U(bool b) : boolean {b} {}
-            inline explicit U(lua_Number n) :number {n} {}
-            bool boolean;
-            lua_Number number;
-        } value_;
+    struct SharedState {
+        lua_State* state;
+        std::mutex mutex;  // Lua state is single threaded - its scripts are resumed (and created/closed) one at a time
+        size_t scripts;
+        MQ_System::Gauge* memory_gauge;  // mq_lua_shared_state_memory_bytes_<index> - scripts of the state together
     };
 
-    static const std::array<std::string, 1 > kTableDefinitions;
-    static const std::array<std::string, 1 > kStatementDefinitions;
-    static const uint64_t flush_interval;
+    // script main function runs as Lua coroutine - wait_and/wait_or yield and worker pool resumes script when the events fire
+    // so waiting script costs just its Lua memory (no thread); scheduling fields are guarded by _scheduler_mutex
+    // (wait_required is written only while no event source references the script)
+    struct Script {
+        std::string name;
+        uint64_t hash;  // source hash - reload restarts script only if it changed
+        std::vector<std::string> values;  // register_value dependencies (status/<sensor>:<value>)
+        lua_State* state;  // own Lua state or shared one
+        lua_State* coroutine;  // anchored on own state stack or in shared state registry
+        SharedState* shared;  // nullptr for own state
+        int reference;  // coroutine (and so _ENV) registry reference in shared state
+        std::vector<uint32_t> wait_ids;  // value events of current wait (cleared before resume)
+        std::vector<std::chrono::system_clock::time_point> wait_times;
+        std::vector<std::pair<std::string, TimeSchedule>> schedules;  // compiled time strings of the script (scripts use just few)
+        size_t wait_required;  // events necessary to resume (all for wait_and, 1 for wait_or); 0 while not waiting
+        std::atomic<size_t> wait_events;  // counted by event sources without scheduler lock
+        std::atomic<uint64_t> wait_value;  // PackedValue satisfying wait_until/wait_change condition (nil - timed out)
+        std::chrono::steady_clock::time_point wait_start;
+        bool running;  // being resumed by worker
+        bool ready;  // queued (or queued once it yields if running)
+        // fields below are used only by the worker resuming the script
+        std::chrono::steady_clock::time_point resume_start;  // wall time - preemption slice
+        std::chrono::nanoseconds resume_cpu;  // thread CPU time at resume start - CPU limit
+        std::chrono::nanoseconds cpu_time;  // total
+        std::chrono::nanoseconds cpu_since_wait;  // of resumes since the script last waited (without current one)
+        bool preempted;  // yielded by instruction hook - queued again
+        MQ_System::Counter* cpu_counter;  // mq_lua_script_cpu_microseconds_<script>
+        MQ_System::Gauge* memory_gauge;  // mq_lua_script_memory_bytes_<script> or the one of shared state
+        const char* killed;  // reason - yielded (or raised error) by instruction hook to be closed
+    };
+
+    typedef ValueTable<Script> Values;
+
+    // simulation state - scripts run in simulating thread (no workers), loop thread work runs inline
+    struct Simulation {
+        std::FILE* output;
+        std::unique_ptr<MQ_System::TimerWheel> wheel;  // rule timers on virtual time
+        std::deque<std::pair<std::string, std::string>> loopback;  // status messages scripts published (broker delivers them back)
+        uint64_t published;
+        uint64_t resumes;
+        uint64_t cpu_kills;  // scripts killed by CPU limit - CPU time differs run to run, so does the output then
+    };
+
+    // script prepared for start - bytecode and scan result are cached in the db by source hash
+    struct CompiledScript {
+        std::string name;
+        std::string source;
+        uint64_t hash;
+        std::string bytecode;  // empty until prepared (unchanged running scripts are not prepared at all)
+        std::vector<std::string> values;
+    };
+
+    static const std::array<std::string, 4 > kTableDefinitions;
+    static const std::array<std::string, 8 > kStatementDefinitions;
+    static const uint64_t flush_interval;  // default globals_flush_interval [s]
     static const std::string kReloadTopic;
 
     std::vector<sqlite3_stmt *> _statements;
     std::string _db_uri;
+    unsigned _lua_shared_states;  // 0 - every script has own Lua state
+    bool _lua_pool_allocator;
+    unsigned _globals_flush_interval;  // [s] changed globals are written to db in batches
+    ScriptLimits _script_limits;
+    std::vector<std::unique_ptr<SharedState>> _shared_states;
     sqlite3* _pDb;
     struct json_tokener* const _tokener;
 
-    void load_daemon_configuration();
+    void load_daemon_configuration(std::string& db_uri, unsigned& shared_states, bool& pool_allocator, unsigned& globals_flush_interval, ScriptLimits& limits);
+    void open_database();
     void check_and_init_database();
+    void load_globals();
+    void flush_globals();  // write-behind of changed globals (one transaction)
+    std::unique_ptr<RuleEngine> load_rules();
+    void start_rules(RuleEngine* rules);  // hands rules over to the loop thread (they replace current ones there)
+    void write_packed_value(const std::string& value_name, uint64_t value);  // set/<sensor> message (rule actions)
+    void publish(const std::string& topic, const std::string& message);  // Publish or simulation report
+    void in_loop(MQ_System::EventLoop::Callback callback);  // Loop().Post - inline in simulation and once the loop has stopped
+    MQ_System::TimerWheel& timer_wheel() noexcept { return _simulation ? *_simulation->wheel : Loop().Wheel(); }
     void load_and_run_scripts();
-    void execute_lua_script(const std::string& script_name, const std::string& script_content);
+    bool prepare_script(CompiledScript& script);
+    bool load_cached_script(CompiledScript& script);
+    void store_cached_script(const CompiledScript& script);
+    bool compile_script(CompiledScript& script);
+    void update_value_table(const std::unordered_set<std::string>& value_list, bool keep_ids);
+    bool execute_lua_script(const CompiledScript& compiled);
+    lua_State* new_lua_state();  // state with mq procedures registered
+    static void close_lua_state(lua_State* state) noexcept;
+    static void set_memory_limit(lua_State* state, size_t limit) noexcept;
+    size_t lua_memory() const noexcept;  // all script states; call with workers held
+    void create_shared_states();
     void parse_status_message(const std::string& topic, const std::string& message);
     void parse_app_message(const std::string& topic);
     void stop_all();
     void start_all();
-    bool scan_script(const std::string& content, std::unordered_set<std::string>& sensor_list);
+    void acquire_sensors(const std::vector<std::string>& values);
+    void release_sensors(const std::vector<std::string>& values);
+    void run_script(Script* script, std::unique_lock<std::mutex>& scheduler_lock);  // dequeued script; lock is released while it runs
+    void run_ready_scripts();  // simulation - runs queued scripts till none is ready
+    bool resume_script(Script& script);  // returns true if script waits (yielded) or was preempted
+    void wake_script(Script* script);  // script event fired
+    void close_script(Script& script) noexcept;
+    void clear_waits(Script& script);
+    void start_workers();
+    void stop_workers();
+    void hold_workers();  // returns once no script runs; scripts stay queued till release_workers
+    void release_workers();
+    void arm_time_timer();  // called with _time_mutex locked
+    void on_time_timer();
+    void fire_time_waits();  // wakes scripts with passed time waits and re-arms the timer
 
-    std::chrono::system_clock::time_point parse_time_string(const std::string& time_string);
-    std::vector<std::thread> _script_threads;
-    std::thread _time_thread;
+    std::chrono::system_clock::time_point next_time(Script& script, const char* text, size_t length);  // throws std::runtime_error
+    static constexpr unsigned kScriptWorkers = 4;
+    std::list<Script> _scripts;  // stable addresses - wait maps and ready queue hold pointers
+    std::vector<std::thread> _workers;
+    std::mutex _scheduler_mutex;
+    std::condition_variable _ready_cv;
+    std::condition_variable _idle_cv;  // no script is running (stop_all waits for it)
+    std::deque<Script*> _ready_scripts;
+    size_t _running_scripts;
+    bool _hold_workers;  // reload is changing scripts
+    std::atomic<bool> _preempt_scripts;  // running scripts yield at next hook (reload waits for them)
+    bool _terminate_workers;
     std::atomic<bool> _terminate_lua_threads;
-    std::atomic<bool> _terminate_time_thread;
 
-    std::mutex _map_mutex;
-    std::unordered_multimap<std::string, SynchronizationObject*> _value_wait_map;
+    // values scripts registered (with their last values and waiters); replaced on reload - old table is deleted in the loop thread
+    // once it no longer delivers messages
+    std::atomic<Values*> _value_table;
+    std::mutex _sensor_mutex;
+    std::unordered_map<std::string, unsigned> _sensor_users;  // subscribed status topic : values of active scripts from it
 
     std::mutex _time_mutex;
-    std::multimap<std::chrono::system_clock::time_point, SynchronizationObject*> _time_wait_map;  // we need (ordered) std::multimap coz it shall be sorted in order to make the sequential search in time thread possible (easy)
-
-    // there is a lot of in-memory key-value databeses :)
-    std::mutex _value_mutex;
-    std::unordered_map<std::string, double> _last_val_double_map;
-    std::unordered_map<std::string, bool> _last_val_boolean_map;
-    
-    std::mutex _global_mutex;
-    std::unordered_map<std::string, const LuaValue> _global_map;
+    std::multimap<std::chrono::system_clock::time_point, Script*> _time_wait_map;  // we need (ordered) std::multimap coz timer is armed for the earliest wait
+    int _time_fd;  // CLOCK_REALTIME timerfd (waits are wall clock) handled in the loop thread
+    std::chrono::system_clock::time_point _time_armed;  // deadline _time_fd is armed to (epoch if disarmed)
+
+    GlobalTable _globals;
+
+    std::unique_ptr<RuleEngine> _rule_engine;  // loop thread only
+    std::vector<std::string> _rule_values;  // rule inputs with acquired sensors (reload only)
+
+    std::unique_ptr<Simulation> _simulation;  // nullptr unless simulating
 
     std::future<bool> reload_sctripts_future_;
 };
@@ -23,6 +23,8 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+time_t mq_exe_time(void);  /* exe_clock.cpp - current time of scripts (virtual in simulation) */
+
 /*
 ** {==================================================================
 ** List of valid conversion specifiers for the 'strftime' function;
@@ -185,7 +187,7 @@ static const char *checkoption (lua_State *L, const char *conv, ptrdiff_t convle
 int os_date (lua_State *L) {
   size_t slen;
   const char *s = luaL_optlstring(L, 1, "%c", &slen);
-  time_t t = luaL_opt(L, l_checktime, 2, time(NULL));
+  time_t t = luaL_opt(L, l_checktime, 2, mq_exe_time());
   const char *se = s + slen;  /* 's' end */
   struct tm tmr, *stm;
   if (*s == '!') {  /* UTC? */
@@ -225,7 +227,7 @@ int os_date (lua_State *L) {
 int os_time (lua_State *L) {
   time_t t;
   if (lua_isnoneornil(L, 1))  /* called without args? */
-    t = time(NULL);  /* get current time */
+    t = mq_exe_time();  /* get current time */
   else {
     struct tm ts;
     luaL_checktype(L, 1, LUA_TTABLE);
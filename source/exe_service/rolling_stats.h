@@ -0,0 +1,90 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// RollingWindow keeps count / min / max / average of a value over last span (request_stats). Span is split to kBuckets
+// buckets tagged by their absolute number so memory is constant, adding a sample is O(1) and expired buckets are just
+// skipped (query is O(kBuckets)). Window moves by whole buckets - it covers span plus up to one bucket (span / kBuckets).
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+class RollingWindow {
+ public:
+    typedef std::chrono::steady_clock Clock;
+    enum : unsigned { kBuckets = 60 };  // enumerator - chrono operators take it by reference
+
+    struct Stats {
+        uint64_t count;
+        double min;
+        double max;
+        double sum;
+    };
+
+    explicit RollingWindow(std::chrono::milliseconds span) : _span(span), _width(span / kBuckets) {
+        for (auto&& bucket : _buckets)
+            bucket.number = kEmpty;
+    }
+
+    std::chrono::milliseconds Span() const noexcept { return _span; }
+
+    void Add(Clock::time_point now, double value) noexcept {
+        const uint64_t number = bucket_number(now);
+        auto& bucket = _buckets[number % kBuckets];
+        if (bucket.number != number) {
+            bucket.number = number;
+            bucket.count = 0;
+            bucket.min = std::numeric_limits<double>::infinity();
+            bucket.max = -std::numeric_limits<double>::infinity();
+            bucket.sum = 0.0;
+        }
+        ++bucket.count;
+        bucket.sum += value;
+        if (value < bucket.min)
+            bucket.min = value;
+        if (value > bucket.max)
+            bucket.max = value;
+    }
+
+    Stats Get(Clock::time_point now) const noexcept {
+        Stats stats = {0, std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 0.0};
+        const uint64_t last = bucket_number(now);
+        for (const auto& bucket : _buckets) {
+            if (bucket.number == kEmpty || bucket.number + kBuckets <= last)
+                continue;  // expired
+            stats.count += bucket.count;
+            stats.sum += bucket.sum;
+            if (bucket.min < stats.min)
+                stats.min = bucket.min;
+            if (bucket.max > stats.max)
+                stats.max = bucket.max;
+        }
+        return stats;
+    }
+
+ private:
+    enum : uint64_t { kEmpty = UINT64_MAX };
+
+    struct Bucket {
+        uint64_t number;  // absolute bucket number (time / width)
+        uint64_t count;
+        double min;
+        double max;
+        double sum;
+    };
+
+    uint64_t bucket_number(Clock::time_point now) const noexcept {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) / _width);
+    }
+
+    std::chrono::milliseconds _span;
+    std::chrono::milliseconds _width;
+    std::array<Bucket, kBuckets> _buckets;
+};
@@ -0,0 +1,585 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+
+#include "rule_engine.h"
+
+#include <algorithm>  // std::push_heap
+#include <cctype>
+#include <cstdlib>  // strtod
+#include <cstring>
+#include <functional>  // std::greater
+#include <stdexcept>
+
+#include "metrics.h"
+#include "value_table.h"  // PackedValue, valid_value_name
+
+constexpr uint32_t RuleEngine::kNone;
+
+namespace {
+
+MQ_System::Counter& rule_actions() {
+    static MQ_System::Counter& counter = MQ_System::Metrics::Instance().GetCounter("mq_rule_actions_total", "Values written by rule actions");
+    return counter;
+}
+
+bool is_number(uint64_t value) noexcept {
+    return !PackedValue::IsNil(value) && !PackedValue::IsBoolean(value);
+}
+
+bool word_character(char character) noexcept {
+    return (character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z') || (character >= '0' && character <= '9') ||
+        character == '_' || character == '/' || character == ':';
+}
+
+}  // namespace
+
+// recursive descent parser - nodes are created after their operands so node order is topological
+class RuleEngine::Parser {
+ public:
+    Parser(RuleEngine& engine, const std::string& text) : _engine(engine), _text(text), _position(0) {}
+
+    void ParseRule(Rule& rule) {
+        expect_word("when");
+        uint32_t condition = parse_or();
+        if (accept_word("for")) {
+            const auto duration = parse_duration();
+            condition = _engine.add_node(Kind::kFor, condition);
+            _engine._nodes[condition].state = _engine._delays.size();
+            _engine._delays.push_back(Delay{duration, MQ_System::TimerWheel::kInvalidTimer});
+        }
+        expect_word("then");
+        rule.actions = _engine._actions.size();
+        rule.then_count = parse_actions();
+        rule.else_count = accept_word("else") ? parse_actions() : 0;
+        skip_space();
+        if (_position != _text.size())
+            fail("unexpected text after the rule");
+        const auto node = _engine.add_node(Kind::kRule, condition);
+        _engine._nodes[node].state = _engine._rules.size();
+        rule.last_node = node;
+    }
+
+ private:
+    enum class TokenType { kEnd, kWord, kName, kNumber, kSymbol };
+    struct Token {
+        TokenType type;
+        std::string text;  // word, name (<sensor>:<value>), symbol or unit of number
+        double number;
+    };
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error(message + " at " + std::to_string(_position + 1));
+    }
+
+    void skip_space() noexcept {
+        while (_position < _text.size() && isspace(static_cast<unsigned char>(_text[_position])))
+            ++_position;
+    }
+
+    Token peek() {
+        const auto position = _position;
+        const auto token = next();
+        _position = position;
+        return token;
+    }
+
+    Token next() {
+        skip_space();
+        Token token{TokenType::kEnd, std::string(), 0};
+        if (_position == _text.size())
+            return token;
+        const char* start = _text.c_str() + _position;
+        const char first = *start;
+        if ((first >= '0' && first <= '9') || first == '.' || (first == '-' && _position + 1 < _text.size() && ((start[1] >= '0' && start[1] <= '9') || start[1] == '.'))) {
+            char* end = nullptr;
+            token.number = strtod(start, &end);
+            if (end == start)
+                fail("malformed number");
+            _position += end - start;
+            while (_position < _text.size() && isalpha(static_cast<unsigned char>(_text[_position])))
+                token.text += _text[_position++];
+            token.type = TokenType::kNumber;
+            return token;
+        }
+        if (word_character(first)) {
+            while (_position < _text.size() && word_character(_text[_position]))
+                token.text += _text[_position++];
+            token.type = token.text.find(':') == std::string::npos ? TokenType::kWord : TokenType::kName;
+            if (token.type == TokenType::kName && !valid_value_name(token.text.data(), token.text.size()))
+                fail("value " + token.text + " does not match sensor:value format");
+            return token;
+        }
+        static const char* const kSymbols[] = {"<=", ">=", "==", "~=", "<", ">", "(", ")", ",", "="};
+        for (const auto symbol : kSymbols)
+            if (!_text.compare(_position, strlen(symbol), symbol)) {
+                token.type = TokenType::kSymbol;
+                token.text = symbol;
+                _position += token.text.size();
+                return token;
+            }
+        fail(std::string("unexpected character '") + first + "'");
+    }
+
+    bool accept_word(const char* word) {
+        const auto token = peek();
+        if (token.type != TokenType::kWord || token.text != word)
+            return false;
+        next();
+        return true;
+    }
+
+    bool accept_symbol(const char* symbol) {
+        const auto token = peek();
+        if (token.type != TokenType::kSymbol || token.text != symbol)
+            return false;
+        next();
+        return true;
+    }
+
+    void expect_word(const char* word) {
+        if (!accept_word(word))
+            fail(std::string("'") + word + "' expected");
+    }
+
+    void expect_symbol(const char* symbol) {
+        if (!accept_symbol(symbol))
+            fail(std::string("'") + symbol + "' expected");
+    }
+
+    double expect_number() {
+        const auto token = next();
+        if (token.type != TokenType::kNumber || !token.text.empty())
+            fail("number expected");
+        return token.number;
+    }
+
+    std::chrono::milliseconds parse_duration() {
+        const auto token = next();
+        if (token.type != TokenType::kNumber || token.number < 0)
+            fail("duration expected");
+        double milliseconds = token.number;
+        if (token.text == "s")
+            milliseconds *= 1000;
+        else if (token.text == "m")
+            milliseconds *= 60 * 1000;
+        else if (token.text == "h")
+            milliseconds *= 60 * 60 * 1000;
+        else if (token.text != "ms")
+            fail("duration unit (ms, s, m, h) expected");
+        return std::chrono::milliseconds(static_cast<int64_t>(milliseconds));
+    }
+
+    uint32_t parse_or() {
+        uint32_t left = parse_and();
+        while (accept_word("or"))
+            left = _engine.add_node(Kind::kOr, left, parse_and());
+        return left;
+    }
+
+    uint32_t parse_and() {
+        uint32_t left = parse_unary();
+        while (accept_word("and"))
+            left = _engine.add_node(Kind::kAnd, left, parse_unary());
+        return left;
+    }
+
+    uint32_t parse_unary() {
+        if (accept_word("not"))
+            return _engine.add_node(Kind::kNot, parse_unary());
+        return parse_comparison();
+    }
+
+    uint32_t parse_comparison() {
+        const uint32_t left = parse_term();
+        static const std::pair<const char*, Compare> kOperators[] = {{"<", Compare::kLess}, {"<=", Compare::kLessEqual},
+            {">", Compare::kGreater}, {">=", Compare::kGreaterEqual}, {"==", Compare::kEqual}, {"~=", Compare::kNotEqual}};
+        const auto token = peek();
+        if (token.type != TokenType::kSymbol)
+            return left;
+        for (const auto& compare : kOperators) {
+            if (token.text != compare.first)
+                continue;
+            next();
+            const uint32_t node = _engine.add_node(Kind::kCompare, left, parse_term());
+            _engine._nodes[node].compare = compare.second;
+            if (accept_word("hysteresis")) {
+                if (compare.second == Compare::kEqual || compare.second == Compare::kNotEqual)
+                    fail("hysteresis of equality");
+                const double band = expect_number();
+                if (band < 0)
+                    fail("negative hysteresis");
+                _engine._nodes[node].parameter = band;
+            }
+            return node;
+        }
+        return left;
+    }
+
+    uint32_t parse_term() {
+        const auto token = next();
+        switch (token.type) {
+            case TokenType::kNumber:
+                if (!token.text.empty())
+                    fail("unit of number in condition");
+                return _engine.constant_node(PackedValue::Number(token.number));
+            case TokenType::kName:
+                return _engine.input_node(token.text);
+            case TokenType::kWord:
+                if (token.text == "true" || token.text == "false")
+                    return _engine.constant_node(PackedValue::Boolean(token.text == "true"));
+                if (token.text == "avg") {
+                    expect_symbol("(");
+                    const auto name = next();
+                    if (name.type != TokenType::kName)
+                        fail("value expected");
+                    const uint32_t input = _engine.input_node(name.text);
+                    expect_symbol(",");
+                    const double window = expect_number();
+                    if (window < 1 || window > 1024 || window != static_cast<uint32_t>(window))
+                        fail("avg samples must be integer 1 - 1024");
+                    expect_symbol(")");
+                    const uint32_t node = _engine.add_node(Kind::kAverage, input);
+                    _engine._nodes[node].state = _engine._averages.size();
+                    _engine._averages.push_back(Average{static_cast<uint32_t>(_engine._samples.size()), static_cast<uint32_t>(window), 0, 0, 0});
+                    _engine._samples.resize(_engine._samples.size() + static_cast<uint32_t>(window));
+                    return node;
+                }
+                fail("unexpected word " + token.text);
+            case TokenType::kSymbol:
+                if (token.text == "(") {
+                    const uint32_t node = parse_or();
+                    expect_symbol(")");
+                    return node;
+                }
+                fail("unexpected " + token.text);
+            default:
+                fail("unexpected end of the rule");
+        }
+    }
+
+    uint32_t parse_actions() {
+        uint32_t count = 0;
+        do {
+            const auto name = next();
+            if (name.type != TokenType::kName)
+                fail("action value expected");
+            expect_symbol("=");
+            const auto value = next();
+            uint32_t source = kNone;
+            if (value.type == TokenType::kNumber && value.text.empty())
+                source = _engine.constant_node(PackedValue::Number(value.number));
+            else if (value.type == TokenType::kWord && (value.text == "true" || value.text == "false"))
+                source = _engine.constant_node(PackedValue::Boolean(value.text == "true"));
+            else if (value.type == TokenType::kName)
+                source = _engine.input_node(value.text);
+            else
+                fail("action value must be number, true, false or sensor:value");
+            _engine._actions.push_back(Action{name.text, source});
+            ++count;
+        } while (accept_symbol(","));
+        return count;
+    }
+
+    RuleEngine& _engine;
+    const std::string& _text;
+    size_t _position;
+};
+
+RuleEngine::RuleEngine(Write write) : _write(std::move(write)), _table(nullptr), _wheel(nullptr) {}
+
+RuleEngine::~RuleEngine() {
+    if (_wheel == nullptr)
+        return;
+    for (const auto& delay : _delays)
+        if (delay.timer != MQ_System::TimerWheel::kInvalidTimer)
+            _wheel->Cancel(delay.timer);
+}
+
+bool RuleEngine::Add(const std::string& name, const std::string& text, std::string& error) {
+    const auto nodes = _nodes.size(), samples = _samples.size(), averages = _averages.size(), delays = _delays.size();
+    const auto actions = _actions.size(), values = _value_names.size();
+    Rule rule{name, text, static_cast<uint32_t>(nodes), 0, 0, 0, 0};
+    try {
+        Parser(*this, text).ParseRule(rule);
+    } catch (const std::exception& parse_error) {  // roll back what the rule added
+        error = parse_error.what();
+        _nodes.resize(nodes);
+        _samples.resize(samples);
+        _averages.resize(averages);
+        _delays.resize(delays);
+        _actions.resize(actions);
+        for (auto i = values; i < _value_names.size(); ++i)
+            _input_index.erase(_value_names[i]);
+        _value_names.resize(values);
+        _inputs.resize(values);
+        return false;
+    }
+    _rules.push_back(std::move(rule));
+    return true;
+}
+
+size_t RuleEngine::Memory() const noexcept {
+    size_t memory = sizeof(*this) + _nodes.capacity() * sizeof(Node) + _dependents.capacity() * sizeof(uint32_t);
+    memory += _averages.capacity() * sizeof(Average) + _samples.capacity() * sizeof(double) + _delays.capacity() * sizeof(Delay);
+    memory += _actions.capacity() * sizeof(Action) + _rules.capacity() * sizeof(Rule) + _inputs.capacity() * sizeof(uint32_t);
+    for (const auto& action : _actions)
+        memory += action.value_name.capacity();
+    for (const auto& rule : _rules)
+        memory += rule.name.capacity() + rule.text.capacity();
+    for (const auto& value_name : _value_names)
+        memory += 2 * value_name.capacity();  // + index key
+    return memory;
+}
+
+uint32_t RuleEngine::add_node(Kind kind, uint32_t left, uint32_t right) {
+    _nodes.push_back(Node{kind, Compare::kEqual, {left, right}, kNone, 0, 0, 0, PackedValue::kNil});
+    return _nodes.size() - 1;
+}
+
+uint32_t RuleEngine::input_node(const std::string& value_name) {
+    const auto input = _input_index.find("status/" + value_name);
+    if (input != _input_index.end())
+        return _inputs[input->second];
+    _input_index.emplace("status/" + value_name, _value_names.size());
+    _value_names.push_back("status/" + value_name);
+    _inputs.push_back(add_node(Kind::kInput));
+    return _inputs.back();
+}
+
+uint32_t RuleEngine::constant_node(uint64_t value) {
+    const uint32_t node = add_node(Kind::kConstant);
+    _nodes[node].value = value;
+    return node;
+}
+
+void RuleEngine::link_dependents() {  // compressed adjacency - dependents of node i are _dependents[dependents, +count)
+    for (auto&& node : _nodes)
+        for (const auto operand : node.operands)
+            if (operand != kNone)
+                ++_nodes[operand].dependent_count;
+    uint32_t offset = 0;
+    for (auto&& node : _nodes) {
+        node.dependents = offset;
+        offset += node.dependent_count;
+        node.dependent_count = 0;
+    }
+    _dependents.resize(offset);
+    for (uint32_t index = 0; index < _nodes.size(); ++index)
+        for (const auto operand : _nodes[index].operands)
+            if (operand != kNone) {
+                auto& node = _nodes[operand];
+                _dependents[node.dependents + node.dependent_count++] = index;
+            }
+}
+
+void RuleEngine::Start(const void* table, const std::vector<uint32_t>& ids, const std::vector<uint64_t>& values, MQ_System::TimerWheel& wheel, const RuleEngine* previous) {
+    _table = table;
+    _wheel = &wheel;
+    link_dependents();
+    _queued.assign(_nodes.size(), false);
+    for (size_t i = 0; i < _inputs.size() && i < ids.size(); ++i) {
+        _nodes[_inputs[i]].value = values[i];
+        _input_by_id[ids[i]] = _inputs[i];
+    }
+    std::vector<bool> carried(_nodes.size(), false);
+    if (previous != nullptr)
+        carry_state(*previous, carried);
+    for (uint32_t index = 0; index < _nodes.size(); ++index) {  // initial evaluation in topological order
+        auto& node = _nodes[index];
+        if (node.kind == Kind::kInput || node.kind == Kind::kConstant || (node.kind == Kind::kAverage && carried[index]))
+            continue;
+        const auto value = evaluate(index);
+        if (value == node.value)
+            continue;
+        node.value = value;
+        if (node.kind == Kind::kRule)
+            fire(node);
+    }
+}
+
+// rule with the same name and text has the same sequence of non-input nodes (inputs are shared by rules so they may be created
+// by earlier rule) - their values (and average samples) are taken over
+void RuleEngine::carry_state(const RuleEngine& previous, std::vector<bool>& carried) {
+    std::unordered_map<std::string, const Rule*> previous_rules;
+    for (const auto& rule : previous._rules)
+        previous_rules.emplace(rule.name, &rule);
+    auto rule_nodes = [](const RuleEngine& engine, const Rule& rule) {
+        std::vector<uint32_t> nodes;
+        for (uint32_t index = rule.first_node; index <= rule.last_node; ++index)
+            if (engine._nodes[index].kind != Kind::kInput)
+                nodes.push_back(index);
+        return nodes;
+    };
+    for (const auto& rule : _rules) {
+        const auto old = previous_rules.find(rule.name);
+        if (old == previous_rules.end() || old->second->text != rule.text)
+            continue;
+        const auto nodes = rule_nodes(*this, rule);
+        const auto old_nodes = rule_nodes(previous, *old->second);
+        if (nodes.size() != old_nodes.size())
+            continue;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            auto& node = _nodes[nodes[i]];
+            const auto& old_node = previous._nodes[old_nodes[i]];
+            node.value = old_node.value;
+            carried[nodes[i]] = true;
+            if (node.kind != Kind::kAverage)
+                continue;
+            auto& average = _averages[node.state];
+            const auto& old_average = previous._averages[old_node.state];
+            std::copy(previous._samples.begin() + old_average.samples, previous._samples.begin() + old_average.samples + old_average.window,
+                _samples.begin() + average.samples);
+            average.count = old_average.count;
+            average.position = old_average.position;
+            average.sum = old_average.sum;
+        }
+    }
+}
+
+void RuleEngine::OnValue(uint32_t id, uint64_t value) {
+    const auto input = _input_by_id.find(id);
+    if (input == _input_by_id.end())
+        return;
+    _nodes[input->second].value = value;
+    changed(input->second);  // even if the value is the same - averages count samples
+    run();
+}
+
+void RuleEngine::changed(uint32_t index) {
+    const auto& node = _nodes[index];
+    for (uint32_t i = node.dependents; i < node.dependents + node.dependent_count; ++i) {
+        const auto dependent = _dependents[i];
+        if (_queued[dependent])
+            continue;
+        _queued[dependent] = true;
+        _queue.push_back(dependent);
+        std::push_heap(_queue.begin(), _queue.end(), std::greater<uint32_t>());
+    }
+}
+
+void RuleEngine::run() {
+    while (!_queue.empty()) {
+        std::pop_heap(_queue.begin(), _queue.end(), std::greater<uint32_t>());
+        const auto index = _queue.back();
+        _queue.pop_back();
+        _queued[index] = false;
+        const auto value = evaluate(index);
+        auto& node = _nodes[index];
+        if (value == node.value)
+            continue;
+        node.value = value;
+        if (node.kind == Kind::kRule)
+            fire(node);
+        else
+            changed(index);
+    }
+}
+
+uint64_t RuleEngine::evaluate(uint32_t index) {
+    auto& node = _nodes[index];
+    const uint64_t left = node.operands[0] == kNone ? PackedValue::kNil : _nodes[node.operands[0]].value;
+    const uint64_t right = node.operands[1] == kNone ? PackedValue::kNil : _nodes[node.operands[1]].value;
+    switch (node.kind) {
+        case Kind::kCompare: {
+            if (PackedValue::IsBoolean(left) && PackedValue::IsBoolean(right)) {
+                if (node.compare == Compare::kEqual || node.compare == Compare::kNotEqual)
+                    return PackedValue::Boolean((left == right) == (node.compare == Compare::kEqual));
+                return PackedValue::kNil;
+            }
+            if (!is_number(left) || !is_number(right))
+                return PackedValue::kNil;
+            const double x = PackedValue::ToNumber(left);
+            const double threshold = PackedValue::ToNumber(right);
+            const double band = node.value == PackedValue::kTrue ? node.parameter : 0;  // true holds till x leaves the band
+            switch (node.compare) {
+                case Compare::kLess:
+                    return PackedValue::Boolean(x < threshold + band);
+                case Compare::kLessEqual:
+                    return PackedValue::Boolean(x <= threshold + band);
+                case Compare::kGreater:
+                    return PackedValue::Boolean(x > threshold - band);
+                case Compare::kGreaterEqual:
+                    return PackedValue::Boolean(x >= threshold - band);
+                case Compare::kEqual:
+                    return PackedValue::Boolean(x == threshold);
+                case Compare::kNotEqual:
+                    return PackedValue::Boolean(x != threshold);
+            }
+            return PackedValue::kNil;
+        }
+        case Kind::kAnd:
+            if (left == PackedValue::kFalse || right == PackedValue::kFalse)
+                return PackedValue::kFalse;
+            return left == PackedValue::kTrue && right == PackedValue::kTrue ? PackedValue::kTrue : PackedValue::kNil;
+        case Kind::kOr:
+            if (left == PackedValue::kTrue || right == PackedValue::kTrue)
+                return PackedValue::kTrue;
+            return left == PackedValue::kFalse && right == PackedValue::kFalse ? PackedValue::kFalse : PackedValue::kNil;
+        case Kind::kNot:
+            return PackedValue::IsBoolean(left) ? PackedValue::Boolean(left == PackedValue::kFalse) : PackedValue::kNil;
+        case Kind::kAverage: {
+            auto& average = _averages[node.state];
+            if (is_number(left)) {
+                double& sample = _samples[average.samples + average.position];
+                if (average.count == average.window)
+                    average.sum -= sample;
+                else
+                    ++average.count;
+                sample = PackedValue::ToNumber(left);
+                average.sum += sample;
+                average.position = (average.position + 1) % average.window;
+            }
+            return average.count ? PackedValue::Number(average.sum / average.count) : PackedValue::kNil;
+        }
+        case Kind::kFor: {
+            auto& delay = _delays[node.state];
+            if (left != PackedValue::kTrue) {
+                if (delay.timer != MQ_System::TimerWheel::kInvalidTimer)
+                    _wheel->Cancel(delay.timer);
+                delay.timer = MQ_System::TimerWheel::kInvalidTimer;
+                return left;
+            }
+            if (node.value == PackedValue::kTrue || delay.timer != MQ_System::TimerWheel::kInvalidTimer)
+                return node.value;
+            if (delay.duration.count() == 0)
+                return PackedValue::kTrue;
+            delay.timer = _wheel->Add(delay.duration, std::chrono::milliseconds(0), [this, index] { on_delay(index); });
+            return PackedValue::kFalse;  // not held long enough yet
+        }
+        case Kind::kRule:
+            return left;
+        default:  // inputs and constants are set directly
+            return node.value;
+    }
+}
+
+void RuleEngine::on_delay(uint32_t index) {
+    auto& node = _nodes[index];
+    _delays[node.state].timer = MQ_System::TimerWheel::kInvalidTimer;
+    if (_nodes[node.operands[0]].value != PackedValue::kTrue || node.value == PackedValue::kTrue)
+        return;
+    node.value = PackedValue::kTrue;
+    changed(index);
+    run();
+}
+
+void RuleEngine::fire(const Node& node) {
+    if (!PackedValue::IsBoolean(node.value))
+        return;
+    const auto& rule = _rules[node.state];
+    const uint32_t first = rule.actions + (node.value == PackedValue::kTrue ? 0 : rule.then_count);
+    const uint32_t count = node.value == PackedValue::kTrue ? rule.then_count : rule.else_count;
+    for (uint32_t i = first; i < first + count; ++i) {
+        const auto value = _nodes[_actions[i].source].value;
+        if (PackedValue::IsNil(value))
+            continue;  // source value was not received yet
+        rule_actions().Increment();
+        _write(_actions[i].value_name, value);
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// RuleEngine runs declarative rules (exe db table rule) - simple automations that need no Lua state and no worker:
+//   when <condition> [for <duration>] then <action>[, <action>...] [else <action>[, <action>...]]
+//   condition - or / and / not of comparisons (<, <=, >, >=, ==, ~=) of values, numbers, true, false and avg(<value>, <samples>);
+//               comparison may end with "hysteresis <band>" (<, <=, >, >= only); value alone is boolean condition
+//   duration  - number with unit ms, s, m or h; condition has to hold that long
+//   action    - <sensor>:<value> = <number> | true | false | <sensor>:<value>
+// Then actions are written when the condition becomes true, else actions when it becomes false (unknown - nil - does nothing).
+// Rules compile to one dataflow graph - nodes are numbered in topological order (operands first) so a value change
+// re-evaluates only nodes depending on it, in order. Node values are PackedValue (nil, boolean, number).
+// Building (Add) may run in any thread; once started the engine is used by the loop thread only (values, timer wheel).
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "timer_wheel.h"
+
+class RuleEngine {
+ public:
+    typedef std::function<void(const std::string& value_name, uint64_t value)> Write;  // value_name is <sensor>:<value>
+
+    explicit RuleEngine(Write write);
+    ~RuleEngine();  // cancels its timers - destroy in the loop thread once started
+    RuleEngine(const RuleEngine&) = delete;
+    RuleEngine& operator=(const RuleEngine&) = delete;
+
+    bool Add(const std::string& name, const std::string& text, std::string& error);  // rule is not added on error
+    const std::vector<std::string>& Values() const noexcept { return _value_names; }  // status/<sensor>:<value> the rules read
+    size_t Rules() const noexcept { return _rules.size(); }
+    size_t Nodes() const noexcept { return _nodes.size(); }
+    size_t Memory() const noexcept;  // approximate bytes of the graph
+
+    // binds Values()[i] to value table id @ids[i] with current value @values[i] and evaluates all the rules; rules with the
+    // same text in @previous keep their output (their actions are not written again). @table only tags which table ids are from.
+    void Start(const void* table, const std::vector<uint32_t>& ids, const std::vector<uint64_t>& values, MQ_System::TimerWheel& wheel, const RuleEngine* previous);
+    bool Serves(const void* table) const noexcept { return table == _table; }
+    void OnValue(uint32_t id, uint64_t value);
+
+ private:
+    enum class Kind : uint8_t { kInput, kConstant, kCompare, kAnd, kOr, kNot, kAverage, kFor, kRule };
+    enum class Compare : uint8_t { kLess, kLessEqual, kGreater, kGreaterEqual, kEqual, kNotEqual };
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    struct Node {
+        Kind kind;
+        Compare compare;
+        uint32_t operands[2];  // node indices (kNone if unused)
+        uint32_t state;  // kAverage - _averages, kFor - _delays, kRule - _rules index
+        uint32_t dependents;  // first index in _dependents
+        uint32_t dependent_count;
+        double parameter;  // kCompare hysteresis band, kConstant value is in value
+        uint64_t value;  // PackedValue
+    };
+    struct Average {
+        uint32_t samples;  // first index in _samples
+        uint32_t window;
+        uint32_t count;
+        uint32_t position;
+        double sum;
+    };
+    struct Delay {
+        std::chrono::milliseconds duration;
+        MQ_System::TimerWheel::TimerId timer;
+    };
+    struct Action {
+        std::string value_name;  // <sensor>:<value>
+        uint32_t source;  // node giving the value
+    };
+    struct Rule {
+        std::string name;
+        std::string text;
+        uint32_t first_node;  // nodes of the rule are [first_node, last_node] (its rule node is the last one)
+        uint32_t last_node;
+        uint32_t actions;  // first index in _actions - then actions first, else actions follow
+        uint32_t then_count;
+        uint32_t else_count;
+    };
+
+    class Parser;
+
+    uint32_t add_node(Kind kind, uint32_t left = kNone, uint32_t right = kNone);
+    uint32_t input_node(const std::string& value_name);
+    uint32_t constant_node(uint64_t value);
+    void link_dependents();
+    void carry_state(const RuleEngine& previous, std::vector<bool>& carried);
+    uint64_t evaluate(uint32_t index);
+    void changed(uint32_t index);  // queues dependents of the node
+    void run();  // evaluates queued nodes in topological order
+    void fire(const Node& node);
+    void on_delay(uint32_t index);
+
+    Write _write;
+    std::vector<Node> _nodes;
+    std::vector<uint32_t> _dependents;
+    std::vector<Average> _averages;
+    std::vector<double> _samples;
+    std::vector<Delay> _delays;
+    std::vector<Action> _actions;
+    std::vector<Rule> _rules;
+    std::vector<std::string> _value_names;  // input node of _value_names[i] is _inputs[i]
+    std::vector<uint32_t> _inputs;
+    std::unordered_map<std::string, uint32_t> _input_index;  // value name : _value_names index
+    std::unordered_map<uint32_t, uint32_t> _input_by_id;  // value table id : input node
+    std::vector<uint32_t> _queue;  // min-heap of node indices to evaluate
+    std::vector<bool> _queued;
+    const void* _table;
+    MQ_System::TimerWheel* _wheel;
+};
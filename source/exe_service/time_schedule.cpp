@@ -0,0 +1,193 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+#include "time_schedule.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+
+constexpr int kMaxSearchDays = 400;  // any valid calendar schedule matches within two months
+const std::runtime_error kTimeFormatError("string does not match expected format!");
+
+bool parse_word(const char*& position, const char* end, const char* word) noexcept {
+    const size_t length = strlen(word);
+    if (static_cast<size_t>(end - position) < length || memcmp(position, word, length))
+        return false;
+    position += length;
+    return true;
+}
+
+bool parse_number(const char*& position, const char* end, bool negative_allowed, long long& value) noexcept {
+    const char* digits = position;
+    if (negative_allowed && digits != end && *digits == '-')
+        ++digits;
+    const char* number_end = digits;
+    value = 0;
+    for (; number_end != end && *number_end >= '0' && *number_end <= '9'; ++number_end)
+        value = value * 10 + (*number_end - '0');
+    if (number_end == digits || number_end - digits > 9)  // 9 digits is way more than any time value
+        return false;
+    if (digits != position)
+        value = -value;
+    position = number_end;
+    return true;
+}
+
+// optional "<word><number>" field in [minimum, maximum]
+bool parse_field(const char*& position, const char* end, const char* word, long long minimum, long long maximum, int& field) {
+    if (!parse_word(position, end, word))
+        return false;
+    long long value = 0;
+    if (!parse_number(position, end, minimum < 0, value))
+        throw kTimeFormatError;
+    if (value < minimum || value > maximum)
+        throw std::runtime_error(std::string(word + 1) + "must be in range [" + std::to_string(minimum) + "..." + std::to_string(maximum) + "] & it is:" + std::to_string(value));
+    field = static_cast<int>(value);
+    return true;
+}
+
+int month_days(int year, int month) noexcept {  // struct tm year and month
+    static const int kDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    year += 1900;
+    if (month == 1 && ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0))
+        return 29;
+    return kDays[month];
+}
+
+// first instant local time reads @civil - both DST offsets are tried as mktime resolves ambiguous time either way;
+// time skipped by DST change (no offset reads it back) maps after the gap
+time_t local_time(const struct tm& civil) noexcept {
+    time_t result = -1;
+    time_t skipped = -1;
+    for (int dst = 0; dst <= 1; ++dst) {
+        struct tm probe = civil;
+        probe.tm_isdst = dst;
+        const time_t instant = ::mktime(&probe);
+        if (instant == -1)
+            continue;
+        struct tm check;
+        ::localtime_r(&instant, &check);
+        if (check.tm_mday == civil.tm_mday && check.tm_hour == civil.tm_hour && check.tm_min == civil.tm_min && check.tm_sec == civil.tm_sec) {
+            if (result == -1 || instant < result)
+                result = instant;
+        } else if (instant > skipped) {
+            skipped = instant;
+        }
+    }
+    return result != -1 ? result : skipped;
+}
+
+}  // namespace
+
+// exact format (single spaces) - it used to be checked by regular expressions
+TimeSchedule TimeSchedule::Parse(const char* text, size_t length) {
+    static const std::pair<const char*, long long> kUnits[] = {
+        {" second", 1}, {" minute", 60}, {" hour", 60 * 60}, {" day", 24 * 60 * 60}, {" week", 7 * 24 * 60 * 60}, {" month", 30 * 24 * 60 * 60}
+    };
+    const char* position = text;
+    const char* const end = text + length;
+    TimeSchedule schedule;
+    if (parse_word(position, end, "NOW ")) {
+        long long amount = 0;
+        if (!parse_number(position, end, false, amount))
+            throw kTimeFormatError;
+        for (const auto& unit : kUnits) {
+            const char* unit_end = position;
+            if (parse_word(unit_end, end, unit.first) && unit_end == end) {
+                if (!amount)
+                    throw std::runtime_error("NOW number of metric not defined or 0");
+                schedule._offset = std::chrono::seconds(amount * unit.second);
+                return schedule;
+            }
+        }
+        throw kTimeFormatError;
+    }
+    if (!parse_word(position, end, "EVERY"))
+        throw kTimeFormatError;
+    schedule._every = true;
+    if (parse_field(position, end, " MONTHDAY ", -31, 31, schedule._monthday)) {
+        if (!schedule._monthday)
+            throw std::runtime_error("MONTHDAY must be in range [1...31] or [-1...-31] & it is:0");
+    } else {
+        parse_field(position, end, " WEEKDAY ", 0, 6, schedule._weekday);
+    }
+    parse_field(position, end, " DAYHOUR ", 0, 23, schedule._dayhour);
+    parse_field(position, end, " HOURMINUTE ", 0, 59, schedule._hourminute);
+    parse_field(position, end, " MINUTESECOND ", 0, 59, schedule._minutesecond);
+    if (position != end)
+        throw kTimeFormatError;
+    return schedule;
+}
+
+TimeSchedule::Clock::time_point TimeSchedule::Next(Clock::time_point now) {
+    if (!_every)
+        return now + _offset;
+    const time_t from = Clock::to_time_t(now) + 1;  // computed from next whole second - wait is always in the future
+    if (_from && _from <= from && from <= _next)
+        return Clock::from_time_t(_next);  // nothing fires between - same result as last time
+    const time_t next = calendar() ? next_calendar(from) : next_elapsed(from);
+    _from = from;
+    _next = next;
+    return Clock::from_time_t(next);
+}
+
+bool TimeSchedule::day_matches(const struct tm& date) const noexcept {
+    if (_monthday > 0)
+        return date.tm_mday == _monthday;
+    if (_monthday < 0)
+        return date.tm_mday == month_days(date.tm_year, date.tm_mon) + _monthday + 1;
+    return _weekday == -1 || date.tm_wday == _weekday;
+}
+
+// walks local dates from the one of @from - date arithmetic runs in UTC (timegm) so it is not affected by DST
+time_t TimeSchedule::next_calendar(time_t from) const {
+    struct tm local;
+    ::localtime_r(&from, &local);
+    for (int day = 0; day < kMaxSearchDays; ++day) {
+        struct tm date = {};
+        date.tm_year = local.tm_year;
+        date.tm_mon = local.tm_mon;
+        date.tm_mday = local.tm_mday + day;
+        date.tm_hour = 12;
+        ::timegm(&date);  // normalizes the date and sets weekday
+        if (!day_matches(date))
+            continue;
+        date.tm_hour = _dayhour == -1 ? 0 : _dayhour;
+        date.tm_min = _hourminute == -1 ? 0 : _hourminute;
+        date.tm_sec = _minutesecond == -1 ? 0 : _minutesecond;
+        const time_t instant = local_time(date);
+        if (instant >= from)
+            return instant;  // earlier - passed today or first occurrence of repeated time passed (it fires once)
+    }
+    throw std::runtime_error("no time matches the schedule");
+}
+
+// position within local hour (minute) - offsets are whole minutes, so only hourly schedules see DST and odd offset zones
+time_t TimeSchedule::next_elapsed(time_t from) const {
+    if (_hourminute == -1 && _minutesecond == -1)
+        return from;  // every second
+    const int period = _hourminute == -1 ? 60 : 60 * 60;
+    const int target = (_hourminute == -1 ? 0 : _hourminute * 60) + (_minutesecond == -1 ? 0 : _minutesecond);
+    auto position = [period](time_t instant) {
+        struct tm local;
+        ::localtime_r(&instant, &local);
+        return period == 60 ? local.tm_sec : local.tm_min * 60 + local.tm_sec;
+    };
+    time_t instant = from;
+    for (int attempt = 0; attempt < 4; ++attempt) {  // offset change other than whole hours in between moves the target
+        const int current = position(instant);
+        if (current == target)
+            break;
+        instant += ((target - current) % period + period) % period;
+    }
+    return instant;
+}
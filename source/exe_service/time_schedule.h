@@ -0,0 +1,48 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// TimeSchedule is compiled wait time string - "NOW <n> <unit>" or
+// "EVERY [MONTHDAY d|WEEKDAY w] [DAYHOUR h] [HOURMINUTE m] [MINUTESECOND s]". Fields below the first given one default to 0,
+// fields above it are free - "EVERY HOURMINUTE 5" fires every hour at :05:00, "EVERY" every second.
+// Next fire time is computed in local time of the tz database (localtime_r / mktime):
+//  - schedules with a day or an hour given (DAYHOUR, WEEKDAY, MONTHDAY) are calendar ones - they fire once per matching
+//    day at its wall clock time; time skipped by DST change fires shifted by the gap (02:30 at 03:30), repeated time fires
+//    at its first occurrence only; MONTHDAY 31 skips shorter months, MONTHDAY -1 is the last day of month
+//  - others (every hour / minute / second) follow elapsed time - hourly schedule fires every real hour, in DST change too
+// Last result is kept - a script woken earlier by a value and waiting on the same schedule again gets it without computing.
+
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+
+class TimeSchedule {
+ public:
+    typedef std::chrono::system_clock Clock;
+
+    static TimeSchedule Parse(const char* text, size_t length);  // throws std::runtime_error
+    Clock::time_point Next(Clock::time_point now);  // first fire time after now (EVERY - on whole second)
+
+ private:
+    TimeSchedule() : _every(false), _offset(0), _monthday(0), _weekday(-1), _dayhour(-1), _hourminute(-1), _minutesecond(-1), _from(0), _next(0) {}
+
+    bool calendar() const noexcept { return _dayhour != -1 || _weekday != -1 || _monthday != 0; }
+    bool day_matches(const struct tm& date) const noexcept;
+    time_t next_calendar(time_t from) const;
+    time_t next_elapsed(time_t from) const;
+
+    bool _every;
+    std::chrono::seconds _offset;  // NOW
+    int _monthday;  // EVERY - 0 if not set
+    int _weekday;  // EVERY - this and following are -1 if not set
+    int _dayhour;
+    int _hourminute;
+    int _minutesecond;
+    time_t _from;  // last Next result _next is first fire time at or after _from
+    time_t _next;
+};
@@ -0,0 +1,316 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// ValueTable interns sensor values scripts use (status/<sensor>:<value>) to dense ids. Table is built from script scan before
+// scripts start and its layout is immutable while they run - only slots change. Value of a slot is a single atomic word
+// (PackedValue) so reads never lock and writes never block readers; slot lock guards just its waiters. Conditional waiters
+// (wait_until/wait_change) are woken only once the new value satisfies their ValueCondition. Slot also keeps rolling windows
+// scripts asked for (request_stats) - updated as values arrive.
+// GlobalTable keeps script globals (set_global/get_global) the same way - name index is hash table of immutable chains readers
+// walk without lock; new names are linked in place, the index is replaced only when it doubles.
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rolling_stats.h"
+
+// sensor value name as scripts use it: <sensor path>:<value> - path of word characters and '/', value of word characters
+inline bool valid_value_name(const char* name, size_t length) noexcept {
+    auto word_character = [](char character) {
+        return (character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z') || (character >= '0' && character <= '9') || character == '_';
+    };
+    size_t position = 0;
+    while (position < length && (word_character(name[position]) || name[position] == '/'))
+        ++position;
+    if (position == 0 || position == length || name[position] != ':')
+        return false;
+    const size_t value_start = ++position;
+    while (position < length && word_character(name[position]))
+        ++position;
+    return position == length && position > value_start;
+}
+
+// nil, boolean or number packed to 64 bits (NaN boxing) - numbers are stored as their bits (NaN canonical),
+// nil and booleans are NaN payloads no number uses (constants are enumerators - no out of class definition is needed)
+class PackedValue {
+ public:
+    enum : uint64_t {
+        kNil = 0xFFF9000000000000ULL,
+        kFalse = kNil + 1,
+        kTrue = kNil + 2,
+        kData = kNil + 3,  // value kept out of the word (serialized string or table - see GlobalTable)
+    };
+
+    static uint64_t Number(double number) noexcept {
+        if (number != number)
+            return kCanonicalNaN;
+        uint64_t bits;
+        std::memcpy(&bits, &number, sizeof(bits));
+        return bits;
+    }
+    static uint64_t Boolean(bool boolean) noexcept { return boolean ? kTrue : kFalse; }
+    static bool IsNil(uint64_t value) noexcept { return value == kNil; }
+    static bool IsBoolean(uint64_t value) noexcept { return value == kFalse || value == kTrue; }
+    static bool ToBoolean(uint64_t value) noexcept { return value == kTrue; }
+    static double ToNumber(uint64_t value) noexcept {
+        double number;
+        std::memcpy(&number, &value, sizeof(number));
+        return number;
+    }
+
+ private:
+    enum : uint64_t { kCanonicalNaN = 0x7FF8000000000000ULL };
+};
+
+// wait predicate evaluated by the event source (loop thread) - nil never satisfies it
+struct ValueCondition {
+    enum class Kind : uint8_t { kLess, kLessEqual, kGreater, kGreaterEqual, kEqual, kNotEqual, kChange };
+    Kind kind;
+    uint64_t operand;  // PackedValue - compared value; kChange - value when the wait started
+    double delta;  // kChange - minimal change of a number (other changes fire at once)
+
+    bool Test(uint64_t value) const noexcept {
+        if (PackedValue::IsNil(value))
+            return false;
+        const bool numbers = !PackedValue::IsBoolean(value) && !PackedValue::IsBoolean(operand) && !PackedValue::IsNil(operand);
+        switch (kind) {
+            case Kind::kEqual:
+                return numbers ? PackedValue::ToNumber(value) == PackedValue::ToNumber(operand) : value == operand;
+            case Kind::kNotEqual:
+                return numbers ? PackedValue::ToNumber(value) != PackedValue::ToNumber(operand) : value != operand;
+            case Kind::kChange:
+                return numbers ? std::fabs(PackedValue::ToNumber(value) - PackedValue::ToNumber(operand)) >= delta && value != operand : value != operand;
+            default:
+                break;
+        }
+        if (!numbers)
+            return false;  // booleans are not ordered
+        const double number = PackedValue::ToNumber(value);
+        const double reference = PackedValue::ToNumber(operand);
+        switch (kind) {
+            case Kind::kLess: return number < reference;
+            case Kind::kLessEqual: return number <= reference;
+            case Kind::kGreater: return number > reference;
+            default: return number >= reference;
+        }
+    }
+};
+
+template <typename Waiter>
+class ValueTable {
+ public:
+    typedef uint32_t ValueId;
+    static constexpr ValueId kInvalidValue = UINT32_MAX;
+
+    struct Slot {
+        explicit Slot(const std::string& slot_name) : name(slot_name), value(PackedValue::kNil) {}
+        const std::string name;
+        std::atomic<uint64_t> value;  // PackedValue - last received (nil until first value)
+        std::mutex mutex;  // guards waiters
+        std::vector<Waiter*> waiters;  // each waiter is woken once and removed
+        std::vector<std::pair<Waiter*, ValueCondition>> conditions;  // woken (and removed) once the value satisfies the condition
+        std::vector<RollingWindow> windows;  // guarded by mutex as well - one per requested span
+    };
+
+    // building - not thread safe (table is not shared yet)
+    ValueId Intern(const std::string& name) {
+        const auto result = _ids.emplace(name, static_cast<ValueId>(_slots.size()));
+        if (!result.second)
+            return result.first->second;
+        _slots.emplace_back(name);
+        const auto separator = name.rfind(':');
+        _sensors[name.substr(0, separator)].emplace_back(name.substr(separator + 1), result.first->second);
+        return result.first->second;
+    }
+
+    ValueId Find(const std::string& name) const noexcept {
+        const auto result = _ids.find(name);
+        return result == _ids.cend() ? kInvalidValue : result->second;
+    }
+
+    // sensors have just few values so linear search is faster than another hash
+    ValueId Find(const std::string& topic, const char* value_name) const noexcept {
+        const auto sensor = _sensors.find(topic);
+        if (sensor == _sensors.cend())
+            return kInvalidValue;
+        for (const auto& value : sensor->second)
+            if (!strcmp(value.first.c_str(), value_name))
+                return value.second;
+        return kInvalidValue;
+    }
+
+    Slot& operator[](ValueId id) noexcept { return _slots[id]; }
+    size_t Size() const noexcept { return _slots.size(); }
+
+ private:
+    std::deque<Slot> _slots;  // deque - slots are not movable (mutex)
+    std::unordered_map<std::string, ValueId> _ids;
+    std::unordered_map<std::string, std::vector<std::pair<std::string, ValueId>>> _sensors;  // topic : (value name, id)
+};
+
+template <typename Waiter>
+constexpr typename ValueTable<Waiter>::ValueId ValueTable<Waiter>::kInvalidValue;
+
+// globals shared by all scripts - lookup is atomic loads of the index, the bucket chain and the value; setting a known global
+// is one atomic store. Only new names take the lock - their entry is published at head of its bucket (entries never change
+// once published). Index grows by doubling - replaced indexes may still be read so they are kept until Reclaim, which the
+// owner calls when no reader can run (no script is running); without it they take at most as much as the current one.
+// Strings and tables are kept serialized (PackedValue::kData) in immutable shared buffers. Changed globals are marked dirty
+// for write-behind persistence (Flush).
+class GlobalTable {
+ public:
+    typedef std::shared_ptr<const std::string> Data;
+
+    GlobalTable() : _index(new Index(kInitialBuckets)), _dirty(false) {}
+    ~GlobalTable() {
+        Reclaim();
+        delete _index.load(std::memory_order_relaxed);
+    }
+    GlobalTable(const GlobalTable&) = delete;
+    GlobalTable& operator=(const GlobalTable&) = delete;
+
+    // @data is set for kData
+    uint64_t Get(const std::string& name, Data& data) const {
+        const Global* global = find(name);
+        return global == nullptr ? PackedValue::kNil : global->Load(data);
+    }
+
+    void Set(const std::string& name, uint64_t value, Data data = Data(), bool dirty = true) {
+        Global* global = find(name);
+        if (global == nullptr) {
+            if (PackedValue::IsNil(value))
+                return;  // nil is not stored - unknown global reads as nil anyway
+            std::unique_lock<std::mutex> lock(_mutex);
+            global = find(name);  // other writer may have added it meanwhile
+            if (global == nullptr) {
+                _globals.emplace_back(name);
+                global = &_globals.back();
+                Index* index = const_cast<Index*>(_index.load(std::memory_order_relaxed));  // writers are serialized by _mutex
+                if (_globals.size() > index->Buckets()) {  // load factor 1 - all globals (this one too) go to twice as big index
+                    Index* grown = new Index(index->Buckets() * 2);
+                    for (auto&& known : _globals)
+                        grown->Insert(&known);
+                    _index.store(grown, std::memory_order_release);
+                    _retired.push_back(index);
+                } else {
+                    index->Insert(global);
+                }
+            }
+        }
+        global->Store(value, std::move(data));
+        if (!dirty)
+            return;
+        global->dirty.store(true, std::memory_order_release);
+        _dirty.store(true, std::memory_order_release);
+    }
+
+    // calls @write(name, value, data) for every global changed since last flush (nil - erased); returns count of them
+    template <typename Write>
+    size_t Flush(Write write) {
+        if (!_dirty.exchange(false, std::memory_order_acq_rel))
+            return 0;
+        std::unique_lock<std::mutex> lock(_mutex);
+        size_t count = 0;
+        for (auto&& global : _globals) {
+            if (!global.dirty.exchange(false, std::memory_order_acq_rel))
+                continue;  // cleared before the value is read - concurrent Set marks it again
+            Data data;
+            const uint64_t value = global.Load(data);
+            write(global.name, value, data);
+            ++count;
+        }
+        return count;
+    }
+
+    void Reclaim() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (const auto index : _retired)
+            delete index;
+        _retired.clear();
+    }
+
+ private:
+    struct Global {
+        explicit Global(const std::string& global_name) : name(global_name), value(PackedValue::kNil), dirty(false) {}
+        uint64_t Load(Data& result) const {
+            while (true) {
+                const uint64_t current = value.load(std::memory_order_acquire);
+                if (current != PackedValue::kData)
+                    return current;
+                result = std::atomic_load(&data);
+                if (result)
+                    return current;  // null - replaced by scalar meanwhile, read again
+            }
+        }
+        void Store(uint64_t new_value, Data new_data) {
+            std::unique_lock<std::mutex> lock(store_mutex);  // writers only - value and data change together
+            if (new_value == PackedValue::kData) {
+                std::atomic_store(&data, std::move(new_data));
+                value.store(new_value, std::memory_order_release);
+            } else {
+                value.store(new_value, std::memory_order_release);
+                std::atomic_store(&data, Data());  // frees the buffer
+            }
+        }
+        const std::string name;
+        std::atomic<uint64_t> value;
+        Data data;  // accessed by std::atomic_load/store only
+        std::atomic<bool> dirty;
+        std::mutex store_mutex;
+    };
+    struct Entry {
+        Global* global;
+        const Entry* next;
+    };
+    // bucket heads are the only mutable part readers see - entry is complete before it is published (release)
+    class Index {
+     public:
+        explicit Index(size_t buckets) : _mask(buckets - 1), _buckets(new std::atomic<const Entry*>[buckets]) {
+            for (size_t i = 0; i < buckets; ++i)
+                _buckets[i].store(nullptr, std::memory_order_relaxed);
+        }
+        size_t Buckets() const noexcept { return _mask + 1; }
+        void Insert(Global* global) {  // writer (under GlobalTable::_mutex)
+            auto& bucket = _buckets[std::hash<std::string>()(global->name) & _mask];
+            _entries.push_back(Entry{global, bucket.load(std::memory_order_relaxed)});
+            bucket.store(&_entries.back(), std::memory_order_release);
+        }
+        Global* Find(const std::string& name) const noexcept {
+            for (auto entry = _buckets[std::hash<std::string>()(name) & _mask].load(std::memory_order_acquire); entry != nullptr; entry = entry->next)
+                if (entry->global->name == name)
+                    return entry->global;
+            return nullptr;
+        }
+
+     private:
+        const size_t _mask;
+        std::unique_ptr<std::atomic<const Entry*>[]> _buckets;
+        std::deque<Entry> _entries;  // deque - entries are never moved
+    };
+    static constexpr size_t kInitialBuckets = 64;  // power of 2
+
+    Global* find(const std::string& name) const {
+        return _index.load(std::memory_order_acquire)->Find(name);
+    }
+
+    std::atomic<const Index*> _index;
+    std::atomic<bool> _dirty;
+    std::mutex _mutex;  // guards below (writers adding a name, flush)
+    std::deque<Global> _globals;  // deque - globals are never moved, erased global is nil
+    std::vector<const Index*> _retired;
+};
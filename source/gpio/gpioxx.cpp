@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2019
-// Version: 10122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -11,12 +11,43 @@
 #include <gpioxx.hpp>
 
 #include <type_traits>  //for std::underlying_type
+#include <fcntl.h>  // O_NONBLOCK
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <poll.h>
 #include <linux/gpio.h>
 
-gpiocxx::gpiocxx(const std::string& path, const std::shared_ptr<spdlog::logger>& logger): _logger(logger), _chip_fd(-1) {
+#include "metrics.h"
+
+// get/set value are only counted - they are used in bit-banging loops (DHT) where timing them would distort the sampling
+namespace {
+
+MQ_System::Counter& line_operations() {
+    static MQ_System::Counter& counter = MQ_System::Metrics::Instance().GetCounter("mq_gpio_line_operations_total", "GPIO line value reads and writes");
+    return counter;
+}
+
+MQ_System::Counter& gpio_errors() {
+    static MQ_System::Counter& counter = MQ_System::Metrics::Instance().GetCounter("mq_gpio_errors_total", "Failed GPIO operations");
+    return counter;
+}
+
+MQ_System::Histogram& line_request_time() {
+    static MQ_System::Histogram& histogram = MQ_System::Metrics::Instance().GetHistogram("mq_gpio_line_request_seconds", "GPIO line (direction) request time");
+    return histogram;
+}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+constexpr uint32_t kEdgeBufferSize = 256;  // edges kernel keeps till they are read (DHT frame has 84)
+constexpr size_t kEdgeReadBatch = 32;  // edges taken by one read
+// GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME / _HTE - enumerators of newer headers (5.11 / 5.19) than the v2 uAPI itself
+constexpr uint64_t kEventClockRealtime = 1ULL << 11;
+constexpr uint64_t kEventClockHardware = 1ULL << 12;
+#endif
+
+}  // namespace
+
+gpiocxx::gpiocxx(const std::string& path, const std::shared_ptr<spdlog::logger>& logger): _logger(logger), _chip_fd(-1), _hardware_clock(true) {
     auto fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
     if (fd < 0) {
         _logger->error("GPIOcxx unable to open chip device {} : {}", path, strerror(errno));
@@ -61,7 +92,7 @@ inline void gpiocxx::check_offset(uint32_t gpio) {
 
 bool gpiocxx::is_output(uint32_t gpio) {
     check_offset(gpio);
-    if (_lines[gpio] == nullptr || _lines[gpio]->event)
+    if (_lines[gpio] == nullptr || _lines[gpio]->event || _lines[gpio]->v2)
         return false;
     if (_lines[gpio]->handle_fd == -1 || _lines[gpio]->input)
         return false;
@@ -70,7 +101,7 @@ bool gpiocxx::is_output(uint32_t gpio) {
 
 bool gpiocxx::is_input(uint32_t gpio) {
     check_offset(gpio);
-    if (_lines[gpio] == nullptr || _lines[gpio]->event)
+    if (_lines[gpio] == nullptr || _lines[gpio]->event || _lines[gpio]->v2)
         return false;
     if (_lines[gpio]->handle_fd == -1 || !_lines[gpio]->input)
         return false;
@@ -90,6 +121,7 @@ void gpiocxx::request(uint32_t gpio, bool input) {
             }
             _lines[gpio]->event = false;
         }
+        _lines[gpio]->v2 = false;
     }
     struct gpiohandle_request req = {};
     if (input)
@@ -100,8 +132,11 @@ void gpiocxx::request(uint32_t gpio, bool input) {
     req.lineoffsets[0] = gpio;
     req.default_values[0] = 1;
     strncpy(req.consumer_label, "mq_dht_daemon", sizeof(req.consumer_label) - 1);
+    const auto request_start = std::chrono::steady_clock::now();
     int rv = ioctl(_chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req);
+    line_request_time().Record(std::chrono::steady_clock::now() - request_start);
     if (rv < 0) {
+        gpio_errors().Increment();
         _logger->error("GPIOcxx unable to request line {}: {}", gpio, strerror(errno));
         throw std::runtime_error("");
     }
@@ -133,7 +168,9 @@ bool gpiocxx::get_value(uint32_t gpio) {
     struct gpiohandle_data data = {};
     set_input(gpio);
     int rv = ioctl(_lines[gpio]->handle_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data);
+    line_operations().Increment();
     if (rv < 0) {
+        gpio_errors().Increment();
         _logger->error("GPIOcxx unable to get value on line {}: {}", gpio, strerror(errno));
         throw std::runtime_error("");
     }
@@ -147,7 +184,9 @@ void gpiocxx::set_value(uint32_t gpio, bool value) {
     data.values[0] = value;
     set_output(gpio);
     int rv = ioctl(_lines[gpio]->handle_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+    line_operations().Increment();
     if (rv < 0) {
+        gpio_errors().Increment();
         _logger->error("GPIOcxx unable to set value on line {}: {}", gpio, strerror(errno));
         throw std::runtime_error("");
     }
@@ -255,4 +294,114 @@ void gpiocxx::read_event(uint32_t gpio, struct gpioevent_data& evdata) {
         _logger->error("GPIOcxx unable to read event on line {}: {}", gpio, strerror(errno));
         throw std::runtime_error("");
     }
-}
\ No newline at end of file
+}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+int gpiocxx::configure(uint32_t gpio, struct gpio_v2_line_config& config) {
+    check_offset(gpio);
+    const auto request_start = std::chrono::steady_clock::now();
+    if (_lines[gpio] != nullptr && _lines[gpio]->v2) {
+        if (ioctl(_lines[gpio]->handle_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+            return errno;
+    } else {
+        reset(gpio);
+        struct gpio_v2_line_request req = {};
+        req.offsets[0] = gpio;
+        req.num_lines = 1;
+        req.config = config;
+        req.event_buffer_size = kEdgeBufferSize;
+        strncpy(req.consumer, "mq_dht_daemon", sizeof(req.consumer) - 1);
+        if (ioctl(_chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0)
+            return errno;
+        fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);  // read_edges takes all buffered edges without blocking
+        _lines[gpio] = new line();
+        _lines[gpio]->handle_fd = req.fd;
+        _lines[gpio]->v2 = true;
+    }
+    line_request_time().Record(std::chrono::steady_clock::now() - request_start);
+    _lines[gpio]->input = config.flags & GPIO_V2_LINE_FLAG_INPUT;
+    _lines[gpio]->event = config.flags & (GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING);
+    return 0;
+}
+
+void gpiocxx::drive(uint32_t gpio, bool value) {
+    struct gpio_v2_line_config config = {};
+    config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    config.num_attrs = 1;
+    config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    config.attrs[0].attr.values = value ? 1 : 0;
+    config.attrs[0].mask = 1;
+    const int error = configure(gpio, config);
+    line_operations().Increment();
+    if (error) {
+        gpio_errors().Increment();
+        _logger->error("GPIOcxx unable to drive line {}: {}", gpio, strerror(error));
+        throw std::runtime_error("");
+    }
+}
+
+void gpiocxx::watch_edges(uint32_t gpio, event_clock clock) {
+    check_offset(gpio);
+    if (_lines[gpio] != nullptr && _lines[gpio]->v2 && _lines[gpio]->event) {  // edges of previous watch nobody read
+        struct gpio_v2_line_event stale[kEdgeReadBatch];
+        while (read(_lines[gpio]->handle_fd, stale, sizeof(stale)) == static_cast<ssize_t>(sizeof(stale))) {}
+    }
+    struct gpio_v2_line_config config = {};
+    config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    if (clock == event_clock::REALTIME)
+        config.flags |= kEventClockRealtime;
+    else if (clock == event_clock::HARDWARE && _hardware_clock)
+        config.flags |= kEventClockHardware;
+    int error = configure(gpio, config);
+    if (error && (config.flags & kEventClockHardware)) {
+        _logger->info("GPIOcxx chip has no hardware timestamps ({}) - line events use monotonic clock", strerror(error));
+        _hardware_clock = false;
+        config.flags &= ~kEventClockHardware;
+        error = configure(gpio, config);
+    }
+    if (error) {
+        gpio_errors().Increment();
+        _logger->error("GPIOcxx unable to watch edges on line {}: {}", gpio, strerror(error));
+        throw std::runtime_error("");
+    }
+}
+
+size_t gpiocxx::read_edges(uint32_t gpio, std::vector<line_event>& events, const struct timespec *timeout) {
+    check_offset(gpio);
+    if (_lines[gpio] == nullptr || !_lines[gpio]->v2 || !_lines[gpio]->event) {
+        _logger->error("GPIOcxx read edges but edges not watched on line {}", gpio);
+        throw std::runtime_error("");
+    }
+    struct pollfd fds[1] = {};
+    fds[0].fd = _lines[gpio]->handle_fd;
+    fds[0].events = POLLIN;
+    const int rv = ppoll(fds, 1, timeout, NULL);
+    if (rv < 0 && errno != EINTR) {
+        gpio_errors().Increment();
+        _logger->error("GPIOcxx unable to poll for edges on line {}: {}", gpio, strerror(errno));
+        throw std::runtime_error("");
+    } else if (rv <= 0) {
+        return 0;
+    }
+    struct gpio_v2_line_event buffer[kEdgeReadBatch];
+    size_t count = 0;
+    while (true) {
+        const ssize_t rd = read(_lines[gpio]->handle_fd, buffer, sizeof(buffer));
+        if (rd < 0) {
+            if (errno == EAGAIN)
+                break;
+            gpio_errors().Increment();
+            _logger->error("GPIOcxx unable to read edges on line {}: {}", gpio, strerror(errno));
+            throw std::runtime_error("");
+        }
+        const size_t read_count = rd / sizeof(buffer[0]);
+        for (size_t i = 0; i < read_count; ++i)
+            events.push_back(line_event{buffer[i].timestamp_ns, buffer[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE});
+        count += read_count;
+        if (read_count < kEdgeReadBatch)
+            break;
+    }
+    line_operations().Increment();
+    return count;
+}
+#endif
@@ -1,6 +1,6 @@
 #pragma once
 // Copyright: (c) Jaromir Veber 2019
-// Version: 10122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -23,6 +23,19 @@ class gpiocxx {
             BOTH_EDGES
         };
 
+#ifdef GPIO_V2_GET_LINE_IOCTL
+        enum class event_clock {
+            MONOTONIC,
+            REALTIME,
+            HARDWARE  // hardware timestamp engine - monotonic is used if the chip has none
+        };
+
+        struct line_event {
+            uint64_t timestamp_ns;  // taken by kernel in the interrupt - clock chosen by watch_edges
+            bool rising;
+        };
+#endif
+
         gpiocxx(const std::string& path, const std::shared_ptr<spdlog::logger>& logger);
         ~gpiocxx();
         
@@ -37,18 +50,30 @@ class gpiocxx {
         int  wait_event(uint32_t gpio, const struct timespec *timeout_ts);
         std::vector<uint32_t>  wait_events(const std::vector<uint32_t>& l, const struct timespec *timeout);
         void read_event(uint32_t gpio, struct gpioevent_data& evdata);
+#ifdef GPIO_V2_GET_LINE_IOCTL
+        // GPIO v2 uAPI line - drive and watch_edges share one line request, so switching direction is just reconfiguration
+        // (no release and new request); kernel timestamps and buffers edges till read_edges takes them
+        void drive(uint32_t gpio, bool value);
+        void watch_edges(uint32_t gpio, event_clock clock);
+        size_t read_edges(uint32_t gpio, std::vector<line_event>& events, const struct timespec *timeout);  // appends; 0 on timeout
+#endif
     private:
         inline void check_offset(uint32_t gpio);
         void request(uint32_t gpio, bool input);
+#ifdef GPIO_V2_GET_LINE_IOCTL
+        int configure(uint32_t gpio, struct gpio_v2_line_config& config);  // returns errno (0 - success)
+#endif
 
         const std::shared_ptr<spdlog::logger> _logger;
         int _chip_fd;
 
         struct line {
-            line () : input(false), event(false), handle_fd(-1) {}
+            line () : input(false), event(false), v2(false), handle_fd(-1) {}
             bool input;
             bool event;
+            bool v2;  // GPIO v2 uAPI request (drive / watch_edges)
             int handle_fd;
         };
         std::vector<struct line*> _lines;
+        bool _hardware_clock;  // cleared once the chip refuses hardware timestamps
 };
@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2019
-// Version: 10122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -15,6 +15,22 @@
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
+#include "metrics.h"
+
+namespace {
+
+MQ_System::Histogram& transaction_time() {
+    static MQ_System::Histogram& histogram = MQ_System::Metrics::Instance().GetHistogram("mq_i2c_transaction_seconds", "I2C transaction time");
+    return histogram;
+}
+
+MQ_System::Counter& transaction_errors() {
+    static MQ_System::Counter& counter = MQ_System::Metrics::Instance().GetCounter("mq_i2c_errors_total", "Failed I2C transactions");
+    return counter;
+}
+
+}  // namespace
+
 i2cxx::i2cxx(const std::string& path, unsigned int i2c_addr, const std::shared_ptr<spdlog::logger>& logger): _logger(logger), _fd(-1), _addr(i2c_addr) {
     auto fd = open(path.c_str(), O_RDWR);
     if (fd < 0) {
@@ -36,7 +52,11 @@ i2cxx::~i2cxx() noexcept {
 
 int i2cxx::smbus_data(char rw, uint8_t cmd, unsigned int size, union i2c_smbus_data *data) {
    struct i2c_smbus_ioctl_data args { rw, cmd, size, data };
-   return ioctl(_fd, I2C_SMBUS, &args);
+   MQ_System::ScopedTimer timer(transaction_time());
+   const int result = ioctl(_fd, I2C_SMBUS, &args);
+   if (result < 0)
+       transaction_errors().Increment();
+   return result;
 }
 
 void i2cxx::write_byte(unsigned bVal) {
@@ -74,8 +94,10 @@ uint8_t i2cxx::read_byte_data(unsigned reg) {
 }
 
 void i2cxx::read(char *buf, size_t count) {
+    MQ_System::ScopedTimer timer(transaction_time());
     auto result = ::read(_fd, static_cast<void*>(buf), count);
     if (result != static_cast<decltype(result)>(count)) {
+        transaction_errors().Increment();
         _logger->error("I2Cxx read error {} : {}", _addr, strerror(errno));
         throw std::runtime_error("");
     }
@@ -0,0 +1,50 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// ConfigDiff is difference of two keyed configurations (sensors, values...) - daemons apply it in Daemon::OnConfigChanged.
+
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace MQ_System {
+
+template <typename Key, typename Value>
+struct ConfigDiff {
+    std::vector<std::pair<Key, Value>> added;
+    std::vector<std::pair<Key, Value>> changed;  // new configuration of the entry
+    std::vector<Key> removed;
+    bool Empty() const noexcept { return added.empty() && changed.empty() && removed.empty(); }
+};
+
+// Value has to be equality comparable; both maps are walked at once so it's O(n)
+template <typename Key, typename Value, typename Compare>
+ConfigDiff<Key, Value> MakeConfigDiff(const std::map<Key, Value, Compare>& current, const std::map<Key, Value, Compare>& next) {
+    ConfigDiff<Key, Value> diff;
+    const Compare less = current.key_comp();
+    auto current_iterator = current.cbegin();
+    auto next_iterator = next.cbegin();
+    while (current_iterator != current.cend() || next_iterator != next.cend()) {
+        if (next_iterator == next.cend() || (current_iterator != current.cend() && less(current_iterator->first, next_iterator->first))) {
+            diff.removed.push_back(current_iterator->first);
+            ++current_iterator;
+        } else if (current_iterator == current.cend() || less(next_iterator->first, current_iterator->first)) {
+            diff.added.push_back(*next_iterator);
+            ++next_iterator;
+        } else {
+            if (!(current_iterator->second == next_iterator->second))
+                diff.changed.push_back(*next_iterator);
+            ++current_iterator;
+            ++next_iterator;
+        }
+    }
+    return diff;
+}
+
+}  // namespace MQ_System
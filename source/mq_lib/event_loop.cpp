@@ -0,0 +1,312 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+
+#include "./event_loop.h"
+// system
+#include <sys/eventfd.h>    // cross-thread wakeup
+#include <sys/signalfd.h>   // signals as file descriptor
+#include <sys/timerfd.h>    // precise timers
+#include <signal.h>
+#include <pthread.h>        // pthread_sigmask
+#include <unistd.h>         // close(2), read(2), write(2)
+// c++lib
+#include <cerrno>
+#include <cstring>          // strerror
+#include <stdexcept>        // runtime_error
+
+namespace MQ_System {
+
+static constexpr int kMaxEvents = 16;
+
+constexpr EventLoop::TimerId EventLoop::kInvalidTimer;
+
+EventLoop::EventLoop(const std::shared_ptr<spdlog::logger>& logger)
+    : _logger(logger)
+    , _epoll_fd(-1)
+    , _wakeup_fd(-1)
+    , _signal_fd(-1)
+    , _wheel_fd(-1)
+    , _wheel_armed(TimerWheel::Clock::time_point::max())
+    , _stop_requested(false)
+    , _generation(0)
+    , _finished(false)
+{
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll_fd < 0) {
+        _logger->error("EventLoop unable to create epoll: {}", strerror(errno));
+        throw std::runtime_error("");
+    }
+    _wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wakeup_fd < 0) {
+        _logger->error("EventLoop unable to create eventfd: {}", strerror(errno));
+        close(_epoll_fd);
+        throw std::runtime_error("");
+    }
+    AddFd(_wakeup_fd, EPOLLIN, [this](uint32_t) {
+        uint64_t counter;
+        while (read(_wakeup_fd, &counter, sizeof(counter)) == sizeof(counter)) {}  // drain (eventfd is non-blocking)
+        run_posted();
+    });
+    _wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);  // steady_clock is CLOCK_MONOTONIC
+    if (_wheel_fd < 0) {
+        _logger->error("EventLoop unable to create wheel timer: {}", strerror(errno));
+        close(_wakeup_fd);
+        close(_epoll_fd);
+        throw std::runtime_error("");
+    }
+    AddFd(_wheel_fd, EPOLLIN, [this](uint32_t) {
+        uint64_t expirations;
+        if (read(_wheel_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            return;
+        _wheel_armed = TimerWheel::Clock::time_point::max();
+        _wheel.Advance(TimerWheel::Clock::now());
+    });
+}
+
+EventLoop::~EventLoop() noexcept {
+    for (const auto& timer : _timers)
+        close(timer.first);
+    if (_signal_fd >= 0)
+        close(_signal_fd);
+    if (_wheel_fd >= 0)
+        close(_wheel_fd);
+    if (_wakeup_fd >= 0)
+        close(_wakeup_fd);
+    if (_epoll_fd >= 0)
+        close(_epoll_fd);
+}
+
+void EventLoop::Run() {
+    _loop_thread = std::this_thread::get_id();
+    {
+        std::unique_lock<std::mutex> post_lock(_post_mutex);
+        _finished = false;
+    }
+    struct epoll_event events[kMaxEvents];
+    _logger->trace("EventLoop run");
+    while (!_stop_requested) {
+        for (const auto& hook : _prepare_hooks)
+            hook();
+        arm_wheel();
+        const int count = epoll_wait(_epoll_fd, events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            _logger->critical("EventLoop epoll_wait error: {}", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < count && !_stop_requested; ++i)
+            dispatch(events[i]);
+    }
+    while (true) {  // let posted work finish (it may be cleanup) - posts are refused once nothing is left
+        std::vector<Callback> posted;
+        {
+            std::unique_lock<std::mutex> post_lock(_post_mutex);
+            if (_posted.empty()) {
+                _finished = true;
+                break;
+            }
+            posted.swap(_posted);
+        }
+        for (const auto& callback : posted)
+            callback();
+    }
+    _logger->trace("EventLoop exit");
+}
+
+void EventLoop::arm_wheel() {
+    const auto next_expiry = _wheel.NextExpiry();
+    if (next_expiry == _wheel_armed)
+        return;
+    struct itimerspec spec = {};  // zero disarms
+    if (next_expiry != TimerWheel::Clock::time_point::max()) {
+        const auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(next_expiry.time_since_epoch()).count();
+        spec.it_value.tv_sec = since_epoch / 1000000000L;
+        spec.it_value.tv_nsec = since_epoch % 1000000000L;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+            spec.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(_wheel_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        _logger->error("EventLoop unable to arm wheel timer: {}", strerror(errno));
+        return;
+    }
+    _wheel_armed = next_expiry;
+}
+
+void EventLoop::Stop() noexcept {
+    _stop_requested = true;
+    Wakeup();
+}
+
+void EventLoop::Wakeup() noexcept {
+    const uint64_t one = 1;
+    if (write(_wakeup_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        _logger->warn("EventLoop wakeup error: {}", strerror(errno));
+}
+
+bool EventLoop::InLoopThread() const noexcept {
+    return _loop_thread == std::this_thread::get_id();
+}
+
+bool EventLoop::Post(Callback callback) {
+    {
+        std::unique_lock<std::mutex> post_lock(_post_mutex);
+        if (_finished)
+            return false;
+        _posted.emplace_back(std::move(callback));
+    }
+    Wakeup();
+    return true;
+}
+
+void EventLoop::run_posted() {
+    std::vector<Callback> posted;
+    {
+        std::unique_lock<std::mutex> post_lock(_post_mutex);
+        posted.swap(_posted);
+    }
+    for (const auto& callback : posted)
+        callback();
+}
+
+void EventLoop::AddFd(int fd, uint32_t events, FdCallback callback) {
+    auto handler = std::make_shared<Handler>();
+    handler->callback = std::move(callback);
+    handler->generation = ++_generation;
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.u64 = (static_cast<uint64_t>(handler->generation) << 32) | static_cast<uint32_t>(fd);
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        _logger->error("EventLoop unable to watch fd {}: {}", fd, strerror(errno));
+        throw std::runtime_error("");
+    }
+    _handlers[fd] = handler;
+}
+
+void EventLoop::ModifyFd(int fd, uint32_t events) {
+    const auto found_handler = _handlers.find(fd);
+    if (found_handler == _handlers.end()) {
+        _logger->error("EventLoop modify of unknown fd {}", fd);
+        throw std::runtime_error("");
+    }
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.u64 = (static_cast<uint64_t>(found_handler->second->generation) << 32) | static_cast<uint32_t>(fd);
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+        _logger->error("EventLoop unable to modify fd {}: {}", fd, strerror(errno));
+        throw std::runtime_error("");
+    }
+}
+
+void EventLoop::RemoveFd(int fd) noexcept {
+    if (_handlers.erase(fd))
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);  // fd may be already closed - that's fine it's removed from epoll set by kernel in such case
+}
+
+void EventLoop::dispatch(const struct epoll_event& event) {
+    const int fd = static_cast<int>(event.data.u64 & 0xFFFFFFFF);
+    const uint32_t generation = static_cast<uint32_t>(event.data.u64 >> 32);
+    const auto found_handler = _handlers.find(fd);
+    if (found_handler == _handlers.end() || found_handler->second->generation != generation)
+        return;  // handler was removed (or replaced) by previous callback in this batch
+    const auto handler = found_handler->second;  // keep it alive - callback may remove itself
+    try {
+        handler->callback(event.events);
+    } catch (const std::exception& e) {
+        _logger->error("EventLoop callback on fd {} failed: {}", fd, e.what());
+    }
+}
+
+EventLoop::TimerId EventLoop::AddTimer(std::chrono::nanoseconds first, std::chrono::nanoseconds interval, Callback callback) {
+    const int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        _logger->error("EventLoop unable to create timer: {}", strerror(errno));
+        throw std::runtime_error("");
+    }
+    if (first.count() <= 0)
+        first = std::chrono::nanoseconds(1);  // zero would disarm the timer
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = first.count() / 1000000000L;
+    spec.it_value.tv_nsec = first.count() % 1000000000L;
+    spec.it_interval.tv_sec = interval.count() / 1000000000L;
+    spec.it_interval.tv_nsec = interval.count() % 1000000000L;
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) < 0) {
+        _logger->error("EventLoop unable to arm timer: {}", strerror(errno));
+        close(timer_fd);
+        throw std::runtime_error("");
+    }
+    try {
+        AddFd(timer_fd, EPOLLIN, [this, timer_fd](uint32_t) { on_timer(timer_fd); });
+    } catch (const std::runtime_error&) {
+        close(timer_fd);
+        throw;
+    }
+    const TimerId id = (static_cast<uint64_t>(_handlers[timer_fd]->generation) << 32) | static_cast<uint32_t>(timer_fd);  // generation is never 0
+    _timers[timer_fd] = Timer{id, interval.count() == 0, std::make_shared<Callback>(std::move(callback))};
+    return id;
+}
+
+void EventLoop::on_timer(int timer_fd) {
+    uint64_t expirations = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;  // spurious wakeup (EAGAIN)
+    const auto found_timer = _timers.find(timer_fd);
+    if (found_timer == _timers.end())
+        return;
+    const auto callback = found_timer->second.callback;  // keep it alive - callback may cancel the timer
+    if (found_timer->second.one_shot)
+        CancelTimer(found_timer->second.id);
+    if (expirations > 1)
+        _logger->debug("EventLoop timer {} overrun {} expirations", timer_fd, expirations - 1);
+    (*callback)();
+}
+
+void EventLoop::CancelTimer(TimerId timer) noexcept {
+    const int timer_fd = static_cast<int>(timer & 0xFFFFFFFF);
+    const auto found_timer = _timers.find(timer_fd);
+    if (found_timer == _timers.end() || found_timer->second.id != timer)
+        return;  // timer is gone - its fd may belong to another timer already
+    _timers.erase(found_timer);
+    RemoveFd(timer_fd);
+    close(timer_fd);
+}
+
+void EventLoop::BlockSignals(const std::vector<int>& signals) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (const auto signal_number : signals)
+        sigaddset(&mask, signal_number);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0)
+        throw std::runtime_error("Unable to block signals");
+}
+
+void EventLoop::HandleSignals(const std::vector<int>& signals, SignalCallback callback) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (const auto signal_number : signals)
+        sigaddset(&mask, signal_number);
+    _signal_fd = signalfd(_signal_fd, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (_signal_fd < 0) {
+        _logger->error("EventLoop unable to create signalfd: {}", strerror(errno));
+        throw std::runtime_error("");
+    }
+    _signal_callback = std::move(callback);
+    RemoveFd(_signal_fd);
+    AddFd(_signal_fd, EPOLLIN, [this](uint32_t) {
+        struct signalfd_siginfo info;
+        while (read(_signal_fd, &info, sizeof(info)) == sizeof(info))
+            _signal_callback(static_cast<int>(info.ssi_signo));
+    });
+}
+
+void EventLoop::AddPrepareHook(Callback hook) {
+    _prepare_hooks.emplace_back(std::move(hook));
+}
+
+}  // namespace MQ_System
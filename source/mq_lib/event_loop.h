@@ -0,0 +1,98 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// EventLoop is epoll based reactor all the daemons run their work on (timers, signals, sockets and cross-thread posts).
+
+#include <sys/epoll.h>  // EPOLLIN, EPOLLOUT...
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "./timer_wheel.h"
+
+namespace MQ_System {
+
+class EventLoop {
+ public:
+    typedef std::function<void()> Callback;
+    typedef std::function<void(uint32_t events)> FdCallback;  // events are epoll events (EPOLLIN | EPOLLOUT | EPOLLERR...)
+    typedef std::function<void(int signal)> SignalCallback;
+    typedef uint64_t TimerId;  // generation << 32 | timerfd - stale id (fired one-shot, reused fd) never matches a new timer
+    static constexpr TimerId kInvalidTimer = 0;  // never returned by AddTimer
+
+    explicit EventLoop(const std::shared_ptr<spdlog::logger>& logger);  // may throw std::runtime_error (always logs reason)
+    ~EventLoop() noexcept;
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    void Run();  // dispatch events in the calling thread until Stop() is called
+    void Stop() noexcept;  // thread-safe; Run() returns after currently dispatched callback finishes
+    bool Post(Callback callback);  // thread-safe; callback is executed in the loop thread; false once Run() returned (not queued)
+    void Wakeup() noexcept;  // thread-safe; forces loop iteration (prepare hooks are re-evaluated)
+    bool InLoopThread() const noexcept;
+
+    void AddFd(int fd, uint32_t events, FdCallback callback);  // loop does not take fd ownership
+    void ModifyFd(int fd, uint32_t events);
+    void RemoveFd(int fd) noexcept;
+
+    // interval == 0 means one-shot timer (it's removed automatically after it fires); timers use CLOCK_MONOTONIC
+    // every timer has it's own timerfd - use it for few precise timers; Wheel() is better for many (sensor) timers
+    TimerId AddTimer(std::chrono::nanoseconds first, std::chrono::nanoseconds interval, Callback callback);
+    void CancelTimer(TimerId timer) noexcept;  // no-op for kInvalidTimer and timers already gone (fired one-shot)
+    TimerWheel& Wheel() noexcept { return _wheel; }  // wheel timers are fired in the loop thread (10ms resolution)
+
+    void HandleSignals(const std::vector<int>& signals, SignalCallback callback);  // signals must be blocked in all threads (see BlockSignals)
+    static void BlockSignals(const std::vector<int>& signals);  // call before any thread is created so all threads inherit the mask
+
+    void AddPrepareHook(Callback hook);  // hook is called in the loop thread before every wait (eg. to update EPOLLOUT interest)
+
+ private:
+    struct Handler {
+        FdCallback callback;
+        uint32_t generation;
+    };
+    struct Timer {
+        TimerId id;
+        bool one_shot;
+        std::shared_ptr<Callback> callback;
+    };
+
+    void dispatch(const struct epoll_event& event);
+    void run_posted();
+    void on_timer(int timer_fd);
+    void arm_wheel();
+
+    const std::shared_ptr<spdlog::logger> _logger;
+    int _epoll_fd;
+    int _wakeup_fd;
+    int _signal_fd;
+    int _wheel_fd;
+    TimerWheel _wheel;
+    TimerWheel::Clock::time_point _wheel_armed;  // expiry _wheel_fd is armed to
+    std::atomic<bool> _stop_requested;
+    std::thread::id _loop_thread;
+    uint32_t _generation;  // stored with fd in epoll data so stale events of reused fd are ignored
+    std::unordered_map<int, std::shared_ptr<Handler>> _handlers;
+    std::unordered_map<int, Timer> _timers;  // timer fd : timer
+    std::vector<Callback> _prepare_hooks;
+    SignalCallback _signal_callback;
+    std::mutex _post_mutex;
+    std::vector<Callback> _posted;
+    bool _finished;  // Run() returned - posted work would never run (guarded by _post_mutex)
+};
+
+}  // namespace MQ_System
@@ -0,0 +1,181 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+
+#include "./metrics.h"
+
+#include <cstdio>  // snprintf
+
+namespace MQ_System {
+
+constexpr unsigned Histogram::kSubBucketBits;
+constexpr unsigned Histogram::kSubBuckets;
+constexpr unsigned Histogram::kBuckets;
+
+unsigned metric_shard_index() noexcept {
+    static std::atomic<unsigned> next_shard(0);
+    return next_shard.fetch_add(1, std::memory_order_relaxed) % kMetricShards;
+}
+
+Counter::Counter() noexcept {
+    for (auto&& shard : _shards)
+        shard.value.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Counter::Value() const noexcept {
+    uint64_t value = 0;
+    for (const auto& shard : _shards)
+        value += shard.value.load(std::memory_order_relaxed);
+    return value;
+}
+
+Histogram::Histogram() noexcept {
+    for (auto&& shard : _shards) {
+        for (auto&& bucket : shard.buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        shard.count.store(0, std::memory_order_relaxed);
+        shard.sum.store(0, std::memory_order_relaxed);
+    }
+}
+
+Histogram::Snapshot Histogram::Take() const {
+    Snapshot snapshot{0, 0, std::vector<uint64_t>(kBuckets, 0)};
+    for (const auto& shard : _shards) {
+        for (unsigned i = 0; i < kBuckets; ++i)
+            snapshot.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    for (const auto bucket : snapshot.buckets)  // count from buckets so it's consistent with them (shards are updated concurrently)
+        snapshot.count += bucket;
+    return snapshot;
+}
+
+uint64_t Histogram::BucketUpperBound(unsigned index) noexcept {
+    if (index < kSubBuckets)
+        return index;
+    const unsigned shift = index / kSubBuckets - 1;  // msb - kSubBucketBits
+    const uint64_t lower = static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << shift;
+    return lower + ((static_cast<uint64_t>(1) << shift) - 1);
+}
+
+uint64_t Histogram::Snapshot::Percentile(double percentile) const noexcept {
+    if (!count)
+        return 0;
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return BucketUpperBound(i);
+    }
+    return BucketUpperBound(kBuckets - 1);
+}
+
+Metrics& Metrics::Instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+template <typename Metric>
+Metric& Metrics::get_metric(std::map<std::string, Entry<Metric>>& metrics, const std::string& name, const std::string& help) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto& entry = metrics[name];
+    if (!entry.metric) {
+        entry.help = help;
+        entry.metric.reset(new Metric());
+    }
+    return *entry.metric;
+}
+
+Counter& Metrics::GetCounter(const std::string& name, const std::string& help) {
+    return get_metric(_counters, name, help);
+}
+
+Gauge& Metrics::GetGauge(const std::string& name, const std::string& help) {
+    return get_metric(_gauges, name, help);
+}
+
+Histogram& Metrics::GetHistogram(const std::string& name, const std::string& help) {
+    return get_metric(_histograms, name, help);
+}
+
+namespace {
+
+std::string format_seconds(uint64_t nanoseconds) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.9g", nanoseconds / 1e9);
+    return buffer;
+}
+
+std::string format_micros(uint64_t nanoseconds) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.3f", nanoseconds / 1e3);
+    return buffer;
+}
+
+}  // namespace
+
+// metric names are fixed identifiers ([a-z_]) so they need no JSON escaping
+std::string Metrics::Json() const {
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::string json = "{";
+    const char* separator = "";
+    for (const auto& counter : _counters) {
+        json += separator + ('"' + counter.first + "\":") + std::to_string(counter.second.metric->Value());
+        separator = ",";
+    }
+    for (const auto& gauge : _gauges) {
+        json += separator + ('"' + gauge.first + "\":") + std::to_string(gauge.second.metric->Value());
+        separator = ",";
+    }
+    for (const auto& histogram : _histograms) {
+        const auto snapshot = histogram.second.metric->Take();
+        json += separator + ('"' + histogram.first + "\":{\"count\":") + std::to_string(snapshot.count);
+        if (snapshot.count) {
+            json += ",\"mean_us\":" + format_micros(snapshot.sum / snapshot.count);
+            json += ",\"p50_us\":" + format_micros(snapshot.Percentile(50));
+            json += ",\"p99_us\":" + format_micros(snapshot.Percentile(99));
+            json += ",\"max_us\":" + format_micros(snapshot.Percentile(100));
+        }
+        json += "}";
+        separator = ",";
+    }
+    return json + "}";
+}
+
+std::string Metrics::PrometheusText() const {
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::string text;
+    for (const auto& counter : _counters) {
+        text += "# HELP " + counter.first + " " + counter.second.help + "\n# TYPE " + counter.first + " counter\n";
+        text += counter.first + " " + std::to_string(counter.second.metric->Value()) + "\n";
+    }
+    for (const auto& gauge : _gauges) {
+        text += "# HELP " + gauge.first + " " + gauge.second.help + "\n# TYPE " + gauge.first + " gauge\n";
+        text += gauge.first + " " + std::to_string(gauge.second.metric->Value()) + "\n";
+    }
+    for (const auto& histogram : _histograms) {
+        const auto snapshot = histogram.second.metric->Take();
+        text += "# HELP " + histogram.first + " " + histogram.second.help + "\n# TYPE " + histogram.first + " histogram\n";
+        uint64_t cumulative = 0;
+        for (unsigned i = 0; i < Histogram::kBuckets; ++i) {  // only non-empty buckets - 496 lines per histogram would be too much
+            if (!snapshot.buckets[i])
+                continue;
+            cumulative += snapshot.buckets[i];
+            text += histogram.first + "_bucket{le=\"" + format_seconds(Histogram::BucketUpperBound(i)) + "\"} " + std::to_string(cumulative) + "\n";
+        }
+        text += histogram.first + "_bucket{le=\"+Inf\"} " + std::to_string(snapshot.count) + "\n";
+        text += histogram.first + "_sum " + format_seconds(snapshot.sum) + "\n";
+        text += histogram.first + "_count " + std::to_string(snapshot.count) + "\n";
+    }
+    return text;
+}
+
+}  // namespace MQ_System
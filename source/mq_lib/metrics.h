@@ -0,0 +1,138 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Metrics is process wide registry of counters, gauges and latency histograms (self-instrumentation of daemons and libraries).
+// Updates are lock-free relaxed atomics on per-thread shards so they are cheap enough for hot paths; registration takes a mutex
+// so hot paths shall look the metric up once and keep the reference (references stay valid for process lifetime).
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MQ_System {
+
+constexpr unsigned kMetricShards = 8;  // threads are assigned to shards round robin
+unsigned metric_shard_index() noexcept;
+
+inline unsigned metric_shard() noexcept {
+    static thread_local const unsigned shard = metric_shard_index();
+    return shard;
+}
+
+class Counter {
+ public:
+    Counter() noexcept;
+    void Increment(uint64_t value = 1) noexcept { _shards[metric_shard()].value.fetch_add(value, std::memory_order_relaxed); }
+    uint64_t Value() const noexcept;
+ private:
+    struct Shard {
+        std::atomic<uint64_t> value;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];  // one cache line per shard
+    };
+    Shard _shards[kMetricShards];
+};
+
+class Gauge {
+ public:
+    Gauge() noexcept : _value(0) {}
+    void Set(int64_t value) noexcept { _value.store(value, std::memory_order_relaxed); }
+    void Add(int64_t value) noexcept { _value.fetch_add(value, std::memory_order_relaxed); }
+    int64_t Value() const noexcept { return _value.load(std::memory_order_relaxed); }
+ private:
+    std::atomic<int64_t> _value;
+};
+
+// log-linear buckets of nanoseconds (8 sub-buckets per power of two - HDR histogram like, relative error <= 12.5%)
+class Histogram {
+ public:
+    static constexpr unsigned kSubBucketBits = 3;
+    static constexpr unsigned kSubBuckets = 1 << kSubBucketBits;
+    static constexpr unsigned kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    struct Snapshot {
+        uint64_t count;
+        uint64_t sum;  // ns
+        std::vector<uint64_t> buckets;
+        uint64_t Percentile(double percentile) const noexcept;  // upper bound of bucket (ns); percentile 0-100
+    };
+
+    Histogram() noexcept;
+    void Record(uint64_t nanoseconds) noexcept {
+        Shard& shard = _shards[metric_shard()];
+        shard.buckets[BucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        shard.count.fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+    void Record(std::chrono::nanoseconds duration) noexcept { Record(static_cast<uint64_t>(duration.count() > 0 ? duration.count() : 0)); }
+    Snapshot Take() const;
+
+    static unsigned BucketIndex(uint64_t value) noexcept {
+        if (value < kSubBuckets)
+            return static_cast<unsigned>(value);
+        const unsigned msb = 63 - __builtin_clzll(value);
+        return (msb - kSubBucketBits + 1) * kSubBuckets + static_cast<unsigned>((value >> (msb - kSubBucketBits)) & (kSubBuckets - 1));
+    }
+    static uint64_t BucketUpperBound(unsigned index) noexcept;  // inclusive (ns)
+
+ private:
+    struct Shard {
+        std::atomic<uint64_t> buckets[kBuckets];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        char padding[64 - 2 * sizeof(std::atomic<uint64_t>)];
+    };
+    Shard _shards[kMetricShards];
+};
+
+// records life time of the object to histogram
+class ScopedTimer {
+ public:
+    explicit ScopedTimer(Histogram& histogram) noexcept : _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() noexcept { _histogram.Record(std::chrono::steady_clock::now() - _start); }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+ private:
+    Histogram& _histogram;
+    const std::chrono::steady_clock::time_point _start;
+};
+
+class Metrics {
+ public:
+    static Metrics& Instance();  // libraries (i2cxx, gpiocxx) register there as well - they are used without Daemon too
+
+    // returns existing metric if the name is already registered; name shall follow prometheus naming (eg. mq_published_total)
+    Counter& GetCounter(const std::string& name, const std::string& help);
+    Gauge& GetGauge(const std::string& name, const std::string& help);
+    Histogram& GetHistogram(const std::string& name, const std::string& help);  // values are reported in seconds
+
+    std::string Json() const;  // compact snapshot - counters, gauges and histogram count/percentiles
+    std::string PrometheusText() const;  // text exposition format 0.0.4
+
+ private:
+    Metrics() = default;
+    template <typename Metric>
+    struct Entry {
+        std::string help;
+        std::unique_ptr<Metric> metric;
+    };
+    template <typename Metric>
+    Metric& get_metric(std::map<std::string, Entry<Metric>>& metrics, const std::string& name, const std::string& help);
+
+    mutable std::mutex _mutex;
+    std::map<std::string, Entry<Counter>> _counters;
+    std::map<std::string, Entry<Gauge>> _gauges;
+    std::map<std::string, Entry<Histogram>> _histograms;
+};
+
+}  // namespace MQ_System
@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2017-2019
-// Version: 09122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -9,12 +9,18 @@
 
 #include "./mq_lib.h"
 // system
-#include <signal.h>  // to handle signals (SIGTERM)
+#include <signal.h>  // SIGTERM, SIGHUP...
 #include <unistd.h>  // getpid(2)
+#include <sys/socket.h>  // metrics endpoint socket
+#include <sys/stat.h>  // mkdir(2)
+#include <sys/un.h>  // sockaddr_un
 // stdlib
+#include <cerrno>
+#include <cstring>  // strerror
 #include <cstdlib>  // daemon(3)
 #include <cstdio>  // fopen(3), fwrite for pid file preparation
 // c++lib
+#include <algorithm>  // std::min
 #include <stdexcept> // runtime_error
 // external lib
 #include <libconfig.h++>  // configuration file parsing
@@ -35,21 +41,6 @@
 #endif
 
 
-namespace MQ_System {
-
-Daemon *g_daemon = nullptr;  // this is needed to support signal handler access to terminate the daemon if called
-
-} // namespace MQ_System
-
-static void signal_handler(int sig) {
-    if (sig == SIGTERM) {
-        MQ_System::g_daemon->~Daemon();  // This may lead to leak; however we expect Daemon to be stack constructed so we can't let normal destructor to be here and placement destructor would do the same... 
-        exit(0);
-    } else if (sig == SIGHUP){
-        //TODO reload configuration - not implemented
-    }
-}
-
 void sqlog_error_callback(void *pArg, int iErrCode, const char *zMsg) {
     auto logger = spdlog::get("emergecy logger");
     if (logger == nullptr)
@@ -69,13 +60,29 @@ extern "C" const char* __ubsan_default_options() {
 #endif
 
 namespace MQ_System {
-const char* Daemon::kMqSystemConfigFile = "/etc/mq_system/system.conf";  // hard coded path (might be altered but...)
+static const char* kMqSystemConfigDir = "/etc/mq_system";  // hard coded path - MQ_SYSTEM_CONFIG_DIR may override it
+
+std::string ConfigPath(const std::string& file_name) {
+    const char* config_dir = getenv("MQ_SYSTEM_CONFIG_DIR");
+    return std::string(config_dir != nullptr && *config_dir ? config_dir : kMqSystemConfigDir) + "/" + file_name;
+}
 const char* Daemon::kDefaultHost = "127.0.0.1";  // IPv4 127.0.0.1 or IPv6 ::1 - for now we keep it on IPv4 thus IPv6 stack may not be enabled... 
+const char* Daemon::kDefaultMetricsSocketDir = "/var/run/mq_system";
 
-Daemon::Daemon(const char* daemon_name, const char* pid_name, bool no_daemon)
+Daemon::Daemon(const char* daemon_name, const char* pid_name, bool no_daemon) : Daemon(daemon_name, pid_name, no_daemon, false) {}
+
+Daemon::Daemon(const char* daemon_name, const char* pid_name, bool no_daemon, bool offline)
     : _logger(nullptr)
+    , _mosquitto_object(nullptr)
+    , _mosquitto_socket(-1)
+    , _mosquitto_want_write(false)
+    , _reconnect_delay(1)
     , _pid_file(pid_name)
     , _log_mqtt(false)
+    , _metrics_interval(kDefaultMetricsInterval)
+    , _metrics_timer(EventLoop::kInvalidTimer)
+    , _metrics_socket_dir(kDefaultMetricsSocketDir)
+    , _metrics_socket(-1)
 {
     std::vector<spdlog::sink_ptr> sinks;
     sinks.push_back(std::make_shared<spdlog::sinks::syslog_sink_mt>("mq_system", 0, LOG_USER, false)); // shall we use systemd sink for systemd?
@@ -84,10 +91,17 @@ Daemon::Daemon(const char* daemon_name, const char* pid_name, bool no_daemon)
     _logger = std::make_shared<spdlog::logger>(daemon_name, begin(sinks), end(sinks));
     _logger->set_level(spdlog::level::trace);
     //auto _log_sink = std::dynamic_pointer_cast<spdlog::sinks::dist_sink_mt>(_logger->sinks()[0]);   
-    daemonize(no_daemon);
-    g_daemon = this; // save the daemon ID for signal handler purposes
-    signal(SIGTERM, signal_handler);
-    signal(SIGHUP, signal_handler);
+    daemonize(no_daemon || offline);
+    EventLoop::BlockSignals({SIGTERM, SIGINT, SIGHUP});  // before any thread is started - signals are received by event loop only
+    _event_loop.reset(new EventLoop(_logger));
+    _event_loop->HandleSignals({SIGTERM, SIGINT, SIGHUP}, [this](int signal_number) {
+        if (signal_number == SIGHUP) {
+            reload_configuration();
+        } else {
+            _logger->info("Signal {} received - stopping", signal_number);
+            _event_loop->Stop();
+        }
+    });
     load_mq_system_configuration();
 	_logger->flush();
     if (_log_file.size()) {
@@ -115,12 +129,17 @@ Daemon::Daemon(const char* daemon_name, const char* pid_name, bool no_daemon)
     }
     _logger->trace("log setup done");
     _logger->flush();
+    if (offline) {
+        _logger->info("Demon initialization finished (offline)");
+        return;
+    }
     connect_mqtt();
     if (_log_mqtt) {
         _logger->flush();
         _logger->sinks()[2] = std::make_shared<mosq_sink>(_mosquitto_object);
         _logger->trace("mqtt_log initialized");
     }
+    setup_metrics();
     _logger->info("Demon initialization finished");
     _logger->flush();
 }
@@ -154,13 +173,30 @@ std::shared_ptr<spdlog::sinks::sink> Daemon::conect_log_db() {
 void Daemon::CallBack(const std::string&, const std::string&) {
 }
 
-void Daemon::load_mq_system_configuration() {
+void Daemon::OnConfigChanged() {
+}
+
+void Daemon::reload_configuration() noexcept {
+    _logger->info("SIGHUP received - reloading configuration");
+    try {
+        load_mq_system_configuration(true);
+        OnConfigChanged();
+        _logger->info("Configuration reloaded");
+    } catch (const std::exception&) {
+        _logger->error("Configuration reload failed - daemon keeps running with previous configuration");
+    }
+    _logger->flush();
+}
+
+// on reload only log level is applied - connection and log sinks are set up once (they need restart)
+void Daemon::load_mq_system_configuration(bool reload) {
     // read mq_system global configuration - libconfig++
+    const std::string config_file = ConfigPath("system.conf");
     libconfig::Config cfg;
     try {
-        cfg.readFile(kMqSystemConfigFile);
+        cfg.readFile(config_file.c_str());
     } catch(const libconfig::FileIOException &fioex) {
-        _logger->error("I/O error while reading system configuration file: {}", kMqSystemConfigFile);
+        _logger->error("I/O error while reading system configuration file: {}", config_file);
         _logger->flush();
         throw std::runtime_error("");
     } catch(const libconfig::ParseException &pex) {
@@ -168,21 +204,32 @@ void Daemon::load_mq_system_configuration() {
         _logger->flush();
         throw std::runtime_error("");
     }
+    std::string connection_host = reload ? _connection_host : kDefaultHost;
+    int connection_port = reload ? _connection_port : kDefaultPort;
+    std::string log_db = reload ? _log_db : "";
+    std::string log_file = _log_file;
+    bool log_mqtt = reload ? _log_mqtt : false;
+    int metrics_interval = kDefaultMetricsInterval;
+    std::string metrics_socket_dir = kDefaultMetricsSocketDir;
     try {
         if (cfg.exists("mqtt_connection.host"))
-            cfg.lookupValue("mqtt_connection.host", _connection_host);
+            cfg.lookupValue("mqtt_connection.host", connection_host);
         else
-            _connection_host = kDefaultHost;
+            connection_host = kDefaultHost;
         if (cfg.exists("mqtt_connection.port"))
-            cfg.lookupValue("mqtt_connection.port", _connection_port);
+            cfg.lookupValue("mqtt_connection.port", connection_port);
         else
-            _connection_port = kDefaultPort;
+            connection_port = kDefaultPort;
         if (cfg.exists("log_db"))
-            cfg.lookupValue("log_db", _log_db);
+            cfg.lookupValue("log_db", log_db);
         if (cfg.exists("log_file"))
-            cfg.lookupValue("log_file", _log_file);
+            cfg.lookupValue("log_file", log_file);
         if (cfg.exists("log_mqtt"))
-            cfg.lookupValue("log_mqtt", _log_mqtt);
+            cfg.lookupValue("log_mqtt", log_mqtt);
+        if (cfg.exists("metrics_interval"))
+            cfg.lookupValue("metrics_interval", metrics_interval);
+        if (cfg.exists("metrics_socket_dir"))
+            cfg.lookupValue("metrics_socket_dir", metrics_socket_dir);
         if  (cfg.exists("log_level")) {
             int level;
             cfg.lookupValue("log_level", level);
@@ -197,6 +244,26 @@ void Daemon::load_mq_system_configuration() {
         _logger->flush();
         throw std::runtime_error("");
     }
+    if (reload) {
+        if (connection_host != _connection_host || connection_port != _connection_port)
+            _logger->warn("MQTT connection change requires daemon restart - keeping {}:{}", _connection_host, _connection_port);
+        if (log_db != _log_db || log_file != _log_file || log_mqtt != _log_mqtt)
+            _logger->warn("Log output change requires daemon restart");
+        if (metrics_socket_dir != _metrics_socket_dir)
+            _logger->warn("Metrics socket change requires daemon restart");
+        if (metrics_interval != _metrics_interval) {
+            _metrics_interval = metrics_interval;
+            schedule_metrics();
+        }
+        return;
+    }
+    _connection_host = connection_host;
+    _connection_port = connection_port;
+    _log_db = log_db;
+    _log_file = log_file;
+    _log_mqtt = log_mqtt;
+    _metrics_interval = metrics_interval;
+    _metrics_socket_dir = metrics_socket_dir;
 }
 
 void Daemon::daemonize(bool no_daemon) const {
@@ -226,6 +293,10 @@ void Daemon::daemonize(bool no_daemon) const {
 }
 
 static void OnMessage (struct mosquitto *mosq __attribute__((unused)), void * context, const struct mosquitto_message * message) {
+    static Counter& received = Metrics::Instance().GetCounter("mq_messages_received_total", "MQTT messages received");
+    static Histogram& callback_time = Metrics::Instance().GetHistogram("mq_callback_seconds", "Time spent in daemon message callback");
+    received.Increment();
+    ScopedTimer timer(callback_time);
     const std::string topic(message->topic);
     const std::string smessage(reinterpret_cast<const char*>(message->payload), message->payloadlen);
     reinterpret_cast<Daemon*>(context)->CallBack(topic, smessage);
@@ -241,6 +312,9 @@ void Daemon::connect_mqtt() {
         _logger->flush();
         throw std::runtime_error("");
     }
+    // Publish / Subscribe are called from other threads (workers, reload, notifications) - packets are queued then and written
+    // by the loop thread only (EPOLLOUT); without it libmosquitto writes to the socket from the calling thread
+    mosquitto_threaded_set(_mosquitto_object, true);
     int connection_attempts = 10;  // we wait up to 10s for connection (it may start the same time the mosquitto dows so it's gonna wait for it to init)
     for(; connection_attempts > 0; --connection_attempts) {
         if (mosquitto_connect(_mosquitto_object, _connection_host.c_str(), _connection_port, 60) == MOSQ_ERR_SUCCESS)
@@ -257,7 +331,61 @@ void Daemon::connect_mqtt() {
     _logger->trace("connect_mqtt done after {} seconds", 10 - connection_attempts);
     _logger->flush();
     mosquitto_message_callback_set(_mosquitto_object, OnMessage);
-    mosquitto_loop_start(_mosquitto_object);
+    watch_mqtt_socket();
+    _event_loop->AddPrepareHook([this] {
+        if (_mosquitto_socket < 0)
+            return;
+        const bool want_write = mosquitto_want_write(_mosquitto_object);
+        if (want_write != _mosquitto_want_write) {
+            _event_loop->ModifyFd(_mosquitto_socket, want_write ? EPOLLIN | EPOLLOUT : EPOLLIN);
+            _mosquitto_want_write = want_write;
+        }
+    });
+    _event_loop->AddTimer(std::chrono::seconds(1), std::chrono::seconds(1), [this] {  // keepalive & retry handling of libmosquitto
+        if (_mosquitto_socket < 0)
+            return;
+        const int result = mosquitto_loop_misc(_mosquitto_object);
+        if (result != MOSQ_ERR_SUCCESS)
+            on_mqtt_connection_lost(result);
+    });
+}
+
+void Daemon::watch_mqtt_socket() {
+    _mosquitto_socket = mosquitto_socket(_mosquitto_object);
+    _mosquitto_want_write = false;
+    _event_loop->AddFd(_mosquitto_socket, EPOLLIN, [this](uint32_t events) { on_mqtt_events(events); });
+}
+
+void Daemon::on_mqtt_events(uint32_t events) {
+    int result = MOSQ_ERR_SUCCESS;
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        result = mosquitto_loop_read(_mosquitto_object, 1);
+    if (result == MOSQ_ERR_SUCCESS && (events & EPOLLOUT))
+        result = mosquitto_loop_write(_mosquitto_object, 1);
+    if (result != MOSQ_ERR_SUCCESS)
+        on_mqtt_connection_lost(result);
+}
+
+void Daemon::on_mqtt_connection_lost(int reason) {
+    _logger->warn("Mosquitto connection lost: {}", mosquitto_strerror(reason));
+    _event_loop->RemoveFd(_mosquitto_socket);
+    _mosquitto_socket = -1;
+    _reconnect_delay = std::chrono::seconds(1);
+    _event_loop->AddTimer(_reconnect_delay, std::chrono::seconds(0), [this] { reconnect_mqtt(); });
+}
+
+void Daemon::reconnect_mqtt() {
+    if (mosquitto_reconnect(_mosquitto_object) != MOSQ_ERR_SUCCESS) {
+        _reconnect_delay = std::min(_reconnect_delay * 2, std::chrono::seconds(32));
+        _logger->debug("Mosquitto reconnect failed - next attempt in {} seconds", _reconnect_delay.count());
+        _event_loop->AddTimer(_reconnect_delay, std::chrono::seconds(0), [this] { reconnect_mqtt(); });
+        return;
+    }
+    watch_mqtt_socket();
+    std::unique_lock<std::mutex> subscription_lock(_subscription_mutex);
+    for (const auto& topic : _subscriptions)  // clean session - broker forgot our subscriptions
+        mosquitto_subscribe(_mosquitto_object, NULL, topic.c_str(), 2);
+    _logger->info("Mosquitto reconnected");
 }
 
 Daemon::~Daemon() noexcept {
@@ -271,41 +399,160 @@ Daemon::~Daemon() noexcept {
     _logger->trace("Unlink successful");
 #endif
     _logger->info("Terminating");
+    _logger->flush();
+    _logger->sinks()[2] = std::make_shared<spdlog::sinks::null_sink_mt>();  // mqtt log can't be used from now on
+    if (_metrics_socket >= 0) {
+        close(_metrics_socket);
+        unlink(_metrics_socket_path.c_str());
+    }
+    if (_mosquitto_object != nullptr) {
+        mosquitto_disconnect(_mosquitto_object);
+        mosquitto_loop_write(_mosquitto_object, 1);  // send the disconnect (event loop does not run anymore)
+    }
+    _event_loop.reset();  // it holds logger reference
     if (!_logger.unique())
         _logger->warn("Logger terminate - Pointer not unique!");
     _logger->flush();
     spdlog::shutdown();
-    mosquitto_disconnect(_mosquitto_object);
-    mosquitto_loop_stop(_mosquitto_object, true);
     mosquitto_destroy(_mosquitto_object);
     mosquitto_lib_cleanup();
     sqlite3_shutdown();
 }
 
 void Daemon::Subscribe(const std::string& topic) noexcept {
+    std::unique_lock<std::mutex> subscription_lock(_subscription_mutex);
+    _subscriptions.insert(topic);
+    if (_mosquitto_object == nullptr)
+        return;  // offline
     if (MOSQ_ERR_SUCCESS != mosquitto_subscribe(_mosquitto_object, NULL, topic.c_str(), 2)) {
         _logger->error("Subscribe topic {} error!", topic);
     }
+    subscription_lock.unlock();
+    if (!_event_loop->InLoopThread())
+        _event_loop->Wakeup();  // packet may wait for EPOLLOUT
 }
 
 void Daemon::Unsubscribe(const std::string& topic) noexcept {
-    if (MOSQ_ERR_SUCCESS != mosquitto_unsubscribe(_mosquitto_object, NULL, topic.c_str())) {
-        _logger->error("Unsubscribe topic {} error!", topic);
+    std::unique_lock<std::mutex> subscription_lock(_subscription_mutex);
+    if (_mosquitto_object == nullptr) {  // offline
+        _subscriptions.erase(topic);
+        return;
     }
+    if (topic == "#" && !_subscriptions.count(topic)) {  // "#" means all the topics we subscribed (broker would not match them by "#" unsubscribe)
+        for (const auto& subscription : _subscriptions)
+            if (MOSQ_ERR_SUCCESS != mosquitto_unsubscribe(_mosquitto_object, NULL, subscription.c_str()))
+                _logger->error("Unsubscribe topic {} error!", subscription);
+        _subscriptions.clear();
+    } else {
+        _subscriptions.erase(topic);
+        if (MOSQ_ERR_SUCCESS != mosquitto_unsubscribe(_mosquitto_object, NULL, topic.c_str())) {
+            _logger->error("Unsubscribe topic {} error!", topic);
+        }
+    }
+    subscription_lock.unlock();
+    if (!_event_loop->InLoopThread())
+        _event_loop->Wakeup();
 }
 
 void Daemon::Publish(const std::string& topic, const std::string& message) {
+    static Counter& published = Metrics::Instance().GetCounter("mq_messages_published_total", "MQTT messages published");
+    static Counter& publish_errors = Metrics::Instance().GetCounter("mq_publish_errors_total", "MQTT publish failures");
+    if (_mosquitto_object == nullptr)
+        return;  // offline
     int mosresult = mosquitto_publish(_mosquitto_object, NULL, topic.c_str(), message.length(), message.c_str(), 2, false);
-    if (mosresult != MOSQ_ERR_SUCCESS)
+    published.Increment();
+    if (mosresult != MOSQ_ERR_SUCCESS) {
+        publish_errors.Increment();
         _logger->warn("Publish error: {} ", mosresult);
+    }
+    if (!_event_loop->InLoopThread() && mosquitto_want_write(_mosquitto_object))
+        _event_loop->Wakeup();  // message is queued - loop needs to re-evaluate EPOLLOUT interest
 }
 
-void Daemon::SleepForever() {
-    std::condition_variable cv;
-    std::mutex m;
-    std::unique_lock<std::mutex> lock(m);
-    cv.wait(lock, [] {return false;});  // wait for something that would never happen
-    //std::this_thread::sleep_until(std::chrono::time_point<std::chrono::system_clock>::max());  // this one proved to be unsafe (overflow (undefined) - may not work) - kepping it therre just to ensure noone use it again...
+// snapshot is published to app/metrics/<daemon> periodically and served as prometheus text on unix socket
+// endpoint failure is not fatal - daemon works without it
+void Daemon::setup_metrics() {
+    schedule_metrics();
+    if (_metrics_socket_dir.empty())
+        return;
+    if (mkdir(_metrics_socket_dir.c_str(), 0755) && errno != EEXIST) {
+        _logger->warn("Unable to create metrics socket directory {}: {}", _metrics_socket_dir, strerror(errno));
+        return;
+    }
+    _metrics_socket_path = _metrics_socket_dir + "/" + _logger->name() + ".prom";
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (_metrics_socket_path.size() >= sizeof(address.sun_path)) {
+        _logger->warn("Metrics socket path too long: {}", _metrics_socket_path);
+        return;
+    }
+    strncpy(address.sun_path, _metrics_socket_path.c_str(), sizeof(address.sun_path) - 1);
+    _metrics_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_metrics_socket < 0) {
+        _logger->warn("Unable to create metrics socket: {}", strerror(errno));
+        return;
+    }
+    unlink(_metrics_socket_path.c_str());  // stale socket of previous run
+    if (bind(_metrics_socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) || listen(_metrics_socket, 4)) {
+        _logger->warn("Unable to bind metrics socket {}: {}", _metrics_socket_path, strerror(errno));
+        close(_metrics_socket);
+        _metrics_socket = -1;
+        return;
+    }
+    _event_loop->AddFd(_metrics_socket, EPOLLIN, [this](uint32_t) { on_metrics_connection(); });
+    _logger->debug("Metrics endpoint: {}", _metrics_socket_path);
+}
+
+void Daemon::schedule_metrics() {
+    _event_loop->CancelTimer(_metrics_timer);
+    _metrics_timer = EventLoop::kInvalidTimer;
+    if (_metrics_interval <= 0)
+        return;
+    const std::chrono::seconds interval(_metrics_interval);
+    _metrics_timer = _event_loop->AddTimer(interval, interval, [this] {
+        Publish("app/metrics/" + _logger->name(), Metrics::Instance().Json());
+    });
+}
+
+void Daemon::on_metrics_connection() {
+    while (true) {
+        const int client = accept4(_metrics_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                _logger->debug("Metrics accept error: {}", strerror(errno));
+            return;
+        }
+        _event_loop->AddFd(client, EPOLLIN, [this, client](uint32_t events) { on_metrics_client(client, events); });
+    }
+}
+
+// client sends HTTP GET (prometheus, curl --unix-socket) or just anything / shuts down writing (socat, nc -U)
+void Daemon::on_metrics_client(int client, uint32_t events) {
+    char request[512];
+    const ssize_t size = (events & EPOLLIN) ? recv(client, request, sizeof(request), 0) : 0;
+    if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    std::string response = Metrics::Instance().PrometheusText();
+    if (size >= 4 && !memcmp(request, "GET ", 4)) {
+        response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(response.size())
+            + "\r\nConnection: close\r\n\r\n" + response;
+    }
+    size_t sent = 0;
+    while (sent < response.size()) {  // snapshot fits socket buffer - short write means client went away
+        const ssize_t result = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0)
+            break;
+        sent += result;
+    }
+    _event_loop->RemoveFd(client);
+    close(client);
+}
+
+void Daemon::Run() {
+    _logger->trace("Run");
+    _logger->flush();
+    _event_loop->Run();
 }
 
 }  // namespace MQ_System
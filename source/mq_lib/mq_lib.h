@@ -1,6 +1,6 @@
 #pragma once
 // Copyright: (c) Jaromir Veber 2017-2019
-// Version: 09122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -12,41 +12,77 @@
 #include "../config.h"
 #include <mosquitto.h>  // struct mosquitto...
 
+#include <chrono>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 
 #include "spdlog/spdlog.h"
+#include "./event_loop.h"
+#include "./config_diff.h"
+#include "./metrics.h"
 
 namespace MQ_System {
 
+// configuration files live in /etc/mq_system - MQ_SYSTEM_CONFIG_DIR environment variable overrides the directory (benchmarks, testing)
+std::string ConfigPath(const std::string& file_name);
 
 class Daemon {
  public:
     Daemon(const char* demon_name, const char* pid_name, bool no_daemon = false);  // may throw std::runtime_error if error happened (always shall log reason)
+    // offline daemon (simulation, tools) does not fork and does not connect MQTT nor open metrics endpoint - Publish does nothing
+    Daemon(const char* demon_name, const char* pid_name, bool no_daemon, bool offline);
     virtual ~Daemon() noexcept;
     virtual void CallBack(const std::string& topic , const std::string& message); // user may overload this one if he needs callback function - proxy for message system - Subscribe (Callback)
+    // called (in Run() thread) on SIGHUP after system configuration was reloaded; daemon shall re-read it's configuration and apply the difference (see ConfigDiff)
+    // may throw std::runtime_error (log reason) - daemon shall keep running with the old configuration then
+    virtual void OnConfigChanged();
     void Unsubscribe(const std::string& topic) noexcept;  // proxy for message system - Unsubscribe
     void Subscribe(const std::string& topic) noexcept; // proxy for message system - Subscribe
     void Publish(const std::string& topic, const std::string& message); // proxy for message system - Publish
     std::shared_ptr<spdlog::logger> _logger;  // logger for general use (logging)
-    void SleepForever();  // it is better to avoid this one as much as possible but sometimes I found that hard to avoid it so it's here.
+    void Run();  // runs event loop (MQTT, timers, signals) in calling thread until SIGTERM/SIGINT is received
+    EventLoop& Loop() noexcept { return *_event_loop; }  // timers and fds of the daemon shall be registered here (callbacks run in Run() thread)
  private:
-    void load_mq_system_configuration();
+    void load_mq_system_configuration(bool reload = false);
+    void reload_configuration() noexcept;
+    void setup_metrics();
+    void schedule_metrics();
+    void on_metrics_connection();
+    void on_metrics_client(int client, uint32_t events);
     void daemonize(bool no_deamon) const;
     void connect_mqtt();
+    void watch_mqtt_socket();
+    void on_mqtt_events(uint32_t events);
+    void on_mqtt_connection_lost(int reason);
+    void reconnect_mqtt();
     std::shared_ptr<spdlog::sinks::sink> conect_log_db();
 
-    static const char* kMqSystemConfigFile;
     static const char* kDefaultHost;
     static constexpr int kDefaultPort = 1887;
+    static const char* kDefaultMetricsSocketDir;
+    static constexpr int kDefaultMetricsInterval = 60;  // s
 
+    std::unique_ptr<EventLoop> _event_loop;
     struct mosquitto* _mosquitto_object;
+    int _mosquitto_socket;  // socket registered in event loop (-1 while disconnected)
+    bool _mosquitto_want_write;  // EPOLLOUT is set for the socket
+    std::chrono::seconds _reconnect_delay;
+    std::mutex _subscription_mutex;
+    std::set<std::string> _subscriptions;  // topics to renew after reconnect
     int _connection_port;
     std::string _connection_host;
     std::string _log_db;
     std::string _log_file = "/var/log/mq_system/system.log";
     const std::string _pid_file;
     bool _log_mqtt;
+    int _metrics_interval;  // s; 0 means metrics are not published to MQTT
+    EventLoop::TimerId _metrics_timer;
+    std::string _metrics_socket_dir;  // prometheus text endpoint <dir>/<daemon>.prom (empty means disabled)
+    std::string _metrics_socket_path;
+    int _metrics_socket;
 };
 
 }  // namespace MQ_System
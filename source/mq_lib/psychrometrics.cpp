@@ -0,0 +1,134 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+
+#include "./psychrometrics.h"
+
+#include <algorithm>  // std::min, std::max
+#include <cstdint>
+#include <cstring>  // std::memcpy
+
+namespace MQ_System {
+namespace Psychrometrics {
+
+namespace {
+
+constexpr float kMagnusA = 17.62f;  // Magnus formula (Sonntag 1990): es = 6.112 hPa * exp(a * T / (b + T))
+constexpr float kMagnusB = 243.12f;  // °C
+constexpr float kMagnusPressure = 6.112f;  // hPa
+constexpr float kZeroCelsius = 273.15f;  // K
+constexpr float kWaterGasFactor = 216.68f;  // g*K/(m³*hPa) - 100 / 461.5 J/(kg*K) (water vapor gas constant) * 1000
+constexpr float kMoistureRatio = 0.62198f;  // molar mass of water / dry air
+constexpr float kLn2 = 0.6931471806f;
+
+// bit casts by memcpy compile to plain moves (vector ones in vectorized loops)
+inline float from_bits(int32_t bits) noexcept {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline int32_t to_bits(float value) noexcept {
+    int32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// e^x = 2^n * 2^f (n integer, f in [0, 1)); 2^f is Taylor polynomial of degree 7
+inline float exp_approx(float x) noexcept {
+    const float t = std::min(std::max(x, -87.f), 88.f) * 1.4426950409f;  // log2(e)
+    int32_t n = static_cast<int32_t>(t);  // truncation - floor by correction below
+    n -= t < static_cast<float>(n) ? 1 : 0;
+    const float f = (t - static_cast<float>(n)) * kLn2;
+    const float p = 1.f + f * (1.f + f * (1.f / 2 + f * (1.f / 6 + f * (1.f / 24 + f * (1.f / 120 + f * (1.f / 720 + f * (1.f / 5040)))))));
+    return p * from_bits((n + 127) << 23);
+}
+
+// ln x = ln m + e * ln 2 (x = m * 2^e, m in [sqrt(2)/2, sqrt(2))); ln m = 2 atanh((m - 1) / (m + 1)) series; x > 0
+inline float log_approx(float x) noexcept {
+    const int32_t bits = to_bits(x);
+    int32_t exponent = ((bits >> 23) & 0xFF) - 127;
+    float m = from_bits((bits & 0x7FFFFF) | 0x3F800000);  // [1, 2)
+    const bool high = m > 1.4142135624f;
+    m = high ? m * 0.5f : m;
+    exponent += high ? 1 : 0;
+    const float s = (m - 1.f) / (m + 1.f);
+    const float s2 = s * s;
+    const float atanh = s * (1.f + s2 * (1.f / 3 + s2 * (1.f / 5 + s2 * (1.f / 7 + s2 * (1.f / 9)))));
+    return 2.f * atanh + static_cast<float>(exponent) * kLn2;
+}
+
+inline float relative_humidity(float humidity) noexcept {  // fraction
+    return std::min(std::max(humidity, kMinHumidity), 100.f) * 0.01f;
+}
+
+inline float vapor_pressure(float temperature, float humidity) noexcept {  // hPa
+    return relative_humidity(humidity) * kMagnusPressure * exp_approx(kMagnusA * temperature / (kMagnusB + temperature));
+}
+
+}  // namespace
+
+unsigned ParseQuantity(const std::string& name) noexcept {
+    if (name == "dew_point")
+        return kDewPoint;
+    if (name == "absolute_humidity")
+        return kAbsoluteHumidity;
+    if (name == "humidex")
+        return kHumidex;
+    if (name == "enthalpy")
+        return kEnthalpy;
+    return 0;
+}
+
+void VaporPressure(const float* temperature, const float* humidity, size_t count, float* pressure) noexcept {
+    for (size_t i = 0; i < count; ++i)
+        pressure[i] = vapor_pressure(temperature[i], humidity[i]);
+}
+
+// Magnus formula inverted: gamma = ln(RH) + a * T / (b + T), Td = b * gamma / (a - gamma)
+void DewPoint(const float* temperature, const float* humidity, size_t count, float* dew_point) noexcept {
+    for (size_t i = 0; i < count; ++i) {
+        const float gamma = log_approx(relative_humidity(humidity[i])) + kMagnusA * temperature[i] / (kMagnusB + temperature[i]);
+        dew_point[i] = kMagnusB * gamma / (kMagnusA - gamma);
+    }
+}
+
+// ideal gas law of water vapor: rho = e / (Rv * T)
+void AbsoluteHumidity(const float* temperature, const float* humidity, size_t count, float* absolute_humidity) noexcept {
+    for (size_t i = 0; i < count; ++i)
+        absolute_humidity[i] = kWaterGasFactor * vapor_pressure(temperature[i], humidity[i]) / (kZeroCelsius + temperature[i]);
+}
+
+// Environment Canada: H = T + 5/9 * (e - 10) - e is vapor pressure (hPa) which equals saturation pressure at the dew point
+void Humidex(const float* temperature, const float* humidity, size_t count, float* humidex) noexcept {
+    for (size_t i = 0; i < count; ++i)
+        humidex[i] = temperature[i] + 5.f / 9.f * (vapor_pressure(temperature[i], humidity[i]) - 10.f);
+}
+
+// moist air: h = 1.006 * T + W * (2501 + 1.86 * T), humidity ratio W = 0.622 * e / (p - e)
+void Enthalpy(const float* temperature, const float* humidity, size_t count, float* enthalpy, float pressure) noexcept {
+    for (size_t i = 0; i < count; ++i) {
+        const float vapor = vapor_pressure(temperature[i], humidity[i]);
+        const float ratio = kMoistureRatio * vapor / (pressure - vapor);
+        enthalpy[i] = 1.006f * temperature[i] + ratio * (2501.f + 1.86f * temperature[i]);
+    }
+}
+
+void Compute(unsigned mask, const float* temperature, const float* humidity, size_t count, float* const outputs[4]) noexcept {
+    if (mask & kDewPoint)
+        DewPoint(temperature, humidity, count, outputs[0]);
+    if (mask & kAbsoluteHumidity)
+        AbsoluteHumidity(temperature, humidity, count, outputs[1]);
+    if (mask & kHumidex)
+        Humidex(temperature, humidity, count, outputs[2]);
+    if (mask & kEnthalpy)
+        Enthalpy(temperature, humidity, count, outputs[3]);
+}
+
+}  // namespace Psychrometrics
+}  // namespace MQ_System
@@ -0,0 +1,47 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// Psychrometrics - quantities derived from air temperature (°C) and relative humidity (%) for daemons reporting them, so
+// scripts do not compute them in Lua. Functions work on arrays of (T, RH) pairs: loops have no branches and no libm calls
+// (exp / log are polynomial approximations, relative error < 1e-6) so the compiler vectorizes them (-ftree-vectorize, NEON;
+// the file is built with -fno-trapping-math so clamps become selects).
+// Saturation vapor pressure is Magnus formula with Sonntag (1990) constants, valid from -45 to 60 °C. Humidity is clamped
+// to [kMinHumidity, 100] - dew point of dry air is not defined.
+
+#include <cstddef>
+#include <string>
+
+namespace MQ_System {
+namespace Psychrometrics {
+
+enum Quantity : unsigned {  // bit mask of quantities to compute
+    kDewPoint = 1 << 0,  // °C
+    kAbsoluteHumidity = 1 << 1,  // g/m³
+    kHumidex = 1 << 2,  // index (°C like)
+    kEnthalpy = 1 << 3,  // kJ/kg of dry air
+};
+
+constexpr float kMinHumidity = 0.01f;  // %
+constexpr float kStandardPressure = 1013.25f;  // hPa
+
+// "dew_point", "absolute_humidity", "humidex", "enthalpy" (configuration names); 0 - unknown name
+unsigned ParseQuantity(const std::string& name) noexcept;
+
+// outputs may alias neither input
+void VaporPressure(const float* temperature, const float* humidity, size_t count, float* pressure) noexcept;  // hPa
+void DewPoint(const float* temperature, const float* humidity, size_t count, float* dew_point) noexcept;
+void AbsoluteHumidity(const float* temperature, const float* humidity, size_t count, float* absolute_humidity) noexcept;
+void Humidex(const float* temperature, const float* humidity, size_t count, float* humidex) noexcept;
+void Enthalpy(const float* temperature, const float* humidity, size_t count, float* enthalpy, float pressure = kStandardPressure) noexcept;  // @pressure hPa
+
+// quantities of @mask into outputs of the same order as Quantity bits (outputs of quantities not in mask are not touched)
+void Compute(unsigned mask, const float* temperature, const float* humidity, size_t count, float* const outputs[4]) noexcept;
+
+}  // namespace Psychrometrics
+}  // namespace MQ_System
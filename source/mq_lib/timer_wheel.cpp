@@ -0,0 +1,235 @@
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+
+#include "./timer_wheel.h"
+
+#include <algorithm>  // std::max, std::min
+#include <exception>  // std::exception_ptr
+#include <limits>
+
+// Timer with expiry e is stored on level l = highest 6bit digit in which e differs from current tick and in slot digit_l(e).
+// Such slot digit is always bigger than current digit on the level so the slot shall be processed (cascaded to lower levels)
+// once current tick reaches start of the slot. Timers that differ above all levels are kept in overflow list.
+
+namespace MQ_System {
+
+constexpr TimerWheel::TimerId TimerWheel::kInvalidTimer;
+constexpr unsigned TimerWheel::kLevelBits;
+constexpr unsigned TimerWheel::kSlots;
+constexpr unsigned TimerWheel::kLevels;
+constexpr uint32_t TimerWheel::kNil;
+constexpr uint16_t TimerWheel::kOverflow;
+constexpr uint16_t TimerWheel::kFree;
+
+static constexpr double kGoldenRatioFraction = 0.6180339887498949;
+
+TimerWheel::TimerWheel(std::chrono::milliseconds tick, Clock::time_point start, NowFunction now)
+    : _tick_ns(std::max<uint64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(tick).count()))
+    , _start(start)
+    , _now(now)
+    , _current(0)
+    , _size(0)
+    , _free_head(kNil)
+{
+    std::fill(std::begin(_heads), std::end(_heads), kNil);
+    std::fill(std::begin(_occupied), std::end(_occupied), 0);
+}
+
+uint64_t TimerWheel::to_ticks(std::chrono::milliseconds duration) const noexcept {
+    if (duration.count() <= 0)
+        return 0;
+    const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    return (ns + _tick_ns - 1) / _tick_ns;
+}
+
+uint64_t TimerWheel::tick_of(Clock::time_point time) const noexcept {
+    if (time <= _start)
+        return 0;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - _start).count() / _tick_ns;
+}
+
+uint32_t TimerWheel::allocate() {
+    if (_free_head != kNil) {
+        const uint32_t index = _free_head;
+        _free_head = _nodes[index].next;
+        return index;
+    }
+    _nodes.emplace_back();
+    Node& node = _nodes.back();
+    node.generation = 1;
+    node.slot = kFree;
+    return static_cast<uint32_t>(_nodes.size() - 1);
+}
+
+void TimerWheel::release(uint32_t index) noexcept {
+    Node& node = _nodes[index];
+    node.callback = nullptr;
+    if (++node.generation == 0)
+        node.generation = 1;  // id 0 is invalid timer
+    node.slot = kFree;
+    node.next = _free_head;
+    _free_head = index;
+}
+
+void TimerWheel::link(uint32_t index) {
+    Node& node = _nodes[index];
+    uint16_t slot;
+    if (node.expiry <= _current) {  // cascaded timer that expires right now
+        node.expiry = _current;
+        slot = static_cast<uint16_t>(_current & (kSlots - 1));
+    } else {
+        const unsigned level = (63 - __builtin_clzll(node.expiry ^ _current)) / kLevelBits;
+        if (level >= kLevels)
+            slot = kOverflow;
+        else
+            slot = static_cast<uint16_t>(level * kSlots + ((node.expiry >> (level * kLevelBits)) & (kSlots - 1)));
+    }
+    node.slot = slot;
+    node.prev = kNil;
+    node.next = _heads[slot];
+    if (node.next != kNil)
+        _nodes[node.next].prev = index;
+    _heads[slot] = index;
+    if (slot != kOverflow)
+        _occupied[slot / kSlots] |= uint64_t(1) << (slot % kSlots);
+}
+
+void TimerWheel::unlink(uint32_t index) noexcept {
+    Node& node = _nodes[index];
+    if (node.prev != kNil)
+        _nodes[node.prev].next = node.next;
+    else
+        _heads[node.slot] = node.next;
+    if (node.next != kNil)
+        _nodes[node.next].prev = node.prev;
+    if (_heads[node.slot] == kNil && node.slot != kOverflow)
+        _occupied[node.slot / kSlots] &= ~(uint64_t(1) << (node.slot % kSlots));
+}
+
+TimerWheel::TimerId TimerWheel::Add(std::chrono::milliseconds first, std::chrono::milliseconds interval, Callback callback) {
+    const uint64_t base = std::max(_current, tick_of(_now()));  // wheel may be behind real time if it was not advanced for a while
+    const uint32_t index = allocate();
+    Node& node = _nodes[index];
+    node.expiry = base + std::max<uint64_t>(1, to_ticks(first));
+    node.interval = interval.count() > 0 ? std::max<uint64_t>(1, to_ticks(interval)) : 0;
+    node.callback = std::move(callback);
+    link(index);
+    ++_size;
+    return (static_cast<TimerId>(node.generation) << 32) | index;
+}
+
+TimerWheel::TimerId TimerWheel::AddPeriodic(std::chrono::milliseconds interval, Callback callback) {
+    const uint64_t interval_ticks = std::max<uint64_t>(1, to_ticks(interval));
+    const uint64_t sequence = _phase_counters[interval_ticks]++;
+    double phase = sequence * kGoldenRatioFraction;
+    phase -= static_cast<uint64_t>(phase);  // fraction part only
+    const auto offset = std::chrono::milliseconds(static_cast<int64_t>(phase * interval.count()));
+    return Add(offset, interval, std::move(callback));
+}
+
+bool TimerWheel::Cancel(TimerId timer) noexcept {
+    const uint32_t index = static_cast<uint32_t>(timer & 0xFFFFFFFF);
+    const uint32_t generation = static_cast<uint32_t>(timer >> 32);
+    if (index >= _nodes.size() || _nodes[index].generation != generation || _nodes[index].slot == kFree)
+        return false;
+    unlink(index);
+    release(index);
+    --_size;
+    return true;
+}
+
+uint64_t TimerWheel::next_event_tick() const noexcept {
+    uint64_t best = std::numeric_limits<uint64_t>::max();
+    for (unsigned level = 0; level < kLevels; ++level) {
+        const unsigned shift = level * kLevelBits;
+        const unsigned current_digit = (_current >> shift) & (kSlots - 1);
+        const uint64_t pending = _occupied[level] & ~((uint64_t(2) << current_digit) - 1);  // slots behind current digit
+        if (!pending)
+            continue;
+        const uint64_t block = (_current >> (shift + kLevelBits)) << (shift + kLevelBits);
+        best = std::min(best, block | (static_cast<uint64_t>(__builtin_ctzll(pending)) << shift));
+    }
+    if (_heads[kOverflow] != kNil)
+        best = std::min(best, ((_current >> (kLevels * kLevelBits)) + 1) << (kLevels * kLevelBits));
+    return best;
+}
+
+void TimerWheel::cascade(unsigned slot) {
+    uint32_t index = _heads[slot];
+    _heads[slot] = kNil;
+    if (slot != kOverflow)
+        _occupied[slot / kSlots] &= ~(uint64_t(1) << (slot % kSlots));
+    while (index != kNil) {
+        const uint32_t next = _nodes[index].next;
+        link(index);
+        index = next;
+    }
+}
+
+size_t TimerWheel::expire(uint32_t slot) {
+    size_t fired = 0;
+    std::exception_ptr error;
+    while (_heads[slot] != kNil) {  // callbacks never add timer to current slot (expiry > _current)
+        const uint32_t index = _heads[slot];
+        unlink(index);
+        Node& node = _nodes[index];
+        const TimerId id = (static_cast<TimerId>(node.generation) << 32) | index;
+        Callback callback = std::move(node.callback);
+        if (node.interval) {
+            node.expiry += node.interval;  // keep the phase (no drift)
+            if (node.expiry <= _current)  // we were late for more than interval
+                node.expiry += ((_current - node.expiry) / node.interval + 1) * node.interval;
+            link(index);
+        } else {
+            release(index);
+            --_size;
+        }
+        ++fired;
+        try {
+            callback();
+        } catch (...) {
+            if (!error)
+                error = std::current_exception();
+        }
+        if (_nodes[index].generation == static_cast<uint32_t>(id >> 32) && _nodes[index].slot != kFree)
+            _nodes[index].callback = std::move(callback);  // periodic timer not canceled by callback
+    }
+    if (error)
+        std::rethrow_exception(error);  // first error only; all timers of the slot were processed
+    return fired;
+}
+
+size_t TimerWheel::Advance(Clock::time_point now) {
+    const uint64_t target = tick_of(now);
+    size_t fired = 0;
+    while (_current < target) {
+        const uint64_t next = next_event_tick();
+        if (next > target) {
+            _current = target;
+            break;
+        }
+        _current = next;
+        if ((_current & ((uint64_t(1) << (kLevels * kLevelBits)) - 1)) == 0)
+            cascade(kOverflow);
+        for (unsigned level = kLevels - 1; level > 0; --level)
+            if ((_current & ((uint64_t(1) << (level * kLevelBits)) - 1)) == 0)
+                cascade(level * kSlots + ((_current >> (level * kLevelBits)) & (kSlots - 1)));
+        fired += expire(static_cast<uint32_t>(_current & (kSlots - 1)));
+    }
+    return fired;
+}
+
+TimerWheel::Clock::time_point TimerWheel::NextExpiry() const noexcept {
+    const uint64_t next = next_event_tick();
+    if (next == std::numeric_limits<uint64_t>::max())
+        return Clock::time_point::max();
+    return _start + std::chrono::nanoseconds(next * _tick_ns);
+}
+
+}  // namespace MQ_System
@@ -0,0 +1,84 @@
+#pragma once
+// Copyright: (c) Jaromir Veber 2026
+// Version: 18102026
+// License: MPL-2.0
+// *******************************************************************************
+//  This Source Code Form is subject to the terms of the Mozilla Public
+//  License, v. 2.0. If a copy of the MPL was not distributed with this
+//  file, You can obtain one at http ://mozilla.org/MPL/2.0/.
+// *******************************************************************************
+// TimerWheel is hierarchical timing wheel (6 levels x 64 slots) for large amount of (mostly periodic) timers.
+// Insert and cancel are O(1); Advance cost depends on number of expired timers only (empty slots are skipped using occupancy bitmaps).
+// It is not thread-safe - it is supposed to be driven by EventLoop (see EventLoop::Wheel).
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace MQ_System {
+
+class TimerWheel {
+ public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<void()> Callback;
+    typedef uint64_t TimerId;  // generation << 32 | node index; 0 is never used
+    typedef Clock::time_point (*NowFunction)();  // time source for Add (benchmark / simulation may use virtual time)
+    static constexpr TimerId kInvalidTimer = 0;
+
+    explicit TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(10), Clock::time_point start = Clock::now(), NowFunction now = &Clock::now);
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // interval == 0 means one-shot timer; delays are rounded up to tick
+    TimerId Add(std::chrono::milliseconds first, std::chrono::milliseconds interval, Callback callback);
+    // periodic timer with first expiry spread over the interval (golden ratio sequence per interval) so timers with same interval don't fire at once
+    TimerId AddPeriodic(std::chrono::milliseconds interval, Callback callback);
+    bool Cancel(TimerId timer) noexcept;  // returns false if timer does not exist (anymore); safe to call from callbacks
+
+    size_t Advance(Clock::time_point now);  // fires all timers expired till now; returns number of fired timers
+    Clock::time_point NextExpiry() const noexcept;  // lower bound of next expiry (may be cascade tick); time_point::max() if there is no timer
+    size_t Size() const noexcept { return _size; }
+
+ private:
+    static constexpr unsigned kLevelBits = 6;
+    static constexpr unsigned kSlots = 1 << kLevelBits;
+    static constexpr unsigned kLevels = 6;
+    static constexpr uint32_t kNil = 0xFFFFFFFF;
+    static constexpr uint16_t kOverflow = kLevels * kSlots;  // "slot" of timers beyond wheel range
+    static constexpr uint16_t kFree = kOverflow + 1;
+
+    struct Node {
+        uint64_t expiry;  // absolute tick
+        uint64_t interval;  // ticks; 0 = one-shot
+        Callback callback;
+        uint32_t generation;
+        uint32_t prev;
+        uint32_t next;  // also free list link
+        uint16_t slot;  // level * kSlots + slot index or kOverflow / kFree
+    };
+
+    uint64_t to_ticks(std::chrono::milliseconds duration) const noexcept;
+    uint64_t tick_of(Clock::time_point time) const noexcept;
+    uint32_t allocate();
+    void release(uint32_t index) noexcept;
+    void link(uint32_t index);
+    void unlink(uint32_t index) noexcept;
+    void cascade(unsigned slot);
+    size_t expire(uint32_t slot);
+    uint64_t next_event_tick() const noexcept;
+
+    const uint64_t _tick_ns;
+    const Clock::time_point _start;
+    const NowFunction _now;
+    uint64_t _current;  // current tick (all timers with expiry <= _current were fired)
+    size_t _size;
+    std::vector<Node> _nodes;
+    uint32_t _free_head;
+    uint32_t _heads[kLevels * kSlots + 1];  // +1 for overflow list
+    uint64_t _occupied[kLevels];  // bitmap of non-empty slots per level
+    std::unordered_map<uint64_t, uint64_t> _phase_counters;  // interval (ticks) : number of timers added with AddPeriodic
+};
+
+}  // namespace MQ_System
@@ -1,5 +1,5 @@
 // Copyright: (c) Jaromir Veber 2017-2019
-// Version: 12122019
+// Version: 18102026
 // License: MPL-2.0
 // *******************************************************************************
 //  This Source Code Form is subject to the terms of the Mozilla Public
@@ -51,7 +51,6 @@
 
 #include <chrono>                   // for elapsed time measurement
 #include <stdexcept>                // exceptions
-#include <thread>                   // sleep_for
 #include <bitset>                   // bit operations
 #include <cmath>                    // for NAN
 
@@ -70,34 +69,43 @@ class UniPi_Service : public Daemon {
     virtual ~UniPi_Service() noexcept;
     void main();
     virtual void CallBack(const std::string& topic, const std::string& message) override;
-    void read_thread_loop();
+    virtual void OnConfigChanged() override;
     //DigitalInputs* _digital_input;
  private:
-    void load_daemon_configuration();
+    void load_daemon_configuration(std::string& sensor_name, double& analog_input_report_time);
+    void report_analog_input();
+    void read_analog_input();
+    void wait_conversion();
+    void schedule_analog_input();
 
     static const char* pid_file_name;
     std::string _sensor_name;
     EEPROM* _eeprom;
     MCP23008* _relays;
     MCP3422* _analog_input;
-    std::atomic<bool> _read_thread_run;
     //AnalogOutput* _analog_output;
     struct json_tokener* _tokener;
-    std::thread _read_thread;
     double _analog_input_report_time;
-    std::chrono::system_clock::time_point _last_ai_report_time;
+    EventLoop::TimerId _analog_input_timer;
+    EventLoop::TimerId _conversion_timer;  // pending MCP3422 conversion read
+    double _AI2_value;  // converted before AI1
 };
 
+static constexpr double kDefaultAnalogInputReportTime = 120;  // seconds
+static constexpr std::chrono::milliseconds kConversionTime(250);  // MCP3422 18bit one-shot conversion (3.75 samples per second)
+
 UniPi_Service::UniPi_Service(): Daemon("mq_unipi_daemon", "/var/run/mq_unipi_daemon.pid"), _eeprom(nullptr), _relays(nullptr), _analog_input(nullptr), 
-            _read_thread_run(true), //_digital_input(nullptr), _analog_output(nullptr),
-             _tokener(json_tokener_new()), _analog_input_report_time(120) {}
+            //_digital_input(nullptr), _analog_output(nullptr),
+             _tokener(json_tokener_new()), _analog_input_report_time(kDefaultAnalogInputReportTime), _analog_input_timer(EventLoop::kInvalidTimer),
+            _conversion_timer(EventLoop::kInvalidTimer), _AI2_value(NAN) {}
 
-void UniPi_Service::load_daemon_configuration() {
-    static const char* config_file = "/etc/mq_system/mq_unipi_daemon.conf";
+// values are set only if present in configuration
+void UniPi_Service::load_daemon_configuration(std::string& sensor_name, double& analog_input_report_time) {
+    const std::string config_file = MQ_System::ConfigPath("mq_unipi_daemon.conf");
     Config cfg;	
     _logger->trace("Load conf");
     try {
-        cfg.readFile(config_file);
+        cfg.readFile(config_file.c_str());
     } catch(const FileIOException &fioex) {
         _logger->error("I/O error while reading system configuration file: {}", config_file);
         throw std::runtime_error("" );
@@ -106,8 +114,8 @@ void UniPi_Service::load_daemon_configuration() {
         throw std::runtime_error("");
     }
     try {
-        cfg.getRoot().lookupValue("name", _sensor_name);
-        cfg.getRoot().lookupValue("AI", _analog_input_report_time);
+        cfg.getRoot().lookupValue("name", sensor_name);
+        cfg.getRoot().lookupValue("AI", analog_input_report_time);
     } catch(const SettingNotFoundException &nfex) {
         _logger->error("Required setting not found in system configuration file");
         throw std::runtime_error("");
@@ -187,8 +195,18 @@ public:
             _logger->error("MCP23008 set_relay_value error - index out of bounds");
             throw std::runtime_error("");
         }
-        _state[7 - pos] = val;  // this does not check boundary so the previous check is needed!
-        _mcp_handle->write_byte_data(MCP23008_GPIO, static_cast<uint8_t>(_state.to_ulong()));
+        set_relay_values(std::bitset<8>().set(pos), std::bitset<8>().set(pos, val));
+    }
+
+    // relays with bit set in mask (bit 0 - first relay) get value of the same bit in values - one register write for all of them
+    void set_relay_values(std::bitset<8> mask, std::bitset<8> values) {
+        auto state = _state;
+        for (size_t pos = 0; pos < 8; ++pos)
+            if (mask.test(pos))
+                state[7 - pos] = values.test(pos);
+        if (state == _state)
+            return;  // relays already are in requested state - no I2C transaction
+        _mcp_handle->write_byte_data(MCP23008_GPIO, static_cast<uint8_t>(state.to_ulong()));
         read_state();
     }
 
@@ -212,29 +230,37 @@ public:
     MCP3422(const std::string& device, const std::shared_ptr<spdlog::logger>& log, float coef1, float coef2):  _logger(log), coef{coef1, coef2} {
         _mcp_handle.reset(new i2cxx(device, MCP3422_ADDRESS, log));
         _logger->trace("MCP3422 open ... OK");
+        _channel = false;
+        _defined_config = 0;
+        _tries = 0;
     }
 
-    // this method takes ~300ms to execute! so it may stall the thread a bit!
-    double read_channel_code(bool channel) {
-        auto defined_config = configure(channel);
+    // one-shot conversion - read_conversion is called every kConversionTime till it returns true so the caller does not
+    // block for the conversion
+    void start_conversion(bool channel) {
+        _channel = channel;
+        _tries = kMaxTries;
+        _defined_config = configure(channel);
+    }
+
+    bool channel() const noexcept { return _channel; }
+
+    // false - conversion is not finished yet
+    bool read_conversion(double& value) {
         uint8_t data[4] = {0,0,0,0};
-        uint8_t returned_config = 0;
-        uint8_t max_tries = 5;
-        do {
-            std::this_thread::sleep_for(std::chrono::milliseconds(250));  // device does on 18bit precision like 3.75 reads per second so it's ~ 250ms for one read
-            _mcp_handle->read((char*) data, 4);			
-            returned_config = data[3];
-            if (!(--max_tries)) 
-                break;
-        } while (returned_config & 0x80 || returned_config != (defined_config & 0x7F));
-        if (!max_tries) {
-            _logger->error("Error MCP3422 reading device: max_tries exceeded");
-            throw std::runtime_error("");
+        _mcp_handle->read((char*) data, 4);
+        const uint8_t returned_config = data[3];
+        if (returned_config & 0x80 || returned_config != (_defined_config & 0x7F)) {
+            if (!(--_tries)) {
+                _logger->error("Error MCP3422 reading device: max_tries exceeded");
+                throw std::runtime_error("");
+            }
+            return false;
         }
         uint8_t sign_byte = (data[0] & 0x03) ? 0xFF : 0x00;  // sign bit
-        int32_t digital_output_code = (static_cast<int32_t>(sign_byte) << 24) | (static_cast<int32_t>(data[0]) << 16) | (static_cast<int32_t>(data[1]) << 8) | data[2];	
-        double result = digital_output_code * (2.048 / 0b11111111111111111) * (channel ? coef[1] : coef[0]);
-        return result;
+        int32_t digital_output_code = (static_cast<int32_t>(sign_byte) << 24) | (static_cast<int32_t>(data[0]) << 16) | (static_cast<int32_t>(data[1]) << 8) | data[2];
+        value = digital_output_code * (2.048 / 0b11111111111111111) * (_channel ? coef[1] : coef[0]);
+        return true;
     }
 
 private:
@@ -258,8 +284,12 @@ private:
     }
 
     static constexpr unsigned MCP3422_ADDRESS = 0x68;
+    static constexpr unsigned kMaxTries = 5;  // reads of one conversion
     std::unique_ptr<i2cxx> _mcp_handle;
     std::bitset<8> _config;
+    bool _channel;  // of the last started conversion
+    uint8_t _defined_config;
+    unsigned _tries;
     const std::shared_ptr<spdlog::logger> _logger;
     float coef[2];
 };
@@ -345,63 +375,54 @@ class AnalogOutput {
 */
 
 
-void read_thread_start(UniPi_Service *u) {
-    u->read_thread_loop();
+// AI2 and then AI1 conversion - loop timer reads each kConversionTime after it is started, the loop is not blocked
+void UniPi_Service::report_analog_input() {
+    _logger->debug("Report Analog input");
+    Loop().CancelTimer(_conversion_timer);  // previous report failed - start over
+    _analog_input->start_conversion(true);
+    wait_conversion();
 }
 
-void UniPi_Service::read_thread_loop() {
-    while (_read_thread_run) {
-        auto now = std::chrono::system_clock::now();
-        std::chrono::duration<double> diff = now - _last_ai_report_time;
-        if (diff.count() > _analog_input_report_time) {
-            _logger->debug("Report Analog input");
-            double AI2_value = _analog_input->read_channel_code(true);
-            double AI1_value = _analog_input->read_channel_code(false);
-            _last_ai_report_time = now;
-            struct json_object* j_object = json_object_new_object();
-            struct json_object* AI1_obj = json_object_new_array();
-            json_object_array_add(AI1_obj, json_object_new_double(AI1_value));
-            json_object_array_add(AI1_obj, json_object_new_string("V"));
-            json_object_object_add(j_object, "AI1", AI1_obj);
-            struct json_object* AI2_obj = json_object_new_array();
-            json_object_array_add(AI2_obj, json_object_new_double(AI2_value));
-            json_object_array_add(AI2_obj, json_object_new_string("V"));
-            json_object_object_add(j_object, "AI2", AI2_obj);
-            const std::string json_string = json_object_to_json_string_ext(j_object, JSON_C_TO_STRING_PLAIN);
-            Publish(std::string("status/") + _sensor_name, json_string);
-            json_object_put(j_object);
-            auto now = std::chrono::system_clock::now();
-            diff = now - _last_ai_report_time;
-        }
-        while (_read_thread_run) {
-            double sleep_time = _analog_input_report_time - diff.count();
-            if (sleep_time < 0.0)
-                break;
-            if (sleep_time >= 1.0) {
-                double intpart = 0;
-                double rest = std::modf(sleep_time, &intpart);
-                /* TODO
-                auto result = _digital_input->wait_events(static_cast<uint32_t>(intpart) > 10 ? 10 : static_cast<uint32_t>(intpart)); // we wait no longer than 10 secs
-                if (result.size()) {
-                    for (const auto& x : result) {
-                        _digital_input->parse_event(x);
-                    }
-                }
-                */
-                auto now = std::chrono::system_clock::now();
-                diff = now - _last_ai_report_time;
-            } else if (sleep_time > 0.0) {
-                _logger->debug("Wait report {}s", sleep_time);
-                std::chrono::duration<double> sleep_duration(sleep_time);
-                std::this_thread::sleep_for(sleep_duration);
-            }
-        }
+void UniPi_Service::wait_conversion() {
+    _conversion_timer = Loop().AddTimer(kConversionTime, std::chrono::nanoseconds(0), [this] { read_analog_input(); });
+}
+
+void UniPi_Service::read_analog_input() {
+    double value;
+    if (!_analog_input->read_conversion(value)) {
+        wait_conversion();
+        return;
     }
+    if (_analog_input->channel()) {
+        _AI2_value = value;
+        _analog_input->start_conversion(false);
+        wait_conversion();
+        return;
+    }
+    const double AI1_value = value;
+    const double AI2_value = _AI2_value;
+    struct json_object* j_object = json_object_new_object();
+    struct json_object* AI1_obj = json_object_new_array();
+    json_object_array_add(AI1_obj, json_object_new_double(AI1_value));
+    json_object_array_add(AI1_obj, json_object_new_string("V"));
+    json_object_object_add(j_object, "AI1", AI1_obj);
+    struct json_object* AI2_obj = json_object_new_array();
+    json_object_array_add(AI2_obj, json_object_new_double(AI2_value));
+    json_object_array_add(AI2_obj, json_object_new_string("V"));
+    json_object_object_add(j_object, "AI2", AI2_obj);
+    const std::string json_string = json_object_to_json_string_ext(j_object, JSON_C_TO_STRING_PLAIN);
+    Publish(std::string("status/") + _sensor_name, json_string);
+    json_object_put(j_object);
+    /* TODO digital inputs shall be registered to event loop (line event fd)
+    auto result = _digital_input->wait_events(...);
+    for (const auto& x : result)
+        _digital_input->parse_event(x);
+    */
 }
 
 void UniPi_Service::main() {
     _logger->debug("Entered main");
-    load_daemon_configuration();
+    load_daemon_configuration(_sensor_name, _analog_input_report_time);
     std::string dev = "/dev/i2c-1";
     std::string gpio_dev = "/dev/gpiochip0";
     // OK now initialize all the devices on UniPi
@@ -412,8 +433,31 @@ void UniPi_Service::main() {
     //_analog_output = new AnalogOutput(_pigpio_handle, _logger, _eeprom->read_byte(0xe3));
     _logger->info("Unipi version {}.{}", _eeprom->read_byte(0xe2), _eeprom->read_byte(0xe3));
     Subscribe(std::string("set/") + _sensor_name);
-    _read_thread = std::move(std::thread(read_thread_start, this));
-    SleepForever();  // do thread instead of sleeping and running other thread?
+    schedule_analog_input();
+    Run();
+}
+
+void UniPi_Service::schedule_analog_input() {
+    const auto ai_interval = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(_analog_input_report_time));
+    _analog_input_timer = Loop().AddTimer(std::chrono::nanoseconds(0), ai_interval, [this] { report_analog_input(); });
+}
+
+void UniPi_Service::OnConfigChanged() {
+    std::string sensor_name;
+    double analog_input_report_time = kDefaultAnalogInputReportTime;
+    load_daemon_configuration(sensor_name, analog_input_report_time);
+    if (sensor_name != _sensor_name) {
+        Unsubscribe(std::string("set/") + _sensor_name);
+        _sensor_name = sensor_name;
+        Subscribe(std::string("set/") + _sensor_name);
+        _logger->info("Configuration reload - sensor renamed to {}", _sensor_name);
+    }
+    if (analog_input_report_time != _analog_input_report_time) {
+        _analog_input_report_time = analog_input_report_time;
+        Loop().CancelTimer(_analog_input_timer);
+        schedule_analog_input();
+        _logger->info("Configuration reload - analog input reported every {} s", _analog_input_report_time);
+    }
 }
 
 void UniPi_Service::CallBack(const std::string& topic, const std::string& message) {
@@ -422,6 +466,7 @@ void UniPi_Service::CallBack(const std::string& topic, const std::string& messag
         _logger->warn("Did not receive object as initial json type - bad json format: {}", message);
         return;
     }
+    std::bitset<8> relay_mask, relay_values;  // relays of the message are set together
     json_object_object_foreach(o, k, object) {
         auto object_type = json_object_get_type(object);
         // it may be an array - [value, unit]; we don't care about unit much here; so extract only the value
@@ -452,20 +497,24 @@ void UniPi_Service::CallBack(const std::string& topic, const std::string& messag
                     else {
                         if (object_type != json_type_boolean)
                             _logger->warn("{} value on sensor {} not of expected type boolean", key, topic.substr(4));
-                        else
-                            _relays->set_relay_value(--relay_num, json_object_get_boolean(object));
+                        else {
+                            relay_mask.set(--relay_num);
+                            relay_values.set(relay_num, json_object_get_boolean(object));
+                        }
                     }
             } else
                 _logger->warn("Unexpected value name {} on sensor {}", key, topic.substr(4));
         }
     }
+    if (relay_mask.any()) {
+        _logger->trace("Set relays {} to {}", relay_mask.to_string(), relay_values.to_string());
+        _relays->set_relay_values(relay_mask, relay_values);
+    }
 }
 
 UniPi_Service::~UniPi_Service() noexcept {
-    _read_thread_run = false;
     delete _eeprom;
     delete _relays;
-    _read_thread.join();  // this may take up to 10 secs :/
     delete _analog_input;
     //delete _digital_input;
     //delete _analog_output;